@@ -16,6 +16,12 @@
 #include <QStandardPaths>
 #include <QDir>
 #include <QUuid>
+#include <QSet>
+
+namespace {
+// Chat attachments below this save without asking
+const qint64 kMaxAutoAcceptBytes = 5 * 1024 * 1024;
+}
 
 SkypeApp::SkypeApp(QObject* parent)
     : QObject(parent)
@@ -45,9 +51,26 @@ SkypeApp::SkypeApp(QObject* parent)
     connect(m_client, &SkypeClient::connected, this, &SkypeApp::onServerConnected);
     connect(m_client, &SkypeClient::disconnected, this, &SkypeApp::onServerDisconnected);
     connect(m_client, &SkypeClient::loginResult, this, &SkypeApp::onServerLoginResult);
+    connect(m_client, &SkypeClient::sessionResumed, this, &SkypeApp::onServerSessionResumed);
     connect(m_client, &SkypeClient::contactListReceived, this, &SkypeApp::onServerContactList);
+    connect(m_client, &SkypeClient::contactsAdded, this, &SkypeApp::onServerContactsAdded);
+    connect(m_client, &SkypeClient::contactsRemoved, this, &SkypeApp::onServerContactsRemoved);
+    connect(m_client, &SkypeClient::contactsUpdated, this, &SkypeApp::onServerContactsUpdated);
+    connect(m_client, &SkypeClient::historyReceived, this, &SkypeApp::onServerHistory);
+    connect(m_client, &SkypeClient::groupInfoReceived, this, &SkypeApp::onServerGroupInfo);
+    connect(m_client, &SkypeClient::groupMembersAdded, this, &SkypeApp::onServerGroupMembersAdded);
+    connect(m_client, &SkypeClient::groupLeaveReceived, this, &SkypeApp::onGroupLeaveReceived);
+    connect(m_client, &SkypeClient::groupMessageReceived, this, &SkypeApp::onServerGroupMessage);
+    connect(m_client, &SkypeClient::groupTypingReceived, this, &SkypeApp::onGroupTypingReceived);
+    connect(m_client, &SkypeClient::conferenceCreateReceived, this, &SkypeApp::onConferenceCreateReceived);
+    connect(m_client, &SkypeClient::conferenceJoinReceived, this, &SkypeApp::onConferenceJoinReceived);
+    connect(m_client, &SkypeClient::conferenceLeaveReceived, this, &SkypeApp::onConferenceLeaveReceived);
+    connect(m_client, &SkypeClient::conferenceRejected, this, &SkypeApp::onConferenceRejected);
+    connect(m_client, &SkypeClient::conferenceAudioReceived, this, &SkypeApp::onConferenceAudioReceived);
+    connect(m_client, &SkypeClient::conferenceVideoReceived, this, &SkypeApp::onConferenceVideoReceived);
     connect(m_client, &SkypeClient::messageReceived, this, &SkypeApp::onServerMessage);
     connect(m_client, &SkypeClient::presenceChanged, this, &SkypeApp::onServerPresence);
+    connect(m_client, &SkypeClient::presenceBatchReceived, this, &SkypeApp::onServerPresenceBatch);
 
     // P2P LAN signals (same slots — identical signal signatures)
     connect(m_lanService, &LANPeerService::loginResult, this, &SkypeApp::onServerLoginResult);
@@ -90,31 +113,54 @@ SkypeApp::SkypeApp(QObject* parent)
     connect(m_lanService, &LANPeerService::conferenceVideoReceived, this, &SkypeApp::onConferenceVideoReceived);
 
     connect(m_lanService, &LANPeerService::fileOfferReceived,
-            [this](const QString& from, const QString& fileName, qint64 fileSize) {
+            [this](const QString& from, const QString& transferId, const QString& fileName,
+                   qint64 fileSize, bool attachment) {
+        if (attachment && fileSize >= 0 && fileSize < kMaxAutoAcceptBytes) {
+            // Small chat attachments save straight to downloads, as they
+            // always have; anything larger is asked about like any file
+            m_attachmentTransfers.insert(transferId, from);
+            m_lanService->acceptFile(transferId, downloadPath(fileName));
+            return;
+        }
+
         auto* ftDlg = new FileTransferDialog(from, fileName,
             FileTransferDialog::Receiving, m_mainWindow, QString(), fileSize);
         ftDlg->setAttribute(Qt::WA_DeleteOnClose);
+        trackFileTransfer(ftDlg, transferId);
+        connect(ftDlg, &FileTransferDialog::transferAccepted, [this, transferId](const QString& savePath) {
+            m_lanService->acceptFile(transferId, savePath);
+        });
+        connect(ftDlg, &FileTransferDialog::transferDeclined, [this, transferId]() {
+            m_lanService->cancelFile(transferId);
+        });
         ftDlg->show();
         ftDlg->raise();
     });
 
-    connect(m_lanService, &LANPeerService::fileDataReceived,
-            [this](const QString& from, const QString& fileName, const QByteArray& data) {
-        // Save to downloads dir
-        QString dlDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/downloads";
-        QDir().mkpath(dlDir);
-        QString savePath = dlDir + "/" + fileName;
-
-        // Avoid overwriting: append number if exists
-        if (QFile::exists(savePath)) {
-            QFileInfo fi(savePath);
-            int n = 1;
-            while (QFile::exists(savePath)) {
-                savePath = dlDir + "/" + fi.completeBaseName() + QString("_%1.").arg(n) + fi.suffix();
-                n++;
-            }
+    connect(m_lanService, &LANPeerService::fileTransferFinished,
+            [this](const QString& transferId, const QString& path) {
+        QString from = m_attachmentTransfers.take(transferId);
+        if (from.isEmpty()) return;
+
+        // Show in chat window
+        Contact* contact = findContactByName(from);
+        if (contact) {
+            auto* chatWin = findOrCreateChatWindow(contact->id);
+            chatWin->receiveFileAttachment(from, QFileInfo(path).fileName(), path);
+            chatWin->show();
+            chatWin->raise();
         }
+    });
+
+    connect(m_lanService, &LANPeerService::fileTransferFailed,
+            [this](const QString& transferId, const QString& reason) {
+        Q_UNUSED(reason);
+        m_attachmentTransfers.remove(transferId);
+    });
 
+    connect(m_lanService, &LANPeerService::fileDataReceived,
+            [this](const QString& from, const QString& fileName, const QByteArray& data) {
+        QString savePath = downloadPath(fileName);
         QFile file(savePath);
         if (file.open(QIODevice::WriteOnly)) {
             file.write(data);
@@ -125,13 +171,49 @@ SkypeApp::SkypeApp(QObject* parent)
         Contact* contact = findContactByName(from);
         if (contact) {
             auto* chatWin = findOrCreateChatWindow(contact->id);
-            chatWin->receiveFileAttachment(from, fileName, savePath);
+            chatWin->receiveFileAttachment(from, QFileInfo(savePath).fileName(), savePath);
             chatWin->show();
             chatWin->raise();
         }
     });
 }
 
+QString SkypeApp::downloadPath(const QString& fileName) const {
+    QString dlDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/downloads";
+    QDir().mkpath(dlDir);
+
+    // The name comes from the peer; keep it inside the downloads dir
+    QFileInfo fi(QFileInfo(fileName).fileName());
+    QString savePath = dlDir + "/" + fi.fileName();
+
+    // Avoid overwriting: append number if exists
+    int n = 1;
+    while (QFile::exists(savePath) || QFile::exists(savePath + ".part")) {
+        savePath = dlDir + "/" + fi.completeBaseName() + QString("_%1.").arg(n) + fi.suffix();
+        n++;
+    }
+    return savePath;
+}
+
+void SkypeApp::trackFileTransfer(FileTransferDialog* dialog, const QString& transferId) {
+    // Dialog-scoped so closing it mid-transfer just stops the updates
+    connect(m_lanService, &LANPeerService::fileTransferProgress, dialog,
+            [dialog, transferId](const QString& id, qint64 transferred, qint64 total) {
+        if (id == transferId) dialog->setProgress(transferred, total);
+    });
+    connect(m_lanService, &LANPeerService::fileTransferFinished, dialog,
+            [dialog, transferId](const QString& id) {
+        if (id == transferId) dialog->setFinished();
+    });
+    connect(m_lanService, &LANPeerService::fileTransferFailed, dialog,
+            [dialog, transferId](const QString& id, const QString& reason) {
+        if (id == transferId) dialog->setFailed(reason);
+    });
+    connect(dialog, &FileTransferDialog::transferCancelled, [this, transferId]() {
+        m_lanService->cancelFile(transferId);
+    });
+}
+
 SkypeApp::~SkypeApp() {
     delete m_trayIcon;
     delete m_trayMenu;
@@ -313,16 +395,21 @@ void SkypeApp::showMainWindow() {
         if (!contact) return;
         QString file = QFileDialog::getOpenFileName(m_mainWindow, "Send File");
         if (!file.isEmpty()) {
-            QFileInfo fi(file);
             auto* ftDlg = new FileTransferDialog(contact->displayName, QString(),
                 FileTransferDialog::Sending, m_mainWindow, file);
             ftDlg->setAttribute(Qt::WA_DeleteOnClose);
-            ftDlg->show();
 
-            // Notify the peer so they get the receive prompt
+            // The peer gets the receive prompt; nothing moves until they accept
+            QString transferId;
             if (m_p2pMode) {
-                m_lanService->sendFileOffer(contact->skypeName, fi.fileName(), fi.size());
+                transferId = m_lanService->sendFile(contact->skypeName, file);
             }
+            if (transferId.isEmpty()) {
+                ftDlg->setFailed(QString("%1 is not reachable").arg(contact->displayName));
+            } else {
+                trackFileTransfer(ftDlg, transferId);
+            }
+            ftDlg->show();
         }
     });
 
@@ -353,15 +440,20 @@ void SkypeApp::onServerDisconnected() {
     }
 }
 
+void SkypeApp::onServerSessionResumed() {
+    if (m_mainWindow) {
+        m_mainWindow->statusBar()->showMessage("Reconnected", 3000);
+    }
+}
+
 void SkypeApp::onServerLoginResult(bool success, const QString& error) {
     if (success) {
         if (!m_mainWindow) {
             m_contacts.clear();
             showMainWindow();
         }
-        if (m_serverMode) {
-            m_client->requestContacts();
-        } else if (m_p2pMode) {
+        // The server pushes the roster right after login_result
+        if (m_p2pMode) {
             m_lanService->requestContacts();
         }
     } else {
@@ -381,13 +473,7 @@ void SkypeApp::onServerContactList(const QJsonArray& contacts) {
         c.displayName = obj["displayName"].toString();
         c.skypeName = obj["username"].toString();
         c.skypeNumber = obj["skypeNumber"].toString();
-        QString statusStr = obj["status"].toString();
-        if (statusStr == "Online") c.status = ContactStatus::Online;
-        else if (statusStr == "Away") c.status = ContactStatus::Away;
-        else if (statusStr == "Not Available") c.status = ContactStatus::NotAvailable;
-        else if (statusStr == "Do Not Disturb") c.status = ContactStatus::DoNotDisturb;
-        else if (statusStr == "Invisible") c.status = ContactStatus::Invisible;
-        else c.status = ContactStatus::Offline;
+        c.status = Contact::statusFromString(obj["status"].toString());
         m_contacts.append(c);
     }
     m_nextContactId = id;
@@ -397,6 +483,73 @@ void SkypeApp::onServerContactList(const QJsonArray& contacts) {
     }
 }
 
+void SkypeApp::onServerContactsAdded(const QJsonArray& contacts) {
+    for (auto val : contacts) {
+        QJsonObject obj = val.toObject();
+        Contact* existing = findContactByName(obj["username"].toString());
+        if (existing) {
+            existing->displayName = obj["displayName"].toString();
+            existing->status = Contact::statusFromString(obj["status"].toString());
+            if (m_mainWindow) m_mainWindow->updateContactRow(*existing);
+            continue;
+        }
+
+        Contact c;
+        c.id = m_nextContactId++;
+        c.displayName = obj["displayName"].toString();
+        c.skypeName = obj["username"].toString();
+        c.status = Contact::statusFromString(obj["status"].toString());
+        m_contacts.append(c);
+        if (m_mainWindow) m_mainWindow->addContactRow(c);
+    }
+}
+
+void SkypeApp::onServerContactsRemoved(const QStringList& usernames) {
+    QSet<QString> removed;
+    for (const QString& username : usernames) removed.insert(username);
+    for (int i = m_contacts.size() - 1; i >= 0; --i) {
+        if (removed.contains(m_contacts[i].skypeName)) {
+            if (m_mainWindow) m_mainWindow->removeContactRow(m_contacts[i].id);
+            m_contacts.removeAt(i);
+        }
+    }
+}
+
+void SkypeApp::onServerContactsUpdated(const QJsonArray& contacts) {
+    // Status catch-up after login; quiet, unlike live presence changes
+    for (auto val : contacts) {
+        QJsonObject obj = val.toObject();
+        Contact* contact = findContactByName(obj["username"].toString());
+        if (contact) {
+            contact->status = Contact::statusFromString(obj["status"].toString());
+            if (m_mainWindow) m_mainWindow->updateContactRow(*contact);
+        }
+    }
+}
+
+void SkypeApp::onServerHistory(const QString& contactName, const QJsonArray& messages,
+                               qint64 cursor, bool more) {
+    Q_UNUSED(cursor);
+    Q_UNUSED(more);
+
+    Contact* contact = findContactByName(contactName);
+    if (!contact) return;
+    auto it = m_chatWindows.find(contact->id);
+    if (it == m_chatWindows.end()) return;
+
+    QList<Message> history;
+    for (auto val : messages) {
+        QJsonObject obj = val.toObject();
+        Message msg;
+        msg.isOutgoing = obj["from"].toString() == m_username;
+        msg.sender = msg.isOutgoing ? QStringLiteral("Me") : contact->displayName;
+        msg.text = obj["text"].toString();
+        msg.timestamp = QDateTime::fromString(obj["timestamp"].toString(), Qt::ISODate);
+        history.append(msg);
+    }
+    (*it)->showServerHistory(history);
+}
+
 void SkypeApp::onServerMessage(const QString& from, const QString& text, const QString& timestamp) {
     Q_UNUSED(timestamp);
 
@@ -424,15 +577,10 @@ void SkypeApp::onServerMessage(const QString& from, const QString& text, const Q
 void SkypeApp::onServerPresence(const QString& username, const QString& status) {
     Contact* contact = findContactByName(username);
     if (contact) {
-        if (status == "Online") contact->status = ContactStatus::Online;
-        else if (status == "Away") contact->status = ContactStatus::Away;
-        else if (status == "Not Available") contact->status = ContactStatus::NotAvailable;
-        else if (status == "Do Not Disturb") contact->status = ContactStatus::DoNotDisturb;
-        else if (status == "Invisible") contact->status = ContactStatus::Invisible;
-        else contact->status = ContactStatus::Offline;
+        contact->status = Contact::statusFromString(status);
 
         if (m_mainWindow) {
-            m_mainWindow->setContacts(m_contacts);
+            m_mainWindow->updateContactRow(*contact);
         }
 
         if (status == "Online") {
@@ -443,6 +591,33 @@ void SkypeApp::onServerPresence(const QString& username, const QString& status)
     }
 }
 
+void SkypeApp::onServerPresenceBatch(const QJsonArray& updates) {
+    // One row per change, then a single chime
+    bool changed = false;
+    bool cameOnline = false;
+    bool wentOffline = false;
+    for (auto val : updates) {
+        QJsonObject obj = val.toObject();
+        Contact* contact = findContactByName(obj["username"].toString());
+        if (!contact) continue;
+
+        QString status = obj["status"].toString();
+        contact->status = Contact::statusFromString(status);
+        if (m_mainWindow) m_mainWindow->updateContactRow(*contact);
+        changed = true;
+        cameOnline |= status == "Online";
+        wentOffline |= status == "Offline";
+    }
+
+    if (!changed) return;
+
+    if (cameOnline) {
+        SoundPlayer::instance().play("ONLINE.WAV");
+    } else if (wentOffline) {
+        SoundPlayer::instance().play("OFFLINE.WAV");
+    }
+}
+
 // === Contact/Chat/Call handlers ===
 
 void SkypeApp::onContactDoubleClicked(int contactId) {
@@ -600,11 +775,11 @@ void SkypeApp::onCallEndReceived(const QString& from, const QString& callId) {
     }
 }
 
-void SkypeApp::onAudioDataReceived(const QString& from, const QByteArray& data) {
+void SkypeApp::onAudioDataReceived(const QString& from, const QByteArray& data, int lostBefore) {
     Contact* contact = findContactByName(from);
     if (!contact) return;
     if (m_callWindows.contains(contact->id)) {
-        m_callWindows[contact->id]->playRemoteAudio(data);
+        m_callWindows[contact->id]->playRemoteAudio(data, lostBefore);
     }
 }
 
@@ -709,6 +884,25 @@ void SkypeApp::onCreateGroupChat(const QString& groupName, const QList<int>& mem
         if (c) group.members.append(c->skypeName);
     }
 
+    auto* win = openGroupChatWindow(group);
+
+    // Send group creation to all members
+    if (m_serverMode) {
+        m_client->createGroup(group.groupId, group.groupName, group.members);
+    } else if (m_p2pMode) {
+        for (const QString& m : group.members) {
+            if (m != m_username) {
+                m_lanService->sendGroupCreate(m, group.groupId, group.groupName, group.members);
+            }
+        }
+    }
+
+    win->show();
+}
+
+// In server mode every action is one frame to the server, which owns the
+// membership and fans out; peer-to-peer sends to each member in turn.
+GroupChatWindow* SkypeApp::openGroupChatWindow(const GroupChat& group) {
     m_groupChats.insert(group.groupId, group);
 
     auto* win = new GroupChatWindow(group, m_username);
@@ -716,6 +910,10 @@ void SkypeApp::onCreateGroupChat(const QString& groupName, const QList<int>& mem
 
     connect(win, &GroupChatWindow::messageSent, [this](const QString& gId, const QString& text) {
         if (!m_groupChats.contains(gId)) return;
+        if (m_serverMode) {
+            m_client->sendGroupMessage(gId, text);
+            return;
+        }
         const GroupChat& g = m_groupChats[gId];
         for (const QString& m : g.members) {
             if (m != m_username && m_p2pMode) {
@@ -726,6 +924,10 @@ void SkypeApp::onCreateGroupChat(const QString& groupName, const QList<int>& mem
 
     connect(win, &GroupChatWindow::typingStarted, [this](const QString& gId) {
         if (!m_groupChats.contains(gId)) return;
+        if (m_serverMode) {
+            m_client->sendGroupTyping(gId);
+            return;
+        }
         const GroupChat& g = m_groupChats[gId];
         for (const QString& m : g.members) {
             if (m != m_username && m_p2pMode) {
@@ -736,10 +938,14 @@ void SkypeApp::onCreateGroupChat(const QString& groupName, const QList<int>& mem
 
     connect(win, &GroupChatWindow::leaveGroup, [this](const QString& gId) {
         if (!m_groupChats.contains(gId)) return;
-        const GroupChat& g = m_groupChats[gId];
-        for (const QString& m : g.members) {
-            if (m != m_username && m_p2pMode) {
-                m_lanService->sendGroupLeave(m, gId);
+        if (m_serverMode) {
+            m_client->leaveGroup(gId);
+        } else {
+            const GroupChat& g = m_groupChats[gId];
+            for (const QString& m : g.members) {
+                if (m != m_username && m_p2pMode) {
+                    m_lanService->sendGroupLeave(m, gId);
+                }
             }
         }
         m_groupChats.remove(gId);
@@ -758,22 +964,15 @@ void SkypeApp::onCreateGroupChat(const QString& groupName, const QList<int>& mem
         if (m_groupChatWindows.contains(gId)) {
             m_groupChatWindows[gId]->addMember(c->skypeName);
         }
-        if (m_p2pMode) {
+        if (m_serverMode) {
+            m_client->inviteToGroup(gId, {c->skypeName});
+        } else if (m_p2pMode) {
             m_lanService->sendGroupInvite(c->skypeName, gId,
                 m_groupChats[gId].groupName, m_groupChats[gId].members);
         }
     });
 
-    // Send group creation to all members
-    if (m_p2pMode) {
-        for (const QString& m : group.members) {
-            if (m != m_username) {
-                m_lanService->sendGroupCreate(m, group.groupId, group.groupName, group.members);
-            }
-        }
-    }
-
-    win->show();
+    return win;
 }
 
 void SkypeApp::onGroupCreateReceived(const QString& from, const QString& groupId,
@@ -785,64 +984,56 @@ void SkypeApp::onGroupCreateReceived(const QString& from, const QString& groupId
     group.groupName = groupName;
     group.creator = from;
     group.members = members;
-    m_groupChats.insert(groupId, group);
 
-    auto* win = new GroupChatWindow(group, m_username);
-    m_groupChatWindows.insert(groupId, win);
+    auto* win = openGroupChatWindow(group);
+    win->show();
+    win->raise();
+    SoundPlayer::instance().play("IM_RECEIVED.WAV");
+}
 
-    connect(win, &GroupChatWindow::messageSent, [this](const QString& gId, const QString& text) {
-        if (!m_groupChats.contains(gId)) return;
-        const GroupChat& g = m_groupChats[gId];
-        for (const QString& m : g.members) {
-            if (m != m_username && m_p2pMode) {
-                m_lanService->sendGroupMessage(m, gId, text);
-            }
-        }
-    });
+void SkypeApp::onServerGroupInfo(const QString& groupId, const QString& name,
+                                 const QString& creator, const QStringList& members) {
+    if (m_groupChatWindows.contains(groupId)) {
+        onServerGroupMembersAdded(creator, groupId, members);
+    } else {
+        onGroupCreateReceived(creator, groupId, name, members);
+    }
 
-    connect(win, &GroupChatWindow::typingStarted, [this](const QString& gId) {
-        if (!m_groupChats.contains(gId)) return;
-        const GroupChat& g = m_groupChats[gId];
-        for (const QString& m : g.members) {
-            if (m != m_username && m_p2pMode) {
-                m_lanService->sendGroupTyping(m, gId);
-            }
-        }
-    });
+    // Messages that arrived before we knew the group
+    const QList<QPair<QString, QString>> pending = m_pendingGroupMessages.take(groupId);
+    for (const auto& message : pending) {
+        onGroupMessageReceived(message.first, groupId, message.second);
+    }
+}
 
-    connect(win, &GroupChatWindow::leaveGroup, [this](const QString& gId) {
-        if (!m_groupChats.contains(gId)) return;
-        const GroupChat& g = m_groupChats[gId];
-        for (const QString& m : g.members) {
-            if (m != m_username && m_p2pMode) {
-                m_lanService->sendGroupLeave(m, gId);
-            }
+void SkypeApp::onServerGroupMembersAdded(const QString& from, const QString& groupId,
+                                         const QStringList& members) {
+    Q_UNUSED(from);
+    if (!m_groupChats.contains(groupId)) return;
+
+    GroupChat& group = m_groupChats[groupId];
+    for (const QString& member : members) {
+        if (!group.members.contains(member)) group.members.append(member);
+        if (m_groupChatWindows.contains(groupId)) {
+            m_groupChatWindows[groupId]->addMember(member);
         }
-        m_groupChats.remove(gId);
-        m_groupChatWindows.remove(gId);
-    });
+    }
+}
 
-    connect(win, &GroupChatWindow::inviteMember, [this](const QString& gId, int) {
-        if (!m_groupChats.contains(gId)) return;
-        if (!m_mainWindow) return;
-        int contactId = m_mainWindow->pickContact("Invite to Group");
-        if (contactId < 0) return;
-        Contact* c = findContact(contactId);
-        if (!c) return;
+void SkypeApp::onServerGroupMessage(const QString& from, const QString& groupId,
+                                    const QString& text, const QString& timestamp) {
+    Q_UNUSED(timestamp);
 
-        m_groupChats[gId].members.append(c->skypeName);
-        if (m_groupChatWindows.contains(gId)) {
-            m_groupChatWindows[gId]->addMember(c->skypeName);
-        }
-        if (m_p2pMode) {
-            m_lanService->sendGroupInvite(c->skypeName, gId,
-                m_groupChats[gId].groupName, m_groupChats[gId].members);
-        }
-    });
+    if (m_groupChatWindows.contains(groupId)) {
+        onGroupMessageReceived(from, groupId, text);
+        return;
+    }
 
-    win->show();
-    win->raise();
-    SoundPlayer::instance().play("IM_RECEIVED.WAV");
+    // First we hear of this group (e.g. queued while we were offline)
+    if (!m_pendingGroupMessages.contains(groupId)) {
+        m_client->requestGroupInfo(groupId);
+    }
+    m_pendingGroupMessages[groupId].append(qMakePair(from, text));
 }
 
 void SkypeApp::onGroupMessageReceived(const QString& from, const QString& groupId, const QString& text) {
@@ -889,37 +1080,12 @@ void SkypeApp::onConferenceCallRequested(const QList<int>& contactIds) {
 
     auto* confWin = new ConferenceCallWindow(confId, m_username, participants);
     m_conferenceWindows.insert(confId, confWin);
-
-    connect(confWin, &ConferenceCallWindow::leaveRequested, [this](const QString& cId) {
-        // Notify all participants
-        ConferenceInfo* info = m_conferenceManager->getConference(cId);
-        if (info && m_p2pMode) {
-            for (const QString& p : info->participants) {
-                if (p != m_username) {
-                    m_lanService->sendConferenceLeave(p, cId);
-                }
-            }
-        }
-        m_conferenceManager->leaveConference(cId, m_username);
-        m_conferenceWindows.remove(cId);
-    });
-
-    connect(confWin, &ConferenceCallWindow::audioToSend, [this](const QString& cId, const QByteArray& data) {
-        ConferenceInfo* info = m_conferenceManager->getConference(cId);
-        if (info && m_p2pMode) {
-            m_lanService->sendConferenceAudio(info->participants, cId, data);
-        }
-    });
-
-    connect(confWin, &ConferenceCallWindow::videoToSend, [this](const QString& cId, const QByteArray& jpegData) {
-        ConferenceInfo* info = m_conferenceManager->getConference(cId);
-        if (info && m_p2pMode) {
-            m_lanService->sendConferenceVideo(info->participants, cId, jpegData);
-        }
-    });
+    wireConferenceWindow(confWin);
 
     // Send conference invitation to all remote participants
-    if (m_p2pMode) {
+    if (m_serverMode) {
+        m_client->createConference(confId, participants);
+    } else if (m_p2pMode) {
         for (const QString& p : participants) {
             if (p != m_username) {
                 m_lanService->sendConferenceCreate(p, confId, participants);
@@ -947,11 +1113,31 @@ void SkypeApp::onConferenceCreateReceived(const QString& from, const QString& co
 
     auto* confWin = new ConferenceCallWindow(conferenceId, m_username, participants);
     m_conferenceWindows.insert(conferenceId, confWin);
+    wireConferenceWindow(confWin);
+
+    // The server only relays media between participants who joined
+    if (m_serverMode) {
+        m_client->joinConference(conferenceId);
+    }
 
+    confWin->show();
+    confWin->raise();
+
+    if (m_trayIcon) {
+        m_trayIcon->showMessage("Conference Call",
+            QString("%1 invited you to a conference call").arg(from),
+            QSystemTrayIcon::Information, 5000);
+    }
+}
+
+void SkypeApp::wireConferenceWindow(ConferenceCallWindow* confWin) {
+    // Server mode uploads one stream to the relay; P2P sends a copy to each peer
     connect(confWin, &ConferenceCallWindow::leaveRequested, [this](const QString& cId) {
-        ConferenceInfo* ci = m_conferenceManager->getConference(cId);
-        if (ci && m_p2pMode) {
-            for (const QString& p : ci->participants) {
+        ConferenceInfo* info = m_conferenceManager->getConference(cId);
+        if (m_serverMode) {
+            m_client->leaveConference(cId);
+        } else if (info && m_p2pMode) {
+            for (const QString& p : info->participants) {
                 if (p != m_username) {
                     m_lanService->sendConferenceLeave(p, cId);
                 }
@@ -961,28 +1147,38 @@ void SkypeApp::onConferenceCreateReceived(const QString& from, const QString& co
         m_conferenceWindows.remove(cId);
     });
 
-    connect(confWin, &ConferenceCallWindow::audioToSend, [this](const QString& cId, const QByteArray& data) {
-        ConferenceInfo* ci = m_conferenceManager->getConference(cId);
-        if (ci && m_p2pMode) {
-            m_lanService->sendConferenceAudio(ci->participants, cId, data);
+    connect(confWin, &ConferenceCallWindow::audioToSend,
+            [this](const QString& cId, const QByteArray& data, int level) {
+        if (m_serverMode) {
+            m_client->sendConferenceAudio(cId, data, level);
+            return;
+        }
+        ConferenceInfo* info = m_conferenceManager->getConference(cId);
+        if (info && m_p2pMode) {
+            m_lanService->sendConferenceAudio(info->participants, cId, data);
         }
     });
 
     connect(confWin, &ConferenceCallWindow::videoToSend, [this](const QString& cId, const QByteArray& jpegData) {
-        ConferenceInfo* ci = m_conferenceManager->getConference(cId);
-        if (ci && m_p2pMode) {
-            m_lanService->sendConferenceVideo(ci->participants, cId, jpegData);
+        if (m_serverMode) {
+            m_client->sendConferenceVideo(cId, jpegData);
+            return;
+        }
+        ConferenceInfo* info = m_conferenceManager->getConference(cId);
+        if (info && m_p2pMode) {
+            m_lanService->sendConferenceVideo(info->participants, cId, jpegData);
         }
     });
+}
 
-    confWin->show();
-    confWin->raise();
-
-    if (m_trayIcon) {
-        m_trayIcon->showMessage("Conference Call",
-            QString("%1 invited you to a conference call").arg(from),
-            QSystemTrayIcon::Information, 5000);
+void SkypeApp::onConferenceRejected(const QString& conferenceId, const QString& error) {
+    ConferenceCallWindow* confWin = m_conferenceWindows.take(conferenceId);
+    m_conferenceManager->leaveConference(conferenceId, m_username);
+    if (confWin) {
+        confWin->close();
+        confWin->deleteLater();
     }
+    QMessageBox::warning(m_mainWindow, "Conference Call Failed", error);
 }
 
 void SkypeApp::onConferenceJoinReceived(const QString& from, const QString& conferenceId) {
@@ -1193,6 +1389,10 @@ void SkypeApp::onRemoveContact(int contactId) {
         QMessageBox::Yes | QMessageBox::No, QMessageBox::No);
 
     if (result == QMessageBox::Yes) {
+        if (m_serverMode) {
+            m_client->removeContact(contact->skypeName);
+        }
+
         // Close any open chat/call windows for this contact
         if (m_chatWindows.contains(contactId)) {
             m_chatWindows[contactId]->close();
@@ -1241,14 +1441,18 @@ ChatWindow* SkypeApp::findOrCreateChatWindow(int contactId) {
     auto* chatWindow = new ChatWindow(*contact);
     connect(chatWindow, &ChatWindow::messageSent, this, &SkypeApp::onMessageSent);
     connect(chatWindow, &ChatWindow::typingStarted, this, &SkypeApp::onTypingStarted);
-    connect(chatWindow, &ChatWindow::fileAttached, [this](int cId, const QString& fileName, const QByteArray& data) {
+    connect(chatWindow, &ChatWindow::fileAttached, [this](int cId, const QString& filePath) {
         Contact* c = findContact(cId);
         if (!c) return;
         if (m_p2pMode) {
-            m_lanService->sendFileData(c->skypeName, fileName, data);
+            m_lanService->sendFile(c->skypeName, filePath, true);
         }
     });
     m_chatWindows.insert(contactId, chatWindow);
 
+    if (m_serverMode) {
+        m_client->fetchHistory(contact->skypeName);
+    }
+
     return chatWindow;
 }
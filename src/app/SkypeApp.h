@@ -19,6 +19,8 @@
 #include "windows/GroupChatWindow.h"
 #include "models/GroupChat.h"
 
+class FileTransferDialog;
+
 class SkypeApp : public QObject {
     Q_OBJECT
 
@@ -48,16 +50,23 @@ private slots:
     void onServerConnected();
     void onServerDisconnected();
     void onServerLoginResult(bool success, const QString& error);
+    void onServerSessionResumed();
     void onServerContactList(const QJsonArray& contacts);
+    void onServerContactsAdded(const QJsonArray& contacts);
+    void onServerContactsRemoved(const QStringList& usernames);
+    void onServerContactsUpdated(const QJsonArray& contacts);
+    void onServerHistory(const QString& contactName, const QJsonArray& messages,
+                         qint64 cursor, bool more);
     void onServerMessage(const QString& from, const QString& text, const QString& timestamp);
     void onServerPresence(const QString& username, const QString& status);
+    void onServerPresenceBatch(const QJsonArray& updates);
 
     // Call signaling
     void onCallOfferReceived(const QString& from, const QString& callId);
     void onCallAcceptReceived(const QString& from, const QString& callId);
     void onCallRejectReceived(const QString& from, const QString& callId);
     void onCallEndReceived(const QString& from, const QString& callId);
-    void onAudioDataReceived(const QString& from, const QByteArray& data);
+    void onAudioDataReceived(const QString& from, const QByteArray& data, int lostBefore);
     void onVideoDataReceived(const QString& from, const QByteArray& jpegData);
 
     // Conference
@@ -72,10 +81,17 @@ private slots:
     void onGroupTypingReceived(const QString& from, const QString& groupId);
     void onGroupInviteReceived(const QString& from, const QString& groupId, const QString& groupName, const QStringList& members);
     void onGroupLeaveReceived(const QString& from, const QString& groupId);
+    void onServerGroupInfo(const QString& groupId, const QString& name, const QString& creator,
+                           const QStringList& members);
+    void onServerGroupMembersAdded(const QString& from, const QString& groupId,
+                                   const QStringList& members);
+    void onServerGroupMessage(const QString& from, const QString& groupId, const QString& text,
+                              const QString& timestamp);
     void onConferenceCallRequested(const QList<int>& contactIds);
     void onConferenceCreateReceived(const QString& from, const QString& conferenceId, const QStringList& participants);
     void onConferenceJoinReceived(const QString& from, const QString& conferenceId);
     void onConferenceLeaveReceived(const QString& from, const QString& conferenceId);
+    void onConferenceRejected(const QString& conferenceId, const QString& error);
     void onConferenceAudioReceived(const QString& from, const QString& conferenceId, const QByteArray& data);
     void onConferenceVideoReceived(const QString& from, const QString& conferenceId, const QByteArray& jpegData);
 
@@ -83,11 +99,15 @@ private:
     Contact* findContact(int id);
     Contact* findContactByName(const QString& username);
     ChatWindow* findOrCreateChatWindow(int contactId);
+    GroupChatWindow* openGroupChatWindow(const GroupChat& group);
     CallWindow* findCallWindowByCallId(const QString& callId);
     void wireCallWindow(CallWindow* callWin, Contact* contact);
+    void wireConferenceWindow(ConferenceCallWindow* confWin);
     void setupSystemTray();
     void showMainWindow();
     void startP2PMode();
+    QString downloadPath(const QString& fileName) const;
+    void trackFileTransfer(FileTransferDialog* dialog, const QString& transferId);
 
     LoginWindow* m_loginWindow = nullptr;
     MainWindow* m_mainWindow = nullptr;
@@ -96,6 +116,8 @@ private:
     QMap<QString, ConferenceCallWindow*> m_conferenceWindows;
     QMap<QString, GroupChatWindow*> m_groupChatWindows;
     QMap<QString, GroupChat> m_groupChats;
+    QMap<QString, QList<QPair<QString, QString>>> m_pendingGroupMessages; // waiting for group_info
+    QMap<QString, QString> m_attachmentTransfers; // incoming attachment transfer id -> sender
     ConferenceManager* m_conferenceManager;
     QSystemTrayIcon* m_trayIcon = nullptr;
     QMenu* m_trayMenu = nullptr;
@@ -4,6 +4,11 @@
 
 #include <QAudioDeviceInfo>
 #include <QDebug>
+#include <cmath>
+
+namespace {
+const int kMaxConcealedFrames = 5;
+}
 
 AudioStreamManager::AudioStreamManager(QObject* parent)
     : QObject(parent)
@@ -112,9 +117,15 @@ void AudioStreamManager::setMuted(bool muted) {
     m_muted = muted;
 }
 
-void AudioStreamManager::playAudioData(const QByteArray& data) {
+void AudioStreamManager::playAudioData(const QByteArray& data, int lostBefore) {
     if (!m_codec->isValid()) return;
 
+    // Past a few frames PLC only smears; let the jitter buffer resync instead
+    for (int i = 0; i < qMin(lostBefore, kMaxConcealedFrames); ++i) {
+        QByteArray plc = m_codec->decodePLC();
+        if (!plc.isEmpty()) m_jitterBuffer->pushFrame(plc);
+    }
+
     QByteArray pcm = m_codec->decode(data);
     if (!pcm.isEmpty()) {
         m_jitterBuffer->pushFrame(pcm);
@@ -127,6 +138,15 @@ void AudioStreamManager::onCaptureReady() {
     QByteArray data = m_inputDevice->readAll();
     if (data.isEmpty() || m_muted) return;
 
+    const auto* samples = reinterpret_cast<const qint16*>(data.constData());
+    const int count = data.size() / static_cast<int>(sizeof(qint16));
+    double energy = 0;
+    for (int i = 0; i < count; ++i) {
+        energy += static_cast<double>(samples[i]) * samples[i];
+    }
+    const double rms = count > 0 ? std::sqrt(energy / count) / 32768.0 : 0;
+    m_level = rms > 0 ? qBound(0, static_cast<int>(-20.0 * std::log10(rms)), 127) : 127;
+
     QList<QByteArray> opusFrames = m_codec->encodeBuffer(data);
     for (const QByteArray& frame : opusFrames) {
         emit audioCaptured(frame);
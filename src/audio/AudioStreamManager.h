@@ -23,7 +23,13 @@ public:
     void stopPlayback();
     void setMuted(bool muted);
     bool isMuted() const { return m_muted; }
-    void playAudioData(const QByteArray& data);
+    // lostBefore frames went missing just ahead of this one; they are
+    // concealed in place so the rest keeps its timing
+    void playAudioData(const QByteArray& data, int lostBefore = 0);
+
+    // Loudness of the last captured chunk in -dBov (RFC 6464): 0 is full
+    // scale, 127 silence. Measured on PCM since the frames leave as Opus.
+    int captureLevel() const { return m_level; }
 
 signals:
     void audioCaptured(const QByteArray& data);
@@ -41,6 +47,7 @@ private:
     bool m_muted = false;
     bool m_capturing = false;
     bool m_playing = false;
+    int m_level = 127;
 
     OpusCodec* m_codec = nullptr;
     JitterBuffer* m_jitterBuffer = nullptr;
@@ -0,0 +1,39 @@
+#include "bench/Bench.h"
+
+#include <QTextStream>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace {
+volatile quintptr g_sink = 0;
+}
+
+namespace Bench {
+
+void report(const QString& label, qint64 ops, qint64 elapsedNs) {
+    double nsPerOp = ops > 0 ? double(elapsedNs) / ops : 0.0;
+    double perSecond = elapsedNs > 0 ? ops * 1e9 / elapsedNs : 0.0;
+    QTextStream(stdout) << QString::asprintf("  %-36s %10.1f ns/op  %12.0f ops/s\n",
+                                             qPrintable(label), nsPerOp, perSecond);
+}
+
+void note(const QString& label, double value, const char* unit) {
+    QTextStream(stdout) << QString::asprintf("  %-36s %10.1f %s\n", qPrintable(label), value, unit);
+}
+
+void keep(quintptr value) {
+    g_sink = g_sink + value;
+}
+
+qint64 heapBytes() {
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 33)
+    return qint64(mallinfo2().uordblks);
+#endif
+#endif
+    return -1;
+}
+
+}
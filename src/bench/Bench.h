@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QString>
+#include <QVector>
+#include <QtGlobal>
+
+// Knobs shared by every case; each case reads the ones it needs
+struct BenchOptions {
+    int count = 100000;       // sessions, users, peers... held in the structure
+    int iterations = 1000000; // operations timed per measurement
+    quint32 seed = 1;
+    QVector<int> shards;      // sessions: loopback relay run at each shard count
+};
+
+// In-process microbenchmarks for the server and network hot paths. Each
+// case builds its structure, times a loop of single operations on it and
+// prints one line per measurement; run the same case before and after a
+// change, on the same machine, to compare.
+namespace Bench {
+
+// Prints "label  ns/op  ops/s" for ops operations that took elapsedNs
+void report(const QString& label, qint64 ops, qint64 elapsedNs);
+// Prints a free-form measurement, e.g. bytes per user
+void note(const QString& label, double value, const char* unit);
+// Keeps the optimizer from discarding a result
+void keep(quintptr value);
+// Bytes currently allocated on the heap, or -1 where the allocator can't say
+qint64 heapBytes();
+
+}
+
+int runSessionBench(const BenchOptions& options);
+int runCodecBench(const BenchOptions& options);
+int runRelayBench(const BenchOptions& options);
+int runMetricsBench(const BenchOptions& options);
+int runDirectoryBench(const BenchOptions& options);
+int runRateLimitBench(const BenchOptions& options);
+int runHistoryBench(const BenchOptions& options);
+int runExpiryBench(const BenchOptions& options);
+int runStoreBench(const BenchOptions& options);
+int runOfflineBench(const BenchOptions& options);
@@ -0,0 +1,90 @@
+#include "bench/Bench.h"
+#include "network/Protocol.h"
+
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QTextStream>
+
+namespace {
+// The order ChatServer::onTextMessage compared type strings in before
+// the opcode table; "message" sat behind login and register
+const char* const kTypeChain[] = {
+    "login", "register", "message", "get_contacts", "add_contact", "status",
+};
+
+int chainDispatch(const QString& type) {
+    for (int i = 0; i < int(sizeof(kTypeChain) / sizeof(kTypeChain[0])); ++i) {
+        if (type == QLatin1String(kTypeChain[i])) return i;
+    }
+    return -1;
+}
+}
+
+// One chat message through both wire formats: encode as the sender does,
+// then decode and pick a handler as the server does. JSON decoding starts
+// from the QString a text frame arrives as.
+int runCodecBench(const BenchOptions& options) {
+    const QJsonObject message{
+        {"type", "message"},
+        {"to", "user12345"},
+        {"from", "user67890"},
+        {"text", QString(64, QChar('x'))},
+        {"timestamp", "2026-10-16T12:00:00Z"},
+    };
+    const QString text = QString::fromUtf8(QJsonDocument(message).toJson(QJsonDocument::Compact));
+    const QByteArray binary = Protocol::encodeBinary(message);
+
+    QTextStream(stdout) << "codec: chat message, " << text.toUtf8().size() << " bytes as JSON, "
+                        << binary.size() << " bytes as CBOR\n";
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < options.iterations; ++i) {
+        Bench::keep(quintptr(QJsonDocument(message).toJson(QJsonDocument::Compact).size()));
+    }
+    Bench::report("JSON encode", options.iterations, timer.nsecsElapsed());
+
+    timer.restart();
+    for (int i = 0; i < options.iterations; ++i) {
+        Bench::keep(quintptr(Protocol::encodeBinary(message).size()));
+    }
+    Bench::report("CBOR encode", options.iterations, timer.nsecsElapsed());
+
+    timer.restart();
+    for (int i = 0; i < options.iterations; ++i) {
+        const QJsonObject obj = QJsonDocument::fromJson(text.toUtf8()).object();
+        Bench::keep(quintptr(chainDispatch(obj["type"].toString())));
+    }
+    Bench::report("JSON decode + string chain (before)", options.iterations, timer.nsecsElapsed());
+
+    timer.restart();
+    for (int i = 0; i < options.iterations; ++i) {
+        const QJsonObject obj = QJsonDocument::fromJson(text.toUtf8()).object();
+        Bench::keep(quintptr(Protocol::opcodeForType(obj["type"].toString())));
+    }
+    Bench::report("JSON decode + opcode hash", options.iterations, timer.nsecsElapsed());
+
+    timer.restart();
+    for (int i = 0; i < options.iterations; ++i) {
+        Protocol::Opcode opcode;
+        QJsonObject obj;
+        Protocol::decodeBinary(binary, opcode, obj);
+        Bench::keep(quintptr(opcode) + quintptr(obj.size()));
+    }
+    Bench::report("CBOR decode + opcode", options.iterations, timer.nsecsElapsed());
+
+    // Dispatch alone, without the parse
+    const QString type = message["type"].toString();
+    timer.restart();
+    for (int i = 0; i < options.iterations; ++i) {
+        Bench::keep(quintptr(chainDispatch(type)));
+    }
+    Bench::report("string chain", options.iterations, timer.nsecsElapsed());
+
+    timer.restart();
+    for (int i = 0; i < options.iterations; ++i) {
+        Bench::keep(quintptr(Protocol::opcodeForType(type)));
+    }
+    Bench::report("opcode hash", options.iterations, timer.nsecsElapsed());
+    return 0;
+}
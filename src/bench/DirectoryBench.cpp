@@ -0,0 +1,111 @@
+#include "bench/Bench.h"
+#include "server/UserDirectory.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QTextStream>
+
+namespace {
+const int kContactsPerUser = 20;
+
+// Account as ChatServer held it before UserDirectory: keyed by name, with
+// names repeated in every contact list, watcher set and status entry
+struct LegacyUser {
+    QString username;
+    QString password;
+    QStringList contacts;
+    quint64 rosterVersion = 0;
+};
+
+// Each call builds a new string, as a name parsed from a frame would be
+QString userName(int index) {
+    return QStringLiteral("user") + QString::number(index);
+}
+
+QString passwordHash(int index) {
+    return QStringLiteral("pbkdf2-sha256$100000$") + QString::number(index, 16).rightJustified(24, '0')
+        + QLatin1Char('$') + QString(44, QChar('h'));
+}
+}
+
+// Bytes per user for --count accounts with 20 contacts each and half of
+// them online, in the interned layout and in the name-keyed one it
+// replaced. Heap use comes from the allocator, so only glibc builds
+// report memory; the lookup timings print everywhere.
+int runDirectoryBench(const BenchOptions& options) {
+    const int count = options.count;
+    QTextStream(stdout) << "directory: " << count << " users, " << kContactsPerUser
+                        << " contacts each, half online\n";
+
+    qint64 heapBefore = Bench::heapBytes();
+    {
+        QHash<QString, LegacyUser> users;
+        QHash<QString, QString> status;
+        QHash<QString, QSet<QString>> watchers;
+        users.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            LegacyUser& user = users[userName(i)];
+            user.username = userName(i);
+            user.password = passwordHash(i);
+            for (int c = 1; c <= kContactsPerUser; ++c) {
+                const QString contact = userName((i + c) % count);
+                user.contacts.append(contact);
+                watchers[userName((i + c) % count)].insert(userName(i));
+            }
+            if (i % 2 == 0) status.insert(userName(i), QStringLiteral("Online"));
+        }
+        const qint64 heap = Bench::heapBytes();
+        if (heapBefore >= 0 && heap >= 0) {
+            Bench::note("name-keyed (before)", double(heap - heapBefore) / count, "bytes/user");
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < options.iterations; ++i) {
+            Bench::keep(quintptr(users.constFind(userName(i % count)).value().contacts.size()));
+        }
+        Bench::report("name-keyed lookup (before)", options.iterations, timer.nsecsElapsed());
+    }
+
+    heapBefore = Bench::heapBytes();
+    {
+        UserDirectory directory;
+        QVector<Presence> status;
+        QVector<UserIdList> watchers;
+        directory.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            directory.intern(userName(i));
+        }
+        watchers.resize(count);
+        status.resize(count);
+        for (int i = 0; i < count; ++i) {
+            ServerUser& user = directory.create(userName(i));
+            user.password = passwordHash(i);
+            const UserId id = directory.find(userName(i));
+            for (int c = 1; c <= kContactsPerUser; ++c) {
+                const UserId contact = directory.intern(userName((i + c) % count));
+                user.contacts.insert(contact);
+                watchers[static_cast<int>(contact)].insert(id);
+            }
+            if (i % 2 == 0) status[static_cast<int>(id)] = Presence::Online;
+        }
+        const qint64 heap = Bench::heapBytes();
+        if (heapBefore >= 0 && heap >= 0) {
+            Bench::note("interned ids", double(heap - heapBefore) / count, "bytes/user");
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < options.iterations; ++i) {
+            Bench::keep(quintptr(directory.user(userName(i % count))->contacts.size()));
+        }
+        Bench::report("interned lookup", options.iterations, timer.nsecsElapsed());
+    }
+
+    if (Bench::heapBytes() < 0) {
+        QTextStream(stdout) << "  (heap use needs glibc 2.33 or later; only timings shown)\n";
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "bench/Bench.h"
+#include "network/ExpiryWheel.h"
+
+#include <QElapsedTimer>
+#include <QMap>
+#include <QRandomGenerator>
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
+
+namespace {
+// As LANPeerService sets up its wheel
+const int kTickMs = 250;
+const int kSlots = 512;
+const int kPeers = 10000;
+const int kTimeoutMs = 15000;
+// Activity between two ticks, spread over random peers
+const int kTouchesPerTick = 1000;
+}
+
+// LAN peer liveness for kPeers peers: the expiry wheel's add, touch and
+// per-tick advance against the full scan of lastSeen stamps that
+// onPeerTimeoutCheck ran before it. Both sides see the same random
+// activity, kTouchesPerTick touches per tick. A peer left idle for
+// kTimeoutMs expires and is added back, as a rediscovered peer would be;
+// the closing step then times every peer out at once.
+int runExpiryBench(const BenchOptions& options) {
+    const int ticks = qMax(1, options.iterations / kTouchesPerTick);
+    QTextStream(stdout) << "expiry: " << kPeers << " peers, " << kTouchesPerTick
+                        << " touches per " << kTickMs << " ms tick, " << ticks << " ticks\n";
+
+    QStringList names;
+    names.reserve(kPeers);
+    for (int i = 0; i < kPeers; ++i) names.append(QString("peer%1").arg(i));
+
+    QRandomGenerator random(options.seed);
+    QVector<int> order(1 << 16);
+    for (int& index : order) index = random.bounded(kPeers);
+
+    QElapsedTimer timer;
+    {
+        ExpiryWheel wheel(kTickMs, kSlots);
+        QVector<ExpiryWheel::Entry*> entries(kPeers);
+
+        timer.start();
+        for (int i = 0; i < kPeers; ++i) entries[i] = wheel.add(names[i], kTimeoutMs);
+        Bench::report("add", kPeers, timer.nsecsElapsed());
+
+        qint64 touchNs = 0;
+        qint64 advanceNs = 0;
+        qint64 expired = 0;
+        int next = 0;
+        for (int tick = 1; tick <= ticks; ++tick) {
+            timer.restart();
+            for (int i = 0; i < kTouchesPerTick; ++i) {
+                wheel.touch(entries[order[next++ % order.size()]], kTimeoutMs);
+            }
+            touchNs += timer.nsecsElapsed();
+
+            timer.restart();
+            const QStringList timedOut = wheel.advance(qint64(tick) * kTickMs);
+            advanceNs += timer.nsecsElapsed();
+
+            expired += timedOut.size();
+            for (const QString& name : timedOut) {
+                entries[name.mid(4).toInt()] = wheel.add(name, kTimeoutMs);
+            }
+        }
+        Bench::report("touch", qint64(ticks) * kTouchesPerTick, touchNs);
+        Bench::report("advance", ticks, advanceNs);
+        Bench::note("expired per tick", double(expired) / ticks, "peers");
+
+        timer.restart();
+        const int last = wheel.advance(qint64(ticks) * kTickMs + 2 * kTimeoutMs).size();
+        Bench::report("advance (all expire)", kPeers, timer.nsecsElapsed());
+        if (last != kPeers || wheel.size() != 0) {
+            QTextStream(stdout) << "  FAIL: " << last << " of " << kPeers << " peers expired\n";
+            return 1;
+        }
+    }
+
+    {
+        QMap<QString, qint64> lastSeen;
+        for (const QString& name : qAsConst(names)) lastSeen.insert(name, 0);
+
+        qint64 touchNs = 0;
+        qint64 scanNs = 0;
+        qint64 expired = 0;
+        int next = 0;
+        for (int tick = 1; tick <= ticks; ++tick) {
+            const qint64 now = qint64(tick) * kTickMs;
+            timer.restart();
+            for (int i = 0; i < kTouchesPerTick; ++i) {
+                lastSeen[names[order[next++ % order.size()]]] = now;
+            }
+            touchNs += timer.nsecsElapsed();
+
+            timer.restart();
+            for (auto it = lastSeen.begin(); it != lastSeen.end(); ++it) {
+                if (now - it.value() > kTimeoutMs) {
+                    it.value() = now;
+                    ++expired;
+                }
+            }
+            scanNs += timer.nsecsElapsed();
+        }
+        Bench::keep(quintptr(expired));
+        Bench::report("lastSeen update (before)", qint64(ticks) * kTouchesPerTick, touchNs);
+        Bench::report("scan (before)", ticks, scanNs);
+    }
+    return 0;
+}
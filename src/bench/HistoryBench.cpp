@@ -0,0 +1,57 @@
+#include "bench/Bench.h"
+#include "server/HistoryStore.h"
+
+#include <QElapsedTimer>
+#include <QTextStream>
+
+namespace {
+// Past the 500 kept per conversation in memory, so the oldest are gone
+const int kMessages = 2000;
+const int kPageSize = 50;
+}
+
+// Pages back through an in-memory conversation longer than what is kept,
+// the way SkypeClient does while "more" is set, and times the fetches.
+// Fails if paging doesn't end at the oldest kept message or hands out an
+// empty page along the way.
+int runHistoryBench(const BenchOptions& options) {
+    QTextStream(stdout) << "history: " << kMessages << " messages in memory, pages of "
+                        << kPageSize << "\n";
+
+    HistoryStore store(QString());
+    store.open();
+    const QString key = HistoryStore::conversationKey("alice", "bob");
+    for (int i = 0; i < kMessages; ++i) {
+        store.append(key, i % 2 ? "alice" : "bob", QString("message %1").arg(i), "2024-01-01T00:00:00");
+    }
+
+    int pages = 0;
+    int messages = 0;
+    HistoryPage page = store.fetch(key, -1, kPageSize);
+    for (;;) {
+        ++pages;
+        messages += page.messages.size();
+        if (page.messages.isEmpty() && page.more()) {
+            QTextStream(stdout) << "  FAIL: empty page " << pages << " still says more\n";
+            return 1;
+        }
+        if (!page.more()) break;
+        if (pages > kMessages / kPageSize + 1) {
+            QTextStream(stdout) << "  FAIL: still paging after " << pages << " pages\n";
+            return 1;
+        }
+        page = store.fetch(key, page.first, kPageSize);
+    }
+    Bench::note("pages until more is false", pages, "pages");
+    Bench::note("messages paged", messages, "messages");
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < options.iterations; ++i) {
+        // Within the kept window, so every fetch returns a full page
+        qint64 before = kMessages - (i % 10) * kPageSize;
+        Bench::keep(quintptr(store.fetch(key, before, kPageSize).messages.size()));
+    }
+    Bench::report("fetch page", options.iterations, timer.nsecsElapsed());
+    return 0;
+}
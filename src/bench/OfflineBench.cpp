@@ -0,0 +1,92 @@
+#include "bench/Bench.h"
+#include "server/ChatServer.h"
+#include "server/OfflineQueue.h"
+
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+namespace {
+const int kQueued = 1000;
+const int kMaxRounds = 200;
+const qint64 kCachedBudget = 64 * 1024 * 1024;
+}
+
+// Befriended by ChatServer, like RelayBench: queues kQueued messages for
+// bob on a disk-backed server, then times the login-side delivery
+// (reading the queue, building the batch frame, handing it to the shard)
+// and bob's offline_ack that tombstones them. The shard has no sockets,
+// so frame encoding and the write aren't in the numbers. Runs once with
+// every payload cached and once with all of them spilled to disk.
+class OfflineBench {
+public:
+    static int run(const BenchOptions& options) {
+        QTemporaryDir directory;
+        if (!directory.isValid()) {
+            QTextStream(stdout) << "  FAIL: no temporary directory\n";
+            return 1;
+        }
+
+        ServerOptions serverOptions;
+        serverOptions.metricsPort = 0;
+        serverOptions.hashIterations = 1;
+        serverOptions.dataDirectory = directory.path();
+        ChatServer server(serverOptions);
+
+        auto* shard = new ServerShard(0, [](ShardEvent) {}, &server.m_metrics,
+                                      serverOptions.backpressure);
+        server.m_shards.append(shard); // owned and deleted by the server
+        Session* bob = server.m_sessions.add(1, shard);
+        server.m_sessions.bindUser(bob, "bob");
+        bob->offlineAcks = true;
+
+        const int rounds = qBound(1, options.iterations / kQueued, kMaxRounds);
+        const OfflineMessage message{"alice", QString(64, QChar('x')), "2024-01-01T00:00:00"};
+        QTextStream(stdout) << "offline: " << kQueued << " messages queued for bob, "
+                            << rounds << " rounds\n";
+
+        for (bool spilled : {false, true}) {
+            server.m_offline->setMemoryBudget(spilled ? 0 : kCachedBudget);
+            const QString suffix = spilled ? " (spilled)" : " (cached)";
+
+            qint64 enqueueNs = 0;
+            qint64 deliverNs = 0;
+            qint64 ackNs = 0;
+            QElapsedTimer timer;
+            for (int round = 0; round < rounds; ++round) {
+                timer.start();
+                for (int i = 0; i < kQueued; ++i) {
+                    server.m_offline->enqueue("bob", message);
+                }
+                enqueueNs += timer.nsecsElapsed();
+                const quint64 last = server.m_offline->peek("bob").last().seq;
+
+                timer.restart();
+                server.deliverOfflineMessages(bob);
+                deliverNs += timer.nsecsElapsed();
+                if (server.m_offline->pendingFor("bob") != kQueued) {
+                    QTextStream(stdout) << "  FAIL: delivery dropped messages before the ack\n";
+                    return 1;
+                }
+
+                timer.restart();
+                server.handleFrame(bob, Protocol::Opcode::OfflineAck,
+                                   {{"type", "offline_ack"}, {"seq", qint64(last)}});
+                ackNs += timer.nsecsElapsed();
+                if (server.m_offline->pendingFor("bob") != 0) {
+                    QTextStream(stdout) << "  FAIL: offline_ack left messages queued\n";
+                    return 1;
+                }
+            }
+
+            Bench::report("enqueue" + suffix, qint64(rounds) * kQueued, enqueueNs);
+            Bench::report("deliver 1000" + suffix, rounds, deliverNs);
+            Bench::report("offline_ack" + suffix, rounds, ackNs);
+        }
+        return 0;
+    }
+};
+
+int runOfflineBench(const BenchOptions& options) {
+    return OfflineBench::run(options);
+}
@@ -0,0 +1,100 @@
+#include "bench/Bench.h"
+#include "network/PeerRateLimit.h"
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QMap>
+#include <QRandomGenerator>
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
+
+namespace {
+// Simulated clock: this many messages arrive per ms across all peers
+const int kMessagesPerMs = 100;
+
+const char* const kTypes[] = {
+    "message", "message_ack", "typing", "call_offer", "group_message", "file_offer", "identify", "status"
+};
+
+// checkRateLimit as LANPeerService had it before PeerRateLimit: a minute
+// of timestamps per sender, trimmed from the front on every message
+bool legacyAllow(QMap<QString, QList<qint64>>& map, const QString& peer, qint64 now) {
+    auto& timestamps = map[peer];
+    while (!timestamps.isEmpty() && now - timestamps.first() > 60000)
+        timestamps.removeFirst();
+    timestamps.append(now);
+    return timestamps.size() <= 30;
+}
+}
+
+// Incoming LAN peer messages from --count peers, one random peer per
+// message and kMessagesPerMs messages per simulated ms: the per-kind GCRA
+// cells against the timestamp lists they replaced. Both look the sender
+// up in a QMap by name, as LANPeerService does. Heap per peer after the
+// run is glibc-only, like the directory case.
+int runRateLimitBench(const BenchOptions& options) {
+    const int count = options.count;
+    QTextStream(stdout) << "ratelimit: " << count << " peers, " << kMessagesPerMs
+                        << " messages per simulated ms\n";
+
+    QStringList names;
+    names.reserve(count);
+    for (int i = 0; i < count; ++i) names.append(QString("peer%1").arg(i));
+
+    QRandomGenerator random(options.seed);
+    QVector<int> order(qMin(options.iterations, 1 << 16));
+    for (int& index : order) index = random.bounded(count);
+
+    const int typeCount = int(sizeof(kTypes) / sizeof(kTypes[0]));
+    QStringList types;
+    for (const char* type : kTypes) types.append(QString::fromLatin1(type));
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < options.iterations; ++i) {
+        Bench::keep(quintptr(PeerRateLimit::kindOf(types[i % typeCount])));
+    }
+    Bench::report("kindOf", options.iterations, timer.nsecsElapsed());
+
+    qint64 heapBefore = Bench::heapBytes();
+    {
+        QMap<QString, PeerRateLimit> limits;
+        for (const QString& name : qAsConst(names)) limits.insert(name, PeerRateLimit());
+
+        qint64 allowed = 0;
+        timer.restart();
+        for (int i = 0; i < options.iterations; ++i) {
+            const QString& peer = names[order[i % order.size()]];
+            PeerRateLimit::Kind kind = PeerRateLimit::kindOf(types[i % typeCount]);
+            allowed += limits[peer].allow(kind, i / kMessagesPerMs);
+        }
+        Bench::report("allow", options.iterations, timer.nsecsElapsed());
+        Bench::note("allowed", 100.0 * allowed / options.iterations, "%");
+
+        const qint64 heap = Bench::heapBytes();
+        if (heapBefore >= 0 && heap >= 0) {
+            Bench::note("heap per peer", double(heap - heapBefore) / count, "bytes");
+        }
+    }
+
+    heapBefore = Bench::heapBytes();
+    {
+        QMap<QString, QList<qint64>> map;
+        for (const QString& name : qAsConst(names)) map.insert(name, QList<qint64>());
+
+        qint64 allowed = 0;
+        timer.restart();
+        for (int i = 0; i < options.iterations; ++i) {
+            allowed += legacyAllow(map, names[order[i % order.size()]], i / kMessagesPerMs);
+        }
+        Bench::report("timestamp list (before)", options.iterations, timer.nsecsElapsed());
+        Bench::note("allowed (before)", 100.0 * allowed / options.iterations, "%");
+
+        const qint64 heap = Bench::heapBytes();
+        if (heapBefore >= 0 && heap >= 0) {
+            Bench::note("heap per peer (before)", double(heap - heapBefore) / count, "bytes");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include "bench/Bench.h"
+#include "server/AllocationCounter.h"
+#include "server/ChatServer.h"
+
+#include <QElapsedTimer>
+#include <QTextStream>
+
+namespace {
+const int kWarmupMessages = 1000;
+// Metrics on/off alternate this many times so drift hits both alike
+const int kMetricsRounds = 10;
+}
+
+// Befriended by ChatServer: feeds chat frames straight into the core's
+// handler, as drainEvents() would, between two logged-in sessions on one
+// in-process shard. The shard has no sockets, so this is the core relay
+// path (lookup, history, ack, hand-off to the shard) without frame
+// encoding or the write; SkypeLoadGen measures those end to end.
+class RelayBench {
+public:
+    static int run(const BenchOptions& options) {
+        ServerOptions serverOptions;
+        serverOptions.metricsPort = 0;
+        serverOptions.hashIterations = 1;
+        ChatServer server(serverOptions);
+        Session* alice = setUp(server, serverOptions);
+        const QJsonObject frame = messageFrame();
+
+        QTextStream(stdout) << "relay: alice -> bob, both online, "
+                            << frame["text"].toString().size() << "-char text\n";
+
+        const quint64 allocationsBefore = AllocationCounter::count();
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < options.iterations; ++i) {
+            server.handleFrame(alice, Protocol::Opcode::Message, frame);
+        }
+        const qint64 elapsed = timer.nsecsElapsed();
+        const quint64 allocations = AllocationCounter::count() - allocationsBefore;
+
+        Bench::report("handleFrame(message)", options.iterations, elapsed);
+        if (AllocationCounter::counting()) {
+            Bench::note("allocations per message", double(allocations) / options.iterations,
+                        "allocs");
+        } else {
+            QTextStream(stdout) << "  (configure with -DSKYPE_COUNT_ALLOCATIONS=ON to count allocations)\n";
+        }
+        return 0;
+    }
+
+    // The same relay loop with every counter and histogram recording and
+    // with MetricsRecording switched off, for the cost of leaving metrics on
+    static int runMetrics(const BenchOptions& options) {
+        ServerOptions serverOptions;
+        serverOptions.metricsPort = 0;
+        serverOptions.hashIterations = 1;
+        ChatServer server(serverOptions);
+        Session* alice = setUp(server, serverOptions);
+        const QJsonObject frame = messageFrame();
+
+        QTextStream(stdout) << "metrics: relay alice -> bob with metrics on and off, "
+                            << kMetricsRounds << " rounds each\n";
+
+        const int perRound = qMax(1, options.iterations / kMetricsRounds);
+        qint64 onNs = 0;
+        qint64 offNs = 0;
+        QElapsedTimer timer;
+        for (int round = 0; round < kMetricsRounds; ++round) {
+            for (bool on : {true, false}) {
+                MetricsRecording::enabled.store(on, std::memory_order_relaxed);
+                timer.start();
+                for (int i = 0; i < perRound; ++i) {
+                    server.handleFrame(alice, Protocol::Opcode::Message, frame);
+                }
+                (on ? onNs : offNs) += timer.nsecsElapsed();
+            }
+        }
+        MetricsRecording::enabled.store(true, std::memory_order_relaxed);
+
+        const qint64 ops = qint64(perRound) * kMetricsRounds;
+        Bench::report("handleFrame(message), metrics on", ops, onNs);
+        Bench::report("handleFrame(message), metrics off", ops, offNs);
+        Bench::note("metrics overhead", 100.0 * (onNs - offNs) / qMax<qint64>(1, offNs), "%");
+        return 0;
+    }
+
+private:
+    // Logs alice and bob in on an in-process shard and warms the path up
+    static Session* setUp(ChatServer& server, const ServerOptions& serverOptions) {
+        auto* shard = new ServerShard(0, [](ShardEvent) {}, &server.m_metrics,
+                                      serverOptions.backpressure);
+        server.m_shards.append(shard); // owned and deleted by the server
+        Session* alice = server.m_sessions.add(1, shard);
+        server.m_sessions.bindUser(alice, "alice");
+        Session* bob = server.m_sessions.add(2, shard);
+        server.m_sessions.bindUser(bob, "bob");
+
+        const QJsonObject frame = messageFrame();
+        for (int i = 0; i < kWarmupMessages; ++i) {
+            server.handleFrame(alice, Protocol::Opcode::Message, frame);
+        }
+        return alice;
+    }
+
+    static QJsonObject messageFrame() {
+        return {{"type", "message"}, {"to", "bob"}, {"text", QString(64, QChar('x'))}};
+    }
+};
+
+int runRelayBench(const BenchOptions& options) {
+    return RelayBench::run(options);
+}
+
+int runMetricsBench(const BenchOptions& options) {
+    return RelayBench::runMetrics(options);
+}
@@ -0,0 +1,117 @@
+#include "bench/Bench.h"
+#include "loadgen/LoadGenerator.h"
+#include "server/ChatServer.h"
+#include "server/SessionRegistry.h"
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QRandomGenerator>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+
+namespace {
+// Cap on the linear-scan pass, which costs count probes per lookup
+const qint64 kScanProbeBudget = 200000000;
+
+// Shard sweep: more chat than one shard can relay, so the relayed rate
+// shows how far extra shards take it
+const quint16 kSweepPort = 33133;
+const int kSweepClients = 1000;
+const double kSweepMessagesPerSecond = 50.0; // per client
+const int kSweepWarmupSeconds = 3;
+const int kSweepSeconds = 10;
+
+// A SkypeLoadGen chat run against a server with this many shard threads,
+// both in this process and on loopback; prints the load generator's report
+int runShardSweep(int shards, quint32 seed) {
+    ServerOptions serverOptions;
+    serverOptions.port = kSweepPort;
+    serverOptions.threads = shards;
+    serverOptions.metricsPort = 0;
+    serverOptions.hashIterations = 1;
+    ChatServer server(serverOptions);
+    if (!server.start()) return 1;
+
+    LoadConfig config;
+    config.url = QUrl(QString("ws://127.0.0.1:%1").arg(kSweepPort));
+    config.clients = kSweepClients;
+    config.threads = qMax(1, QThread::idealThreadCount());
+    config.rampPerSecond = kSweepClients;
+    config.warmupSeconds = kSweepWarmupSeconds;
+    config.durationSeconds = kSweepSeconds;
+    config.seed = seed;
+    config.userPrefix = QString("shards%1-").arg(shards);
+    Scenario::fromPreset("chat", config.scenario);
+    config.scenario.opsPerSecond = kSweepMessagesPerSecond;
+
+    QTextStream(stdout) << "\nsessions --shards " << shards << ":\n";
+    LoadGenerator generator(config);
+    QEventLoop loop;
+    int exitCode = 0;
+    QObject::connect(&generator, &LoadGenerator::finished, &loop, [&](int code) {
+        exitCode = code;
+        loop.quit();
+    });
+    generator.start();
+    loop.exec();
+    return exitCode;
+}
+}
+
+// Lookups on the relay path: by username (message routing) and by session
+// id (socket events from a shard), against the linear scan over a list of
+// clients that SessionRegistry replaced. With --shards, then relays chat
+// end to end at each shard count; the load clients share the machine, so
+// compare the relayed rate between counts rather than against cores.
+int runSessionBench(const BenchOptions& options) {
+    QTextStream(stdout) << "sessions: " << options.count << " logged-in sessions\n";
+
+    SessionRegistry registry;
+    QList<Session*> list;
+    QStringList names;
+    names.reserve(options.count);
+    for (int i = 0; i < options.count; ++i) {
+        names.append(QString("user%1").arg(i));
+        Session* session = registry.add(quint64(i) + 1, nullptr);
+        registry.bindUser(session, names.last());
+        list.append(session);
+    }
+
+    // A fixed pseudo-random probe order, so every pass sees the same keys
+    QRandomGenerator random(options.seed);
+    QVector<int> order(qMin(options.iterations, 1 << 16));
+    for (int& index : order) index = random.bounded(options.count);
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < options.iterations; ++i) {
+        Bench::keep(quintptr(registry.byUsername(names[order[i % order.size()]])));
+    }
+    Bench::report("byUsername", options.iterations, timer.nsecsElapsed());
+
+    timer.restart();
+    for (int i = 0; i < options.iterations; ++i) {
+        Bench::keep(quintptr(registry.byId(quint64(order[i % order.size()]) + 1)));
+    }
+    Bench::report("byId", options.iterations, timer.nsecsElapsed());
+
+    const int scans = int(qBound<qint64>(1, kScanProbeBudget / options.count, options.iterations));
+    timer.restart();
+    for (int i = 0; i < scans; ++i) {
+        const QString& name = names[order[i % order.size()]];
+        for (Session* session : qAsConst(list)) {
+            if (session->username == name) {
+                Bench::keep(quintptr(session));
+                break;
+            }
+        }
+    }
+    Bench::report("linear scan by username (before)", scans, timer.nsecsElapsed());
+
+    int result = 0;
+    for (int shards : options.shards) {
+        result |= runShardSweep(shards, options.seed);
+    }
+    return result;
+}
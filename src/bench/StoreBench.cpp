@@ -0,0 +1,74 @@
+#include "bench/Bench.h"
+#include "server/UserStore.h"
+
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+namespace {
+const int kContactsPerUser = 10;
+// Records handed to the writer at a time while the accounts are built
+const int kFlushEvery = 10000;
+
+QString userName(int index) {
+    return QStringLiteral("user") + QString::number(index);
+}
+}
+
+// Server startup with --count accounts on disk: logs them with
+// kContactsPerUser contacts each, has the writer compact the log into a
+// snapshot, then times a fresh UserStore::open() loading it. The snapshot
+// call itself is timed too; it only rotates the log, and the compaction
+// runs on the writer thread. Run with --count 1000000 for the 1M-user
+// startup target.
+int runStoreBench(const BenchOptions& options) {
+    const int count = options.count;
+    QTextStream(stdout) << "store: " << count << " users, " << kContactsPerUser
+                        << " contacts each\n";
+
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        QTextStream(stdout) << "  FAIL: no temporary directory\n";
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    {
+        UserStore store(directory.path());
+        UserDirectory users;
+        QHash<QString, ServerGroup> groups;
+        if (!store.open(users, groups)) return 1;
+
+        const QString password = QStringLiteral("pbkdf2-sha256$100000$") + QString(68, QChar('h'));
+        for (int i = 0; i < count; ++i) {
+            store.logUser(userName(i), password);
+            for (int c = 1; c <= kContactsPerUser; ++c) {
+                store.logContact(userName(i), userName((i + c) % count));
+            }
+            if (i % kFlushEvery == kFlushEvery - 1) store.flush();
+        }
+
+        timer.start();
+        store.snapshot();
+        Bench::report("snapshot (event loop side)", 1, timer.nsecsElapsed());
+
+        // The destructor waits for the writer to finish compacting
+        timer.restart();
+    }
+    Bench::note("compaction (writer thread)", timer.nsecsElapsed() / 1e6, "ms");
+
+    UserDirectory users;
+    QHash<QString, ServerGroup> groups;
+    UserStore store(directory.path());
+    timer.restart();
+    if (!store.open(users, groups)) return 1;
+    const qint64 elapsed = timer.nsecsElapsed();
+
+    Bench::report("open per user", count, elapsed);
+    Bench::note("open", elapsed / 1e6, "ms");
+    if (users.userCount() != count) {
+        QTextStream(stdout) << "  FAIL: loaded " << users.userCount() << " of " << count << " users\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+#include <QDebug>
+#include "bench/Bench.h"
+
+namespace {
+struct BenchCase {
+    const char* name;
+    int (*run)(const BenchOptions& options);
+};
+
+const BenchCase kCases[] = {
+    {"sessions", runSessionBench},
+    {"codec", runCodecBench},
+    {"relay", runRelayBench},
+    {"metrics", runMetricsBench},
+    {"directory", runDirectoryBench},
+    {"ratelimit", runRateLimitBench},
+    {"expiry", runExpiryBench},
+    {"store", runStoreBench},
+    {"offline", runOfflineBench},
+    {"history", runHistoryBench},
+};
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("SkypeClassic Benchmarks");
+    app.setApplicationVersion("1.0");
+
+    QStringList names;
+    for (const BenchCase& benchCase : kCases) names.append(benchCase.name);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Times server and network hot paths in process and prints ns per operation.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption caseOption("case",
+        QString("Case to run: %1, or all (default: all)").arg(names.join(", ")), "name", "all");
+    parser.addOption(caseOption);
+    QCommandLineOption countOption("count",
+        "Entries held in the structure under test (default: 100000)", "count", "100000");
+    parser.addOption(countOption);
+    QCommandLineOption iterationsOption("iterations",
+        "Operations per measurement (default: 1000000)", "count", "1000000");
+    parser.addOption(iterationsOption);
+    QCommandLineOption seedOption("seed", "Random seed (default: 1)", "seed", "1");
+    parser.addOption(seedOption);
+    QCommandLineOption shardsOption("shards",
+        "Also relay chat over loopback through an in-process server at each shard count, "
+        "e.g. 1,2,4 (sessions case)", "counts");
+    parser.addOption(shardsOption);
+    parser.process(app);
+
+    BenchOptions options;
+    options.count = qMax(1, parser.value(countOption).toInt());
+    options.iterations = qMax(1, parser.value(iterationsOption).toInt());
+    options.seed = parser.value(seedOption).toUInt();
+    for (const QString& shards : parser.value(shardsOption).split(',', QString::SkipEmptyParts)) {
+        options.shards.append(qMax(1, shards.trimmed().toInt()));
+    }
+
+    const QString selected = parser.value(caseOption);
+    if (selected != "all" && !names.contains(selected)) {
+        qCritical() << "Unknown case" << selected;
+        return 2;
+    }
+
+    int result = 0;
+    for (const BenchCase& benchCase : kCases) {
+        if (selected != "all" && selected != benchCase.name) continue;
+        result |= benchCase.run(options);
+        QTextStream(stdout) << "\n";
+    }
+    return result;
+}
@@ -0,0 +1,148 @@
+#include "loadgen/BeaconFlood.h"
+#include "network/DiscoveryBeacon.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+
+namespace {
+const int kTickMs = 10;
+const int kLegacyIntervalMs = 5000;
+const int kRejoinMs = 120000;
+}
+
+BeaconFlood::BeaconFlood(const LoadConfig& config, QObject* parent)
+    : QObject(parent)
+    , m_config(config)
+    , m_random(config.seed)
+{
+    connect(&m_tickTimer, &QTimer::timeout, this, &BeaconFlood::tick);
+    connect(&m_progressTimer, &QTimer::timeout, this, &BeaconFlood::onProgress);
+    m_finishTimer.setSingleShot(true);
+    connect(&m_finishTimer, &QTimer::timeout, this, &BeaconFlood::finish);
+}
+
+void BeaconFlood::start() {
+    m_clock.start();
+
+    // Spread the first beacons over one interval, as if the peers had
+    // been up for a while
+    m_peers.resize(m_config.lanPeers);
+    for (Peer& peer : m_peers) {
+        peer.instance = m_random.generate() | 1;
+        peer.nextAt = m_random.bounded(nextInterval());
+    }
+
+    QTextStream(stdout) << "Beacon flood: " << m_config.lanPeers << " peers, "
+                        << m_config.lanChurnPerSecond << " status changes/s, "
+                        << m_config.lanLeavePerSecond << " leaves/s, "
+                        << (m_config.lanLegacy ? "JSON" : "binary") << " beacons to 127.0.0.1:"
+                        << m_config.discoveryPort << "\n";
+
+    m_tickTimer.start(kTickMs);
+    m_progressTimer.start(1000);
+    m_finishTimer.start((m_config.warmupSeconds + m_config.durationSeconds) * 1000);
+}
+
+int BeaconFlood::nextInterval() {
+    // Every simulated peer sees the others, so all share one interval
+    int interval = m_config.lanLegacy
+        ? kLegacyIntervalMs
+        : DiscoveryBeacon::intervalMs(m_config.lanPeers, false);
+    return interval + m_random.bounded(interval / 5) - interval / 10;
+}
+
+void BeaconFlood::tick() {
+    qint64 now = m_clock.elapsed();
+
+    m_churnDue += m_config.lanChurnPerSecond * (now - m_lastTickAt) / 1000.0;
+    m_leaveDue += m_config.lanLeavePerSecond * (now - m_lastTickAt) / 1000.0;
+    m_lastTickAt = now;
+    while (m_leaveDue >= 1.0 && !m_peers.isEmpty()) {
+        m_leaveDue -= 1.0;
+        Peer& peer = m_peers[m_random.bounded(m_peers.size())];
+        if (peer.silentUntil == 0) {
+            peer.silentUntil = now + kRejoinMs;
+            m_leaves++;
+        }
+    }
+    while (m_churnDue >= 1.0 && !m_peers.isEmpty()) {
+        m_churnDue -= 1.0;
+        int index = m_random.bounded(m_peers.size());
+        if (m_peers[index].silentUntil != 0) continue;
+        m_peers[index].away = !m_peers[index].away;
+        m_peers[index].stateVersion++;
+        m_changes++;
+        send(index);
+    }
+
+    for (int i = 0; i < m_peers.size(); ++i) {
+        Peer& peer = m_peers[i];
+        if (peer.silentUntil != 0) {
+            if (peer.silentUntil > now) continue;
+            // Back as if restarted
+            peer.silentUntil = 0;
+            peer.instance = m_random.generate() | 1;
+            peer.stateVersion = 1;
+            peer.nextAt = now;
+        }
+        if (peer.nextAt <= now) send(i);
+    }
+}
+
+void BeaconFlood::send(int index) {
+    Peer& peer = m_peers[index];
+    int interval = nextInterval();
+    QString status = peer.away ? "Away" : "Online";
+
+    QByteArray data;
+    if (m_config.lanLegacy) {
+        QJsonObject packet;
+        packet["type"] = "discovery";
+        packet["username"] = m_config.username(index);
+        packet["status"] = status;
+        packet["wsPort"] = 0;
+        packet["skypeNumber"] = QString("SKP-%1").arg(index, 5, 10, QChar('0'));
+        data = QJsonDocument(packet).toJson(QJsonDocument::Compact);
+    } else {
+        DiscoveryBeacon::Beacon beacon;
+        beacon.instance = peer.instance;
+        beacon.stateVersion = peer.stateVersion;
+        beacon.intervalMs = interval;
+        beacon.wsPort = 0; // nothing listens; the client's connect attempt fails once
+        beacon.username = m_config.username(index);
+        beacon.status = status;
+        beacon.skypeNumber = QString("SKP-%1").arg(index, 5, 10, QChar('0'));
+        data = DiscoveryBeacon::encode(beacon);
+    }
+
+    m_socket.writeDatagram(data, QHostAddress::LocalHost, m_config.discoveryPort);
+    m_sent++;
+    m_bytes += static_cast<quint64>(data.size());
+    peer.nextAt = m_clock.elapsed() + interval;
+}
+
+void BeaconFlood::onProgress() {
+    m_elapsedSeconds++;
+    QTextStream(stdout) << QString::asprintf("[%3ds] beacons %6llu/s  status changes %llu  leaves %llu\n",
+                                             m_elapsedSeconds, m_sent - m_lastSent, m_changes,
+                                             m_leaves);
+    m_lastSent = m_sent;
+}
+
+void BeaconFlood::finish() {
+    m_tickTimer.stop();
+    m_progressTimer.stop();
+
+    double seconds = qMax(m_clock.elapsed() / 1000.0, 0.001);
+    QTextStream out(stdout);
+    out << QString::asprintf("\nSent over %.1f s\n", seconds);
+    out << QString::asprintf("  beacons           %10llu  %10.1f/s\n", m_sent, m_sent / seconds);
+    out << QString::asprintf("  KB                %10.1f  %10.2f/s\n",
+                             m_bytes / 1024.0, m_bytes / 1024.0 / seconds);
+    out << QString::asprintf("  status changes    %10llu\n", m_changes);
+    out << QString::asprintf("  leaves            %10llu\n", m_leaves);
+    out.flush();
+
+    emit finished(0);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <QObject>
+#include <QUdpSocket>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QRandomGenerator>
+#include "loadgen/LoadConfig.h"
+
+// Stands in for a LAN of --lan-peers clients by sending their discovery
+// beacons to one client's discovery port on loopback. Each simulated peer
+// keeps the adaptive interval a real one would; --lan-churn status changes
+// a second go out immediately with a new state version. --lan-leave peers
+// a second go silent, as if unplugged, so the client has to time them out;
+// each comes back two minutes later as a fresh instance. --lan-legacy
+// sends the old JSON packet every 5 s instead, for a before/after
+// comparison.
+//
+// What it measures is the receiving client: watch its CPU while this runs,
+// and the "Discovery:" line it logs on exit for how many beacons it had
+// to decode in full.
+class BeaconFlood : public QObject {
+    Q_OBJECT
+
+public:
+    explicit BeaconFlood(const LoadConfig& config, QObject* parent = nullptr);
+
+    void start();
+
+signals:
+    void finished(int exitCode);
+
+private:
+    struct Peer {
+        quint32 instance = 0;
+        quint32 stateVersion = 1;
+        bool away = false;
+        qint64 nextAt = 0;
+        qint64 silentUntil = 0; // 0 = beaconing
+    };
+
+    void tick();
+    void onProgress();
+    void finish();
+    void send(int index);
+    int nextInterval();
+
+    const LoadConfig m_config;
+    QUdpSocket m_socket;
+    QTimer m_tickTimer;
+    QTimer m_progressTimer;
+    QTimer m_finishTimer;
+    QRandomGenerator m_random;
+    QVector<Peer> m_peers;
+    QElapsedTimer m_clock;
+    qint64 m_lastTickAt = 0;
+    double m_churnDue = 0;
+    double m_leaveDue = 0;
+    int m_elapsedSeconds = 0;
+    quint64 m_sent = 0;
+    quint64 m_bytes = 0;
+    quint64 m_changes = 0;
+    quint64 m_leaves = 0;
+    quint64 m_lastSent = 0;
+};
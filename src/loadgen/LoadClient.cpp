@@ -0,0 +1,392 @@
+#include "loadgen/LoadClient.h"
+
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <cstring>
+
+namespace {
+const char* const kStatuses[] = {"Online", "Away", "Not Available", "Do Not Disturb"};
+const int kRetryDelayMs = 1000;
+
+// Roughly a 32 kbit/s Opus voice and a small JPEG camera stream
+const int kAudioFrameMs = 20;
+const int kAudioBytes = 80;
+const int kVideoEvery = 3; // audio frames per video frame, ~16 fps
+const int kVideoBytes = 6000;
+const int kSpeakerTurnMs = 2000;
+
+// Same bound SkypeClient puts on an inflated frame
+const int kMaxInflatedFrame = 16 * 1024 * 1024;
+}
+
+LoadClient::LoadClient(int index, const LoadConfig& config, LoadStats* stats, QObject* parent)
+    : QObject(parent)
+    , m_index(index)
+    , m_config(config)
+    , m_stats(stats)
+    , m_random(config.seed + static_cast<quint32>(index))
+    , m_username(config.username(index))
+    , m_padding(qMax(0, config.payloadBytes), QChar('x'))
+    , m_interval(qMax(1, static_cast<int>(1000.0 / config.scenario.opsPerSecond)))
+{
+    connect(&m_socket, &QWebSocket::connected, this, &LoadClient::onConnected);
+    connect(&m_socket, &QWebSocket::disconnected, this, &LoadClient::onDisconnected);
+    connect(&m_socket, &QWebSocket::textMessageReceived, this, &LoadClient::onTextMessage);
+    connect(&m_socket, &QWebSocket::binaryMessageReceived, this, &LoadClient::onBinaryMessage);
+    connect(&m_socket, QOverload<QAbstractSocket::SocketError>::of(&QWebSocket::error),
+            this, &LoadClient::onError);
+    connect(&m_ticker, &QTimer::timeout, this, &LoadClient::tick);
+    connect(&m_mediaTimer, &QTimer::timeout, this, &LoadClient::sendMedia);
+}
+
+void LoadClient::start() {
+    m_running = true;
+    m_socket.open(m_config.url);
+
+    // Random phase so clients don't all fire on the same millisecond
+    m_ticker.start(static_cast<int>(m_random.bounded(m_interval)) + 1);
+}
+
+void LoadClient::stop() {
+    m_running = false;
+    m_ticker.stop();
+    m_mediaTimer.stop();
+    m_socket.close();
+}
+
+void LoadClient::onConnected() {
+    m_connected = true;
+    m_stats->counters.connects++;
+
+    // Login goes out as JSON; binary starts once the server's hello arrives
+    m_binary = false;
+    m_compress = false;
+    m_compressor.reset();
+    if (m_config.binary) {
+        QJsonObject hello{{"type", "hello"},
+                          {"protocols", QJsonArray{QString::fromLatin1(Protocol::kBinaryProtocol)}}};
+        if (m_config.compress) {
+            hello["compression"] = QJsonArray{QString::fromLatin1(Protocol::kCompression)};
+        }
+        send(hello);
+    }
+
+    m_loginSentAt = LoadStats::now();
+    if (m_config.resume && !m_resumeToken.isEmpty()) {
+        send({{"type", "resume"}, {"username", m_username}, {"token", m_resumeToken}});
+        return;
+    }
+    sendLogin();
+}
+
+void LoadClient::sendLogin() {
+    send({{"type", "login"}, {"username", m_username}, {"password", "loadgen"}});
+}
+
+void LoadClient::onDisconnected() {
+    bool wasConnected = m_connected;
+    m_connected = false;
+    m_loggedIn = false;
+    m_binary = false;
+    m_compress = false;
+    m_mediaTimer.stop();
+
+    // Relogin closes the socket on purpose; come straight back
+    if (m_running && wasConnected) {
+        m_socket.open(m_config.url);
+    }
+}
+
+void LoadClient::onError(QAbstractSocket::SocketError error) {
+    Q_UNUSED(error);
+    if (m_connected || !m_running) return;
+
+    m_stats->counters.connectFailures++;
+    QTimer::singleShot(kRetryDelayMs, this, [this]() {
+        if (m_running && !m_connected) m_socket.open(m_config.url);
+    });
+}
+
+void LoadClient::onTextMessage(const QString& message) {
+    m_stats->counters.framesReceived++;
+    m_stats->counters.bytesReceived += static_cast<quint64>(message.size());
+
+    QJsonDocument doc = QJsonDocument::fromJson(message.toUtf8());
+    if (!doc.isObject()) return;
+
+    QJsonObject obj = doc.object();
+    handleFrame(Protocol::opcodeForType(obj["type"].toString()), obj);
+}
+
+void LoadClient::onBinaryMessage(const QByteArray& message) {
+    m_stats->counters.framesReceived++;
+    m_stats->counters.bytesReceived += static_cast<quint64>(message.size());
+
+    if (Protocol::isMediaFrame(message)) {
+        handleMedia(message);
+        return;
+    }
+
+    QByteArray inflated;
+    if (Protocol::isCompressedFrame(message)
+        && !Protocol::decompressBinary(message, m_compressor, inflated, kMaxInflatedFrame)) {
+        m_socket.close(QWebSocketProtocol::CloseCodeProtocolError);
+        return;
+    }
+
+    Protocol::Opcode opcode;
+    QJsonObject obj;
+    if (Protocol::decodeBinary(inflated.isNull() ? message : inflated, opcode, obj)) {
+        handleFrame(opcode, obj);
+    }
+}
+
+void LoadClient::handleFrame(Protocol::Opcode opcode, const QJsonObject& obj) {
+    using Protocol::Opcode;
+    qint64 sentAt = 0;
+
+    switch (opcode) {
+    case Opcode::Hello:
+        m_binary = obj["protocol"].toString() == QLatin1String(Protocol::kBinaryProtocol);
+        m_compress = m_binary
+            && obj["compression"].toString() == QLatin1String(Protocol::kCompression);
+        break;
+    case Opcode::LoginResult:
+        if (!obj["success"].toBool() && obj["retryAfter"].toInt() > 0) {
+            // Busy server: retry with jitter, keeping the original send time
+            // so login latency includes the wait
+            m_stats->counters.loginsBusy++;
+            int delay = obj["retryAfter"].toInt();
+            QTimer::singleShot(delay + static_cast<int>(m_random.bounded(delay)), this, [this]() {
+                if (m_running && m_connected && !m_loggedIn) sendLogin();
+            });
+            break;
+        }
+        if (!obj["success"].toBool()) {
+            m_stats->counters.loginFailures++;
+            break;
+        }
+        m_loggedIn = true;
+        m_resumeToken = obj["resumeToken"].toString();
+        m_stats->counters.logins++;
+        m_stats->record(m_stats->loginLatency, m_loginSentAt);
+        addNeighbours();
+        joinConference();
+        break;
+    case Opcode::ResumeResult:
+        if (!obj["success"].toBool()) {
+            m_stats->counters.resumeFailures++;
+            m_resumeToken.clear();
+            sendLogin();
+            break;
+        }
+        m_loggedIn = true;
+        m_resumeToken = obj["resumeToken"].toString();
+        m_stats->counters.resumes++;
+        if (m_droppedAt != 0) {
+            m_stats->record(m_stats->resumeLatency, m_droppedAt);
+            m_droppedAt = 0;
+        }
+        joinConference();
+        break;
+    case Opcode::ContactList:
+        // A full login is usable once the roster is in
+        if (m_droppedAt != 0) {
+            m_stats->record(m_stats->reloginLatency, m_droppedAt);
+            m_droppedAt = 0;
+        }
+        break;
+    case Opcode::Message:
+        if (payloadTime(obj["text"].toString(), sentAt)) {
+            m_stats->counters.messagesRelayed++;
+            m_stats->record(m_stats->relayLatency, sentAt);
+        }
+        break;
+    case Opcode::MessageAck:
+        if (obj["queued"].toBool()) {
+            m_stats->counters.messagesQueued++;
+        }
+        if (payloadTime(obj["text"].toString(), sentAt)) {
+            m_stats->record(m_stats->ackLatency, sentAt);
+        }
+        break;
+    case Opcode::Presence:
+        recordPresence(obj);
+        break;
+    case Opcode::PresenceBatch:
+        for (const QJsonValue& update : obj["updates"].toArray()) {
+            recordPresence(update.toObject());
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void LoadClient::tick() {
+    if (m_ticker.interval() != m_interval) {
+        m_ticker.setInterval(m_interval);
+    }
+    if (!m_loggedIn) return;
+
+    const Scenario& scenario = m_config.scenario;
+    switch (scenario.pick(static_cast<int>(m_random.bounded(scenario.totalWeight())))) {
+    case Scenario::Message:
+        sendChatMessage();
+        break;
+    case Scenario::Status:
+        m_statusIndex = (m_statusIndex + 1) % 4;
+        if (m_config.statusChangedAt) {
+            m_config.statusChangedAt[m_index].store(LoadStats::now(), std::memory_order_release);
+        }
+        send({{"type", "status"}, {"status", kStatuses[m_statusIndex]}});
+        m_stats->counters.statusChanges++;
+        break;
+    case Scenario::GetContacts:
+        send({{"type", "get_contacts"}});
+        break;
+    case Scenario::AddContact:
+        send({{"type", "add_contact"}, {"contact", randomPeer()}});
+        break;
+    case Scenario::Relogin:
+        m_loggedIn = false;
+        m_droppedAt = LoadStats::now();
+        m_socket.close();
+        break;
+    case Scenario::ActionCount:
+        break;
+    }
+}
+
+void LoadClient::recordPresence(const QJsonObject& update) {
+    m_stats->counters.presenceUpdates++;
+    if (!m_config.statusChangedAt) return;
+
+    // Coalesced updates only carry the latest status, so latency is
+    // measured from the latest change
+    int index = m_config.clientIndex(update["username"].toString());
+    if (index < 0) return;
+    qint64 changedAt = m_config.statusChangedAt[index].load(std::memory_order_acquire);
+    if (changedAt != 0) {
+        m_stats->record(m_stats->presenceLatency, changedAt);
+    }
+}
+
+void LoadClient::addNeighbours() {
+    if (m_neighboursAdded) return;
+    m_neighboursAdded = true;
+
+    int count = qMin(m_config.scenario.contactsPerClient, m_config.clients - 1);
+    for (int i = 1; i <= count; ++i) {
+        send({{"type", "add_contact"},
+              {"contact", m_config.username((m_index + i) % m_config.clients)}});
+    }
+}
+
+void LoadClient::sendChatMessage() {
+    // "lg:<send time ns>:<padding>" lets the receiver compute latency
+    QString text = QString("lg:%1:%2").arg(LoadStats::now()).arg(m_padding);
+    send({{"type", "message"}, {"to", randomPeer()}, {"text", text}});
+    m_stats->counters.messagesSent++;
+}
+
+void LoadClient::joinConference() {
+    const int size = m_config.scenario.conferenceSize;
+    if (size <= 0) return;
+
+    // Consecutive clients share a call
+    m_conferenceId = QString("%1-conf-%2").arg(m_config.userPrefix).arg(m_index / size);
+    send({{"type", "conf_join"}, {"conferenceId", m_conferenceId}});
+    m_mediaTimer.start(kAudioFrameMs);
+}
+
+void LoadClient::sendMedia() {
+    if (!m_loggedIn) return;
+
+    const int size = m_config.scenario.conferenceSize;
+    const qint64 now = LoadStats::now();
+
+    // Participants take turns at being the loudest so the relay's speaker
+    // selection keeps changing; the rest murmur at random levels
+    const int turn = static_cast<int>((now / 1000000 / kSpeakerTurnMs) % size);
+    const int distance = (m_index % size - turn + size) % size;
+    const int level = distance == 0 ? 10 : distance < 3 ? 30 : 60 + static_cast<int>(m_random.bounded(60));
+
+    // Payload starts with the send time for the receivers' latency
+    Protocol::MediaFrame header;
+    header.flags = Protocol::kMediaLevel;
+    header.seq = m_mediaSeq++;
+    header.conferenceId = m_conferenceId;
+    header.level = level;
+
+    QByteArray payload(kAudioBytes, 'a');
+    memcpy(payload.data(), &now, sizeof(now));
+    QByteArray frame = Protocol::encodeMedia(header, payload);
+    m_socket.sendBinaryMessage(frame);
+    m_stats->counters.mediaSent++;
+    m_stats->counters.framesSent++;
+    m_stats->counters.bytesSent += static_cast<quint64>(frame.size());
+
+    if (header.seq % kVideoEvery == 0) {
+        header.video = true;
+        header.flags = 0;
+        payload = QByteArray(kVideoBytes, 'v');
+        memcpy(payload.data(), &now, sizeof(now));
+        frame = Protocol::encodeMedia(header, payload);
+        m_socket.sendBinaryMessage(frame);
+        m_stats->counters.mediaSent++;
+        m_stats->counters.framesSent++;
+        m_stats->counters.bytesSent += static_cast<quint64>(frame.size());
+    }
+}
+
+void LoadClient::handleMedia(const QByteArray& frame) {
+    Protocol::MediaFrame header;
+    if (!Protocol::decodeMedia(frame, header)) return;
+    if (frame.size() - header.payloadOffset < static_cast<int>(sizeof(qint64))) return;
+
+    if (header.video) {
+        m_stats->counters.videoReceived++;
+    } else {
+        m_stats->counters.audioReceived++;
+    }
+
+    qint64 sentAt = 0;
+    memcpy(&sentAt, frame.constData() + header.payloadOffset, sizeof(sentAt));
+    m_stats->record(m_stats->mediaLatency, sentAt);
+}
+
+QString LoadClient::randomPeer() {
+    if (m_config.clients < 2) return m_username;
+
+    int peer = static_cast<int>(m_random.bounded(m_config.clients - 1));
+    if (peer >= m_index) peer++;
+    return m_config.username(peer);
+}
+
+bool LoadClient::payloadTime(const QString& text, qint64& sentAt) const {
+    if (!text.startsWith(QLatin1String("lg:"))) return false;
+
+    int end = text.indexOf(':', 3);
+    if (end < 0) return false;
+
+    bool ok = false;
+    sentAt = text.midRef(3, end - 3).toLongLong(&ok);
+    return ok;
+}
+
+void LoadClient::send(const QJsonObject& obj) {
+    m_stats->counters.framesSent++;
+    if (m_binary) {
+        QByteArray frame = Protocol::encodeBinary(obj);
+        if (m_compress && frame.size() >= CompressionPolicy().threshold) {
+            frame = Protocol::compressBinary(frame, m_compressor);
+        }
+        m_stats->counters.bytesSent += static_cast<quint64>(frame.size());
+        m_socket.sendBinaryMessage(frame);
+    } else {
+        QByteArray frame = QJsonDocument(obj).toJson(QJsonDocument::Compact);
+        m_stats->counters.bytesSent += static_cast<quint64>(frame.size());
+        m_socket.sendTextMessage(QString::fromUtf8(frame));
+    }
+}
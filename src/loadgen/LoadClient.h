@@ -0,0 +1,71 @@
+#pragma once
+
+#include <QObject>
+#include <QWebSocket>
+#include <QTimer>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include "loadgen/LoadConfig.h"
+#include "loadgen/LoadStats.h"
+#include "network/FrameCompressor.h"
+#include "network/Protocol.h"
+
+// Headless client speaking the same protocol as SkypeClient. Signs in and
+// then performs one scenario action per tick until stopped. Chat payloads
+// carry the send time so the recipient can measure relay latency. With a
+// conference size set, the client also joins a call and streams audio and
+// video frames through the server's media relay.
+class LoadClient : public QObject {
+    Q_OBJECT
+
+public:
+    LoadClient(int index, const LoadConfig& config, LoadStats* stats, QObject* parent = nullptr);
+
+    void start();
+    void stop();
+
+private slots:
+    void onConnected();
+    void onDisconnected();
+    void onError(QAbstractSocket::SocketError error);
+    void onTextMessage(const QString& message);
+    void onBinaryMessage(const QByteArray& message);
+    void tick();
+    void sendMedia();
+
+private:
+    void handleFrame(Protocol::Opcode opcode, const QJsonObject& obj);
+    void sendLogin();
+    void send(const QJsonObject& obj);
+    void addNeighbours();
+    void sendChatMessage();
+    void joinConference();
+    void handleMedia(const QByteArray& frame);
+    void recordPresence(const QJsonObject& update);
+    QString randomPeer();
+    bool payloadTime(const QString& text, qint64& sentAt) const;
+
+    int m_index;
+    const LoadConfig& m_config;
+    LoadStats* m_stats;
+    QWebSocket m_socket;
+    QTimer m_ticker;
+    QTimer m_mediaTimer;
+    QRandomGenerator m_random;
+    FrameCompressor m_compressor;
+    QString m_username;
+    QString m_padding;
+    QString m_conferenceId;
+    QString m_resumeToken;
+    int m_interval;
+    int m_statusIndex = 0;
+    quint32 m_mediaSeq = 0;
+    qint64 m_loginSentAt = 0;
+    qint64 m_droppedAt = 0; // set by a relogin until the client is usable again
+    bool m_running = false;
+    bool m_connected = false;
+    bool m_loggedIn = false;
+    bool m_binary = false;
+    bool m_compress = false;
+    bool m_neighboursAdded = false;
+};
@@ -0,0 +1,112 @@
+#include "loadgen/LoadConfig.h"
+
+namespace {
+const char* const kActionNames[Scenario::ActionCount] = {
+    "message", "status", "get_contacts", "add_contact", "relogin"
+};
+}
+
+bool Scenario::fromPreset(const QString& name, Scenario& scenario) {
+    Scenario preset;
+    preset.name = name;
+
+    if (name == "login-storm") {
+        // Every tick drops the connection and signs in again
+        preset.weights[Relogin] = 1;
+        preset.opsPerSecond = 0.5;
+    } else if (name == "login-storm-chat") {
+        // Relogins mixed with chat, to see what a storm does to relay latency
+        preset.weights[Relogin] = 1;
+        preset.weights[Message] = 4;
+        preset.opsPerSecond = 2.0;
+    } else if (name == "reconnect") {
+        // Drops and reconnects with chat in between; compare runs with
+        // and without --resume
+        preset.weights[Relogin] = 1;
+        preset.weights[Message] = 4;
+        preset.opsPerSecond = 1.0;
+        preset.contactsPerClient = 20;
+    } else if (name == "chat") {
+        preset.weights[Message] = 90;
+        preset.weights[Status] = 5;
+        preset.weights[GetContacts] = 5;
+        preset.opsPerSecond = 2.0;
+    } else if (name == "presence") {
+        // Contacts give every status change a fan-out
+        preset.weights[Status] = 70;
+        preset.weights[Message] = 10;
+        preset.weights[GetContacts] = 10;
+        preset.weights[AddContact] = 10;
+        preset.contactsPerClient = 20;
+    } else if (name == "presence-fanout") {
+        // Status changes only, each watched by --contacts others (default
+        // 100); the report gives deliveries per change and their latency
+        preset.weights[Status] = 1;
+        preset.opsPerSecond = 0.5;
+        preset.contactsPerClient = 100;
+    } else if (name == "conference") {
+        // Calls of 16 streaming audio and video through the server's relay,
+        // with a trickle of chat beside them
+        preset.weights[Message] = 1;
+        preset.opsPerSecond = 0.2;
+        preset.conferenceSize = 16;
+    } else {
+        return false;
+    }
+
+    scenario = preset;
+    return true;
+}
+
+QStringList Scenario::presetNames() {
+    return {"login-storm", "login-storm-chat", "reconnect", "chat", "presence", "presence-fanout",
+            "conference"};
+}
+
+bool Scenario::applyMix(const QString& mix, QString* error) {
+    for (const QString& entry : mix.split(',', QString::SkipEmptyParts)) {
+        const QStringList pair = entry.split('=');
+        int action = ActionCount;
+        for (int i = 0; i < ActionCount; ++i) {
+            if (pair.first().trimmed() == QLatin1String(kActionNames[i])) {
+                action = i;
+                break;
+            }
+        }
+
+        bool ok = false;
+        int weight = pair.size() == 2 ? pair[1].trimmed().toInt(&ok) : 0;
+        if (action == ActionCount || !ok || weight < 0) {
+            if (error) *error = QString("Invalid mix entry: %1").arg(entry);
+            return false;
+        }
+        weights[action] = weight;
+    }
+
+    if (totalWeight() == 0) {
+        if (error) *error = "Mix has no non-zero weights";
+        return false;
+    }
+    return true;
+}
+
+int LoadConfig::clientIndex(const QString& username) const {
+    if (!username.startsWith(userPrefix)) return -1;
+    bool ok = false;
+    int index = username.midRef(userPrefix.size()).toInt(&ok);
+    return ok && index >= 0 && index < clients ? index : -1;
+}
+
+int Scenario::totalWeight() const {
+    int total = 0;
+    for (int weight : weights) total += weight;
+    return total;
+}
+
+Scenario::Action Scenario::pick(int roll) const {
+    for (int i = 0; i < ActionCount; ++i) {
+        if (roll < weights[i]) return static_cast<Action>(i);
+        roll -= weights[i];
+    }
+    return Message;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QUrl>
+#include <QVector>
+#include <array>
+#include <atomic>
+
+// Weighted mix of the actions a logged-in load client performs per tick
+struct Scenario {
+    enum Action { Message, Status, GetContacts, AddContact, Relogin, ActionCount };
+
+    QString name;
+    std::array<int, ActionCount> weights{};
+    double opsPerSecond = 1.0; // per client
+    int contactsPerClient = 0; // neighbours added once after the first login
+    int conferenceSize = 0;    // clients per relayed conference call, 0 = no media
+
+    static bool fromPreset(const QString& name, Scenario& scenario);
+    static QStringList presetNames();
+
+    // Overrides weights from a list like "message=8,status=1"
+    bool applyMix(const QString& mix, QString* error);
+    int totalWeight() const;
+    Action pick(int roll) const;
+};
+
+struct LoadConfig {
+    QUrl url{"ws://127.0.0.1:33033"};
+    int clients = 1000;
+    int threads = 1;
+    int rampPerSecond = 500;
+    int durationSeconds = 30;
+    int warmupSeconds = 5;
+    int payloadBytes = 64;
+    bool binary = false;
+    bool compress = false;  // also offer deflate; only takes effect with binary
+    quint32 seed = 1;
+    QString userPrefix = "lg";
+    int stalledClients = 0; // the first N clients log in and never read
+    bool resume = false;    // reconnects present the resume token instead of logging in
+    int lanPeers = 0;       // > 0: send LAN discovery beacons instead of driving the server
+    quint16 discoveryPort = 33034;
+    double lanChurnPerSecond = 0;
+    double lanLeavePerSecond = 0;
+    bool lanLegacy = false; // JSON discovery packets, as before binary beacons
+    QVector<int> mediaLoss; // non-empty: time call audio over loopback at each loss %
+    Scenario scenario;
+
+    // Send time of each client's latest status change, indexed by client
+    // and shared by every worker; watchers read it for presence latency
+    std::atomic<qint64>* statusChangedAt = nullptr;
+
+    // Regression gates; 0 disables the check
+    double maxRelayP99Ms = 0;
+    double minRelayedPerSecond = 0;
+
+    QString username(int index) const { return userPrefix + QString::number(index); }
+    // Inverse of username(); -1 for a name this run didn't create
+    int clientIndex(const QString& username) const;
+};
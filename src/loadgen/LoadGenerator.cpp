@@ -0,0 +1,254 @@
+#include "loadgen/LoadGenerator.h"
+#include "loadgen/LoadClient.h"
+#include "loadgen/StalledClient.h"
+
+#include <QThread>
+#include <QTextStream>
+#include <algorithm>
+
+namespace {
+const int kRampStepMs = 10;
+const qint64 kNsPerSecond = 1000000000;
+
+double toMs(qint64 ns) {
+    return ns / 1e6;
+}
+}
+
+LoadWorker::LoadWorker(const LoadConfig& config, int first, int count, qint64 recordFrom,
+                       QObject* parent)
+    : QObject(parent)
+    , m_config(config)
+    , m_first(first)
+    , m_count(count)
+{
+    m_stats.recordFrom = recordFrom;
+    connect(&m_rampTimer, &QTimer::timeout, this, &LoadWorker::rampStep);
+}
+
+void LoadWorker::start() {
+    m_rampStartedAt = LoadStats::now();
+    m_rampTimer.start(kRampStepMs);
+    rampStep();
+}
+
+void LoadWorker::rampStep() {
+    // Each worker ramps its share of the global connection rate
+    double rate = qMax(1.0, m_config.rampPerSecond / double(qMax(1, m_config.threads)));
+    double elapsed = (LoadStats::now() - m_rampStartedAt) / double(kNsPerSecond);
+    int target = qMin(m_count, qMax(1, static_cast<int>(elapsed * rate)));
+
+    while (m_clients.size() + m_stalled.size() < target) {
+        int index = m_first + m_clients.size() + m_stalled.size();
+        if (index < m_config.stalledClients) {
+            auto* client = new StalledClient(index, m_config, &m_stats, this);
+            m_stalled.append(client);
+            client->start();
+        } else {
+            auto* client = new LoadClient(index, m_config, &m_stats, this);
+            m_clients.append(client);
+            client->start();
+        }
+    }
+
+    if (m_clients.size() + m_stalled.size() == m_count) {
+        m_rampTimer.stop();
+    }
+}
+
+void LoadWorker::stop() {
+    m_rampTimer.stop();
+    for (LoadClient* client : qAsConst(m_clients)) {
+        client->stop();
+    }
+    for (StalledClient* client : qAsConst(m_stalled)) {
+        client->stop();
+    }
+}
+
+LoadGenerator::LoadGenerator(const LoadConfig& config, QObject* parent)
+    : QObject(parent)
+    , m_config(config)
+{
+    m_config.threads = qBound(1, m_config.threads, qMax(1, m_config.clients));
+    m_statusChangedAt.reset(new std::atomic<qint64>[m_config.clients]());
+    m_config.statusChangedAt = m_statusChangedAt.get();
+
+    connect(&m_progressTimer, &QTimer::timeout, this, &LoadGenerator::onProgress);
+    m_finishTimer.setSingleShot(true);
+    connect(&m_finishTimer, &QTimer::timeout, this, &LoadGenerator::finish);
+}
+
+LoadGenerator::~LoadGenerator() {
+    for (QThread* thread : qAsConst(m_threads)) {
+        thread->quit();
+        thread->wait();
+    }
+    qDeleteAll(m_workers);
+    qDeleteAll(m_threads);
+}
+
+void LoadGenerator::start() {
+    m_startedAt = LoadStats::now();
+    m_measureFrom = m_startedAt + m_config.warmupSeconds * kNsPerSecond;
+
+    int first = 0;
+    for (int i = 0; i < m_config.threads; ++i) {
+        // Spread the remainder over the first workers
+        int count = m_config.clients / m_config.threads
+                  + (i < m_config.clients % m_config.threads ? 1 : 0);
+
+        auto* thread = new QThread;
+        thread->setObjectName(QString("loadgen-%1").arg(i));
+        auto* worker = new LoadWorker(m_config, first, count, m_measureFrom);
+        worker->moveToThread(thread);
+        thread->start();
+        QMetaObject::invokeMethod(worker, [worker]() { worker->start(); }, Qt::QueuedConnection);
+
+        m_workers.append(worker);
+        m_threads.append(thread);
+        first += count;
+    }
+
+    QTextStream(stdout) << "Scenario " << m_config.scenario.name << ": "
+                        << m_config.clients << " clients on " << m_config.threads
+                        << " thread(s) against " << m_config.url.toString()
+                        << (m_config.compress ? " (cbor+deflate)"
+                            : m_config.binary ? " (cbor)" : " (json)") << "\n";
+
+    m_progressTimer.start(1000);
+    m_finishTimer.start((m_config.warmupSeconds + m_config.durationSeconds) * 1000);
+}
+
+LoadCounters LoadGenerator::collectCounters() {
+    LoadCounters total;
+    for (LoadWorker* worker : qAsConst(m_workers)) {
+        LoadCounters counters;
+        QMetaObject::invokeMethod(worker, [worker, &counters]() {
+            counters = worker->stats().counters;
+        }, Qt::BlockingQueuedConnection);
+        total += counters;
+    }
+    return total;
+}
+
+void LoadGenerator::onProgress() {
+    m_elapsedSeconds++;
+    LoadCounters now = collectCounters();
+    LoadCounters delta = now - m_last;
+    m_last = now;
+
+    if (m_elapsedSeconds == m_config.warmupSeconds) {
+        m_baseline = now;
+    }
+
+    QTextStream(stdout) << QString::asprintf(
+        "[%3ds]%s logins %6llu/s  sent %7llu/s  relayed %7llu/s  presence %7llu/s  failures %llu\n",
+        m_elapsedSeconds, m_elapsedSeconds <= m_config.warmupSeconds ? "*" : " ",
+        delta.logins, delta.messagesSent, delta.messagesRelayed, delta.presenceUpdates,
+        now.connectFailures + now.loginFailures);
+}
+
+void LoadGenerator::finish() {
+    m_progressTimer.stop();
+
+    LoadStats total;
+    for (LoadWorker* worker : qAsConst(m_workers)) {
+        QMetaObject::invokeMethod(worker, [worker, &total]() {
+            worker->stop();
+            total.merge(worker->stats());
+        }, Qt::BlockingQueuedConnection);
+    }
+
+    // Counters before the warmup cut-off don't count towards throughput
+    double seconds = (LoadStats::now() - qMax(m_measureFrom, m_startedAt)) / double(kNsPerSecond);
+    LoadCounters window = total.counters - (m_config.warmupSeconds > 0 ? m_baseline : LoadCounters());
+
+    emit finished(report(total, window, seconds));
+}
+
+int LoadGenerator::report(LoadStats& total, const LoadCounters& window, double seconds) {
+    QTextStream out(stdout);
+    seconds = qMax(seconds, 0.001);
+
+    out << QString::asprintf("\nMeasured window: %.1f s\n", seconds);
+    out << QString::asprintf("  logins            %10llu  %10.1f/s  (%llu failed, %llu busy)\n",
+                             window.logins, window.logins / seconds, total.counters.loginFailures,
+                             total.counters.loginsBusy);
+    if (m_config.resume) {
+        out << QString::asprintf("  resumes           %10llu  %10.1f/s  (%llu refused)\n",
+                                 window.resumes, window.resumes / seconds,
+                                 total.counters.resumeFailures);
+    }
+    out << QString::asprintf("  messages sent     %10llu  %10.1f/s\n",
+                             window.messagesSent, window.messagesSent / seconds);
+    out << QString::asprintf("  messages relayed  %10llu  %10.1f/s\n",
+                             window.messagesRelayed, window.messagesRelayed / seconds);
+    out << QString::asprintf("  queued offline    %10llu\n", window.messagesQueued);
+    out << QString::asprintf("  presence updates  %10llu  %10.1f/s\n",
+                             window.presenceUpdates, window.presenceUpdates / seconds);
+    if (window.statusChanges > 0) {
+        // Fan-out cost: deliveries each change caused; ~ watchers per user
+        // unless coalescing merged changes
+        out << QString::asprintf("  status changes    %10llu  %10.1f/s  (%.1f updates each)\n",
+                                 window.statusChanges, window.statusChanges / seconds,
+                                 double(window.presenceUpdates) / window.statusChanges);
+    }
+    out << QString::asprintf("  frames out/in     %10llu / %llu\n",
+                             window.framesSent, window.framesReceived);
+    out << QString::asprintf("  MB out/in         %10.1f / %.1f\n",
+                             window.bytesSent / 1048576.0, window.bytesReceived / 1048576.0);
+    out << QString::asprintf("  connect failures  %10llu\n", total.counters.connectFailures);
+    if (m_config.scenario.conferenceSize > 0) {
+        out << QString::asprintf("  media sent        %10llu  %10.1f/s\n",
+                                 window.mediaSent, window.mediaSent / seconds);
+        out << QString::asprintf("  audio received    %10llu  %10.1f/s\n",
+                                 window.audioReceived, window.audioReceived / seconds);
+        out << QString::asprintf("  video received    %10llu  %10.1f/s\n",
+                                 window.videoReceived, window.videoReceived / seconds);
+    }
+    if (m_config.stalledClients > 0) {
+        out << QString::asprintf("  stalled dropped   %10llu / %d\n",
+                                 total.counters.stalledDropped, m_config.stalledClients);
+    }
+
+    out << QString::asprintf("\n  latency (ms)   %10s %9s %9s %9s %9s\n",
+                             "samples", "p50", "p99", "p999", "max");
+    auto printLatency = [&out](const char* name, QVector<qint64>& samples) {
+        std::sort(samples.begin(), samples.end());
+        out << QString::asprintf("  %-14s %10d %9.2f %9.2f %9.2f %9.2f\n", name, samples.size(),
+                                 toMs(percentile(samples, 0.50)), toMs(percentile(samples, 0.99)),
+                                 toMs(percentile(samples, 0.999)),
+                                 toMs(samples.isEmpty() ? 0 : samples.last()));
+    };
+    printLatency("relay", total.relayLatency);
+    printLatency("message_ack", total.ackLatency);
+    printLatency("login", total.loginLatency);
+    if (!total.reloginLatency.isEmpty() || !total.resumeLatency.isEmpty()) {
+        // Drop to usable again: roster received, or the resume accepted
+        printLatency("reconnect", total.reloginLatency);
+        printLatency("resume", total.resumeLatency);
+    }
+    if (m_config.scenario.conferenceSize > 0) {
+        printLatency("media", total.mediaLatency);
+    }
+    if (!total.presenceLatency.isEmpty()) {
+        printLatency("presence", total.presenceLatency);
+    }
+    out.flush();
+
+    int exitCode = 0;
+    double relayP99 = toMs(percentile(total.relayLatency, 0.99));
+    if (m_config.maxRelayP99Ms > 0 && relayP99 > m_config.maxRelayP99Ms) {
+        out << QString::asprintf("FAIL: relay p99 %.2f ms exceeds %.2f ms\n",
+                                 relayP99, m_config.maxRelayP99Ms);
+        exitCode = 1;
+    }
+    double relayed = window.messagesRelayed / seconds;
+    if (m_config.minRelayedPerSecond > 0 && relayed < m_config.minRelayedPerSecond) {
+        out << QString::asprintf("FAIL: relayed %.1f/s is below %.1f/s\n",
+                                 relayed, m_config.minRelayedPerSecond);
+        exitCode = 1;
+    }
+    return exitCode;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+#include <memory>
+#include "loadgen/LoadConfig.h"
+#include "loadgen/LoadStats.h"
+
+class QThread;
+class LoadClient;
+class StalledClient;
+
+// Owns the clients assigned to one thread and ramps them up gradually
+class LoadWorker : public QObject {
+    Q_OBJECT
+
+public:
+    LoadWorker(const LoadConfig& config, int first, int count, qint64 recordFrom,
+               QObject* parent = nullptr);
+
+    // Must run on the worker's thread
+    void start();
+    void stop();
+    const LoadStats& stats() const { return m_stats; }
+
+private:
+    void rampStep();
+
+    LoadConfig m_config;
+    int m_first;
+    int m_count;
+    LoadStats m_stats;
+    QVector<LoadClient*> m_clients;
+    QVector<StalledClient*> m_stalled;
+    QTimer m_rampTimer;
+    qint64 m_rampStartedAt = 0;
+};
+
+// Spreads the clients over worker threads, prints progress once a second
+// and a throughput/latency report at the end. Samples and counters from
+// the warmup period are left out of the report.
+class LoadGenerator : public QObject {
+    Q_OBJECT
+
+public:
+    explicit LoadGenerator(const LoadConfig& config, QObject* parent = nullptr);
+    ~LoadGenerator();
+
+    void start();
+
+signals:
+    void finished(int exitCode);
+
+private:
+    void onProgress();
+    void finish();
+    LoadCounters collectCounters();
+    int report(LoadStats& total, const LoadCounters& window, double seconds);
+
+    LoadConfig m_config;
+    std::unique_ptr<std::atomic<qint64>[]> m_statusChangedAt;
+    QVector<LoadWorker*> m_workers;
+    QVector<QThread*> m_threads;
+    QTimer m_progressTimer;
+    QTimer m_finishTimer;
+    LoadCounters m_last;
+    LoadCounters m_baseline;
+    qint64 m_startedAt = 0;
+    qint64 m_measureFrom = 0;
+    int m_elapsedSeconds = 0;
+};
@@ -0,0 +1,80 @@
+#include "loadgen/LoadStats.h"
+
+#include <chrono>
+#include <cmath>
+
+LoadCounters& LoadCounters::operator+=(const LoadCounters& other) {
+    connects += other.connects;
+    connectFailures += other.connectFailures;
+    logins += other.logins;
+    loginFailures += other.loginFailures;
+    loginsBusy += other.loginsBusy;
+    resumes += other.resumes;
+    resumeFailures += other.resumeFailures;
+    framesSent += other.framesSent;
+    framesReceived += other.framesReceived;
+    bytesSent += other.bytesSent;
+    bytesReceived += other.bytesReceived;
+    messagesSent += other.messagesSent;
+    messagesRelayed += other.messagesRelayed;
+    messagesQueued += other.messagesQueued;
+    presenceUpdates += other.presenceUpdates;
+    statusChanges += other.statusChanges;
+    stalledDropped += other.stalledDropped;
+    mediaSent += other.mediaSent;
+    audioReceived += other.audioReceived;
+    videoReceived += other.videoReceived;
+    return *this;
+}
+
+LoadCounters LoadCounters::operator-(const LoadCounters& other) const {
+    LoadCounters diff;
+    diff.connects = connects - other.connects;
+    diff.connectFailures = connectFailures - other.connectFailures;
+    diff.logins = logins - other.logins;
+    diff.loginFailures = loginFailures - other.loginFailures;
+    diff.loginsBusy = loginsBusy - other.loginsBusy;
+    diff.resumes = resumes - other.resumes;
+    diff.resumeFailures = resumeFailures - other.resumeFailures;
+    diff.framesSent = framesSent - other.framesSent;
+    diff.framesReceived = framesReceived - other.framesReceived;
+    diff.bytesSent = bytesSent - other.bytesSent;
+    diff.bytesReceived = bytesReceived - other.bytesReceived;
+    diff.messagesSent = messagesSent - other.messagesSent;
+    diff.messagesRelayed = messagesRelayed - other.messagesRelayed;
+    diff.messagesQueued = messagesQueued - other.messagesQueued;
+    diff.presenceUpdates = presenceUpdates - other.presenceUpdates;
+    diff.statusChanges = statusChanges - other.statusChanges;
+    diff.stalledDropped = stalledDropped - other.stalledDropped;
+    diff.mediaSent = mediaSent - other.mediaSent;
+    diff.audioReceived = audioReceived - other.audioReceived;
+    diff.videoReceived = videoReceived - other.videoReceived;
+    return diff;
+}
+
+void LoadStats::record(QVector<qint64>& samples, qint64 startedAt) {
+    if (startedAt < recordFrom) return;
+    samples.append(now() - startedAt);
+}
+
+void LoadStats::merge(const LoadStats& other) {
+    counters += other.counters;
+    relayLatency += other.relayLatency;
+    ackLatency += other.ackLatency;
+    loginLatency += other.loginLatency;
+    mediaLatency += other.mediaLatency;
+    reloginLatency += other.reloginLatency;
+    resumeLatency += other.resumeLatency;
+    presenceLatency += other.presenceLatency;
+}
+
+qint64 LoadStats::now() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+qint64 percentile(const QVector<qint64>& sorted, double q) {
+    if (sorted.isEmpty()) return 0;
+    int rank = static_cast<int>(std::ceil(q * sorted.size()));
+    return sorted[qBound(0, rank - 1, sorted.size() - 1)];
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <QtGlobal>
+#include <QVector>
+
+struct LoadCounters {
+    quint64 connects = 0;
+    quint64 connectFailures = 0;
+    quint64 logins = 0;
+    quint64 loginFailures = 0;
+    quint64 loginsBusy = 0; // refused with retryAfter and tried again
+    quint64 resumes = 0;
+    quint64 resumeFailures = 0; // token refused, fell back to login
+    quint64 framesSent = 0;
+    quint64 framesReceived = 0;
+    quint64 bytesSent = 0;
+    quint64 bytesReceived = 0;
+    quint64 messagesSent = 0;
+    quint64 messagesRelayed = 0;
+    quint64 messagesQueued = 0;
+    quint64 presenceUpdates = 0;
+    quint64 statusChanges = 0;
+    quint64 stalledDropped = 0; // stalled clients the server disconnected
+    quint64 mediaSent = 0;
+    quint64 audioReceived = 0;
+    quint64 videoReceived = 0;
+
+    LoadCounters& operator+=(const LoadCounters& other);
+    LoadCounters operator-(const LoadCounters& other) const;
+};
+
+// Results for one worker. Only touched from that worker's thread; the
+// generator merges copies once the run is over.
+struct LoadStats {
+    LoadCounters counters;
+    QVector<qint64> relayLatency; // ns, sender -> recipient
+    QVector<qint64> ackLatency;   // ns, sender -> message_ack
+    QVector<qint64> loginLatency; // ns, login -> login_result
+    QVector<qint64> mediaLatency; // ns, uploader -> conference receiver
+    QVector<qint64> reloginLatency; // ns, drop -> roster after a full login
+    QVector<qint64> resumeLatency;  // ns, drop -> resume_result
+    QVector<qint64> presenceLatency; // ns, status change -> a watcher's update
+    qint64 recordFrom = 0;        // samples started before this are warmup
+
+    void record(QVector<qint64>& samples, qint64 startedAt);
+    void merge(const LoadStats& other);
+
+    // Monotonic nanoseconds, comparable across threads of one process
+    static qint64 now();
+};
+
+// Nearest-rank value at quantile q (0..1) of an ascending sample vector
+qint64 percentile(const QVector<qint64>& sorted, double q);
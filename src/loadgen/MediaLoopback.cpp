@@ -0,0 +1,200 @@
+#include "loadgen/MediaLoopback.h"
+#include "loadgen/LoadStats.h"
+#include "network/MediaTransport.h"
+
+#include <QWebSocket>
+#include <QWebSocketServer>
+#include <QTextStream>
+#include <QtEndian>
+#include <QDebug>
+#include <algorithm>
+
+namespace {
+const int kFrameMs = 20;
+const int kFrameBytes = 80;        // Opus at 32 kbit/s
+const int kPlayoutBudgetMs = 60;   // JitterBuffer's target depth
+const int kRetransmitMs = 200;     // Linux's minimum TCP RTO
+const int kDrainMs = 1000;         // after the last frame, before counting losses
+const char* const kCaller = "caller";
+const char* const kCallee = "callee";
+}
+
+MediaLoopback::MediaLoopback(const LoadConfig& config, QObject* parent)
+    : QObject(parent)
+    , m_config(config)
+    , m_random(config.seed)
+{
+    m_frameTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_frameTimer, &QTimer::timeout, this, &MediaLoopback::sendFrame);
+    m_runTimer.setSingleShot(true);
+    connect(&m_runTimer, &QTimer::timeout, this, &MediaLoopback::stopSending);
+    m_retransmitTimer.setSingleShot(true);
+    connect(&m_retransmitTimer, &QTimer::timeout, this, &MediaLoopback::flushHeld);
+}
+
+void MediaLoopback::start() {
+    for (int loss : m_config.mediaLoss) {
+        Run udp;
+        udp.path = Udp;
+        udp.lossPercent = loss;
+        m_runs.append(udp);
+        Run webSocket = udp;
+        webSocket.path = WebSocket;
+        m_runs.append(webSocket);
+    }
+    m_current = 0;
+
+    // From the event loop, so a failed setup can end it
+    QTimer::singleShot(0, this, &MediaLoopback::startRun);
+}
+
+void MediaLoopback::startRun() {
+    if (m_current >= m_runs.size()) {
+        report();
+        return;
+    }
+
+    const Run& run = m_runs[m_current];
+    m_seq = 0;
+    QTextStream(stdout) << (run.path == Udp ? "UDP" : "WebSocket (modeled loss)") << " at " << run.lossPercent
+                        << "% loss for " << m_config.durationSeconds << " s\n";
+
+    if (run.path == Udp) {
+        // The shim is read once in open(); only the caller's media is dropped
+        qputenv("SKYPE_MEDIA_LOSS", QByteArray::number(run.lossPercent));
+        m_caller = new MediaTransport(this);
+        bool ok = m_caller->open();
+        qunsetenv("SKYPE_MEDIA_LOSS");
+        m_callee = new MediaTransport(this);
+        ok = m_callee->open() && ok;
+        if (!ok) {
+            qCritical() << "Cannot open UDP media on loopback";
+            emit finished(1);
+            return;
+        }
+
+        QHostAddress loopback(QHostAddress::LocalHost);
+        QJsonObject callerMedia = m_caller->localDescription(kCallee);
+        QJsonObject calleeMedia = m_callee->localDescription(kCaller);
+        m_caller->setRemoteDescription(kCallee, loopback, calleeMedia);
+        m_callee->setRemoteDescription(kCaller, loopback, callerMedia);
+        connect(m_callee, &MediaTransport::audioReceived, this,
+                [this](const QString&, const QByteArray& data, int) { receive(data); });
+
+        // Frames only count once the path is confirmed, as in a real call
+        m_frameTimer.start(kFrameMs);
+        m_runTimer.start(m_config.durationSeconds * 1000);
+        return;
+    }
+
+    m_server = new QWebSocketServer("SkypeLoadGen media", QWebSocketServer::NonSecureMode, this);
+    if (!m_server->listen(QHostAddress::LocalHost, 0)) {
+        qCritical() << "Cannot listen on loopback:" << m_server->errorString();
+        emit finished(1);
+        return;
+    }
+    connect(m_server, &QWebSocketServer::newConnection, this, [this]() {
+        while (QWebSocket* socket = m_server->nextPendingConnection()) {
+            socket->setParent(m_server);
+            connect(socket, &QWebSocket::binaryMessageReceived, this,
+                    [this](const QByteArray& frame) { receive(frame.mid(8)); });
+        }
+    });
+
+    m_client = new QWebSocket(QString(), QWebSocketProtocol::VersionLatest, this);
+    connect(m_client, &QWebSocket::connected, this, [this]() {
+        m_frameTimer.start(kFrameMs);
+        m_runTimer.start(m_config.durationSeconds * 1000);
+    });
+    m_client->open(QUrl(QString("ws://127.0.0.1:%1").arg(m_server->serverPort())));
+}
+
+void MediaLoopback::sendFrame() {
+    Run& run = m_runs[m_current];
+    QByteArray payload(kFrameBytes, '\0');
+    qToBigEndian<qint64>(LoadStats::now(), reinterpret_cast<uchar*>(payload.data()));
+
+    if (run.path == Udp) {
+        // A frame the shim drops still counts as sent: the far end sees the gap
+        if (m_caller->sendAudio(kCallee, payload)) run.sent++;
+        return;
+    }
+
+    // As LANPeerService sends it: "AUD\0" + 4-byte seq + data
+    QByteArray frame("AUD", 4);
+    frame.resize(8);
+    qToBigEndian<quint32>(m_seq++, reinterpret_cast<uchar*>(frame.data()) + 4);
+    frame.append(payload);
+    run.sent++;
+
+    // Behind a lost segment, TCP holds everything until the retransmit lands
+    if (!m_held.isEmpty()) {
+        m_held.append(frame);
+    } else if (static_cast<int>(m_random.bounded(100)) < run.lossPercent) {
+        m_held.append(frame);
+        m_retransmitTimer.start(kRetransmitMs);
+    } else {
+        m_client->sendBinaryMessage(frame);
+    }
+}
+
+void MediaLoopback::flushHeld() {
+    if (m_client) {
+        for (const QByteArray& frame : m_held) m_client->sendBinaryMessage(frame);
+    }
+    m_held.clear();
+}
+
+void MediaLoopback::stopSending() {
+    m_frameTimer.stop();
+    QTimer::singleShot(kDrainMs, this, &MediaLoopback::endRun);
+}
+
+void MediaLoopback::endRun() {
+    m_retransmitTimer.stop();
+    m_held.clear();
+    delete m_caller;
+    delete m_callee;
+    delete m_client;
+    delete m_server;
+    m_caller = m_callee = nullptr;
+    m_client = nullptr;
+    m_server = nullptr;
+
+    m_current++;
+    startRun();
+}
+
+void MediaLoopback::receive(const QByteArray& payload) {
+    if (m_current < 0 || m_current >= m_runs.size() || payload.size() < 8) return;
+
+    Run& run = m_runs[m_current];
+    qint64 latency = LoadStats::now() - qFromBigEndian<qint64>(reinterpret_cast<const uchar*>(payload.constData()));
+    run.received++;
+    run.latency.append(latency);
+    if (latency > kPlayoutBudgetMs * 1000000LL) run.late++;
+}
+
+void MediaLoopback::report() {
+    QTextStream out(stdout);
+    out << QString::asprintf("\nCall audio over loopback: %d ms frames of %d bytes, %d ms playout budget\n",
+                             kFrameMs, kFrameBytes, kPlayoutBudgetMs);
+    out << "  path                 loss    sent  received    lost    late  concealed   p50 ms   p99 ms   max ms\n";
+    for (Run& run : m_runs) {
+        std::sort(run.latency.begin(), run.latency.end());
+        quint64 lost = run.sent > run.received ? run.sent - run.received : 0;
+        double concealed = run.sent ? 100.0 * (lost + run.late) / run.sent : 0;
+        qint64 max = run.latency.isEmpty() ? 0 : run.latency.last();
+        out << QString::asprintf("  %-19s %4d%% %7llu %9llu %7llu %7llu %9.2f%% %8.1f %8.1f %8.1f\n",
+                                 run.path == Udp ? "UDP" : "WebSocket (modeled)", run.lossPercent,
+                                 run.sent, run.received, lost, run.late, concealed,
+                                 percentile(run.latency, 0.50) / 1e6,
+                                 percentile(run.latency, 0.99) / 1e6, max / 1e6);
+    }
+    out << QString::asprintf("  WebSocket loss is modeled, not measured: a \"lost\" frame and everything\n"
+                             "  behind it are held for %d ms (Linux's minimum TCP RTO) before sending,\n"
+                             "  so its late column follows from that constant\n", kRetransmitMs);
+    out.flush();
+
+    emit finished(0);
+}
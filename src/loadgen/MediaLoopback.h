@@ -0,0 +1,67 @@
+#pragma once
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+#include <QRandomGenerator>
+#include "loadgen/LoadConfig.h"
+
+class MediaTransport;
+class QWebSocket;
+class QWebSocketServer;
+
+// Plays one side of a call to the other over loopback: a 20 ms audio
+// frame at a time, first through two MediaTransports on UDP, then through
+// a WebSocket as LANPeerService's fallback sends it, once per --media-loss
+// percentage. Each frame carries its send time, so the receiver can tell
+// which frames arrive too late for the jitter buffer.
+//
+// UDP loss is MediaTransport's own SKYPE_MEDIA_LOSS shim. TCP never loses
+// a frame, so the WebSocket run models the retransmit instead: a "lost"
+// frame and every frame behind it are held for kRetransmitMs, Linux's
+// minimum RTO, then delivered together. Real recovery is never faster.
+class MediaLoopback : public QObject {
+    Q_OBJECT
+
+public:
+    explicit MediaLoopback(const LoadConfig& config, QObject* parent = nullptr);
+
+    void start();
+
+signals:
+    void finished(int exitCode);
+
+private:
+    enum Path { Udp, WebSocket };
+
+    struct Run {
+        Path path = Udp;
+        int lossPercent = 0;
+        quint64 sent = 0;
+        quint64 received = 0;
+        quint64 late = 0; // past the playout budget, concealed like a loss
+        QVector<qint64> latency; // ns, send -> receive
+    };
+
+    void startRun();
+    void sendFrame();
+    void stopSending();
+    void endRun();
+    void flushHeld();
+    void receive(const QByteArray& payload);
+    void report();
+
+    const LoadConfig m_config;
+    QRandomGenerator m_random;
+    QVector<Run> m_runs;
+    int m_current = -1;
+    quint32 m_seq = 0;
+    QTimer m_frameTimer;
+    QTimer m_runTimer;
+    QTimer m_retransmitTimer;
+    MediaTransport* m_caller = nullptr;
+    MediaTransport* m_callee = nullptr;
+    QWebSocketServer* m_server = nullptr;
+    QWebSocket* m_client = nullptr;
+    QVector<QByteArray> m_held; // WebSocket frames waiting on a modeled retransmit
+};
@@ -0,0 +1,103 @@
+#include "loadgen/StalledClient.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+
+namespace {
+const int kPingMs = 1000;
+const quint8 kTextFrame = 0x1;
+const quint8 kPingFrame = 0x9;
+}
+
+StalledClient::StalledClient(int index, const LoadConfig& config, LoadStats* stats, QObject* parent)
+    : QObject(parent)
+    , m_config(config)
+    , m_stats(stats)
+    , m_random(config.seed + static_cast<quint32>(index))
+    , m_username(config.username(index))
+{
+    connect(&m_socket, &QTcpSocket::connected, this, &StalledClient::onConnected);
+    connect(&m_socket, &QTcpSocket::readyRead, this, &StalledClient::onReadyRead);
+    connect(&m_socket, &QTcpSocket::disconnected, this, &StalledClient::onClosed);
+    connect(&m_socket, QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::error),
+            this, &StalledClient::onClosed);
+    connect(&m_pingTimer, &QTimer::timeout, this, &StalledClient::ping);
+}
+
+void StalledClient::start() {
+    m_socket.connectToHost(m_config.url.host(), static_cast<quint16>(m_config.url.port()));
+}
+
+void StalledClient::stop() {
+    m_pingTimer.stop();
+    m_socket.disconnect(this);
+    m_socket.abort();
+}
+
+void StalledClient::onConnected() {
+    m_stats->counters.connects++;
+
+    // Fixed key; the accept hash in the reply isn't checked
+    QByteArray request = "GET / HTTP/1.1\r\n"
+                         "Host: " + m_config.url.host().toUtf8() + "\r\n"
+                         "Upgrade: websocket\r\n"
+                         "Connection: Upgrade\r\n"
+                         "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                         "Sec-WebSocket-Version: 13\r\n\r\n";
+    m_socket.write(request);
+}
+
+void StalledClient::onReadyRead() {
+    if (m_upgraded) return;
+
+    QByteArray reply = m_socket.readAll();
+    if (!reply.startsWith("HTTP/1.1 101")) {
+        m_stats->counters.connectFailures++;
+        m_socket.abort();
+        return;
+    }
+    m_upgraded = true;
+
+    QJsonObject login{{"type", "login"}, {"username", m_username}, {"password", "loadgen"}};
+    sendFrame(kTextFrame, QJsonDocument(login).toJson(QJsonDocument::Compact));
+    m_stats->counters.logins++;
+
+    // From here on nothing is read; Qt stops draining the kernel buffer
+    m_socket.setReadBufferSize(1);
+    m_pingTimer.start(kPingMs);
+}
+
+void StalledClient::onClosed() {
+    if (m_dropped || !m_upgraded) return;
+    m_dropped = true;
+    m_pingTimer.stop();
+    m_stats->counters.stalledDropped++;
+}
+
+void StalledClient::ping() {
+    sendFrame(kPingFrame, QByteArray());
+}
+
+void StalledClient::sendFrame(quint8 opcode, const QByteArray& payload) {
+    // Client frames are always masked (RFC 6455 5.3)
+    QByteArray frame;
+    frame.append(static_cast<char>(0x80 | opcode));
+    if (payload.size() < 126) {
+        frame.append(static_cast<char>(0x80 | payload.size()));
+    } else {
+        frame.append(static_cast<char>(0x80 | 126));
+        frame.append(static_cast<char>((payload.size() >> 8) & 0xff));
+        frame.append(static_cast<char>(payload.size() & 0xff));
+    }
+
+    quint32 key = m_random.generate();
+    const char* mask = reinterpret_cast<const char*>(&key);
+    frame.append(mask, 4);
+    for (int i = 0; i < payload.size(); ++i) {
+        frame.append(payload[i] ^ mask[i % 4]);
+    }
+
+    m_stats->counters.framesSent++;
+    m_stats->counters.bytesSent += static_cast<quint64>(frame.size());
+    m_socket.write(frame);
+}
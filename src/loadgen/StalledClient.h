@@ -0,0 +1,40 @@
+#pragma once
+
+#include <QObject>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QRandomGenerator>
+#include "loadgen/LoadConfig.h"
+#include "loadgen/LoadStats.h"
+
+// Client that signs in and then never reads again. Speaks just enough
+// WebSocket over a raw TCP socket to log in, then caps its read buffer so
+// the kernel window fills and the server's writes back up. A ping goes
+// out every second so a server-side disconnect is noticed.
+class StalledClient : public QObject {
+    Q_OBJECT
+
+public:
+    StalledClient(int index, const LoadConfig& config, LoadStats* stats, QObject* parent = nullptr);
+
+    void start();
+    void stop();
+
+private slots:
+    void onConnected();
+    void onReadyRead();
+    void onClosed();
+    void ping();
+
+private:
+    void sendFrame(quint8 opcode, const QByteArray& payload);
+
+    const LoadConfig& m_config;
+    LoadStats* m_stats;
+    QTcpSocket m_socket;
+    QTimer m_pingTimer;
+    QRandomGenerator m_random;
+    QString m_username;
+    bool m_upgraded = false;
+    bool m_dropped = false;
+};
@@ -0,0 +1,166 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QHostAddress>
+#include <QThread>
+#include <QDebug>
+#include "loadgen/LoadGenerator.h"
+#include "loadgen/BeaconFlood.h"
+#include "loadgen/MediaLoopback.h"
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("SkypeClassic Load Generator");
+    app.setApplicationVersion("1.0");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Drives SkypeServer with headless clients and reports throughput and latency.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption portOption("port", "Server port on loopback (default: 33033)", "port", "33033");
+    parser.addOption(portOption);
+    QCommandLineOption clientsOption("clients", "Number of clients (default: 1000)", "count", "1000");
+    parser.addOption(clientsOption);
+    QCommandLineOption threadsOption("threads",
+        "Client threads (default: 1, 0 = one per CPU core)", "count", "1");
+    parser.addOption(threadsOption);
+    QCommandLineOption scenarioOption("scenario",
+        QString("Scenario preset: %1 (default: chat)").arg(Scenario::presetNames().join(", ")),
+        "name", "chat");
+    parser.addOption(scenarioOption);
+    QCommandLineOption mixOption("mix",
+        "Override action weights, e.g. message=8,status=1,get_contacts=1,add_contact=0,relogin=0",
+        "weights");
+    parser.addOption(mixOption);
+    QCommandLineOption rateOption("rate", "Actions per client per second", "ops");
+    parser.addOption(rateOption);
+    QCommandLineOption contactsOption("contacts", "Contacts each client adds after its first login",
+        "count");
+    parser.addOption(contactsOption);
+    QCommandLineOption conferenceOption("conference",
+        "Clients per relayed conference call streaming audio and video (0 = none)", "size");
+    parser.addOption(conferenceOption);
+    QCommandLineOption rampOption("ramp", "New connections per second (default: 500)", "count", "500");
+    parser.addOption(rampOption);
+    QCommandLineOption durationOption("duration", "Measured seconds (default: 30)", "seconds", "30");
+    parser.addOption(durationOption);
+    QCommandLineOption warmupOption("warmup", "Seconds excluded from the report (default: 5)",
+        "seconds", "5");
+    parser.addOption(warmupOption);
+    QCommandLineOption payloadOption("payload", "Padding bytes per chat message (default: 64)",
+        "bytes", "64");
+    parser.addOption(payloadOption);
+    QCommandLineOption binaryOption("binary", "Negotiate CBOR framing instead of JSON text");
+    parser.addOption(binaryOption);
+    QCommandLineOption compressOption("compress",
+        "Also offer deflate compression of large binary frames (implies --binary)");
+    parser.addOption(compressOption);
+    QCommandLineOption resumeOption("resume",
+        "Reconnect with the session's resume token instead of logging in again");
+    parser.addOption(resumeOption);
+    QCommandLineOption prefixOption("prefix", "Username prefix (default: lg)", "prefix", "lg");
+    parser.addOption(prefixOption);
+    QCommandLineOption stalledOption("stalled",
+        "Clients that log in and never read, to exercise slow-consumer handling", "count", "0");
+    parser.addOption(stalledOption);
+    QCommandLineOption lanPeersOption("lan-peers",
+        "Instead of the server, flood a LAN client's discovery port with beacons from this many "
+        "simulated peers", "count");
+    parser.addOption(lanPeersOption);
+    QCommandLineOption discoveryPortOption("discovery-port",
+        "Discovery port of the LAN client (default: 33034)", "port", "33034");
+    parser.addOption(discoveryPortOption);
+    QCommandLineOption lanChurnOption("lan-churn",
+        "Status changes per second across the simulated peers (default: 0)", "rate", "0");
+    parser.addOption(lanChurnOption);
+    QCommandLineOption lanLeaveOption("lan-leave",
+        "Simulated peers per second that go silent and must be timed out (default: 0)", "rate", "0");
+    parser.addOption(lanLeaveOption);
+    QCommandLineOption lanLegacyOption("lan-legacy",
+        "Send the old JSON discovery packets every 5 s instead of binary beacons");
+    parser.addOption(lanLegacyOption);
+    QCommandLineOption mediaLossOption("media-loss",
+        "Instead of the server, play call audio between two clients on loopback over UDP and the "
+        "WebSocket fallback at each loss percentage, e.g. 1,5", "percents");
+    parser.addOption(mediaLossOption);
+    QCommandLineOption seedOption("seed", "Random seed (default: 1)", "seed", "1");
+    parser.addOption(seedOption);
+    QCommandLineOption maxP99Option("max-p99", "Exit with 1 if relay p99 exceeds this many ms", "ms");
+    parser.addOption(maxP99Option);
+    QCommandLineOption minRateOption("min-relayed",
+        "Exit with 1 if fewer messages per second are relayed", "count");
+    parser.addOption(minRateOption);
+    parser.process(app);
+
+    LoadConfig config;
+    if (!Scenario::fromPreset(parser.value(scenarioOption), config.scenario)) {
+        qCritical() << "Unknown scenario" << parser.value(scenarioOption);
+        return 2;
+    }
+    if (parser.isSet(mixOption)) {
+        QString error;
+        if (!config.scenario.applyMix(parser.value(mixOption), &error)) {
+            qCritical() << error;
+            return 2;
+        }
+        config.scenario.name += "+mix";
+    }
+    if (parser.isSet(rateOption)) {
+        config.scenario.opsPerSecond = qMax(0.001, parser.value(rateOption).toDouble());
+    }
+    if (parser.isSet(contactsOption)) {
+        config.scenario.contactsPerClient = parser.value(contactsOption).toInt();
+    }
+    if (parser.isSet(conferenceOption)) {
+        config.scenario.conferenceSize = qMax(0, parser.value(conferenceOption).toInt());
+    }
+
+    // Loopback only: the numbers are meant to gate regressions, not the network
+    config.url.setHost(QHostAddress(QHostAddress::LocalHost).toString());
+    config.url.setPort(parser.value(portOption).toUShort());
+    config.clients = qMax(1, parser.value(clientsOption).toInt());
+    config.threads = parser.value(threadsOption).toInt();
+    if (config.threads <= 0) config.threads = QThread::idealThreadCount();
+    config.rampPerSecond = qMax(1, parser.value(rampOption).toInt());
+    config.durationSeconds = qMax(1, parser.value(durationOption).toInt());
+    config.warmupSeconds = qMax(0, parser.value(warmupOption).toInt());
+    config.payloadBytes = qMax(0, parser.value(payloadOption).toInt());
+    config.compress = parser.isSet(compressOption);
+    config.binary = parser.isSet(binaryOption) || config.compress;
+    config.resume = parser.isSet(resumeOption);
+    config.userPrefix = parser.value(prefixOption).toLower();
+    config.stalledClients = qBound(0, parser.value(stalledOption).toInt(), config.clients);
+    config.seed = parser.value(seedOption).toUInt();
+    config.maxRelayP99Ms = parser.value(maxP99Option).toDouble();
+    config.minRelayedPerSecond = parser.value(minRateOption).toDouble();
+    config.lanPeers = qMax(0, parser.value(lanPeersOption).toInt());
+    config.discoveryPort = parser.value(discoveryPortOption).toUShort();
+    config.lanChurnPerSecond = qMax(0.0, parser.value(lanChurnOption).toDouble());
+    config.lanLeavePerSecond = qMax(0.0, parser.value(lanLeaveOption).toDouble());
+    config.lanLegacy = parser.isSet(lanLegacyOption);
+    if (parser.isSet(mediaLossOption)) {
+        for (const QString& percent : parser.value(mediaLossOption).split(',', QString::SkipEmptyParts)) {
+            config.mediaLoss.append(qBound(0, percent.trimmed().toInt(), 100));
+        }
+    }
+
+    if (!config.mediaLoss.isEmpty()) {
+        MediaLoopback loopback(config);
+        QObject::connect(&loopback, &MediaLoopback::finished, &app, &QCoreApplication::exit);
+        loopback.start();
+        return app.exec();
+    }
+
+    if (config.lanPeers > 0) {
+        BeaconFlood flood(config);
+        QObject::connect(&flood, &BeaconFlood::finished, &app, &QCoreApplication::exit);
+        flood.start();
+        return app.exec();
+    }
+
+    LoadGenerator generator(config);
+    QObject::connect(&generator, &LoadGenerator::finished, &app, &QCoreApplication::exit);
+    generator.start();
+
+    return app.exec();
+}
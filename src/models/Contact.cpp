@@ -12,6 +12,15 @@ QString Contact::statusString() const {
     return "Unknown";
 }
 
+ContactStatus Contact::statusFromString(const QString& status) {
+    if (status == "Online") return ContactStatus::Online;
+    if (status == "Away") return ContactStatus::Away;
+    if (status == "Not Available") return ContactStatus::NotAvailable;
+    if (status == "Do Not Disturb") return ContactStatus::DoNotDisturb;
+    if (status == "Invisible") return ContactStatus::Invisible;
+    return ContactStatus::Offline;
+}
+
 QList<Contact> Contact::createMockContacts() {
     return {
         {1, "Echo / Sound Test Service", "echo123", "SKP-10001", ContactStatus::Online, ""},
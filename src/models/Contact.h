@@ -26,5 +26,6 @@ struct Contact {
     }
 
     QString statusString() const;
+    static ContactStatus statusFromString(const QString& status);
     static QList<Contact> createMockContacts();
 };
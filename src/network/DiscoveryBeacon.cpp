@@ -0,0 +1,79 @@
+#include "network/DiscoveryBeacon.h"
+
+#include <QtEndian>
+#include <cstring>
+
+namespace DiscoveryBeacon {
+
+namespace {
+const char kMagic[] = {'S', 'K', 'B'};
+
+void appendField(QByteArray& out, const QString& value) {
+    QByteArray utf8 = value.toUtf8().left(kMaxFieldSize);
+    out.append(static_cast<char>(utf8.size()));
+    out.append(utf8);
+}
+
+// Reads one length-prefixed field at offset and moves past it
+bool readField(const QByteArray& packet, int& offset, QString& value) {
+    if (offset >= packet.size()) return false;
+    int length = static_cast<quint8>(packet[offset]);
+    if (offset + 1 + length > packet.size()) return false;
+    value = QString::fromUtf8(packet.constData() + offset + 1, length);
+    offset += 1 + length;
+    return true;
+}
+}
+
+bool isBeacon(const QByteArray& packet) {
+    return packet.size() > kHeaderSize
+        && memcmp(packet.constData(), kMagic, sizeof(kMagic)) == 0
+        && static_cast<quint8>(packet[3]) == kFormatVersion;
+}
+
+int intervalMs(int peerCount, bool recentChurn) {
+    int interval = (peerCount + 1) * 1000 / kBeaconsPerSecond;
+    if (recentChurn) interval /= kChurnSpeedup;
+    return qBound(kMinIntervalMs, interval, kMaxIntervalMs);
+}
+
+int timeoutMs(int interval) {
+    return qMax(kMinTimeoutMs, kMissedBeacons * interval);
+}
+
+QByteArray encode(const Beacon& beacon) {
+    QByteArray out(kHeaderSize, Qt::Uninitialized);
+    char* header = out.data();
+    memcpy(header, kMagic, sizeof(kMagic));
+    header[3] = static_cast<char>(kFormatVersion);
+    qToBigEndian<quint32>(beacon.instance, header + 4);
+    qToBigEndian<quint32>(beacon.stateVersion, header + 8);
+    qToBigEndian<quint16>(static_cast<quint16>(qBound(0, beacon.intervalMs / 100, 0xffff)), header + 12);
+    qToBigEndian<quint16>(beacon.wsPort, header + 14);
+
+    appendField(out, beacon.username);
+    appendField(out, beacon.status);
+    appendField(out, beacon.skypeNumber);
+    return out;
+}
+
+bool decodeHeader(const QByteArray& packet, Beacon& beacon) {
+    if (!isBeacon(packet)) return false;
+    const char* in = packet.constData();
+    beacon.instance = qFromBigEndian<quint32>(in + 4);
+    beacon.stateVersion = qFromBigEndian<quint32>(in + 8);
+    beacon.intervalMs = qFromBigEndian<quint16>(in + 12) * 100;
+    beacon.wsPort = qFromBigEndian<quint16>(in + 14);
+
+    int offset = kHeaderSize;
+    return readField(packet, offset, beacon.username) && !beacon.username.isEmpty();
+}
+
+bool decode(const QByteArray& packet, Beacon& beacon) {
+    if (!decodeHeader(packet, beacon)) return false;
+    int offset = kHeaderSize + 1 + static_cast<quint8>(packet[kHeaderSize]);
+    return readField(packet, offset, beacon.status)
+        && readField(packet, offset, beacon.skypeNumber);
+}
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+
+// Binary presence beacon that LANPeerService multicasts on the discovery
+// port in place of the old JSON packet. Integers are big-endian:
+//
+//   "SKB" + format version                         4
+//   instance id                                    4   random per start()
+//   state version                                  4   bumped when anything below changes
+//   beacon interval, in 100 ms units               2   receivers time the sender out from it
+//   ws port                                        2
+//   username     (1-byte length + UTF-8)
+//   status       (1-byte length + UTF-8)
+//   skype number (1-byte length + UTF-8)
+//
+// The username sits right after the fixed header, so a receiver can look
+// the sender up and, if instance and state version match what it already
+// has, stop there without touching the rest.
+namespace DiscoveryBeacon {
+
+const quint8 kFormatVersion = 1;
+const int kHeaderSize = 4 + 4 + 4 + 2 + 2;
+const int kMaxFieldSize = 255;
+
+// The whole LAN shares about kBeaconsPerSecond beacons a second, so each
+// peer slows down as the peer count grows. A join or leave in the last
+// kChurnWindowMs speeds everyone up so the change settles quickly.
+const int kMinIntervalMs = 5000;
+const int kMaxIntervalMs = 30000;
+const int kBeaconsPerSecond = 20;
+const int kChurnWindowMs = 60000;
+const int kChurnSpeedup = 4;
+
+// A peer is gone after missing this many of its own beacons
+const int kMissedBeacons = 3;
+const int kMinTimeoutMs = 15000;
+
+struct Beacon {
+    quint32 instance = 0;
+    quint32 stateVersion = 0;
+    int intervalMs = 0;
+    quint16 wsPort = 0;
+    QString username;
+    QString status;
+    QString skypeNumber;
+};
+
+bool isBeacon(const QByteArray& packet);
+
+// Interval for a sender that knows of peerCount others, before jitter
+int intervalMs(int peerCount, bool recentChurn);
+// How long a receiver waits on a sender that advertised this interval
+int timeoutMs(int interval);
+
+// Fields longer than kMaxFieldSize bytes are cut short
+QByteArray encode(const Beacon& beacon);
+// Fixed header and username only
+bool decodeHeader(const QByteArray& packet, Beacon& beacon);
+// Everything; status and skype number included
+bool decode(const QByteArray& packet, Beacon& beacon);
+
+}
@@ -0,0 +1,104 @@
+#include "network/ExpiryWheel.h"
+
+ExpiryWheel::ExpiryWheel(int tickMs, int slotCount)
+    : m_tickMs(qMax(1, tickMs))
+    , m_slots(qMax(2, slotCount), nullptr)
+{
+}
+
+ExpiryWheel::~ExpiryWheel() {
+    clear();
+}
+
+ExpiryWheel::Entry* ExpiryWheel::add(const QString& key, int timeoutMs) {
+    auto* entry = new Entry;
+    entry->key = key;
+    entry->deadline = m_now + timeoutMs;
+    link(entry);
+    ++m_size;
+    return entry;
+}
+
+void ExpiryWheel::touch(Entry* entry, int timeoutMs) {
+    if (!entry) return;
+    qint64 deadline = m_now + timeoutMs;
+    if (deadline == entry->deadline) return;
+
+    entry->deadline = deadline;
+    unlink(entry);
+    link(entry);
+}
+
+void ExpiryWheel::remove(Entry* entry) {
+    if (!entry) return;
+    unlink(entry);
+    delete entry;
+    --m_size;
+}
+
+QStringList ExpiryWheel::advance(qint64 now) {
+    QStringList expired;
+    m_now = qMax(m_now, now);
+    qint64 target = m_now / m_tickMs;
+    if (target <= m_tick) return expired;
+
+    // Past a full turn every slot has come round once
+    qint64 from = m_tick;
+    qint64 steps = qMin<qint64>(target - from, m_slots.size());
+    m_tick = target;
+
+    for (qint64 i = 1; i <= steps; ++i) {
+        int slot = static_cast<int>((from + i) % m_slots.size());
+        Entry* entry = m_slots[slot];
+        m_slots[slot] = nullptr;
+
+        while (entry) {
+            Entry* next = entry->next;
+            entry->prev = entry->next = nullptr;
+            entry->slot = -1;
+            if (entry->deadline <= m_now) {
+                expired.append(entry->key);
+                delete entry;
+                --m_size;
+            } else {
+                // Beyond the span when it was linked; due on a later turn
+                link(entry);
+            }
+            entry = next;
+        }
+    }
+    return expired;
+}
+
+void ExpiryWheel::clear() {
+    for (Entry*& head : m_slots) {
+        while (head) {
+            Entry* next = head->next;
+            delete head;
+            head = next;
+        }
+    }
+    m_size = 0;
+}
+
+void ExpiryWheel::link(Entry* entry) {
+    // Never the current tick's slot, which advance() has already been past
+    qint64 tick = qBound(m_tick + 1, (entry->deadline + m_tickMs - 1) / m_tickMs,
+                         m_tick + m_slots.size());
+    int slot = static_cast<int>(tick % m_slots.size());
+
+    entry->slot = slot;
+    entry->prev = nullptr;
+    entry->next = m_slots[slot];
+    if (entry->next) entry->next->prev = entry;
+    m_slots[slot] = entry;
+}
+
+void ExpiryWheel::unlink(Entry* entry) {
+    if (entry->slot < 0) return;
+    if (entry->prev) entry->prev->next = entry->next;
+    else m_slots[entry->slot] = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    entry->prev = entry->next = nullptr;
+    entry->slot = -1;
+}
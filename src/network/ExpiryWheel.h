@@ -0,0 +1,52 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// Timing wheel for peer liveness. Each peer holds an Entry; activity moves
+// it to the slot of its new deadline in O(1), and advance() only walks the
+// slots the clock passed over, so a tick costs the entries that are due
+// rather than a scan of every peer.
+//
+// Times are ms on the caller's monotonic clock. touch() and add() measure
+// from the last advance() instead of reading the clock again, so a
+// deadline can come up to one tick early. Deadlines past the wheel's span
+// sit in its last slot and are re-slotted when it comes round.
+class ExpiryWheel {
+public:
+    struct Entry {
+        QString key;
+        qint64 deadline = 0;
+        int slot = -1;
+        Entry* prev = nullptr;
+        Entry* next = nullptr;
+    };
+
+    ExpiryWheel(int tickMs, int slotCount);
+    ~ExpiryWheel();
+
+    qint64 now() const { return m_now; }
+    int size() const { return m_size; }
+
+    Entry* add(const QString& key, int timeoutMs);
+    // Pushes the deadline out to timeoutMs from now
+    void touch(Entry* entry, int timeoutMs);
+    void remove(Entry* entry);
+    // Moves the clock to now; returns the keys that expired, whose entries
+    // are freed
+    QStringList advance(qint64 now);
+    void clear();
+
+private:
+    Q_DISABLE_COPY(ExpiryWheel)
+
+    void link(Entry* entry);
+    void unlink(Entry* entry);
+
+    int m_tickMs;
+    QVector<Entry*> m_slots;
+    qint64 m_now = 0;
+    qint64 m_tick = 0; // last tick advance() processed
+    int m_size = 0;
+};
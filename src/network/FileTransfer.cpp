@@ -0,0 +1,172 @@
+#include "network/FileTransfer.h"
+
+#include <QFileInfo>
+#include <QtEndian>
+#include <cstring>
+#include <zlib.h>
+
+namespace FileTransfer {
+
+bool isChunkFrame(const QByteArray& frame) {
+    return frame.size() >= kChunkHeaderSize && frame.startsWith(QByteArray("FCH\0", 4));
+}
+
+bool isAckFrame(const QByteArray& frame) {
+    return frame.size() >= kAckSize && frame.startsWith(QByteArray("FAK\0", 4));
+}
+
+quint32 checksum(const char* data, int size) {
+    return static_cast<quint32>(crc32(crc32(0L, Z_NULL, 0),
+                                      reinterpret_cast<const Bytef*>(data),
+                                      static_cast<uInt>(size)));
+}
+
+QByteArray encodeChunk(const QByteArray& id, qint64 offset, const char* data, int size) {
+    QByteArray frame(kChunkHeaderSize + size, Qt::Uninitialized);
+    char* out = frame.data();
+    memcpy(out, "FCH\0", 4);
+    memcpy(out + 4, id.constData(), kIdSize);
+    qToBigEndian<qint64>(offset, out + 4 + kIdSize);
+    qToBigEndian<quint32>(checksum(data, size), out + 4 + kIdSize + 8);
+    memcpy(out + kChunkHeaderSize, data, static_cast<size_t>(size));
+    return frame;
+}
+
+bool decodeChunk(const QByteArray& frame, QByteArray& id, qint64& offset, quint32& crc,
+                 const char*& data, int& size) {
+    if (!isChunkFrame(frame)) return false;
+    const char* in = frame.constData();
+    id = QByteArray(in + 4, kIdSize);
+    offset = qFromBigEndian<qint64>(in + 4 + kIdSize);
+    crc = qFromBigEndian<quint32>(in + 4 + kIdSize + 8);
+    data = in + kChunkHeaderSize;
+    size = frame.size() - kChunkHeaderSize;
+    return offset >= 0 && size <= kChunkSize;
+}
+
+QByteArray encodeAck(const QByteArray& id, qint64 received, quint8 flags) {
+    QByteArray frame(kAckSize, Qt::Uninitialized);
+    char* out = frame.data();
+    memcpy(out, "FAK\0", 4);
+    memcpy(out + 4, id.constData(), kIdSize);
+    qToBigEndian<qint64>(received, out + 4 + kIdSize);
+    out[4 + kIdSize + 8] = static_cast<char>(flags);
+    return frame;
+}
+
+bool decodeAck(const QByteArray& frame, QByteArray& id, qint64& received, quint8& flags) {
+    if (!isAckFrame(frame)) return false;
+    const char* in = frame.constData();
+    id = QByteArray(in + 4, kIdSize);
+    received = qFromBigEndian<qint64>(in + 4 + kIdSize);
+    flags = static_cast<quint8>(in[4 + kIdSize + 8]);
+    return received >= 0;
+}
+
+}
+
+// === Sending ===
+
+OutgoingFile::OutgoingFile(const QString& id, const QString& peer)
+    : id(id)
+    , peer(peer)
+{
+}
+
+OutgoingFile::~OutgoingFile() {
+    if (m_map) m_file.unmap(const_cast<uchar*>(m_map));
+}
+
+bool OutgoingFile::open(const QString& path) {
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly)) return false;
+
+    fileName = QFileInfo(path).fileName();
+    size = m_file.size();
+    if (size > 0) m_map = m_file.map(0, size);
+    return true;
+}
+
+const char* OutgoingFile::chunkData(qint64 offset, int length, QByteArray& buffer) {
+    if (m_map) return reinterpret_cast<const char*>(m_map + offset);
+
+    buffer.resize(length);
+    if (!m_file.seek(offset) || m_file.read(buffer.data(), length) != length) return nullptr;
+    return buffer.constData();
+}
+
+QByteArray OutgoingFile::chunkFrame(qint64 offset) {
+    int length = static_cast<int>(qMin<qint64>(FileTransfer::kChunkSize, size - offset));
+    QByteArray buffer;
+    const char* data = chunkData(offset, length, buffer);
+    if (!data) return QByteArray();
+    return FileTransfer::encodeChunk(wireId, offset, data, length);
+}
+
+quint32 OutgoingFile::chunkChecksum(qint64 offset, int length) {
+    QByteArray buffer;
+    const char* data = chunkData(offset, length, buffer);
+    return data ? FileTransfer::checksum(data, length) : 0;
+}
+
+// === Receiving ===
+
+IncomingFile::IncomingFile(const QString& id, const QString& peer)
+    : id(id)
+    , peer(peer)
+{
+}
+
+IncomingFile::~IncomingFile() {
+    m_file.close();
+}
+
+bool IncomingFile::open(const QString& path) {
+    savePath = path;
+    m_file.setFileName(path + ".part");
+    if (!m_file.open(QIODevice::ReadWrite)) return false;
+
+    // Only whole chunks count; a torn last write is sent again
+    qint64 existing = qMin(m_file.size(), size);
+    received = existing - existing % FileTransfer::kChunkSize;
+    if (!m_file.resize(received) || !m_file.seek(received)) return false;
+    return true;
+}
+
+bool IncomingFile::write(qint64 offset, const char* data, int length) {
+    if (offset != received || received + length > size) return false;
+    if (m_file.write(data, length) != length) return false;
+    received += length;
+    return true;
+}
+
+quint32 IncomingFile::tailChecksum() {
+    if (received == 0) return 0;
+
+    int length = static_cast<int>(qMin<qint64>(FileTransfer::kChunkSize, received));
+    QByteArray tail(length, Qt::Uninitialized);
+    bool ok = m_file.seek(received - length) && m_file.read(tail.data(), length) == length;
+    m_file.seek(received);
+    return ok ? FileTransfer::checksum(tail.constData(), length) : 0;
+}
+
+bool IncomingFile::restart() {
+    received = 0;
+    unacked = 0;
+    resendAt = -1;
+    return m_file.resize(0) && m_file.seek(0);
+}
+
+bool IncomingFile::finish() {
+    if (!m_file.flush()) return false;
+    m_file.close();
+
+    // The save dialog already asked about overwriting
+    QFile::remove(savePath);
+    return QFile::rename(m_file.fileName(), savePath);
+}
+
+void IncomingFile::abort(bool keepPart) {
+    m_file.close();
+    if (!keepPart) m_file.remove();
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+class QWebSocket;
+
+// Chunked peer-to-peer file transfer over LANPeerService's WebSockets.
+//
+// Control messages are JSON: file_offer {transferId, fileName, fileSize,
+// attachment}, file_accept {transferId, offset, tailCrc}, file_restart and
+// file_cancel {transferId}. Data and acks are binary frames, in the same
+// magic-header style as media, so they skip the JSON path entirely:
+//
+//   "FCH\0" + 16-byte transfer id + 8-byte offset + 4-byte CRC32 + data
+//   "FAK\0" + 16-byte transfer id + 8-byte bytes received + flags byte
+//
+// Integers are big-endian. The sender keeps up to kWindowChunks past the
+// last ack in flight; the receiver writes chunks strictly in order and
+// acks every kAckEveryChunks. A chunk out of order or failing its checksum
+// gets an ack with kAckResend, and the sender goes back to that offset.
+namespace FileTransfer {
+
+const int kChunkSize = 64 * 1024;
+const int kWindowChunks = 64;   // 4 MB in flight keeps loopback saturated
+const int kAckEveryChunks = 8;
+const int kIdSize = 16;
+const int kChunkHeaderSize = 4 + kIdSize + 8 + 4;
+const int kAckSize = 4 + kIdSize + 8 + 1;
+const quint8 kAckResend = 0x01;
+
+bool isChunkFrame(const QByteArray& frame);
+bool isAckFrame(const QByteArray& frame);
+
+quint32 checksum(const char* data, int size);
+
+QByteArray encodeChunk(const QByteArray& id, qint64 offset, const char* data, int size);
+// data/size point into the frame; the checksum is checked by the caller
+bool decodeChunk(const QByteArray& frame, QByteArray& id, qint64& offset, quint32& crc,
+                 const char*& data, int& size);
+
+QByteArray encodeAck(const QByteArray& id, qint64 received, quint8 flags);
+bool decodeAck(const QByteArray& frame, QByteArray& id, qint64& received, quint8& flags);
+
+}
+
+// Sending side of one transfer. The file is mapped read-only, so a chunk
+// costs one copy into its frame; files that can't be mapped (or don't fit
+// the address space) fall back to positioned reads.
+class OutgoingFile {
+public:
+    OutgoingFile(const QString& id, const QString& peer);
+    ~OutgoingFile();
+
+    bool open(const QString& path);
+    // Up to kChunkSize bytes at offset, framed and ready to send
+    QByteArray chunkFrame(qint64 offset);
+    quint32 chunkChecksum(qint64 offset, int length);
+
+    QString id;
+    QString peer;
+    QByteArray wireId;
+    QString fileName;
+    qint64 size = 0;
+    qint64 nextOffset = 0;  // next byte to send
+    qint64 ackedOffset = 0; // bytes the receiver has on disk
+    bool accepted = false;  // false until file_accept
+    QWebSocket* socket = nullptr; // chunks stay on one socket so they arrive in order
+    qint64 lastProgressAt = 0;
+    qint64 offeredAt = 0;   // LANPeerService clock; unanswered offers expire
+
+private:
+    Q_DISABLE_COPY(OutgoingFile)
+
+    const char* chunkData(qint64 offset, int length, QByteArray& buffer);
+
+    QFile m_file;
+    const uchar* m_map = nullptr;
+};
+
+// Receiving side. Writes go straight to "<savePath>.part", which is renamed
+// into place once every byte is in; an existing .part is picked up where it
+// left off, cut back to a whole chunk.
+class IncomingFile {
+public:
+    IncomingFile(const QString& id, const QString& peer);
+    ~IncomingFile();
+
+    // size must be set first; it bounds the resume point
+    bool open(const QString& savePath);
+    // In-order only: false if the offset isn't the next expected byte
+    bool write(qint64 offset, const char* data, int length);
+    // CRC of the last chunk already on disk, so the sender can tell a
+    // .part that belongs to some other file; 0 when starting fresh
+    quint32 tailChecksum();
+    // Throws away what's on disk and starts from zero
+    bool restart();
+    // Flushes and renames into place; false if that fails
+    bool finish();
+    // Closes and, unless keepPart, deletes the partial file
+    void abort(bool keepPart);
+
+    bool isComplete() const { return received == size; }
+
+    QString id;
+    QString peer;
+    QByteArray wireId;
+    QString fileName;
+    QString savePath;
+    qint64 size = 0;
+    qint64 received = 0;
+    int unacked = 0;        // chunks written since the last ack
+    qint64 resendAt = -1;   // offset we last asked to be resent from
+    bool attachment = false;
+    qint64 lastProgressAt = 0;
+    qint64 offeredAt = 0;   // LANPeerService clock; unanswered offers expire
+
+private:
+    Q_DISABLE_COPY(IncomingFile)
+
+    QFile m_file;
+};
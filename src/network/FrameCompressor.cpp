@@ -0,0 +1,106 @@
+#include "network/FrameCompressor.h"
+
+#include <QtGlobal>
+#include <zlib.h>
+
+namespace {
+// 4 KB hash chains instead of zlib's 128 KB; the window is what matters
+// for small frames and it is capped at kWindowBits anyway
+const int kMemLevel = 4;
+
+// Every sync flush ends with an empty stored block; it is implied on the wire
+const char kFlushTail[] = {'\x00', '\x00', '\xff', '\xff'};
+}
+
+FrameCompressor::FrameCompressor(int level)
+    : m_level(qBound(1, level, 9))
+{
+}
+
+FrameCompressor::~FrameCompressor() {
+    reset();
+}
+
+void FrameCompressor::reset() {
+    if (m_deflate) {
+        deflateEnd(m_deflate);
+        delete m_deflate;
+        m_deflate = nullptr;
+    }
+    if (m_inflate) {
+        inflateEnd(m_inflate);
+        delete m_inflate;
+        m_inflate = nullptr;
+    }
+}
+
+void FrameCompressor::setLevel(int level) {
+    m_level = qBound(1, level, 9);
+}
+
+QByteArray FrameCompressor::compress(const char* data, int size) {
+    if (!m_deflate) {
+        m_deflate = new z_stream();
+        if (deflateInit2(m_deflate, m_level, Z_DEFLATED, -kWindowBits, kMemLevel,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+            delete m_deflate;
+            m_deflate = nullptr;
+            return QByteArray();
+        }
+    }
+
+    QByteArray out(size / 2 + 64, Qt::Uninitialized);
+    m_deflate->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    m_deflate->avail_in = static_cast<uInt>(size);
+    int written = 0;
+    for (;;) {
+        m_deflate->next_out = reinterpret_cast<Bytef*>(out.data() + written);
+        m_deflate->avail_out = static_cast<uInt>(out.size() - written);
+        deflate(m_deflate, Z_SYNC_FLUSH);
+        written = out.size() - static_cast<int>(m_deflate->avail_out);
+
+        // Space left over means the flush is complete
+        if (m_deflate->avail_out > 0) break;
+        out.resize(out.size() * 2);
+    }
+
+    out.resize(qMax(0, written - static_cast<int>(sizeof(kFlushTail))));
+    return out;
+}
+
+bool FrameCompressor::decompress(const char* data, int size, QByteArray& out, int maxSize) {
+    if (!m_inflate) {
+        m_inflate = new z_stream();
+        if (inflateInit2(m_inflate, -kWindowBits) != Z_OK) {
+            delete m_inflate;
+            m_inflate = nullptr;
+            return false;
+        }
+    }
+
+    QByteArray input;
+    input.reserve(size + static_cast<int>(sizeof(kFlushTail)));
+    input.append(data, size);
+    input.append(kFlushTail, static_cast<int>(sizeof(kFlushTail)));
+
+    out.resize(qBound(1, size * 4, maxSize));
+    m_inflate->next_in = reinterpret_cast<Bytef*>(input.data());
+    m_inflate->avail_in = static_cast<uInt>(input.size());
+    int written = 0;
+    for (;;) {
+        m_inflate->next_out = reinterpret_cast<Bytef*>(out.data() + written);
+        m_inflate->avail_out = static_cast<uInt>(out.size() - written);
+        int result = inflate(m_inflate, Z_SYNC_FLUSH);
+        written = out.size() - static_cast<int>(m_inflate->avail_out);
+
+        if (result != Z_OK && result != Z_BUF_ERROR) return false;
+        if (m_inflate->avail_in == 0 && m_inflate->avail_out > 0) break;
+        // Stuck with room to spare: truncated or corrupt input
+        if (m_inflate->avail_out > 0) return false;
+        if (out.size() >= maxSize) return false;
+        out.resize(qMin(maxSize, out.size() * 2));
+    }
+
+    out.resize(written);
+    return true;
+}
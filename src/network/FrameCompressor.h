@@ -0,0 +1,48 @@
+#pragma once
+
+#include <QByteArray>
+
+struct z_stream_s;
+
+// How hard to try; shared by the server, the client and LAN peers
+struct CompressionPolicy {
+    int threshold = 512; // frames smaller than this go out as they are; 0 = never compress
+    int level = 1;       // zlib level: 1 is several times cheaper than 6 for most of the gain
+};
+
+// Per-connection deflate in the manner of RFC 7692 permessage-deflate
+// with context takeover: each direction keeps one raw deflate stream for
+// the life of the connection, so field names and usernames repeated from
+// earlier frames compress to back-references. Every message ends on a
+// sync flush whose trailing 00 00 ff ff is left off the wire.
+//
+// Both ends use a kWindowBits window. The streams are only allocated on
+// first use (about 30 KB for deflate, 10 KB for inflate), so connections
+// that never see a large frame cost nothing.
+class FrameCompressor {
+public:
+    static const int kWindowBits = 12;
+
+    explicit FrameCompressor(int level = CompressionPolicy().level);
+    ~FrameCompressor();
+
+    // Frees both streams; the next frame either way starts a fresh one,
+    // as it must on a new connection
+    void reset();
+    // Takes effect when the next deflate stream starts
+    void setLevel(int level);
+
+    // Every compressed message must reach the peer, in order. Null if
+    // zlib could not be set up; send the frame uncompressed then.
+    QByteArray compress(const char* data, int size);
+    // False on a corrupt stream or output past maxSize; the connection
+    // can't continue after either
+    bool decompress(const char* data, int size, QByteArray& out, int maxSize);
+
+private:
+    Q_DISABLE_COPY(FrameCompressor)
+
+    int m_level;
+    z_stream_s* m_deflate = nullptr;
+    z_stream_s* m_inflate = nullptr;
+};
@@ -1,13 +1,41 @@
 #include "network/LANPeerService.h"
+#include "network/Protocol.h"
+#include "network/DiscoveryBeacon.h"
 
 #include <QJsonDocument>
 #include <QNetworkDatagram>
 #include <QDebug>
+#include <QFileInfo>
 #include <QSettings>
 #include <QRandomGenerator>
+#include <QUuid>
+
+namespace {
+const int kMaxPeerMessage = 65536;
+
+// Progress signals drive a dialog; a few a second is plenty at line rate
+const int kFileProgressIntervalMs = 100;
+
+// An offer nobody accepts or declines is dropped on both sides after this
+const qint64 kFileOfferTimeoutMs = 10 * 60 * 1000;
+
+// Peers go offline within a tick of their timeout; 512 slots span 128 s,
+// past the longest beacon timeout
+const int kExpiryTickMs = 250;
+const int kExpirySlots = 512;
+
+// Clients from before the binary beacon drop anything else, and expect the
+// JSON packet as often as they sent it themselves
+const int kLegacyIntervalMs = 5000;
+
+QString transferIdFromWire(const QByteArray& id) {
+    return QUuid::fromRfc4122(id).toString(QUuid::WithoutBraces);
+}
+}
 
 LANPeerService::LANPeerService(QObject* parent)
     : QObject(parent)
+    , m_expiry(kExpiryTickMs, kExpirySlots)
 {
 }
 
@@ -62,21 +90,36 @@ bool LANPeerService::start(const QString& username, quint16 discoveryPort) {
     connect(m_wsServer, &QWebSocketServer::newConnection,
             this, &LANPeerService::onNewPeerConnection);
 
-    qDebug() << "P2P started: UDP" << m_discoveryPort << "WS" << m_wsListenPort;
+    m_media = new MediaTransport(this);
+    m_media->open();
+    connect(m_media, &MediaTransport::audioReceived, this, &LANPeerService::audioDataReceived);
+    connect(m_media, &MediaTransport::videoReceived, this, &LANPeerService::videoDataReceived);
+
+    qDebug() << "P2P started: UDP" << m_discoveryPort << "WS" << m_wsListenPort
+             << "media" << m_media->port();
 
-    // Heartbeat timer — broadcast presence every 5s
+    // Heartbeat timer — rescheduled after every beacon, see scheduleBeacon()
+    m_beaconInstance = QRandomGenerator::global()->generate() | 1;
+    m_stateVersion = 1;
+    m_beaconsReceived = 0;
+    m_beaconsDecoded = 0;
+    m_lastChurnAt = -DiscoveryBeacon::kChurnWindowMs; // none yet
     m_heartbeatTimer = new QTimer(this);
+    m_heartbeatTimer->setSingleShot(true);
     connect(m_heartbeatTimer, &QTimer::timeout, this, &LANPeerService::onHeartbeatTimer);
-    m_heartbeatTimer->start(5000);
 
-    // Timeout timer — check for stale peers every 5s
+    // Timeout timer — advances the expiry wheel every kExpiryTickMs.
+    // The clock is kept across restarts; the wheel's only moves forward,
+    // and beacon timing and churn tracking read the same one
+    if (!m_clock.isValid()) m_clock.start();
     m_timeoutTimer = new QTimer(this);
     connect(m_timeoutTimer, &QTimer::timeout, this, &LANPeerService::onPeerTimeoutCheck);
-    m_timeoutTimer->start(5000);
+    m_timeoutTimer->start(kExpiryTickMs);
 
     m_running = true;
 
     // Broadcast immediately so peers discover us right away
+    scheduleBeacon();
     broadcastPresence();
 
     // P2P login always succeeds
@@ -93,12 +136,21 @@ void LANPeerService::stop() {
     // Best-effort offline broadcast
     if (m_discoverySocket) {
         m_status = "Offline";
+        ++m_stateVersion;
         broadcastPresence();
     }
+    qDebug() << "Discovery:" << m_beaconsReceived << "beacons received,"
+             << m_beaconsDecoded << "decoded in full";
 
     if (m_heartbeatTimer) { m_heartbeatTimer->stop(); delete m_heartbeatTimer; m_heartbeatTimer = nullptr; }
     if (m_timeoutTimer) { m_timeoutTimer->stop(); delete m_timeoutTimer; m_timeoutTimer = nullptr; }
 
+    // Receivers keep their .part files to resume from
+    qDeleteAll(m_outgoingFiles);
+    m_outgoingFiles.clear();
+    qDeleteAll(m_incomingFiles);
+    m_incomingFiles.clear();
+
     // Close outgoing connections
     for (auto* ws : m_outgoingConnections) {
         ws->close();
@@ -114,9 +166,14 @@ void LANPeerService::stop() {
     m_incomingConnections.clear();
 
     m_socketToUsername.clear();
+    qDeleteAll(m_compressors);
+    m_compressors.clear();
     m_peers.clear();
+    m_expiry.clear();
     m_pendingMessages.clear();
 
+    delete m_media;
+    m_media = nullptr;
     if (m_wsServer) { m_wsServer->close(); delete m_wsServer; m_wsServer = nullptr; }
     if (m_discoverySocket) { m_discoverySocket->close(); delete m_discoverySocket; m_discoverySocket = nullptr; }
 
@@ -131,34 +188,53 @@ void LANPeerService::addManualPeer(const QHostAddress& address, quint16 wsPort)
     // Send a direct discovery packet to a specific IP instead of relying on broadcast
     if (!m_discoverySocket || !m_running) return;
 
-    QJsonObject packet;
-    packet["type"] = "discovery";
-    packet["username"] = m_username;
-    packet["status"] = m_status;
-    packet["wsPort"] = static_cast<int>(m_wsListenPort);
-    packet["skypeNumber"] = m_skypeNumber;
-
-    QByteArray data = QJsonDocument(packet).toJson(QJsonDocument::Compact);
-    m_discoverySocket->writeDatagram(data, address, m_discoveryPort);
+    // We can't tell yet which packet it reads
+    m_discoverySocket->writeDatagram(presenceBeacon(), address, m_discoveryPort);
+    m_discoverySocket->writeDatagram(legacyDiscovery(), address, m_discoveryPort);
     qDebug() << "Sent manual discovery to" << address.toString() << ":" << wsPort;
 }
 
 // === UDP Discovery ===
 
-void LANPeerService::broadcastPresence() {
-    if (!m_discoverySocket) return;
+QByteArray LANPeerService::presenceBeacon() const {
+    DiscoveryBeacon::Beacon beacon;
+    beacon.instance = m_beaconInstance;
+    beacon.stateVersion = m_stateVersion;
+    beacon.intervalMs = m_beaconIntervalMs > 0 ? m_beaconIntervalMs : DiscoveryBeacon::kMinIntervalMs;
+    beacon.wsPort = m_wsListenPort;
+    beacon.username = m_username;
+    beacon.status = m_status;
+    beacon.skypeNumber = m_skypeNumber;
+    return DiscoveryBeacon::encode(beacon);
+}
 
+QByteArray LANPeerService::legacyDiscovery() const {
     QJsonObject packet;
     packet["type"] = "discovery";
     packet["username"] = m_username;
     packet["status"] = m_status;
-    packet["wsPort"] = static_cast<int>(m_wsListenPort);
+    packet["wsPort"] = m_wsListenPort;
     packet["skypeNumber"] = m_skypeNumber;
+    return QJsonDocument(packet).toJson(QJsonDocument::Compact);
+}
 
-    QByteArray data = QJsonDocument(packet).toJson(QJsonDocument::Compact);
-    // Send to both multicast (cross-subnet) and broadcast (same-subnet fallback)
-    m_discoverySocket->writeDatagram(data, QHostAddress("239.77.83.75"), m_discoveryPort);
-    m_discoverySocket->writeDatagram(data, QHostAddress::Broadcast, m_discoveryPort);
+bool LANPeerService::hasLegacyPeers() const {
+    for (const PeerInfo& info : m_peers) {
+        if (info.beaconInstance == 0) return true;
+    }
+    return false;
+}
+
+void LANPeerService::broadcastPresence() {
+    if (!m_discoverySocket) return;
+
+    QList<QByteArray> packets{presenceBeacon()};
+    if (hasLegacyPeers()) packets.append(legacyDiscovery());
+    for (const QByteArray& data : packets) {
+        // Send to both multicast (cross-subnet) and broadcast (same-subnet fallback)
+        m_discoverySocket->writeDatagram(data, QHostAddress("239.77.83.75"), m_discoveryPort);
+        m_discoverySocket->writeDatagram(data, QHostAddress::Broadcast, m_discoveryPort);
+    }
 }
 
 void LANPeerService::onDiscoveryReadyRead() {
@@ -169,19 +245,26 @@ void LANPeerService::onDiscoveryReadyRead() {
 }
 
 void LANPeerService::handleDiscoveryPacket(const QByteArray& data, const QHostAddress& sender) {
-    QJsonDocument doc = QJsonDocument::fromJson(data);
-    if (!doc.isObject()) return;
+    DiscoveryBeacon::Beacon beacon;
+    if (DiscoveryBeacon::isBeacon(data)) {
+        if (!DiscoveryBeacon::decodeHeader(data, beacon)) return;
+        ++m_beaconsReceived;
+    } else {
+        // JSON discovery from clients that predate the binary beacon
+        QJsonDocument doc = QJsonDocument::fromJson(data);
+        if (!doc.isObject()) return;
 
-    QJsonObject obj = doc.object();
-    if (obj["type"].toString() != "discovery") return;
+        QJsonObject obj = doc.object();
+        if (obj["type"].toString() != "discovery") return;
 
-    QString username = obj["username"].toString();
-    QString status = obj["status"].toString();
-    quint16 wsPort = static_cast<quint16>(obj["wsPort"].toInt());
-    QString skypeNumber = obj["skypeNumber"].toString();
+        beacon.username = obj["username"].toString();
+        beacon.status = obj["status"].toString();
+        beacon.wsPort = static_cast<quint16>(obj["wsPort"].toInt());
+        beacon.skypeNumber = obj["skypeNumber"].toString();
+    }
 
     // Ignore our own broadcasts
-    if (username == m_username) return;
+    if (beacon.username == m_username) return;
 
     // Normalize IPv4-mapped IPv6 addresses (::ffff:x.x.x.x -> x.x.x.x)
     QHostAddress normalizedSender = sender;
@@ -191,36 +274,68 @@ void LANPeerService::handleDiscoveryPacket(const QByteArray& data, const QHostAd
         normalizedSender = QHostAddress(ipv4);
     }
 
-    qint64 now = QDateTime::currentMSecsSinceEpoch();
-    bool isNew = !m_peers.contains(username);
+    int timeoutMs = DiscoveryBeacon::timeoutMs(beacon.intervalMs);
+    auto existing = m_peers.find(beacon.username);
+
+    // Nothing changed since the last beacon: refresh liveness and stop
+    if (beacon.instance != 0 && existing != m_peers.end()
+        && existing->beaconInstance == beacon.instance
+        && existing->stateVersion == beacon.stateVersion) {
+        existing->address = normalizedSender;
+        existing->wsPort = beacon.wsPort;
+        existing->timeoutMs = timeoutMs;
+        m_expiry.touch(existing->expiry, timeoutMs);
+        return;
+    }
+    if (beacon.instance != 0) {
+        if (!DiscoveryBeacon::decode(data, beacon)) return;
+        ++m_beaconsDecoded;
+    }
+
+    const QString& username = beacon.username;
+    const QString& status = beacon.status;
+    bool isNew = existing == m_peers.end();
     bool statusChanged = false;
+    bool becameLegacy = beacon.instance == 0 && (isNew || existing->beaconInstance != 0);
 
     if (isNew) {
         PeerInfo info;
         info.username = username;
         info.status = status;
-        info.skypeNumber = skypeNumber;
+        info.skypeNumber = beacon.skypeNumber;
         info.address = normalizedSender;
-        info.wsPort = wsPort;
-        info.lastSeen = now;
+        info.wsPort = beacon.wsPort;
+        info.beaconInstance = beacon.instance;
+        info.stateVersion = beacon.stateVersion;
+        info.timeoutMs = timeoutMs;
+        info.expiry = m_expiry.add(username, timeoutMs);
         m_peers.insert(username, info);
         statusChanged = true;
-        qDebug() << "Discovered peer:" << username << "at" << normalizedSender.toString() << ":" << wsPort;
+        m_lastChurnAt = m_clock.elapsed();
+        qDebug() << "Discovered peer:" << username << "at" << normalizedSender.toString() << ":" << beacon.wsPort;
 
         // Proactively connect so the peer gets our identify message
         // (handles one-directional multicast — they discover us even if
         //  our multicast doesn't reach them)
         getOrCreateConnection(username);
     } else {
-        PeerInfo& info = m_peers[username];
+        PeerInfo& info = *existing;
         if (info.status != status) {
             statusChanged = true;
         }
         info.status = status;
-        info.skypeNumber = skypeNumber;
+        info.skypeNumber = beacon.skypeNumber;
         info.address = normalizedSender;
-        info.wsPort = wsPort;
-        info.lastSeen = now;
+        info.wsPort = beacon.wsPort;
+        info.beaconInstance = beacon.instance;
+        info.stateVersion = beacon.stateVersion;
+        info.timeoutMs = timeoutMs;
+        m_expiry.touch(info.expiry, timeoutMs);
+    }
+
+    // Don't leave an old client waiting out a long interval for our JSON
+    if (becameLegacy && m_heartbeatTimer && m_heartbeatTimer->remainingTime() > kLegacyIntervalMs) {
+        scheduleBeacon();
     }
 
     if (statusChanged) {
@@ -230,24 +345,32 @@ void LANPeerService::handleDiscoveryPacket(const QByteArray& data, const QHostAd
 }
 
 void LANPeerService::onHeartbeatTimer() {
+    scheduleBeacon();
     broadcastPresence();
 }
 
-void LANPeerService::onPeerTimeoutCheck() {
-    qint64 now = QDateTime::currentMSecsSinceEpoch();
-    QStringList timedOut;
+void LANPeerService::scheduleBeacon() {
+    qint64 now = m_clock.elapsed();
+    int interval = DiscoveryBeacon::intervalMs(m_peers.size(),
+                                               now - m_lastChurnAt < DiscoveryBeacon::kChurnWindowMs);
 
-    for (auto it = m_peers.begin(); it != m_peers.end(); ++it) {
-        if (now - it->lastSeen > 15000) {
-            timedOut.append(it.key());
-        }
-    }
+    // +-10% so peers started together don't stay in lockstep
+    m_beaconIntervalMs = interval + QRandomGenerator::global()->bounded(interval / 5) - interval / 10;
+    if (hasLegacyPeers()) m_beaconIntervalMs = qMin(m_beaconIntervalMs, kLegacyIntervalMs);
+    m_heartbeatTimer->start(m_beaconIntervalMs);
+}
+
+void LANPeerService::onPeerTimeoutCheck() {
+    // Expired entries are freed by the wheel; only the peers remain to drop
+    const QStringList timedOut = m_expiry.advance(m_clock.elapsed());
 
     for (const QString& username : timedOut) {
         qDebug() << "Peer timed out:" << username;
         m_peers.remove(username);
 
         if (m_outgoingConnections.contains(username)) {
+            dropCompressor(m_outgoingConnections[username]);
+            detachOutgoingFiles(m_outgoingConnections[username]);
             m_outgoingConnections[username]->close();
             m_outgoingConnections[username]->deleteLater();
             m_outgoingConnections.remove(username);
@@ -258,8 +381,16 @@ void LANPeerService::onPeerTimeoutCheck() {
     }
 
     if (!timedOut.isEmpty()) {
+        m_lastChurnAt = m_clock.elapsed();
         emitContactList();
     }
+
+    for (auto it = m_identifyRateLimits.begin(); it != m_identifyRateLimits.end();) {
+        if (it->idle(m_expiry.now())) it = m_identifyRateLimits.erase(it);
+        else ++it;
+    }
+
+    expireFileOffers();
 }
 
 // === WebSocket Server (incoming peer connections) ===
@@ -277,30 +408,24 @@ void LANPeerService::onNewPeerConnection() {
     }
 }
 
-bool LANPeerService::checkRateLimit(const QString& peer) {
-    qint64 now = QDateTime::currentMSecsSinceEpoch();
-    auto& timestamps = m_rateLimitMap[peer];
-    while (!timestamps.isEmpty() && now - timestamps.first() > 60000)
-        timestamps.removeFirst();
-    timestamps.append(now);
-    return timestamps.size() <= 30;
-}
-
 void LANPeerService::onPeerTextMessage(const QString& message) {
     // Message size limit: 64KB
-    if (message.size() > 65536) {
+    if (message.size() > kMaxPeerMessage) {
         qWarning() << "Dropping oversized message:" << message.size() << "bytes";
         return;
     }
 
-    QJsonDocument doc = QJsonDocument::fromJson(message.toUtf8());
+    handlePeerMessage(qobject_cast<QWebSocket*>(sender()), message.toUtf8());
+}
+
+void LANPeerService::handlePeerMessage(QWebSocket* socket, const QByteArray& json) {
+    QJsonDocument doc = QJsonDocument::fromJson(json);
     if (!doc.isObject()) return;
 
     QJsonObject obj = doc.object();
     QString type = obj["type"].toString();
 
     if (type == "identify") {
-        auto* socket = qobject_cast<QWebSocket*>(sender());
         if (socket) {
             QString username = obj["username"].toString();
             if (username.isEmpty()) {
@@ -308,27 +433,40 @@ void LANPeerService::onPeerTextMessage(const QString& message) {
                 socket->close(QWebSocketProtocol::CloseCodePolicyViolated, "Empty username");
                 return;
             }
+
+            QHostAddress peerAddr = socket->peerAddress();
+            bool ok;
+            quint32 ipv4 = peerAddr.toIPv4Address(&ok);
+            if (ok) peerAddr = QHostAddress(ipv4);
+
+            if (!m_identifyRateLimits[peerAddr].allow(PeerRateLimit::Identify, m_expiry.now())) {
+                qWarning() << "Rate limit exceeded for identify from" << peerAddr.toString() << username;
+                socket->close(QWebSocketProtocol::CloseCodePolicyViolated, "Too many identifies");
+                return;
+            }
             m_socketToUsername[socket] = username;
 
-            if (m_peers.contains(username)) {
-                // Update lastSeen so they don't time out
-                m_peers[username].lastSeen = QDateTime::currentMSecsSinceEpoch();
+            // A second identify on the socket would restart the peer's streams too
+            dropCompressor(socket);
+            if (obj["compression"].toString() == QLatin1String(Protocol::kCompression)) {
+                m_compressors.insert(socket, new FrameCompressor);
+            }
+
+            auto peer = m_peers.find(username);
+            if (peer != m_peers.end()) {
+                // Push out the deadline so they don't time out
+                m_expiry.touch(peer->expiry, peer->timeoutMs);
                 qDebug() << "Peer identified:" << username;
             } else {
                 // Auto-register peer from WebSocket connection
                 // (handles case where multicast didn't reach us)
-                QHostAddress peerAddr = socket->peerAddress();
-                bool ok;
-                quint32 ipv4 = peerAddr.toIPv4Address(&ok);
-                if (ok) peerAddr = QHostAddress(ipv4);
-
                 PeerInfo info;
                 info.username = username;
                 info.status = obj["status"].toString("Online");
                 info.skypeNumber = obj["skypeNumber"].toString();
                 info.address = peerAddr;
                 info.wsPort = static_cast<quint16>(obj["wsPort"].toInt());
-                info.lastSeen = QDateTime::currentMSecsSinceEpoch();
+                info.expiry = m_expiry.add(username, info.timeoutMs);
                 m_peers.insert(username, info);
 
                 qDebug() << "Peer auto-registered from WebSocket:" << username
@@ -338,6 +476,9 @@ void LANPeerService::onPeerTextMessage(const QString& message) {
                 emitContactList();
             }
 
+            // A reconnect picks up any transfers it interrupted
+            resumeIncomingFiles(username);
+
             // Send our own identify back so the other side maps this socket too
             // (enables bidirectional messaging on a single connection)
             if (!obj.contains("reply")) {
@@ -348,12 +489,12 @@ void LANPeerService::onPeerTextMessage(const QString& message) {
                 reply["status"] = m_status;
                 reply["skypeNumber"] = m_skypeNumber;
                 reply["reply"] = true;  // prevent infinite ping-pong
+                reply["compression"] = QString::fromLatin1(Protocol::kCompression);
                 socket->sendTextMessage(QJsonDocument(reply).toJson(QJsonDocument::Compact));
             }
         }
     } else {
         // For all other message types, verify sender matches socket identity
-        auto* socket = qobject_cast<QWebSocket*>(sender());
         QString claimedFrom = obj["from"].toString();
         if (socket && m_socketToUsername.contains(socket)) {
             if (m_socketToUsername[socket] != claimedFrom) {
@@ -363,14 +504,18 @@ void LANPeerService::onPeerTextMessage(const QString& message) {
             }
         }
 
-        // Update lastSeen so active peers don't time out
-        if (!claimedFrom.isEmpty() && m_peers.contains(claimedFrom)) {
-            m_peers[claimedFrom].lastSeen = QDateTime::currentMSecsSinceEpoch();
+        // Push out the deadline so active peers don't time out
+        auto peer = m_peers.find(claimedFrom);
+        PeerRateLimit* rateLimit = &m_strangerRateLimit;
+        if (!claimedFrom.isEmpty() && peer != m_peers.end()) {
+            m_expiry.touch(peer->expiry, peer->timeoutMs);
+            rateLimit = &peer->rateLimit;
         }
 
-        // Rate limiting
-        if (!claimedFrom.isEmpty() && !checkRateLimit(claimedFrom)) {
-            qWarning() << "Rate limit exceeded for" << claimedFrom;
+        // Rate limiting, on the wheel's clock rather than a fresh read
+        if (!claimedFrom.isEmpty()
+            && !rateLimit->allow(PeerRateLimit::kindOf(type), m_expiry.now())) {
+            qWarning() << "Rate limit exceeded for" << claimedFrom << type;
             return;
         }
 
@@ -385,29 +530,31 @@ void LANPeerService::onPeerTextMessage(const QString& message) {
                 ack["type"] = "message_ack";
                 ack["from"] = m_username;
                 ack["text"] = text;
-                socket->sendTextMessage(QJsonDocument(ack).toJson(QJsonDocument::Compact));
+                sendToSocket(socket, ack);
             }
         } else if (type == "message_ack") {
             emit messageAcknowledged(obj["from"].toString(), obj["text"].toString());
         } else if (type == "typing") {
             emit typingReceived(obj["from"].toString());
-        } else if (type == "file_offer") {
-            QString from = obj["from"].toString();
-            QString fileName = obj["fileName"].toString();
-            qint64 fileSize = static_cast<qint64>(obj["fileSize"].toDouble());
-            emit fileOfferReceived(from, fileName, fileSize);
+        } else if (type.startsWith("file_") && type != "file_data") {
+            handleFileMessage(socket, type, obj);
         } else if (type == "file_data") {
+            // Whole-file messages from older peers
             QString from = obj["from"].toString();
             QString fileName = obj["fileName"].toString();
             QByteArray data = QByteArray::fromBase64(obj["data"].toString().toLatin1());
             emit fileDataReceived(from, fileName, data);
         } else if (type == "call_offer") {
+            setRemoteMedia(socket, obj["from"].toString(), obj);
             emit callOfferReceived(obj["from"].toString(), obj["callId"].toString());
         } else if (type == "call_accept") {
+            setRemoteMedia(socket, obj["from"].toString(), obj);
             emit callAcceptReceived(obj["from"].toString(), obj["callId"].toString());
         } else if (type == "call_reject") {
+            if (m_media) m_media->endSession(obj["from"].toString());
             emit callRejectReceived(obj["from"].toString(), obj["callId"].toString());
         } else if (type == "call_end") {
+            if (m_media) m_media->endSession(obj["from"].toString());
             emit callEndReceived(obj["from"].toString(), obj["callId"].toString());
         } else if (type == "group_create") {
             QStringList members;
@@ -451,6 +598,8 @@ void LANPeerService::onPeerDisconnected() {
 
     m_incomingConnections.removeAll(socket);
     m_socketToUsername.remove(socket);
+    dropCompressor(socket);
+    detachOutgoingFiles(socket);
 
     // Check if it was an outgoing connection
     for (auto it = m_outgoingConnections.begin(); it != m_outgoingConnections.end(); ++it) {
@@ -460,6 +609,15 @@ void LANPeerService::onPeerDisconnected() {
         }
     }
 
+    // Transfers that were on this socket carry on over another one to the
+    // same peer if there is one
+    if (m_running) {
+        const QList<OutgoingFile*> files = m_outgoingFiles.values();
+        for (OutgoingFile* file : files) {
+            if (file->accepted && !file->socket) pumpFile(file);
+        }
+    }
+
     socket->deleteLater();
 }
 
@@ -474,6 +632,8 @@ QWebSocket* LANPeerService::getOrCreateConnection(const QString& peerUsername) {
             return ws;
         }
         // Dead connection, clean up
+        dropCompressor(ws);
+        detachOutgoingFiles(ws);
         ws->deleteLater();
         m_outgoingConnections.remove(peerUsername);
     }
@@ -498,6 +658,7 @@ QWebSocket* LANPeerService::getOrCreateConnection(const QString& peerUsername) {
         identify["wsPort"] = static_cast<int>(m_wsListenPort);
         identify["status"] = m_status;
         identify["skypeNumber"] = m_skypeNumber;
+        identify["compression"] = QString::fromLatin1(Protocol::kCompression);
         ws->sendTextMessage(QJsonDocument(identify).toJson(QJsonDocument::Compact));
 
         // Flush any queued messages
@@ -532,18 +693,6 @@ void LANPeerService::sendTyping(const QString& to) {
     sendJsonToPeer(to, msg);
 }
 
-void LANPeerService::sendFileData(const QString& to, const QString& fileName, const QByteArray& data) {
-    if (!m_peers.contains(to)) return;
-
-    QJsonObject msg;
-    msg["type"] = "file_data";
-    msg["from"] = m_username;
-    msg["fileName"] = fileName;
-    msg["fileSize"] = static_cast<double>(data.size());
-    msg["data"] = QString::fromLatin1(data.toBase64());
-    sendJsonToPeer(to, msg);
-}
-
 void LANPeerService::sendCallOffer(const QString& to, const QString& callId) {
     if (!m_peers.contains(to)) {
         qWarning() << "Cannot send call offer: peer" << to << "not discovered."
@@ -556,6 +705,10 @@ void LANPeerService::sendCallOffer(const QString& to, const QString& callId) {
     msg["type"] = "call_offer";
     msg["from"] = m_username;
     msg["callId"] = callId;
+    if (m_media) {
+        QJsonObject media = m_media->localDescription(to);
+        if (!media.isEmpty()) msg["media"] = media;
+    }
     sendJsonToPeer(to, msg);
 }
 
@@ -565,6 +718,10 @@ void LANPeerService::sendCallAccept(const QString& to, const QString& callId) {
     msg["type"] = "call_accept";
     msg["from"] = m_username;
     msg["callId"] = callId;
+    if (m_media) {
+        QJsonObject media = m_media->localDescription(to);
+        if (!media.isEmpty()) msg["media"] = media;
+    }
     sendJsonToPeer(to, msg);
 }
 
@@ -575,6 +732,7 @@ void LANPeerService::sendCallReject(const QString& to, const QString& callId) {
     msg["from"] = m_username;
     msg["callId"] = callId;
     sendJsonToPeer(to, msg);
+    if (m_media) m_media->endSession(to);
 }
 
 void LANPeerService::sendCallEnd(const QString& to, const QString& callId) {
@@ -584,10 +742,21 @@ void LANPeerService::sendCallEnd(const QString& to, const QString& callId) {
     msg["from"] = m_username;
     msg["callId"] = callId;
     sendJsonToPeer(to, msg);
+    if (m_media) m_media->endSession(to);
+}
+
+void LANPeerService::setRemoteMedia(QWebSocket* socket, const QString& from, const QJsonObject& obj) {
+    if (!m_media || !obj["media"].isObject()) return;
+
+    // Media goes to the address the peer announced itself from
+    QHostAddress address = m_peers.contains(from) ? m_peers[from].address
+                         : socket ? socket->peerAddress() : QHostAddress();
+    m_media->setRemoteDescription(from, address, obj["media"].toObject());
 }
 
 void LANPeerService::sendAudioData(const QString& to, const QByteArray& audioData) {
     if (!m_peers.contains(to)) return;
+    if (m_media && m_media->sendAudio(to, audioData)) return;
 
     QWebSocket* ws = getOrCreateConnection(to);
     if (!ws || ws->state() != QAbstractSocket::ConnectedState) return;
@@ -605,6 +774,7 @@ void LANPeerService::sendAudioData(const QString& to, const QByteArray& audioDat
 
 void LANPeerService::sendVideoData(const QString& to, const QByteArray& jpegData) {
     if (!m_peers.contains(to)) return;
+    if (m_media && m_media->sendVideo(to, jpegData)) return;
 
     QWebSocket* ws = getOrCreateConnection(to);
     if (!ws || ws->state() != QAbstractSocket::ConnectedState) return;
@@ -621,24 +791,49 @@ void LANPeerService::sendVideoData(const QString& to, const QByteArray& jpegData
 }
 
 void LANPeerService::onPeerBinaryMessage(const QByteArray& data) {
+    auto* socket = qobject_cast<QWebSocket*>(sender());
+
+    // Compressed JSON: "ZJS\0" + deflate stream bytes
+    if (socket && data.size() > 4 && data.startsWith(QByteArray("ZJS\0", 4))) {
+        FrameCompressor* compressor = m_compressors.value(socket);
+        QByteArray json;
+        if (!compressor || !compressor->decompress(data.constData() + 4, data.size() - 4,
+                                                   json, kMaxPeerMessage)) {
+            qWarning() << "Bad compressed message from peer" << m_socketToUsername.value(socket);
+            socket->close(QWebSocketProtocol::CloseCodeProtocolError);
+            return;
+        }
+        handlePeerMessage(socket, json);
+        return;
+    }
+
     if (data.size() < 8) return;
 
-    auto* socket = qobject_cast<QWebSocket*>(sender());
     QString from;
     if (socket && m_socketToUsername.contains(socket)) {
         from = m_socketToUsername[socket];
     }
     if (from.isEmpty()) return;
 
-    // Update lastSeen for active peers
-    if (m_peers.contains(from)) {
-        m_peers[from].lastSeen = QDateTime::currentMSecsSinceEpoch();
+    // Push out the deadline for active peers
+    auto peer = m_peers.find(from);
+    if (peer != m_peers.end()) {
+        m_expiry.touch(peer->expiry, peer->timeoutMs);
+    }
+
+    if (FileTransfer::isChunkFrame(data)) {
+        handleFileChunk(from, data);
+        return;
+    }
+    if (FileTransfer::isAckFrame(data)) {
+        handleFileAck(from, data);
+        return;
     }
 
     // Check magic header
     if (data[0] == 'A' && data[1] == 'U' && data[2] == 'D') {
         QByteArray audioData = data.mid(8);
-        emit audioDataReceived(from, audioData);
+        emit audioDataReceived(from, audioData, 0);
     } else if (data[0] == 'V' && data[1] == 'I' && data[2] == 'D') {
         QByteArray jpegData = data.mid(8);
         emit videoDataReceived(from, jpegData);
@@ -791,15 +986,341 @@ void LANPeerService::sendConferenceVideo(const QStringList& participants, const
     }
 }
 
-void LANPeerService::sendFileOffer(const QString& to, const QString& fileName, qint64 fileSize) {
-    if (!m_peers.contains(to)) return;
+// === File transfer ===
+
+QString LANPeerService::sendFile(const QString& to, const QString& filePath, bool attachment) {
+    if (!m_peers.contains(to)) return QString();
+
+    QString id = QUuid::createUuid().toString(QUuid::WithoutBraces);
+    auto* file = new OutgoingFile(id, to);
+    if (!file->open(filePath)) {
+        delete file;
+        return QString();
+    }
+    file->wireId = QUuid(id).toRfc4122();
+    file->offeredAt = m_clock.elapsed();
+    m_outgoingFiles.insert(id, file);
 
     QJsonObject msg;
     msg["type"] = "file_offer";
     msg["from"] = m_username;
-    msg["fileName"] = fileName;
-    msg["fileSize"] = static_cast<double>(fileSize);
+    msg["transferId"] = id;
+    msg["fileName"] = file->fileName;
+    msg["fileSize"] = static_cast<double>(file->size);
+    msg["attachment"] = attachment;
     sendJsonToPeer(to, msg);
+    return id;
+}
+
+void LANPeerService::acceptFile(const QString& transferId, const QString& savePath) {
+    IncomingFile* file = m_incomingFiles.value(transferId);
+    if (!file || !file->savePath.isEmpty()) return;
+
+    if (!file->open(savePath)) {
+        sendFileCancel(file->peer, transferId);
+        failFile(transferId, QString("Could not write to %1").arg(savePath));
+        return;
+    }
+    sendFileAccept(file);
+
+    // Empty file, or a .part that already had everything
+    if (file->isComplete()) finishIncomingFile(file);
+}
+
+void LANPeerService::cancelFile(const QString& transferId) {
+    QString peer;
+    if (OutgoingFile* file = m_outgoingFiles.take(transferId)) {
+        peer = file->peer;
+        delete file;
+    } else if (IncomingFile* file = m_incomingFiles.take(transferId)) {
+        peer = file->peer;
+        file->abort(false);
+        delete file;
+    } else {
+        return;
+    }
+    sendFileCancel(peer, transferId);
+}
+
+void LANPeerService::handleFileMessage(QWebSocket* socket, const QString& type, const QJsonObject& obj) {
+    QString from = obj["from"].toString();
+    QString id = obj["transferId"].toString();
+    if (QUuid(id).isNull()) return;
+
+    if (type == "file_offer") {
+        if (m_incomingFiles.contains(id)) return;
+
+        auto* file = new IncomingFile(id, from);
+        file->wireId = QUuid(id).toRfc4122();
+        // Never let the sender pick a directory
+        file->fileName = QFileInfo(obj["fileName"].toString()).fileName();
+        file->size = qMax<qint64>(0, static_cast<qint64>(obj["fileSize"].toDouble()));
+        file->attachment = obj["attachment"].toBool();
+        if (file->fileName.isEmpty()) file->fileName = "file";
+        file->offeredAt = m_clock.elapsed();
+        m_incomingFiles.insert(id, file);
+        emit fileOfferReceived(from, id, file->fileName, file->size, file->attachment);
+    } else if (type == "file_accept") {
+        OutgoingFile* file = m_outgoingFiles.value(id);
+        if (!file || file->peer != from) return;
+
+        qint64 offset = qBound<qint64>(0, static_cast<qint64>(obj["offset"].toDouble()), file->size);
+        if (file->accepted && file->socket
+            && file->socket->state() == QAbstractSocket::ConnectedState) {
+            // Re-sent because the peer saw another socket come up; the
+            // stream in flight is fine, so take it as an ack
+            file->ackedOffset = qMax(file->ackedOffset, offset);
+            file->nextOffset = qMax(file->nextOffset, file->ackedOffset);
+        } else {
+            // Resuming: make sure the receiver's .part is a prefix of this file
+            if (offset > 0) {
+                int length = static_cast<int>(qMin<qint64>(FileTransfer::kChunkSize, offset));
+                quint32 tail = static_cast<quint32>(obj["tailCrc"].toDouble());
+                if (file->chunkChecksum(offset - length, length) != tail) {
+                    QJsonObject restart;
+                    restart["type"] = "file_restart";
+                    restart["from"] = m_username;
+                    restart["transferId"] = id;
+                    sendJsonToPeer(from, restart);
+                    return;
+                }
+            }
+            file->accepted = true;
+            file->socket = socket;
+            file->ackedOffset = offset;
+            file->nextOffset = offset;
+        }
+
+        if (file->ackedOffset == file->size) {
+            m_outgoingFiles.remove(id);
+            emit fileTransferFinished(id, QString());
+            delete file;
+            return;
+        }
+        pumpFile(file);
+    } else if (type == "file_restart") {
+        IncomingFile* file = m_incomingFiles.value(id);
+        if (!file || file->peer != from || file->savePath.isEmpty()) return;
+        if (!file->restart()) {
+            cancelFile(id);
+            failFile(id, "Could not write the file");
+            return;
+        }
+        sendFileAccept(file);
+    } else if (type == "file_cancel") {
+        if (OutgoingFile* file = m_outgoingFiles.value(id)) {
+            if (file->peer != from) return;
+            m_outgoingFiles.remove(id);
+            delete file;
+        } else if (IncomingFile* file = m_incomingFiles.value(id)) {
+            if (file->peer != from) return;
+            m_incomingFiles.remove(id);
+            file->abort(false);
+            delete file;
+        } else {
+            return;
+        }
+        emit fileTransferFailed(id, QString("Cancelled by %1").arg(from));
+    }
+}
+
+void LANPeerService::pumpFile(OutgoingFile* file) {
+    if (!file->accepted) return;
+
+    if (!file->socket || file->socket->state() != QAbstractSocket::ConnectedState) {
+        // Carry on over another live socket if there is one; otherwise the
+        // receiver's file_accept after the reconnect restarts us
+        file->socket = getOrCreateConnection(file->peer);
+        if (!file->socket || file->socket->state() != QAbstractSocket::ConnectedState) {
+            file->socket = nullptr;
+            return;
+        }
+    }
+
+    qint64 windowEnd = qMin(file->size, file->ackedOffset
+                            + static_cast<qint64>(FileTransfer::kWindowChunks) * FileTransfer::kChunkSize);
+    while (file->nextOffset < windowEnd) {
+        QByteArray frame = file->chunkFrame(file->nextOffset);
+        if (frame.isNull()) {
+            QString id = file->id;
+            cancelFile(id);
+            failFile(id, "Could not read the file");
+            return;
+        }
+        file->socket->sendBinaryMessage(frame);
+        file->nextOffset += frame.size() - FileTransfer::kChunkHeaderSize;
+    }
+}
+
+void LANPeerService::handleFileChunk(const QString& from, const QByteArray& frame) {
+    QByteArray wireId;
+    qint64 offset;
+    quint32 crc;
+    const char* data;
+    int size;
+    if (!FileTransfer::decodeChunk(frame, wireId, offset, crc, data, size)) return;
+
+    QString id = transferIdFromWire(wireId);
+    IncomingFile* file = m_incomingFiles.value(id);
+    if (!file || file->peer != from || file->savePath.isEmpty()) return;
+
+    // Duplicates after a go-back or a socket switch
+    if (offset < file->received) return;
+
+    if (FileTransfer::checksum(data, size) != crc) {
+        qWarning() << "Checksum mismatch in" << file->fileName << "at" << offset;
+        sendFileAck(file, FileTransfer::kAckResend);
+        return;
+    }
+    if (offset > file->received) {
+        // A gap: everything in flight behind it is useless, ask once
+        if (file->resendAt != file->received) {
+            file->resendAt = file->received;
+            sendFileAck(file, FileTransfer::kAckResend);
+        }
+        return;
+    }
+
+    if (!file->write(offset, data, size)) {
+        cancelFile(id);
+        failFile(id, "Could not write the file");
+        return;
+    }
+    file->resendAt = -1;
+
+    if (file->isComplete()) {
+        finishIncomingFile(file);
+        return;
+    }
+    if (++file->unacked >= FileTransfer::kAckEveryChunks) {
+        sendFileAck(file, 0);
+    }
+    reportFileProgress(id, file->received, file->size, file->lastProgressAt);
+}
+
+void LANPeerService::handleFileAck(const QString& from, const QByteArray& frame) {
+    QByteArray wireId;
+    qint64 received;
+    quint8 flags;
+    if (!FileTransfer::decodeAck(frame, wireId, received, flags)) return;
+
+    QString id = transferIdFromWire(wireId);
+    OutgoingFile* file = m_outgoingFiles.value(id);
+    if (!file || file->peer != from || !file->accepted) return;
+
+    // Acks can trail a go-back; never move backwards past what's confirmed
+    if (received < file->ackedOffset || received > file->size) return;
+    file->ackedOffset = received;
+    if ((flags & FileTransfer::kAckResend) || file->nextOffset < received) {
+        file->nextOffset = received;
+    }
+
+    if (received == file->size) {
+        m_outgoingFiles.remove(id);
+        emit fileTransferProgress(id, received, file->size);
+        emit fileTransferFinished(id, QString());
+        delete file;
+        return;
+    }
+    reportFileProgress(id, received, file->size, file->lastProgressAt);
+    pumpFile(file);
+}
+
+void LANPeerService::sendFileAccept(IncomingFile* file) {
+    file->unacked = 0;
+    file->resendAt = -1;
+
+    QJsonObject msg;
+    msg["type"] = "file_accept";
+    msg["from"] = m_username;
+    msg["transferId"] = file->id;
+    msg["offset"] = static_cast<double>(file->received);
+    msg["tailCrc"] = static_cast<double>(file->tailChecksum());
+    sendJsonToPeer(file->peer, msg);
+}
+
+void LANPeerService::sendFileAck(IncomingFile* file, quint8 flags) {
+    file->unacked = 0;
+
+    QWebSocket* ws = getOrCreateConnection(file->peer);
+    if (!ws || ws->state() != QAbstractSocket::ConnectedState) return;
+    ws->sendBinaryMessage(FileTransfer::encodeAck(file->wireId, file->received, flags));
+}
+
+void LANPeerService::sendFileCancel(const QString& peer, const QString& transferId) {
+    QJsonObject msg;
+    msg["type"] = "file_cancel";
+    msg["from"] = m_username;
+    msg["transferId"] = transferId;
+    sendJsonToPeer(peer, msg);
+}
+
+void LANPeerService::finishIncomingFile(IncomingFile* file) {
+    QString id = file->id;
+    sendFileAck(file, 0);
+    m_incomingFiles.remove(id);
+
+    if (file->finish()) {
+        emit fileTransferProgress(id, file->size, file->size);
+        emit fileTransferFinished(id, file->savePath);
+    } else {
+        emit fileTransferFailed(id, QString("Could not save %1").arg(file->savePath));
+    }
+    delete file;
+}
+
+void LANPeerService::failFile(const QString& transferId, const QString& reason) {
+    qWarning() << "File transfer" << transferId << "failed:" << reason;
+    if (IncomingFile* file = m_incomingFiles.take(transferId)) {
+        file->abort(false);
+        delete file;
+    }
+    delete m_outgoingFiles.take(transferId);
+    emit fileTransferFailed(transferId, reason);
+}
+
+void LANPeerService::expireFileOffers() {
+    // A handful of transfers at most, so a scan per tick is nothing
+    const qint64 cutoff = m_clock.elapsed() - kFileOfferTimeoutMs;
+    QStringList expired;
+    for (OutgoingFile* file : qAsConst(m_outgoingFiles)) {
+        if (!file->accepted && file->offeredAt < cutoff) expired.append(file->id);
+    }
+    for (IncomingFile* file : qAsConst(m_incomingFiles)) {
+        if (file->savePath.isEmpty() && file->offeredAt < cutoff) expired.append(file->id);
+    }
+
+    for (const QString& id : expired) {
+        const OutgoingFile* outgoing = m_outgoingFiles.value(id);
+        const QString peer = outgoing ? outgoing->peer : m_incomingFiles.value(id)->peer;
+        sendFileCancel(peer, id);
+        failFile(id, "Offer expired");
+    }
+}
+
+void LANPeerService::reportFileProgress(const QString& transferId, qint64 done, qint64 total, qint64& lastAt) {
+    qint64 now = m_clock.elapsed();
+    if (now - lastAt < kFileProgressIntervalMs) return;
+    lastAt = now;
+    emit fileTransferProgress(transferId, done, total);
+}
+
+void LANPeerService::resumeIncomingFiles(const QString& peer) {
+    for (IncomingFile* file : m_incomingFiles) {
+        if (file->peer == peer && !file->savePath.isEmpty() && !file->isComplete()) {
+            sendFileAccept(file);
+        }
+    }
+}
+
+void LANPeerService::detachOutgoingFiles(QWebSocket* socket) {
+    for (OutgoingFile* file : m_outgoingFiles) {
+        if (file->socket != socket) continue;
+
+        // Whatever was in flight on it is gone
+        file->socket = nullptr;
+        file->nextOffset = file->ackedOffset;
+    }
 }
 
 void LANPeerService::sendMessage(const QString& to, const QString& text) {
@@ -822,13 +1343,33 @@ void LANPeerService::sendJsonToPeer(const QString& peerUsername, const QJsonObje
     if (!ws) return;
 
     if (ws->state() == QAbstractSocket::ConnectedState) {
-        ws->sendTextMessage(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+        sendToSocket(ws, obj);
     } else {
         // Queue for when connection establishes
         m_pendingMessages[peerUsername].append(obj);
     }
 }
 
+void LANPeerService::sendToSocket(QWebSocket* socket, const QJsonObject& obj) {
+    QByteArray json = QJsonDocument(obj).toJson(QJsonDocument::Compact);
+
+    // Long messages and file offers; file data goes out as its own binary
+    // frames and never comes through here. Short frames aren't worth it
+    FrameCompressor* compressor = m_compressors.value(socket);
+    if (compressor && json.size() >= CompressionPolicy().threshold) {
+        QByteArray payload = compressor->compress(json.constData(), json.size());
+        if (!payload.isNull()) {
+            socket->sendBinaryMessage(QByteArray("ZJS\0", 4) + payload);
+            return;
+        }
+    }
+    socket->sendTextMessage(QString::fromUtf8(json));
+}
+
+void LANPeerService::dropCompressor(QWebSocket* socket) {
+    delete m_compressors.take(socket);
+}
+
 void LANPeerService::flushPendingMessages(const QString& peerUsername) {
     if (!m_pendingMessages.contains(peerUsername)) return;
     if (!m_outgoingConnections.contains(peerUsername)) return;
@@ -837,7 +1378,7 @@ void LANPeerService::flushPendingMessages(const QString& peerUsername) {
     if (ws->state() != QAbstractSocket::ConnectedState) return;
 
     for (const QJsonObject& msg : m_pendingMessages[peerUsername]) {
-        ws->sendTextMessage(QJsonDocument(msg).toJson(QJsonDocument::Compact));
+        sendToSocket(ws, msg);
     }
     m_pendingMessages.remove(peerUsername);
 }
@@ -845,6 +1386,8 @@ void LANPeerService::flushPendingMessages(const QString& peerUsername) {
 // === Public API ===
 
 void LANPeerService::setStatus(const QString& status) {
+    // Out of schedule, so peers see the change now rather than a beacon later
+    if (status != m_status) ++m_stateVersion;
     m_status = status;
     broadcastPresence();
 }
@@ -8,9 +8,16 @@
 #include <QJsonObject>
 #include <QTimer>
 #include <QMap>
+#include <QHash>
 #include <QList>
 #include <QHostAddress>
 #include <QDateTime>
+#include <QElapsedTimer>
+#include "network/ExpiryWheel.h"
+#include "network/FileTransfer.h"
+#include "network/FrameCompressor.h"
+#include "network/MediaTransport.h"
+#include "network/PeerRateLimit.h"
 
 struct PeerInfo {
     QString username;
@@ -18,7 +25,13 @@ struct PeerInfo {
     QString skypeNumber;
     QHostAddress address;
     quint16 wsPort;
-    qint64 lastSeen;
+    // From the peer's last beacon; instance 0 until one arrives
+    quint32 beaconInstance = 0;
+    quint32 stateVersion = 0;
+    int timeoutMs = 15000;
+    // Liveness slot in m_expiry, pushed out on every beacon or frame
+    ExpiryWheel::Entry* expiry = nullptr;
+    PeerRateLimit rateLimit;
 };
 
 class LANPeerService : public QObject {
@@ -33,8 +46,13 @@ public:
 
     void sendMessage(const QString& to, const QString& text);
     void sendTyping(const QString& to);
-    void sendFileOffer(const QString& to, const QString& fileName, qint64 fileSize);
-    void sendFileData(const QString& to, const QString& fileName, const QByteArray& data);
+    // Offers the file and streams it once accepted. Returns the transfer id
+    // the progress signals carry, or empty if the file can't be read.
+    QString sendFile(const QString& to, const QString& filePath, bool attachment = false);
+    // Resumes from "<savePath>.part" if an earlier attempt left one
+    void acceptFile(const QString& transferId, const QString& savePath);
+    // Declines an offer or cancels a transfer in either direction
+    void cancelFile(const QString& transferId);
     void sendCallOffer(const QString& to, const QString& callId);
     void sendCallAccept(const QString& to, const QString& callId);
     void sendCallReject(const QString& to, const QString& callId);
@@ -68,13 +86,18 @@ signals:
     void messageAcknowledged(const QString& to, const QString& text);
     void typingReceived(const QString& from);
     void presenceChanged(const QString& username, const QString& status);
-    void fileOfferReceived(const QString& from, const QString& fileName, qint64 fileSize);
+    void fileOfferReceived(const QString& from, const QString& transferId, const QString& fileName,
+                           qint64 fileSize, bool attachment);
+    void fileTransferProgress(const QString& transferId, qint64 transferred, qint64 total);
+    void fileTransferFinished(const QString& transferId, const QString& path);
+    void fileTransferFailed(const QString& transferId, const QString& reason);
     void fileDataReceived(const QString& from, const QString& fileName, const QByteArray& data);
     void callOfferReceived(const QString& from, const QString& callId);
     void callAcceptReceived(const QString& from, const QString& callId);
     void callRejectReceived(const QString& from, const QString& callId);
     void callEndReceived(const QString& from, const QString& callId);
-    void audioDataReceived(const QString& from, const QByteArray& data);
+    // lostBefore: frames known lost just before this one (UDP only)
+    void audioDataReceived(const QString& from, const QByteArray& data, int lostBefore);
     void videoDataReceived(const QString& from, const QByteArray& jpegData);
     void conferenceCreateReceived(const QString& from, const QString& conferenceId, const QStringList& participants);
     void conferenceJoinReceived(const QString& from, const QString& conferenceId);
@@ -100,8 +123,31 @@ private slots:
     void onPeerDisconnected();
 
 private:
+    QByteArray presenceBeacon() const;
+    // The JSON packet of clients from before the binary beacon, sent as
+    // well while any of them is around
+    QByteArray legacyDiscovery() const;
+    bool hasLegacyPeers() const;
     void broadcastPresence();
+    void scheduleBeacon();
     void handleDiscoveryPacket(const QByteArray& data, const QHostAddress& sender);
+    void handlePeerMessage(QWebSocket* socket, const QByteArray& json);
+    void sendToSocket(QWebSocket* socket, const QJsonObject& obj);
+    void dropCompressor(QWebSocket* socket);
+    void setRemoteMedia(QWebSocket* socket, const QString& from, const QJsonObject& obj);
+    void handleFileMessage(QWebSocket* socket, const QString& type, const QJsonObject& obj);
+    void handleFileChunk(const QString& from, const QByteArray& frame);
+    void handleFileAck(const QString& from, const QByteArray& frame);
+    void pumpFile(OutgoingFile* file);
+    void sendFileAccept(IncomingFile* file);
+    void sendFileAck(IncomingFile* file, quint8 flags);
+    void sendFileCancel(const QString& peer, const QString& transferId);
+    void finishIncomingFile(IncomingFile* file);
+    void failFile(const QString& transferId, const QString& reason);
+    void expireFileOffers();
+    void reportFileProgress(const QString& transferId, qint64 done, qint64 total, qint64& lastAt);
+    void resumeIncomingFiles(const QString& peer);
+    void detachOutgoingFiles(QWebSocket* socket);
     QWebSocket* getOrCreateConnection(const QString& peerUsername);
     void sendJsonToPeer(const QString& peerUsername, const QJsonObject& obj);
     void flushPendingMessages(const QString& peerUsername);
@@ -119,6 +165,23 @@ private:
     QTimer* m_heartbeatTimer = nullptr;
     QTimer* m_timeoutTimer = nullptr;
 
+    // Peer liveness; the timeout timer advances it every kExpiryTickMs
+    QElapsedTimer m_clock;
+    ExpiryWheel m_expiry;
+
+    // Beacons carry our state version; receivers skip the body when it and
+    // the instance id match what they already have. The interval stretches
+    // with the peer count and shrinks again after a join or leave.
+    quint32 m_beaconInstance = 0;
+    quint32 m_stateVersion = 0;
+    int m_beaconIntervalMs = 0;
+    qint64 m_lastChurnAt = 0;
+    quint64 m_beaconsReceived = 0;
+    quint64 m_beaconsDecoded = 0;
+
+    // Call media over UDP, falling back to the peer WebSocket
+    MediaTransport* m_media = nullptr;
+
     // WebSocket server for incoming peer connections
     QWebSocketServer* m_wsServer = nullptr;
     quint16 m_wsListenPort = 0;
@@ -129,10 +192,24 @@ private:
     QList<QWebSocket*> m_incomingConnections;
     QMap<QWebSocket*, QString> m_socketToUsername;
 
+    // Sockets whose peer offered deflate in its identify; JSON past the
+    // threshold goes out as a "ZJS" binary frame through the socket's
+    // compressor, which also inflates what the peer sends back
+    QMap<QWebSocket*, FrameCompressor*> m_compressors;
+
+    // File transfers by transfer id; entries live until done, failed or cancelled
+    QMap<QString, OutgoingFile*> m_outgoingFiles;
+    QMap<QString, IncomingFile*> m_incomingFiles;
+
     // Message queue for connections still establishing
     QMap<QString, QList<QJsonObject>> m_pendingMessages;
 
-    // Rate limiting: peer username -> list of message timestamps
-    QMap<QString, QList<qint64>> m_rateLimitMap;
-    bool checkRateLimit(const QString& peer);
+    // Shared by senders that aren't (or are no longer) in m_peers, so
+    // made-up names can't each get a fresh allowance
+    PeerRateLimit m_strangerRateLimit;
+
+    // Identify is charged to the sender's address, since each one can
+    // bring a new name and with it a fresh per-peer allowance. Entries go
+    // once idle, when they'd be no different from a new one.
+    QHash<QHostAddress, PeerRateLimit> m_identifyRateLimits;
 };
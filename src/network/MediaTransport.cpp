@@ -0,0 +1,356 @@
+#include "network/MediaTransport.h"
+
+#include <QNetworkDatagram>
+#include <QRandomGenerator>
+#include <QDebug>
+#include <QtEndian>
+#include <cstring>
+
+namespace {
+const quint8 kAudioPayload = 111;
+const quint8 kVideoPayload = 26;
+const quint8 kProbePayload = 127;
+const quint8 kReceiverReport = 201;
+const int kHeaderSize = 12;
+const int kReportSize = 32;
+const int kMaxFragment = 1200; // payload per datagram, under a 1500-byte MTU
+const int kMaxVideoFrame = 1024 * 1024;
+const int kAudioClockPerMs = 16;
+const int kVideoClockPerMs = 90;
+const int kReportIntervalMs = 1000;
+const int kReportTimeoutMs = 2500;
+const int kProbeIntervalMs = 500;
+const int kMaxDropout = 3000;  // a bigger jump means the sender restarted
+
+QHostAddress plainAddress(const QHostAddress& address) {
+    bool ok;
+    quint32 ipv4 = address.toIPv4Address(&ok);
+    return ok ? QHostAddress(ipv4) : address;
+}
+}
+
+// === Sequence tracking ===
+
+int MediaTransport::InStream::accept(quint16 seq) {
+    if (!started) {
+        started = true;
+        maxSeq = seq;
+        baseSeq = seq;
+        cycles = 0;
+        received = 1;
+        expectedPrior = 0;
+        receivedPrior = 0;
+        return 0;
+    }
+
+    quint16 delta = static_cast<quint16>(seq - maxSeq);
+    if (delta == 0 || delta >= 0x8000) return -1; // already concealed
+    if (delta > kMaxDropout) {
+        started = false;
+        return accept(seq);
+    }
+    if (seq < maxSeq) cycles += 0x10000;
+    maxSeq = seq;
+    ++received;
+    return delta - 1;
+}
+
+void MediaTransport::InStream::updateJitter(quint32 timestamp, qint64 arrival) {
+    qint64 transit = static_cast<qint32>(static_cast<quint32>(arrival) - timestamp);
+    if (received > 1) {
+        double d = static_cast<double>(qAbs(transit - lastTransit));
+        jitter += (d - jitter) / 16.0;
+    }
+    lastTransit = transit;
+}
+
+// === Setup ===
+
+MediaTransport::MediaTransport(QObject* parent)
+    : QObject(parent)
+{
+}
+
+MediaTransport::~MediaTransport() {
+    qDeleteAll(m_sessions);
+}
+
+bool MediaTransport::open() {
+    m_socket = new QUdpSocket(this);
+    if (!m_socket->bind(QHostAddress::AnyIPv4, 0)) {
+        qWarning() << "UDP media unavailable, calls stay on the WebSocket:" << m_socket->errorString();
+        delete m_socket;
+        m_socket = nullptr;
+        return false;
+    }
+    connect(m_socket, &QUdpSocket::readyRead, this, &MediaTransport::onReadyRead);
+
+    m_reportTimer = new QTimer(this);
+    connect(m_reportTimer, &QTimer::timeout, this, &MediaTransport::onReportTimer);
+    m_reportTimer->start(kReportIntervalMs);
+    m_clock.start();
+
+    m_lossPercent = qBound(0, qEnvironmentVariableIntValue("SKYPE_MEDIA_LOSS"), 100);
+    if (m_lossPercent > 0) {
+        qWarning() << "Dropping" << m_lossPercent << "% of outgoing UDP media (SKYPE_MEDIA_LOSS)";
+    }
+    return true;
+}
+
+quint16 MediaTransport::port() const {
+    return m_socket ? m_socket->localPort() : 0;
+}
+
+MediaTransport::Session* MediaTransport::session(const QString& peer) {
+    Session* s = m_sessions.value(peer);
+    if (!s) {
+        s = new Session;
+        s->audioOut.ssrc = QRandomGenerator::global()->generate();
+        do {
+            s->videoOut.ssrc = QRandomGenerator::global()->generate();
+        } while (s->videoOut.ssrc == s->audioOut.ssrc);
+        m_sessions.insert(peer, s);
+    }
+    return s;
+}
+
+QJsonObject MediaTransport::localDescription(const QString& peer) {
+    if (!m_socket) return QJsonObject();
+
+    Session* s = session(peer);
+    QJsonObject media;
+    media["udpPort"] = static_cast<int>(port());
+    media["audioSsrc"] = static_cast<double>(s->audioOut.ssrc);
+    media["videoSsrc"] = static_cast<double>(s->videoOut.ssrc);
+    return media;
+}
+
+void MediaTransport::setRemoteDescription(const QString& peer, const QHostAddress& address,
+                                          const QJsonObject& media) {
+    int remotePort = media["udpPort"].toInt();
+    if (!m_socket || remotePort <= 0 || remotePort > 65535 || address.isNull()) return;
+
+    Session* s = session(peer);
+    s->address = plainAddress(address);
+    s->port = static_cast<quint16>(remotePort);
+    s->audioIn = InStream();
+    s->audioIn.ssrc = static_cast<quint32>(media["audioSsrc"].toDouble());
+    s->videoIn = InStream();
+    s->videoIn.ssrc = static_cast<quint32>(media["videoSsrc"].toDouble());
+}
+
+void MediaTransport::endSession(const QString& peer) {
+    Session* s = m_sessions.take(peer);
+    if (!s) return;
+
+    if (s->heardFrom || s->audioOut.packets > 0) {
+        const InStream& in = s->audioIn;
+        quint32 expected = in.started ? in.expected() : 0;
+        qDebug() << "UDP media with" << peer << "- sent" << s->audioOut.packets << "audio packets,"
+                 << s->peerLost << "reported lost; received" << in.received << "of" << expected
+                 << "- jitter" << in.jitter / kAudioClockPerMs << "ms";
+    }
+    delete s;
+}
+
+// === Sending ===
+
+bool MediaTransport::confirmed(const Session* s) const {
+    return s->lastReportAt >= 0 && m_clock.elapsed() - s->lastReportAt < kReportTimeoutMs;
+}
+
+bool MediaTransport::sendPacket(Session* s, OutStream& stream, quint8 payloadType, bool marker,
+                                quint32 timestamp, const char* data, int size) {
+    QByteArray packet(kHeaderSize + size, Qt::Uninitialized);
+    uchar* out = reinterpret_cast<uchar*>(packet.data());
+    out[0] = 0x80; // version 2, no padding, extension or CSRCs
+    out[1] = static_cast<uchar>((marker ? 0x80 : 0) | payloadType);
+    qToBigEndian<quint16>(stream.seq++, out + 2);
+    qToBigEndian<quint32>(timestamp, out + 4);
+    qToBigEndian<quint32>(stream.ssrc, out + 8);
+    memcpy(out + kHeaderSize, data, static_cast<size_t>(size));
+    ++stream.packets;
+
+    // Impairment for testing: the sequence number is spent, so the far end sees a loss
+    if (m_lossPercent > 0 && static_cast<int>(QRandomGenerator::global()->bounded(100)) < m_lossPercent) {
+        return true;
+    }
+    return m_socket->writeDatagram(packet, s->address, s->port) == packet.size();
+}
+
+void MediaTransport::sendProbe(Session* s) {
+    qint64 now = m_clock.elapsed();
+    if (s->lastProbeAt >= 0 && now - s->lastProbeAt < kProbeIntervalMs) return;
+    s->lastProbeAt = now;
+
+    QByteArray packet(kHeaderSize, '\0');
+    uchar* out = reinterpret_cast<uchar*>(packet.data());
+    out[0] = 0x80;
+    out[1] = kProbePayload;
+    qToBigEndian<quint32>(s->audioOut.ssrc, out + 8);
+    m_socket->writeDatagram(packet, s->address, s->port);
+}
+
+bool MediaTransport::sendAudio(const QString& peer, const QByteArray& opus) {
+    Session* s = m_sessions.value(peer);
+    if (!s || !s->port) return false;
+    if (!confirmed(s)) {
+        sendProbe(s);
+        return false;
+    }
+
+    quint32 timestamp = static_cast<quint32>(m_clock.elapsed() * kAudioClockPerMs);
+    return sendPacket(s, s->audioOut, kAudioPayload, false, timestamp, opus.constData(), opus.size());
+}
+
+bool MediaTransport::sendVideo(const QString& peer, const QByteArray& jpeg) {
+    Session* s = m_sessions.value(peer);
+    if (!s || !s->port || jpeg.isEmpty() || jpeg.size() > kMaxVideoFrame) return false;
+    if (!confirmed(s)) {
+        sendProbe(s);
+        return false;
+    }
+
+    quint32 timestamp = static_cast<quint32>(m_clock.elapsed() * kVideoClockPerMs);
+    bool ok = true;
+    for (int offset = 0; offset < jpeg.size(); offset += kMaxFragment) {
+        int size = qMin(kMaxFragment, jpeg.size() - offset);
+        bool last = offset + size == jpeg.size();
+        ok = sendPacket(s, s->videoOut, kVideoPayload, last, timestamp,
+                        jpeg.constData() + offset, size) && ok;
+    }
+    return ok;
+}
+
+// === Receiving ===
+
+void MediaTransport::onReadyRead() {
+    while (m_socket && m_socket->hasPendingDatagrams()) {
+        QNetworkDatagram datagram = m_socket->receiveDatagram();
+        QByteArray packet = datagram.data();
+        if (packet.size() < kHeaderSize || (static_cast<quint8>(packet[0]) & 0xc0) != 0x80) continue;
+
+        const uchar* in = reinterpret_cast<const uchar*>(packet.constData());
+        bool report = in[1] == kReceiverReport;
+        // Reports carry the sender's SSRC at 4, media packets at 8
+        quint32 ssrc = qFromBigEndian<quint32>(in + (report ? 4 : 8));
+        QHostAddress from = plainAddress(datagram.senderAddress());
+
+        QString peer;
+        Session* s = nullptr;
+        for (auto it = m_sessions.constBegin(); it != m_sessions.constEnd(); ++it) {
+            Session* candidate = it.value();
+            if (candidate->address == from
+                && (ssrc == candidate->audioIn.ssrc || ssrc == candidate->videoIn.ssrc)) {
+                peer = it.key();
+                s = candidate;
+                break;
+            }
+        }
+        if (!s) continue;
+
+        if (report) {
+            handleReport(s, packet);
+            continue;
+        }
+
+        // Answer the first thing we hear at once so the peer can switch over
+        bool first = !s->heardFrom;
+        s->heardFrom = true;
+        s->reportDue = true;
+        if (first) sendReports(s);
+
+        quint8 payloadType = in[1] & 0x7f;
+        bool marker = (in[1] & 0x80) != 0;
+        quint16 seq = qFromBigEndian<quint16>(in + 2);
+        quint32 timestamp = qFromBigEndian<quint32>(in + 4);
+
+        if (payloadType == kAudioPayload && ssrc == s->audioIn.ssrc) {
+            int lost = s->audioIn.accept(seq);
+            if (lost < 0) continue;
+            s->audioIn.updateJitter(timestamp, m_clock.elapsed() * kAudioClockPerMs);
+            emit audioReceived(peer, packet.mid(kHeaderSize), lost);
+        } else if (payloadType == kVideoPayload && ssrc == s->videoIn.ssrc) {
+            InStream& video = s->videoIn;
+            int lost = video.accept(seq);
+            if (lost < 0) continue;
+
+            // Anything missing may have been part of this frame
+            if (timestamp != video.frameTimestamp) {
+                video.frameTimestamp = timestamp;
+                video.frame.clear();
+                video.frameBroken = lost > 0;
+            } else if (lost > 0) {
+                video.frameBroken = true;
+            }
+            if (video.frame.size() + packet.size() - kHeaderSize > kMaxVideoFrame) {
+                video.frameBroken = true;
+            }
+            if (!video.frameBroken) {
+                video.frame.append(packet.constData() + kHeaderSize, packet.size() - kHeaderSize);
+            }
+            if (marker) {
+                QByteArray frame = video.frame;
+                bool complete = !video.frameBroken;
+                video.frame.clear();
+                video.frameBroken = true;
+                if (complete) emit videoReceived(peer, frame);
+            }
+        }
+    }
+}
+
+// === Reports ===
+
+void MediaTransport::sendReports(Session* s) {
+    if (!s->port) return;
+    s->reportDue = false;
+
+    InStream* streams[] = {&s->audioIn, &s->videoIn};
+    for (InStream* stream : streams) {
+        // Always report audio, even if only probes came in: that's what
+        // tells the peer its packets get here
+        if (stream != &s->audioIn && !stream->started) continue;
+
+        quint32 expected = stream->started ? stream->expected() : 0;
+        qint64 lost = qMax<qint64>(0, static_cast<qint64>(expected) - stream->received);
+        qint64 expectedInterval = static_cast<qint64>(expected) - stream->expectedPrior;
+        qint64 lostInterval = expectedInterval - (static_cast<qint64>(stream->received) - stream->receivedPrior);
+        stream->expectedPrior = expected;
+        stream->receivedPrior = stream->received;
+        quint8 fraction = (expectedInterval <= 0 || lostInterval <= 0)
+            ? 0 : static_cast<quint8>(qMin<qint64>(255, (lostInterval << 8) / expectedInterval));
+
+        QByteArray packet(kReportSize, '\0');
+        uchar* out = reinterpret_cast<uchar*>(packet.data());
+        out[0] = 0x81; // version 2, one report block
+        out[1] = kReceiverReport;
+        qToBigEndian<quint16>(kReportSize / 4 - 1, out + 2);
+        qToBigEndian<quint32>(s->audioOut.ssrc, out + 4);
+        qToBigEndian<quint32>(stream->ssrc, out + 8);
+        qToBigEndian<quint32>((static_cast<quint32>(fraction) << 24)
+                              | static_cast<quint32>(qMin<qint64>(lost, 0xffffff)), out + 12);
+        qToBigEndian<quint32>(stream->started ? stream->cycles + stream->maxSeq : 0, out + 16);
+        qToBigEndian<quint32>(static_cast<quint32>(stream->jitter), out + 20);
+        m_socket->writeDatagram(packet, s->address, s->port);
+    }
+}
+
+void MediaTransport::handleReport(Session* s, const QByteArray& packet) {
+    if (packet.size() < kReportSize) return;
+
+    const uchar* in = reinterpret_cast<const uchar*>(packet.constData());
+    quint32 source = qFromBigEndian<quint32>(in + 8);
+    if (source != s->audioOut.ssrc && source != s->videoOut.ssrc) return;
+
+    s->lastReportAt = m_clock.elapsed();
+    if (source == s->audioOut.ssrc) {
+        s->peerLost = qFromBigEndian<quint32>(in + 12) & 0xffffff;
+    }
+}
+
+void MediaTransport::onReportTimer() {
+    for (Session* s : m_sessions) {
+        if (s->reportDue) sendReports(s);
+    }
+}
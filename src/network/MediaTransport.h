@@ -0,0 +1,115 @@
+#pragma once
+
+#include <QObject>
+#include <QUdpSocket>
+#include <QHostAddress>
+#include <QJsonObject>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QMap>
+
+// RTP-style UDP media for one-to-one calls, next to the peer WebSocket
+// that carries the signalling. A lost datagram costs one frame, which
+// Opus PLC covers, instead of holding every later frame behind a TCP
+// retransmit.
+//
+// call_offer and call_accept each carry a "media" object with the
+// sender's UDP port and the SSRCs of its audio and video streams.
+// Packets use the RFC 3550 layout: 12-byte header with sequence number,
+// timestamp (16 kHz audio, 90 kHz video) and SSRC. Video frames are split
+// into fragments that share a timestamp, with the marker bit on the last.
+// Every second, each side sends an RTCP-style receiver report for the
+// streams it received.
+//
+// A report from the peer is the only proof the path works. Until one
+// arrives, or if reports stop, send*() returns false and the caller falls
+// back to the WebSocket. Meanwhile a small probe goes out every
+// kProbeIntervalMs so the path can come back.
+class MediaTransport : public QObject {
+    Q_OBJECT
+
+public:
+    explicit MediaTransport(QObject* parent = nullptr);
+    ~MediaTransport();
+
+    bool open();
+    quint16 port() const;
+
+    // Our half of the negotiation with peer, creating its session; empty
+    // if UDP isn't available
+    QJsonObject localDescription(const QString& peer);
+    // The peer's half, from its call_offer or call_accept
+    void setRemoteDescription(const QString& peer, const QHostAddress& address, const QJsonObject& media);
+    void endSession(const QString& peer);
+
+    // False if the UDP path isn't confirmed; send over the WebSocket then
+    bool sendAudio(const QString& peer, const QByteArray& opus);
+    bool sendVideo(const QString& peer, const QByteArray& jpeg);
+
+signals:
+    // lostBefore: frames missing right before this one, for concealment
+    void audioReceived(const QString& peer, const QByteArray& data, int lostBefore);
+    void videoReceived(const QString& peer, const QByteArray& jpegData);
+
+private slots:
+    void onReadyRead();
+    void onReportTimer();
+
+private:
+    struct OutStream {
+        quint32 ssrc = 0;
+        quint16 seq = 0;
+        quint32 packets = 0;
+    };
+
+    // Receive-side sequence tracking after RFC 3550 appendix A.1
+    struct InStream {
+        quint32 ssrc = 0;
+        bool started = false;
+        quint16 maxSeq = 0;
+        quint32 cycles = 0;
+        quint32 baseSeq = 0;
+        quint32 received = 0;
+        quint32 expectedPrior = 0;
+        quint32 receivedPrior = 0;
+        double jitter = 0;       // in timestamp units
+        qint64 lastTransit = 0;
+        // Video reassembly
+        quint32 frameTimestamp = 0;
+        QByteArray frame;
+        bool frameBroken = true;
+
+        // Frames lost just before seq, or -1 for a duplicate or late packet
+        int accept(quint16 seq);
+        quint32 expected() const { return cycles + maxSeq - baseSeq + 1; }
+        void updateJitter(quint32 timestamp, qint64 arrival);
+    };
+
+    struct Session {
+        QHostAddress address;
+        quint16 port = 0;
+        OutStream audioOut;
+        OutStream videoOut;
+        InStream audioIn;
+        InStream videoIn;
+        qint64 lastReportAt = -1; // last report from the peer, i.e. it hears us
+        qint64 lastProbeAt = -1;
+        bool heardFrom = false;     // anything from the peer yet
+        bool reportDue = false;     // received something since our last report
+        quint32 peerLost = 0;       // cumulative, from the peer's reports
+    };
+
+    Session* session(const QString& peer);
+    bool confirmed(const Session* s) const;
+    bool sendPacket(Session* s, OutStream& stream, quint8 payloadType, bool marker,
+                    quint32 timestamp, const char* data, int size);
+    void sendProbe(Session* s);
+    void sendReports(Session* s);
+    void handleReport(Session* s, const QByteArray& packet);
+
+    QUdpSocket* m_socket = nullptr;
+    QTimer* m_reportTimer = nullptr;
+    QElapsedTimer m_clock;
+    QMap<QString, Session*> m_sessions;
+    int m_lossPercent = 0; // SKYPE_MEDIA_LOSS: drop this share of outgoing media
+};
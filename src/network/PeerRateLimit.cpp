@@ -0,0 +1,50 @@
+#include "network/PeerRateLimit.h"
+
+#include <QtGlobal>
+
+namespace {
+struct Limit {
+    qint64 intervalMs; // one message per interval, sustained
+    qint64 burst;      // messages accepted back to back
+};
+
+const Limit kLimits[PeerRateLimit::KindCount] = {
+    {2000, 30},  // Chat: the old 30 a minute
+    {500, 60},   // Receipt: one per message we send, which we don't limit
+    {1000, 5},   // Typing: a client sends one every few seconds while typing
+    {1000, 10},  // Call
+    {2000, 20},  // Group
+    {250, 40},   // File: offers and resumes for a folder's worth of files
+    {5000, 20},  // Identify: per address; room for a few clients on one machine
+    {2000, 30},  // Other
+};
+}
+
+PeerRateLimit::Kind PeerRateLimit::kindOf(const QString& type) {
+    if (type == QLatin1String("message") || type == QLatin1String("group_message")
+        || type == QLatin1String("contact_share")) {
+        return Chat;
+    }
+    if (type == QLatin1String("message_ack")) return Receipt;
+    if (type == QLatin1String("typing") || type == QLatin1String("group_typing")) return Typing;
+    if (type.startsWith(QLatin1String("call_")) || type.startsWith(QLatin1String("conf_"))) return Call;
+    if (type.startsWith(QLatin1String("group_"))) return Group;
+    if (type.startsWith(QLatin1String("file_"))) return File;
+    if (type == QLatin1String("identify")) return Identify;
+    return Other;
+}
+
+bool PeerRateLimit::allow(Kind kind, qint64 now) {
+    const Limit& limit = kLimits[kind];
+    qint64 arrival = qMax(m_arrival[kind], now);
+    if (arrival - now > (limit.burst - 1) * limit.intervalMs) return false;
+    m_arrival[kind] = arrival + limit.intervalMs;
+    return true;
+}
+
+bool PeerRateLimit::idle(qint64 now) const {
+    for (qint64 arrival : m_arrival) {
+        if (arrival > now) return false;
+    }
+    return true;
+}
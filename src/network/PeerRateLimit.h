@@ -0,0 +1,26 @@
+#pragma once
+
+#include <QString>
+#include <array>
+
+// Per-peer limits on incoming JSON messages, one budget per kind of
+// message so a flood of typing notifications can't use up the allowance
+// for chat. Each budget is a GCRA cell: a single "theoretical arrival
+// time" that moves one interval forward per accepted message and may run
+// at most burst - 1 intervals ahead of now. That is a token bucket of
+// size burst refilled every interval, in 8 bytes and with no allocation;
+// the limits live inline in PeerInfo and go away with it.
+class PeerRateLimit {
+public:
+    enum Kind { Chat, Receipt, Typing, Call, Group, File, Identify, Other, KindCount };
+
+    static Kind kindOf(const QString& type);
+
+    // now is ms on any monotonic clock, the same one for every call
+    bool allow(Kind kind, qint64 now);
+    // Every budget full again, i.e. no different from a new PeerRateLimit
+    bool idle(qint64 now) const;
+
+private:
+    std::array<qint64, KindCount> m_arrival{};
+};
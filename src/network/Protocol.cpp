@@ -0,0 +1,269 @@
+#include "network/Protocol.h"
+#include "network/FrameCompressor.h"
+
+#include <QCborMap>
+#include <QCborValue>
+#include <array>
+#include <cstring>
+
+namespace Protocol {
+
+namespace {
+
+struct TypeName {
+    Opcode opcode;
+    const char* name;
+};
+
+// In opcode order, so an opcode indexes its own name
+constexpr TypeName kTypeNames[] = {
+    {Opcode::Hello, "hello"},
+    {Opcode::Login, "login"},
+    {Opcode::LoginResult, "login_result"},
+    {Opcode::Register, "register"},
+    {Opcode::RegisterResult, "register_result"},
+    {Opcode::Message, "message"},
+    {Opcode::MessageAck, "message_ack"},
+    {Opcode::GetContacts, "get_contacts"},
+    {Opcode::ContactList, "contact_list"},
+    {Opcode::AddContact, "add_contact"},
+    {Opcode::AddContactResult, "add_contact_result"},
+    {Opcode::Status, "status"},
+    {Opcode::Presence, "presence"},
+    {Opcode::OfflineMessages, "offline_messages"},
+    {Opcode::PresenceBatch, "presence_batch"},
+    {Opcode::RemoveContact, "remove_contact"},
+    {Opcode::ContactAdded, "contact_added"},
+    {Opcode::ContactRemoved, "contact_removed"},
+    {Opcode::ContactUpdated, "contact_updated"},
+    {Opcode::HistoryFetch, "history_fetch"},
+    {Opcode::History, "history"},
+    {Opcode::GroupCreate, "group_create"},
+    {Opcode::GroupInfo, "group_info"},
+    {Opcode::GroupInvite, "group_invite"},
+    {Opcode::GroupLeave, "group_leave"},
+    {Opcode::GroupMessage, "group_message"},
+    {Opcode::GroupTyping, "group_typing"},
+    {Opcode::ConfCreate, "conf_create"},
+    {Opcode::ConfJoin, "conf_join"},
+    {Opcode::ConfLeave, "conf_leave"},
+    {Opcode::Resume, "resume"},
+    {Opcode::ResumeResult, "resume_result"},
+    {Opcode::OfflineAck, "offline_ack"},
+};
+
+constexpr int kTypeCount = sizeof(kTypeNames) / sizeof(kTypeNames[0]);
+
+// FNV-1a folded to kSlotBits. The seed is picked so every type name lands
+// in its own slot; if a new name collides the static_assert below fires
+// and the seed needs bumping.
+constexpr int kSlotBits = 7;
+constexpr quint32 kHashSeed = 118;
+
+template <typename Char>
+constexpr int slotFor(const Char* data, int size) {
+    quint32 hash = 2166136261u ^ kHashSeed;
+    for (int i = 0; i < size; ++i) {
+        hash ^= static_cast<quint32>(data[i]);
+        hash *= 16777619u;
+    }
+    return static_cast<int>(hash >> (32 - kSlotBits));
+}
+
+constexpr int nameLength(const char* name) {
+    int size = 0;
+    while (name[size]) ++size;
+    return size;
+}
+
+constexpr std::array<Opcode, 1 << kSlotBits> buildSlots() {
+    std::array<Opcode, 1 << kSlotBits> slots{};
+    for (const TypeName& entry : kTypeNames) {
+        slots[slotFor(entry.name, nameLength(entry.name))] = entry.opcode;
+    }
+    return slots;
+}
+
+constexpr std::array<Opcode, 1 << kSlotBits> kSlots = buildSlots();
+
+constexpr bool namesWellFormed() {
+    int used = 0;
+    for (Opcode opcode : kSlots) {
+        if (opcode != Opcode::Unknown) ++used;
+    }
+    for (int i = 0; i < kTypeCount; ++i) {
+        if (static_cast<int>(kTypeNames[i].opcode) != i + 1) return false;
+    }
+    return used == kTypeCount && kTypeCount + 1 == static_cast<int>(Opcode::Count);
+}
+
+static_assert(namesWellFormed(),
+              "type names must be in opcode order and hash to distinct slots");
+
+}
+
+Opcode opcodeForType(QStringView type) {
+    Opcode opcode = kSlots[slotFor(type.utf16(), static_cast<int>(type.size()))];
+    if (opcode == Opcode::Unknown) return opcode;
+
+    // Unknown names can share a slot; confirm it's really this one
+    const char* name = kTypeNames[static_cast<int>(opcode) - 1].name;
+    for (int i = 0; i < type.size(); ++i) {
+        if (type[i].unicode() != static_cast<ushort>(name[i]) || !name[i]) return Opcode::Unknown;
+    }
+    return name[type.size()] ? Opcode::Unknown : opcode;
+}
+
+QLatin1String typeName(Opcode opcode) {
+    int index = static_cast<int>(opcode);
+    if (index <= 0 || index > kTypeCount) return QLatin1String();
+    return QLatin1String(kTypeNames[index - 1].name);
+}
+
+QString typeForOpcode(Opcode opcode) {
+    return typeName(opcode);
+}
+
+QByteArray encodeBinary(const QJsonObject& obj) {
+    Opcode opcode = opcodeForType(obj.value(QLatin1String("type")).toString());
+
+    QJsonObject fields = obj;
+    fields.remove("type");
+
+    QByteArray frame;
+    frame.append(static_cast<char>(kBinaryVersion));
+    frame.append(static_cast<char>(opcode));
+    frame.append(QCborMap::fromJsonObject(fields).toCborValue().toCbor());
+    return frame;
+}
+
+bool decodeBinary(const QByteArray& frame, Opcode& opcode, QJsonObject& obj) {
+    if (frame.size() < 2) return false;
+    if (static_cast<quint8>(frame[0]) != kBinaryVersion) return false;
+
+    quint8 raw = static_cast<quint8>(frame[1]);
+    if (raw == 0 || raw >= static_cast<quint8>(Opcode::Count)) return false;
+    opcode = static_cast<Opcode>(raw);
+
+    // Parse in place rather than copying the payload out with mid()
+    QCborParserError error;
+    QCborValue value = QCborValue::fromCbor(
+        QByteArray::fromRawData(frame.constData() + 2, frame.size() - 2), &error);
+    if (error.error != QCborError::NoError || !value.isMap()) return false;
+
+    obj = value.toMap().toJsonObject();
+    return true;
+}
+
+bool isCompressedFrame(const QByteArray& frame) {
+    return frame.size() >= 2 && static_cast<quint8>(frame[0]) == kCompressedVersion;
+}
+
+QByteArray compressBinary(const QByteArray& frame, FrameCompressor& compressor) {
+    QByteArray payload = compressor.compress(frame.constData() + 2, frame.size() - 2);
+    if (payload.isNull()) return frame;
+
+    QByteArray out;
+    out.reserve(2 + payload.size());
+    out.append(static_cast<char>(kCompressedVersion));
+    out.append(frame[1]);
+    out.append(payload);
+    return out;
+}
+
+bool decompressBinary(const QByteArray& frame, FrameCompressor& compressor,
+                      QByteArray& out, int maxSize) {
+    if (!isCompressedFrame(frame)) return false;
+
+    QByteArray payload;
+    if (!compressor.decompress(frame.constData() + 2, frame.size() - 2, payload, maxSize - 2)) {
+        return false;
+    }
+    out.clear();
+    out.reserve(2 + payload.size());
+    out.append(static_cast<char>(kBinaryVersion));
+    out.append(frame[1]);
+    out.append(payload);
+    return true;
+}
+
+namespace {
+
+void appendMediaHeader(QByteArray& out, const MediaFrame& header, quint8 flags) {
+    out.append(header.video ? "CVD" : "CAU", 3);
+    out.append(static_cast<char>(flags));
+    out.append(reinterpret_cast<const char*>(&header.seq), sizeof(header.seq));
+
+    QByteArray id = header.conferenceId.toUtf8().left(kMediaIdSize);
+    out.append(id);
+    out.append(kMediaIdSize - id.size(), '\0');
+
+    if (flags & kMediaLevel) {
+        out.append(static_cast<char>(qBound(0, header.level, kMediaSilent)));
+    }
+}
+
+void appendSender(QByteArray& out, const QString& sender) {
+    QByteArray name = sender.toUtf8().left(255);
+    out.append(static_cast<char>(name.size()));
+    out.append(name);
+}
+
+}
+
+bool isMediaFrame(const QByteArray& frame) {
+    return frame.size() >= kMediaHeaderSize && frame[0] == 'C'
+        && ((frame[1] == 'A' && frame[2] == 'U') || (frame[1] == 'V' && frame[2] == 'D'));
+}
+
+QByteArray encodeMedia(const MediaFrame& header, const QByteArray& payload) {
+    quint8 flags = header.flags;
+    if (!header.sender.isEmpty()) flags |= kMediaSender;
+
+    QByteArray out;
+    out.reserve(kMediaHeaderSize + 2 + header.sender.size() * 3 + payload.size());
+    appendMediaHeader(out, header, flags);
+    if (flags & kMediaSender) appendSender(out, header.sender);
+    out.append(payload);
+    return out;
+}
+
+bool decodeMedia(const QByteArray& frame, MediaFrame& header) {
+    if (!isMediaFrame(frame)) return false;
+
+    header.video = frame[1] == 'V';
+    header.flags = static_cast<quint8>(frame[3]);
+    memcpy(&header.seq, frame.constData() + 4, sizeof(header.seq));
+
+    const char* id = frame.constData() + 8;
+    header.conferenceId = QString::fromUtf8(id, static_cast<int>(qstrnlen(id, kMediaIdSize)));
+
+    int offset = kMediaHeaderSize;
+    if (header.flags & kMediaLevel) {
+        if (offset >= frame.size()) return false;
+        header.level = static_cast<quint8>(frame[offset++]) & 0x7f;
+    }
+    if (header.flags & kMediaSender) {
+        if (offset >= frame.size()) return false;
+        int length = static_cast<quint8>(frame[offset++]);
+        if (offset + length > frame.size()) return false;
+        header.sender = QString::fromUtf8(frame.constData() + offset, length);
+        offset += length;
+    }
+    header.payloadOffset = offset;
+    return true;
+}
+
+QByteArray forwardMedia(const QByteArray& frame, const MediaFrame& header, const QString& sender) {
+    const char* payload = frame.constData() + header.payloadOffset;
+    const int payloadSize = frame.size() - header.payloadOffset;
+
+    QByteArray out;
+    out.reserve(kMediaHeaderSize + 2 + sender.size() * 3 + payloadSize);
+    appendMediaHeader(out, header, (header.flags & kMediaLevel) | kMediaSender);
+    appendSender(out, sender);
+    out.append(payload, payloadSize);
+    return out;
+}
+
+}
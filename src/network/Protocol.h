@@ -0,0 +1,113 @@
+#pragma once
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QString>
+#include <QStringView>
+
+class FrameCompressor;
+
+// Wire protocol shared by SkypeClient and ChatServer.
+//
+// Every connection starts in JSON text mode. A client that understands the
+// binary format sends {"type":"hello","protocols":["cbor/1"]}; a server that
+// agrees answers {"type":"hello","protocol":"cbor/1"} and from then on both
+// sides send binary frames: one version byte, one opcode byte, then the
+// remaining fields as a CBOR map. WebSocket framing supplies the length.
+// Either side keeps accepting JSON text frames after the switch.
+//
+// The hello may also offer "compression":["deflate"]. If the server
+// answers "compression":"deflate", either side may send a binary frame
+// as kCompressedVersion, the opcode, then the CBOR map deflated through
+// the connection's FrameCompressor. Small frames still go out plain; the
+// answer's "compressionThreshold" and "compressionLevel" say where small
+// ends and how hard to deflate, and the client follows them too.
+namespace Protocol {
+
+const quint8 kBinaryVersion = 1;
+const quint8 kCompressedVersion = 0x81;
+const char* const kBinaryProtocol = "cbor/1";
+const char* const kCompression = "deflate";
+
+// Values are on the wire; only ever append
+enum class Opcode : quint8 {
+    Unknown = 0,
+    Hello,
+    Login,
+    LoginResult,
+    Register,
+    RegisterResult,
+    Message,
+    MessageAck,
+    GetContacts,
+    ContactList,
+    AddContact,
+    AddContactResult,
+    Status,
+    Presence,
+    OfflineMessages,
+    PresenceBatch,
+    RemoveContact,
+    ContactAdded,
+    ContactRemoved,
+    ContactUpdated,
+    HistoryFetch,
+    History,
+    GroupCreate,
+    GroupInfo,
+    GroupInvite,
+    GroupLeave,
+    GroupMessage,
+    GroupTyping,
+    ConfCreate,
+    ConfJoin,
+    ConfLeave,
+    Resume,
+    ResumeResult,
+    OfflineAck,
+    Count
+};
+
+// Perfect-hash lookup; neither direction allocates except typeForOpcode
+Opcode opcodeForType(QStringView type);
+QLatin1String typeName(Opcode opcode);
+QString typeForOpcode(Opcode opcode);
+
+QByteArray encodeBinary(const QJsonObject& obj);
+bool decodeBinary(const QByteArray& frame, Opcode& opcode, QJsonObject& obj);
+
+// Compressed form of an encodeBinary() frame, and back. Media frames and
+// JSON text are never compressed.
+bool isCompressedFrame(const QByteArray& frame);
+QByteArray compressBinary(const QByteArray& frame, FrameCompressor& compressor);
+bool decompressBinary(const QByteArray& frame, FrameCompressor& compressor,
+                      QByteArray& out, int maxSize);
+
+// Conference media travels as its own binary frames, outside the opcode
+// space: "CAU" (audio) or "CVD" (video), a flags byte, a 4-byte sequence
+// number, the conference id NUL-padded to 36 bytes, then the optional
+// fields the flags announce and finally the codec payload.
+const quint8 kMediaLevel = 0x01;  // one byte of audio level, RFC 6464 -dBov: 0 loudest, 127 silent
+const quint8 kMediaSender = 0x02; // length byte + UTF-8 username, added by the relay
+const int kMediaIdSize = 36;
+const int kMediaHeaderSize = 8 + kMediaIdSize;
+const int kMediaSilent = 127;
+
+struct MediaFrame {
+    bool video = false;
+    quint8 flags = 0;
+    quint32 seq = 0;
+    QString conferenceId;
+    int level = kMediaSilent;
+    QString sender;
+    int payloadOffset = 0; // payload is frame.mid(payloadOffset)
+};
+
+bool isMediaFrame(const QByteArray& frame);
+QByteArray encodeMedia(const MediaFrame& header, const QByteArray& payload);
+bool decodeMedia(const QByteArray& frame, MediaFrame& header);
+
+// The uploaded frame with the sender filled in, built once per upload
+QByteArray forwardMedia(const QByteArray& frame, const MediaFrame& header, const QString& sender);
+
+}
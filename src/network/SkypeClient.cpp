@@ -1,26 +1,58 @@
 #include "network/SkypeClient.h"
 
 #include <QJsonDocument>
+#include <QSettings>
+#include <QSet>
+#include <QTimer>
 #include <QDebug>
 
+namespace {
+const int kReconnectMinMs = 250;
+const int kReconnectMaxMs = 10000;
+
+// A full contact list or history page inflates well past the server's
+// inbound limit; anything beyond this is a broken or hostile stream
+const int kMaxInflatedFrame = 16 * 1024 * 1024;
+
+// Roster deltas arrive in bursts; the cache is rewritten once they settle
+const int kRosterSaveDelayMs = 2000;
+}
+
 SkypeClient::SkypeClient(QObject* parent)
     : QObject(parent)
 {
     connect(&m_socket, &QWebSocket::connected, this, &SkypeClient::onConnected);
     connect(&m_socket, &QWebSocket::disconnected, this, &SkypeClient::onDisconnected);
     connect(&m_socket, &QWebSocket::textMessageReceived, this, &SkypeClient::onTextMessage);
+    connect(&m_socket, &QWebSocket::binaryMessageReceived, this, &SkypeClient::onBinaryMessage);
     connect(&m_socket, QOverload<QAbstractSocket::SocketError>::of(&QWebSocket::error),
             this, &SkypeClient::onError);
+
+    m_reconnectTimer.setSingleShot(true);
+    connect(&m_reconnectTimer, &QTimer::timeout, this, [this]() { m_socket.open(m_url); });
+
+    m_rosterSaveTimer.setSingleShot(true);
+    m_rosterSaveTimer.setInterval(kRosterSaveDelayMs);
+    connect(&m_rosterSaveTimer, &QTimer::timeout, this, &SkypeClient::saveRoster);
+}
+
+SkypeClient::~SkypeClient() {
+    if (m_rosterSaveTimer.isActive()) saveRoster();
 }
 
 void SkypeClient::connectToServer(const QString& host, quint16 port) {
-    QString url = QString("ws://%1:%2").arg(host).arg(port);
-    m_socket.open(QUrl(url));
+    m_url = QUrl(QString("ws://%1:%2").arg(host).arg(port));
+    m_socket.open(m_url);
 }
 
 void SkypeClient::login(const QString& username, const QString& password) {
+    // A pending save belongs to the previous account
+    if (m_rosterSaveTimer.isActive()) saveRoster();
     m_username = username;
-    sendJson({{"type", "login"}, {"username", username}, {"password", password}});
+    loadRoster();
+    m_loginRequest = {{"type", "login"}, {"username", username}, {"password", password},
+                      {"rosterVersion", m_rosterVersion}, {"offlineAck", true}};
+    sendJson(m_loginRequest);
 }
 
 void SkypeClient::sendMessage(const QString& to, const QString& text) {
@@ -31,6 +63,76 @@ void SkypeClient::addContact(const QString& contactName) {
     sendJson({{"type", "add_contact"}, {"contact", contactName}});
 }
 
+void SkypeClient::removeContact(const QString& contactName) {
+    sendJson({{"type", "remove_contact"}, {"contact", contactName}});
+}
+
+void SkypeClient::fetchHistory(const QString& contactName, qint64 before, int limit) {
+    QJsonObject request{{"type", "history_fetch"}, {"conversation", contactName}, {"limit", limit}};
+    if (before >= 0) {
+        request["before"] = before;
+    }
+    sendJson(request);
+}
+
+void SkypeClient::createGroup(const QString& groupId, const QString& name,
+                              const QStringList& members) {
+    sendJson({{"type", "group_create"}, {"groupId", groupId}, {"name", name},
+              {"members", QJsonArray::fromStringList(members)}});
+}
+
+void SkypeClient::requestGroupInfo(const QString& groupId) {
+    sendJson({{"type", "group_info"}, {"groupId", groupId}});
+}
+
+void SkypeClient::inviteToGroup(const QString& groupId, const QStringList& members) {
+    sendJson({{"type", "group_invite"}, {"groupId", groupId},
+              {"members", QJsonArray::fromStringList(members)}});
+}
+
+void SkypeClient::leaveGroup(const QString& groupId) {
+    sendJson({{"type", "group_leave"}, {"groupId", groupId}});
+}
+
+void SkypeClient::sendGroupMessage(const QString& groupId, const QString& text) {
+    sendJson({{"type", "group_message"}, {"groupId", groupId}, {"text", text}});
+}
+
+void SkypeClient::sendGroupTyping(const QString& groupId) {
+    sendJson({{"type", "group_typing"}, {"groupId", groupId}});
+}
+
+void SkypeClient::createConference(const QString& conferenceId, const QStringList& participants) {
+    sendJson({{"type", "conf_create"},
+              {"conferenceId", conferenceId},
+              {"participants", QJsonArray::fromStringList(participants)}});
+}
+
+void SkypeClient::joinConference(const QString& conferenceId) {
+    sendJson({{"type", "conf_join"}, {"conferenceId", conferenceId}});
+}
+
+void SkypeClient::leaveConference(const QString& conferenceId) {
+    sendJson({{"type", "conf_leave"}, {"conferenceId", conferenceId}});
+}
+
+void SkypeClient::sendConferenceAudio(const QString& conferenceId, const QByteArray& data, int level) {
+    Protocol::MediaFrame header;
+    header.flags = Protocol::kMediaLevel;
+    header.seq = m_audioSeq++;
+    header.conferenceId = conferenceId;
+    header.level = level;
+    m_socket.sendBinaryMessage(Protocol::encodeMedia(header, data));
+}
+
+void SkypeClient::sendConferenceVideo(const QString& conferenceId, const QByteArray& jpegData) {
+    Protocol::MediaFrame header;
+    header.video = true;
+    header.seq = m_videoSeq++;
+    header.conferenceId = conferenceId;
+    m_socket.sendBinaryMessage(Protocol::encodeMedia(header, jpegData));
+}
+
 void SkypeClient::setStatus(const QString& status) {
     sendJson({{"type", "status"}, {"status", status}});
 }
@@ -45,46 +147,332 @@ bool SkypeClient::isConnected() const {
 
 void SkypeClient::onConnected() {
     qDebug() << "Connected to server";
+
+    // Offer binary framing and compression; stay on plain JSON until the
+    // server agrees
+    m_binary = false;
+    m_compress = false;
+    m_compressor.reset();
+    sendJson({{"type", "hello"},
+              {"protocols", QJsonArray{QString::fromLatin1(Protocol::kBinaryProtocol)}},
+              {"compression", QJsonArray{QString::fromLatin1(Protocol::kCompression)}}});
+
+    if (m_droppedAt.isValid()) {
+        sendJson({{"type", "resume"}, {"username", m_username}, {"token", m_resumeToken},
+                  {"rosterVersion", m_rosterVersion}, {"offlineAck", true}});
+        return;
+    }
     emit connected();
 }
 
 void SkypeClient::onDisconnected() {
     qDebug() << "Disconnected from server";
+    m_binary = false;
+    m_compress = false;
+
+    if (!m_resumeToken.isEmpty()) {
+        if (!m_droppedAt.isValid()) {
+            m_droppedAt.start();
+            m_reconnectDelay = 0;
+        }
+        scheduleReconnect();
+    }
     emit disconnected();
 }
 
+void SkypeClient::scheduleReconnect() {
+    // Quick first retry for a blip, backing off if the server stays away
+    m_reconnectDelay = m_reconnectDelay == 0
+        ? kReconnectMinMs : qMin(m_reconnectDelay * 2, kReconnectMaxMs);
+    m_reconnectTimer.start(m_reconnectDelay);
+}
+
 void SkypeClient::onTextMessage(const QString& message) {
     QJsonDocument doc = QJsonDocument::fromJson(message.toUtf8());
     if (!doc.isObject()) return;
 
     QJsonObject obj = doc.object();
-    QString type = obj["type"].toString();
-
-    if (type == "login_result") {
-        bool success = obj["success"].toBool();
-        QString error = obj["error"].toString();
-        emit loginResult(success, error);
-    } else if (type == "contact_list") {
-        emit contactListReceived(obj["contacts"].toArray());
-    } else if (type == "message") {
+    handleFrame(Protocol::opcodeForType(obj["type"].toString()), obj);
+}
+
+void SkypeClient::onBinaryMessage(const QByteArray& message) {
+    if (Protocol::isMediaFrame(message)) {
+        handleMedia(message);
+        return;
+    }
+
+    QByteArray inflated;
+    if (Protocol::isCompressedFrame(message)
+        && !Protocol::decompressBinary(message, m_compressor, inflated, kMaxInflatedFrame)) {
+        // The stream is out of step from here on; reconnecting resets it
+        qWarning() << "Bad compressed frame from server";
+        m_socket.close(QWebSocketProtocol::CloseCodeProtocolError);
+        return;
+    }
+
+    Protocol::Opcode opcode;
+    QJsonObject obj;
+    if (Protocol::decodeBinary(inflated.isNull() ? message : inflated, opcode, obj)) {
+        handleFrame(opcode, obj);
+    }
+}
+
+void SkypeClient::handleFrame(Protocol::Opcode opcode, const QJsonObject& obj) {
+    using Protocol::Opcode;
+
+    switch (opcode) {
+    case Opcode::Hello:
+        m_binary = obj["protocol"].toString() == QLatin1String(Protocol::kBinaryProtocol);
+        m_compress = m_binary
+            && obj["compression"].toString() == QLatin1String(Protocol::kCompression);
+        // Older servers don't send their policy; the defaults match theirs
+        m_compressThreshold = obj["compressionThreshold"].toInt(CompressionPolicy().threshold);
+        m_compressor.setLevel(obj["compressionLevel"].toInt(CompressionPolicy().level));
+        break;
+    case Opcode::LoginResult:
+        if (!obj["success"].toBool() && obj["retryAfter"].toInt() > 0) {
+            // Server is working through a login storm; ask again later
+            QTimer::singleShot(obj["retryAfter"].toInt(), this, [this]() {
+                if (isConnected() && !m_loginRequest.isEmpty()) sendJson(m_loginRequest);
+            });
+            break;
+        }
+        m_droppedAt.invalidate();
+        if (obj["success"].toBool()) {
+            m_resumeToken = obj["resumeToken"].toString();
+        } else {
+            m_loginRequest = QJsonObject();
+            m_resumeToken.clear();
+        }
+        emit loginResult(obj["success"].toBool(), obj["error"].toString());
+        break;
+    case Opcode::ResumeResult:
+        if (obj["success"].toBool()) {
+            qDebug() << "Session resumed after" << m_droppedAt.elapsed() << "ms";
+            m_resumeToken = obj["resumeToken"].toString();
+            m_droppedAt.invalidate();
+            emit sessionResumed();
+            break;
+        }
+        // Grace period ran out; sign in from scratch
+        m_resumeToken.clear();
+        m_droppedAt.invalidate();
+        if (m_loginRequest.isEmpty()) {
+            emit loginResult(false, "Session expired");
+            break;
+        }
+        m_loginRequest["rosterVersion"] = m_rosterVersion;
+        sendJson(m_loginRequest);
+        break;
+    case Opcode::ContactList:
+        m_roster = obj["contacts"].toArray();
+        m_rosterVersion = obj["rosterVersion"].toVariant().toLongLong();
+        m_rosterShown = true;
+        m_rosterSaveTimer.start();
+        emit contactListReceived(m_roster);
+        break;
+    case Opcode::ContactAdded: {
+        emitCachedRoster();
+        const QJsonArray added = obj["contacts"].toArray();
+        for (const QJsonValue& value : added) {
+            QString username = value.toObject()["username"].toString();
+            bool replaced = false;
+            for (int i = 0; i < m_roster.size() && !replaced; ++i) {
+                if (m_roster[i].toObject()["username"].toString() == username) {
+                    m_roster[i] = value;
+                    replaced = true;
+                }
+            }
+            if (!replaced) m_roster.append(value);
+        }
+        m_rosterVersion = obj["rosterVersion"].toVariant().toLongLong();
+        m_rosterSaveTimer.start();
+        emit contactsAdded(added);
+        break;
+    }
+    case Opcode::ContactRemoved: {
+        emitCachedRoster();
+        QStringList removed;
+        QSet<QString> removedSet;
+        for (const QJsonValue& value : obj["contacts"].toArray()) {
+            removed.append(value.toString());
+            removedSet.insert(value.toString());
+        }
+        for (int i = m_roster.size() - 1; i >= 0; --i) {
+            if (removedSet.contains(m_roster[i].toObject()["username"].toString())) {
+                m_roster.removeAt(i);
+            }
+        }
+        m_rosterVersion = obj["rosterVersion"].toVariant().toLongLong();
+        m_rosterSaveTimer.start();
+        emit contactsRemoved(removed);
+        break;
+    }
+    case Opcode::ContactUpdated:
+        emitCachedRoster();
+        emit contactsUpdated(obj["contacts"].toArray());
+        break;
+    case Opcode::GroupInfo: {
+        QStringList members;
+        for (const QJsonValue& member : obj["members"].toArray()) {
+            members.append(member.toString());
+        }
+        emit groupInfoReceived(obj["groupId"].toString(), obj["name"].toString(),
+                               obj["creator"].toString(), members);
+        break;
+    }
+    case Opcode::GroupInvite: {
+        QStringList members;
+        for (const QJsonValue& member : obj["members"].toArray()) {
+            members.append(member.toString());
+        }
+        emit groupMembersAdded(obj["from"].toString(), obj["groupId"].toString(), members);
+        break;
+    }
+    case Opcode::GroupLeave:
+        emit groupLeaveReceived(obj["from"].toString(), obj["groupId"].toString());
+        break;
+    case Opcode::GroupMessage:
+        emit groupMessageReceived(obj["from"].toString(), obj["groupId"].toString(),
+                                  obj["text"].toString(), obj["timestamp"].toString());
+        break;
+    case Opcode::GroupTyping:
+        emit groupTypingReceived(obj["from"].toString(), obj["groupId"].toString());
+        break;
+    case Opcode::ConfCreate: {
+        QStringList participants;
+        for (const QJsonValue& participant : obj["participants"].toArray()) {
+            participants.append(participant.toString());
+        }
+        emit conferenceCreateReceived(obj["from"].toString(), obj["conferenceId"].toString(),
+                                      participants);
+        break;
+    }
+    case Opcode::ConfJoin:
+        // Our own join is answered with who was already in the call
+        if (obj.contains("from")) {
+            emit conferenceJoinReceived(obj["from"].toString(), obj["conferenceId"].toString());
+        } else {
+            for (const QJsonValue& participant : obj["participants"].toArray()) {
+                emit conferenceJoinReceived(participant.toString(), obj["conferenceId"].toString());
+            }
+        }
+        break;
+    case Opcode::ConfLeave:
+        if (obj.contains("error")) {
+            emit conferenceRejected(obj["conferenceId"].toString(), obj["error"].toString());
+        } else {
+            emit conferenceLeaveReceived(obj["from"].toString(), obj["conferenceId"].toString());
+        }
+        break;
+    case Opcode::History:
+        emit historyReceived(obj["conversation"].toString(), obj["messages"].toArray(),
+                             obj["cursor"].toVariant().toLongLong(), obj["more"].toBool());
+        break;
+    case Opcode::Message:
         emit messageReceived(obj["from"].toString(), obj["text"].toString(),
                              obj["timestamp"].toString());
-    } else if (type == "message_ack") {
+        break;
+    case Opcode::OfflineMessages:
+        for (const QJsonValue& value : obj["messages"].toArray()) {
+            QJsonObject message = value.toObject();
+            if (message.contains("groupId")) {
+                emit groupMessageReceived(message["from"].toString(), message["groupId"].toString(),
+                                          message["text"].toString(), message["timestamp"].toString());
+                continue;
+            }
+            emit messageReceived(message["from"].toString(), message["text"].toString(),
+                                 message["timestamp"].toString());
+        }
+        // Handed on; the server may now drop them
+        if (obj.contains("seq")) {
+            sendJson({{"type", "offline_ack"}, {"seq", obj["seq"]}});
+        }
+        break;
+    case Opcode::MessageAck:
         emit messageAcknowledged(obj["to"].toString(), obj["text"].toString());
-    } else if (type == "presence") {
+        break;
+    case Opcode::Presence:
         emit presenceChanged(obj["username"].toString(), obj["status"].toString());
-    } else if (type == "add_contact_result") {
+        break;
+    case Opcode::PresenceBatch:
+        emit presenceBatchReceived(obj["updates"].toArray());
+        break;
+    case Opcode::AddContactResult:
         if (obj["success"].toBool()) {
             emit contactAdded(obj["contact"].toString());
         }
+        break;
+    default:
+        break;
+    }
+}
+
+// Per server as well as per user: the same name on two servers is two accounts
+QString SkypeClient::rosterKey() const {
+    return QString("roster/%1:%2/%3").arg(m_url.host()).arg(m_url.port()).arg(m_username.toLower());
+}
+
+void SkypeClient::loadRoster() {
+    QSettings settings("SkypeClassic", "SkypeClassic");
+    QJsonObject cached = QJsonDocument::fromJson(settings.value(rosterKey()).toByteArray()).object();
+
+    m_roster = cached["contacts"].toArray();
+    m_rosterVersion = cached["version"].toVariant().toLongLong();
+    m_rosterShown = false;
+}
+
+void SkypeClient::saveRoster() {
+    m_rosterSaveTimer.stop();
+    QSettings settings("SkypeClassic", "SkypeClassic");
+    QJsonObject cached{{"version", m_rosterVersion}, {"contacts", m_roster}};
+    settings.setValue(rosterKey(), QJsonDocument(cached).toJson(QJsonDocument::Compact));
+}
+
+void SkypeClient::emitCachedRoster() {
+    if (m_rosterShown) return;
+    m_rosterShown = true;
+
+    // The server only sent a diff; start from the cached roster with
+    // everyone offline until the status update says otherwise
+    QJsonArray contacts;
+    for (const QJsonValue& value : qAsConst(m_roster)) {
+        QJsonObject contact = value.toObject();
+        contact["status"] = "Offline";
+        contacts.append(contact);
+    }
+    emit contactListReceived(contacts);
+}
+
+void SkypeClient::handleMedia(const QByteArray& frame) {
+    Protocol::MediaFrame header;
+    if (!Protocol::decodeMedia(frame, header) || header.sender.isEmpty()) return;
+
+    if (header.video) {
+        emit conferenceVideoReceived(header.sender, header.conferenceId, frame.mid(header.payloadOffset));
+    } else {
+        emit conferenceAudioReceived(header.sender, header.conferenceId, frame.mid(header.payloadOffset));
     }
 }
 
 void SkypeClient::onError(QAbstractSocket::SocketError error) {
     Q_UNUSED(error);
+    // A failed reconnect attempt never gets as far as disconnected()
+    if (m_droppedAt.isValid() && !isConnected()) {
+        scheduleReconnect();
+        return;
+    }
     emit connectionError(m_socket.errorString());
 }
 
 void SkypeClient::sendJson(const QJsonObject& obj) {
-    m_socket.sendTextMessage(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+    if (m_binary) {
+        QByteArray frame = Protocol::encodeBinary(obj);
+        if (m_compress && m_compressThreshold > 0 && frame.size() >= m_compressThreshold) {
+            frame = Protocol::compressBinary(frame, m_compressor);
+        }
+        m_socket.sendBinaryMessage(frame);
+    } else {
+        m_socket.sendTextMessage(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+    }
 }
@@ -4,43 +4,120 @@
 #include <QWebSocket>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QUrl>
 #include "models/Contact.h"
+#include "network/Protocol.h"
+#include "network/FrameCompressor.h"
 
 class SkypeClient : public QObject {
     Q_OBJECT
 
 public:
     explicit SkypeClient(QObject* parent = nullptr);
+    ~SkypeClient();
 
     void connectToServer(const QString& host, quint16 port = 33033);
     void login(const QString& username, const QString& password);
     void sendMessage(const QString& to, const QString& text);
     void addContact(const QString& contactName);
+    void removeContact(const QString& contactName);
+    // Page of stored messages older than seq "before" (< 0 = the latest)
+    void fetchHistory(const QString& contactName, qint64 before = -1, int limit = 50);
     void setStatus(const QString& status);
     void requestContacts();
 
+    // Server-hosted group chats; the server fans each frame out to members
+    void createGroup(const QString& groupId, const QString& name, const QStringList& members);
+    void requestGroupInfo(const QString& groupId);
+    void inviteToGroup(const QString& groupId, const QStringList& members);
+    void leaveGroup(const QString& groupId);
+    void sendGroupMessage(const QString& groupId, const QString& text);
+    void sendGroupTyping(const QString& groupId);
+
+    // Conference calls relayed by the server: one upload per stream, the
+    // server forwards it to the other participants
+    void createConference(const QString& conferenceId, const QStringList& participants);
+    void joinConference(const QString& conferenceId);
+    void leaveConference(const QString& conferenceId);
+    void sendConferenceAudio(const QString& conferenceId, const QByteArray& data, int level);
+    void sendConferenceVideo(const QString& conferenceId, const QByteArray& jpegData);
+
     bool isConnected() const;
 
 signals:
     void connected();
     void disconnected();
     void loginResult(bool success, const QString& error);
+    // Reconnected after a drop and picked the old login back up
+    void sessionResumed();
     void contactListReceived(const QJsonArray& contacts);
+    void contactsAdded(const QJsonArray& contacts);
+    void contactsRemoved(const QStringList& usernames);
+    void contactsUpdated(const QJsonArray& contacts);
+    void historyReceived(const QString& contactName, const QJsonArray& messages,
+                         qint64 cursor, bool more);
     void messageReceived(const QString& from, const QString& text, const QString& timestamp);
     void messageAcknowledged(const QString& to, const QString& text);
     void presenceChanged(const QString& username, const QString& status);
+    void presenceBatchReceived(const QJsonArray& updates);
     void contactAdded(const QString& contact);
+    void groupInfoReceived(const QString& groupId, const QString& name, const QString& creator,
+                           const QStringList& members);
+    void groupMembersAdded(const QString& from, const QString& groupId, const QStringList& members);
+    void groupLeaveReceived(const QString& from, const QString& groupId);
+    void groupMessageReceived(const QString& from, const QString& groupId, const QString& text,
+                              const QString& timestamp);
+    void groupTypingReceived(const QString& from, const QString& groupId);
+    void conferenceCreateReceived(const QString& from, const QString& conferenceId,
+                                  const QStringList& participants);
+    void conferenceJoinReceived(const QString& from, const QString& conferenceId);
+    void conferenceLeaveReceived(const QString& from, const QString& conferenceId);
+    void conferenceRejected(const QString& conferenceId, const QString& error);
+    void conferenceAudioReceived(const QString& from, const QString& conferenceId, const QByteArray& data);
+    void conferenceVideoReceived(const QString& from, const QString& conferenceId, const QByteArray& jpegData);
     void connectionError(const QString& error);
 
 private slots:
     void onConnected();
     void onDisconnected();
     void onTextMessage(const QString& message);
+    void onBinaryMessage(const QByteArray& message);
     void onError(QAbstractSocket::SocketError error);
 
 private:
     void sendJson(const QJsonObject& obj);
+    void handleFrame(Protocol::Opcode opcode, const QJsonObject& obj);
+    void handleMedia(const QByteArray& frame);
+    void scheduleReconnect();
+    QString rosterKey() const;
+    void loadRoster();
+    void saveRoster();
+    void emitCachedRoster();
 
     QWebSocket m_socket;
+    QUrl m_url;
     QString m_username;
+    bool m_binary = false; // server agreed to CBOR framing
+    bool m_compress = false; // ...and to deflate; frames past the threshold go compressed
+    int m_compressThreshold = CompressionPolicy().threshold; // from the server's hello
+    FrameCompressor m_compressor;
+    QJsonObject m_loginRequest; // resent when busy, or when a resume is refused
+
+    // After a drop the client reconnects on its own and presents the
+    // token from login_result instead of logging in again
+    QString m_resumeToken;
+    QTimer m_reconnectTimer;
+    QElapsedTimer m_droppedAt; // valid while reconnecting
+    int m_reconnectDelay = 0;
+    quint32 m_audioSeq = 0;
+    quint32 m_videoSeq = 0;
+
+    // Last roster seen for m_username, persisted so a login can ask for
+    // just the changes since m_rosterVersion
+    QJsonArray m_roster;
+    qint64 m_rosterVersion = 0;
+    bool m_rosterShown = false; // base roster handed to the app this login
+    QTimer m_rosterSaveTimer;   // deltas are written back once they settle
 };
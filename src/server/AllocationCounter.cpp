@@ -0,0 +1,55 @@
+#include "server/AllocationCounter.h"
+
+#include <atomic>
+#include <cstddef>
+
+#ifdef SKYPE_COUNT_ALLOCATIONS
+
+namespace {
+std::atomic<quint64> g_allocations{0};
+}
+
+// Defined in the executable, these take precedence over libc for every
+// library in the process, Qt included. glibc's own entry points do the work.
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t count, std::size_t size);
+void* __libc_realloc(void* ptr, std::size_t size);
+
+void* malloc(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(std::size_t count, std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+}
+
+#endif
+
+namespace AllocationCounter {
+
+bool counting() {
+#ifdef SKYPE_COUNT_ALLOCATIONS
+    return true;
+#else
+    return false;
+#endif
+}
+
+quint64 count() {
+#ifdef SKYPE_COUNT_ALLOCATIONS
+    return g_allocations.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <QtGlobal>
+
+// Process-wide count of heap allocations (malloc, calloc, realloc, and
+// operator new, which sits on malloc). Only collected in builds configured
+// with -DSKYPE_COUNT_ALLOCATIONS=ON, which interpose the glibc allocator;
+// otherwise counting() is false and count() stays 0.
+namespace AllocationCounter {
+
+bool counting();
+quint64 count();
+
+}
@@ -1,312 +1,1960 @@
 #include "server/ChatServer.h"
+#include "server/UserStore.h"
+#include "server/OfflineQueue.h"
+#include "server/HistoryStore.h"
+#include "server/PasswordHasher.h"
+#include "server/MediaRelay.h"
+#include "server/MetricsServer.h"
+#include "server/ClusterNode.h"
 
 #include <QJsonDocument>
 #include <QJsonArray>
+#include <QDateTime>
+#include <QDir>
+#include <QRandomGenerator>
+#include <QThread>
 #include <QDebug>
+#include <array>
 
-ChatServer::ChatServer(quint16 port, QObject* parent)
+namespace {
+// Proxy sessions get ids from their own range so they never collide with
+// the socket session ids handed out by the shards
+const quint64 kProxySessionBit = 1ULL << 63;
+
+// Roster changes kept per user for catch-up; older clients get a full list
+const int kMaxRosterChanges = 256;
+
+const int kDefaultHistoryPage = 50;
+const int kMaxHistoryPage = 200;
+
+// Suggested wait before a client retries a login refused as busy
+const int kLoginRetryMs = 1000;
+
+const int kMaxGroupMembers = 2000;
+const int kMaxConferenceInvites = 64;
+}
+
+ChatServer::ChatServer(const ServerOptions& options, QObject* parent)
     : QObject(parent)
-    , m_server(new QWebSocketServer("SkypeClassicServer",
-          QWebSocketServer::NonSecureMode, this))
+    , m_options(options)
+    , m_acceptor(new ConnectionAcceptor(
+          [this](qintptr descriptor) { onIncomingConnection(descriptor); }, this))
 {
-    Q_UNUSED(port);
+    m_options.threads = qMax(1, m_options.threads);
+
+    m_presenceTimer.setSingleShot(true);
+    m_presenceTimer.setInterval(m_options.presenceWindowMs);
+    connect(&m_presenceTimer, &QTimer::timeout, this, &ChatServer::flushPresence);
+
+    if (!m_options.dataDirectory.isEmpty()) {
+        m_store = new UserStore(m_options.dataDirectory, this);
+        if (!m_store->open(m_users, m_groups)) {
+            delete m_store;
+            m_store = nullptr;
+        }
+    }
+
+    QString offlineDirectory;
+    if (m_store) {
+        offlineDirectory = QDir(m_options.dataDirectory).filePath("offline");
+    }
+    m_offline = new OfflineQueue(offlineDirectory, this);
+    m_offline->open();
+
+    QString historyDirectory;
+    if (m_store) {
+        historyDirectory = QDir(m_options.dataDirectory).filePath("history");
+    }
+    m_history = new HistoryStore(historyDirectory, this);
+    m_history->open();
 
-    // Create some default accounts
-    m_users["echo123"] = {"echo123", "echo", {}};
-    m_users["alice"] = {"alice", "alice", {"bob", "charlie", "echo123"}};
-    m_users["bob"] = {"bob", "bob", {"alice", "charlie"}};
-    m_users["charlie"] = {"charlie", "charlie", {"alice", "bob"}};
+    m_hasher = new PasswordHasher(m_options.hashThreads, m_options.maxPendingLogins,
+                                  m_options.hashIterations, &m_metrics, this);
+
+    if (m_options.conferenceSpeakers > 0) {
+        m_relay = new MediaRelay(m_options.conferenceSpeakers, &m_metrics);
+    }
+
+    if (m_users.userCount() == 0) {
+        seedDefaultAccounts();
+    } else {
+        // Rebuild the reverse index for accounts loaded from disk; owners
+        // come in id order, so every insert is an append
+        m_watchers.resize(m_users.idCount());
+        m_users.forEachUser([this](UserId id, const ServerUser& user) {
+            for (UserId contact : user.contacts) {
+                m_watchers[static_cast<int>(contact)].insert(id);
+            }
+        });
+    }
+}
+
+void ChatServer::seedDefaultAccounts() {
+    // A handful of hashes at first start; cheap enough to do inline
+    int iterations = m_options.hashIterations;
+    createUser("echo123", CryptoUtils::hashAndStore("echo", iterations));
+    createUser("alice", CryptoUtils::hashAndStore("alice", iterations));
+    createUser("bob", CryptoUtils::hashAndStore("bob", iterations));
+    createUser("charlie", CryptoUtils::hashAndStore("charlie", iterations));
+
+    addContactEdge("alice", "bob");
+    addContactEdge("alice", "charlie");
+    addContactEdge("alice", "echo123");
+    addContactEdge("bob", "alice");
+    addContactEdge("bob", "charlie");
+    addContactEdge("charlie", "alice");
+    addContactEdge("charlie", "bob");
 }
 
 ChatServer::~ChatServer() {
-    m_server->close();
-    for (auto& client : m_clients) {
-        client.socket->close();
+    m_acceptor->close();
+
+    if (m_cluster) {
+        m_cluster->leave();
     }
+
+    if (m_store) {
+        m_store->snapshot();
+    }
+
+    if (m_shardThreads.isEmpty()) {
+        qDeleteAll(m_shards);
+    } else {
+        // Each shard deletes itself on its own thread as the loop winds
+        // down (finished -> deleteLater), so its sockets and timers never
+        // get touched from this one
+        for (QThread* thread : qAsConst(m_shardThreads)) {
+            thread->quit();
+            thread->wait();
+            delete thread;
+        }
+    }
+    m_shards.clear();
+    delete m_relay;
 }
 
 bool ChatServer::start() {
-    if (m_server->listen(QHostAddress::Any, 33033)) {
-        qDebug() << "Chat server listening on port 33033";
-        connect(m_server, &QWebSocketServer::newConnection,
-                this, &ChatServer::onNewConnection);
-        return true;
+    if (!m_acceptor->listen(QHostAddress::Any, m_options.port)) {
+        qWarning() << "Failed to start server:" << m_acceptor->errorString();
+        return false;
+    }
+
+    if (m_options.clusterPort != 0) {
+        QString address = QString("%1:%2").arg(m_options.clusterHost).arg(m_options.clusterPort);
+        QString nodeId = m_options.nodeId.isEmpty() ? address : m_options.nodeId;
+        QHostAddress bindAddress(m_options.clusterBind.isEmpty() ? m_options.clusterHost
+                                                                  : m_options.clusterBind);
+        if (bindAddress.isNull()) {
+            qWarning() << "Cluster listen address must be an IP; use --cluster-bind";
+            return false;
+        }
+        if (m_options.clusterSecret.isEmpty()) {
+            qWarning() << "Clustering needs a shared secret (--cluster-secret or SKYPE_CLUSTER_SECRET)";
+            return false;
+        }
+        m_cluster = new ClusterNode(nodeId, address, m_options.clusterSeeds,
+                                    m_options.clusterSecret, this);
+        connect(m_cluster, &ClusterNode::messageReceived, this, &ChatServer::onClusterMessage);
+        connect(m_cluster, &ClusterNode::membershipChanged, this, &ChatServer::onMembershipChanged);
+        if (!m_cluster->start(bindAddress, m_options.clusterPort)) {
+            return false;
+        }
     }
-    qWarning() << "Failed to start server:" << m_server->errorString();
-    return false;
-}
 
-void ChatServer::onNewConnection() {
-    auto* socket = m_server->nextPendingConnection();
-    connect(socket, &QWebSocket::textMessageReceived, this, &ChatServer::onTextMessage);
-    connect(socket, &QWebSocket::disconnected, this, &ChatServer::onDisconnected);
+    if (m_options.metricsPort != 0) {
+        m_metricsServer = new MetricsServer([this]() { return renderMetrics(); }, this);
+        m_metricsServer->listen(QHostAddress::LocalHost, m_options.metricsPort);
+    }
 
-    ConnectedClient client;
-    client.socket = socket;
-    m_clients.append(client);
+    auto sink = [this](ShardEvent event) { postEvent(std::move(event)); };
 
-    qDebug() << "New connection from" << socket->peerAddress().toString();
+    if (m_options.threads == 1) {
+        // Single shard shares the core thread; no cross-thread handoff
+        m_shards.append(new ServerShard(0, sink, &m_metrics, m_options.backpressure));
+        m_shards.first()->setMediaRelay(m_relay);
+        m_shards.first()->setCompression(m_options.compression);
+    } else {
+        for (int i = 0; i < m_options.threads; ++i) {
+            auto* thread = new QThread;
+            thread->setObjectName(QString("shard-%1").arg(i));
+            auto* shard = new ServerShard(i, sink, &m_metrics, m_options.backpressure);
+            shard->setMediaRelay(m_relay);
+            shard->setCompression(m_options.compression);
+            shard->moveToThread(thread);
+            connect(thread, &QThread::finished, shard, &QObject::deleteLater);
+            thread->start();
+            m_shards.append(shard);
+            m_shardThreads.append(thread);
+        }
+    }
+
+    qDebug() << "Chat server listening on port" << m_options.port
+             << "with" << m_shards.size() << "shard(s)";
+    return true;
 }
 
-void ChatServer::onTextMessage(const QString& message) {
-    auto* socket = qobject_cast<QWebSocket*>(sender());
-    if (!socket) return;
+void ChatServer::onIncomingConnection(qintptr descriptor) {
+    // Least-loaded shard gets the new socket
+    ServerShard* target = m_shards.first();
+    for (ServerShard* shard : qAsConst(m_shards)) {
+        if (shard->sessionCount() < target->sessionCount()) {
+            target = shard;
+        }
+    }
+    target->adoptDescriptor(descriptor);
+}
 
-    if (message.size() > 65536) {
-        qWarning() << "Dropping oversized message:" << message.size() << "bytes";
+void ChatServer::postEvent(ShardEvent event) {
+    if (QThread::currentThread() == thread()) {
+        handleEvent(event);
         return;
     }
 
-    QJsonDocument doc = QJsonDocument::fromJson(message.toUtf8());
-    if (!doc.isObject()) return;
+    event.queuedAt = ServerMetrics::now();
+    m_metrics.coreQueueDepth.fetch_add(1, std::memory_order_relaxed);
+    m_events.push(std::move(event));
+    if (!m_drainScheduled.exchange(true, std::memory_order_acq_rel)) {
+        QMetaObject::invokeMethod(this, &ChatServer::drainEvents, Qt::QueuedConnection);
+    }
+}
 
-    QJsonObject obj = doc.object();
-    QString type = obj["type"].toString();
+void ChatServer::drainEvents() {
+    m_drainScheduled.exchange(false, std::memory_order_acq_rel);
 
-    if (type == "login") {
-        handleLogin(socket, obj);
-    } else if (type == "register") {
-        handleRegister(socket, obj);
-    } else if (type == "message") {
-        handleMessage(socket, obj);
-    } else if (type == "get_contacts") {
-        handleContactList(socket);
-    } else if (type == "add_contact") {
-        handleAddContact(socket, obj);
-    } else if (type == "status") {
-        handleStatusChange(socket, obj);
+    ShardEvent event;
+    while (m_events.pop(event)) {
+        m_metrics.coreQueueDepth.fetch_sub(1, std::memory_order_relaxed);
+        m_metrics.coreQueueDelay.record(ServerMetrics::now() - event.queuedAt);
+        handleEvent(event);
     }
 }
 
-void ChatServer::onDisconnected() {
-    auto* socket = qobject_cast<QWebSocket*>(sender());
-    if (!socket) return;
+void ChatServer::handleEvent(const ShardEvent& event) {
+    switch (event.kind) {
+    case ShardEvent::Opened:
+        m_sessions.add(event.sessionId, m_shards.value(event.shard));
+        break;
+    case ShardEvent::Frame:
+        if (Session* session = m_sessions.byId(event.sessionId)) {
+            handleFrame(session, event.opcode, event.data);
+        }
+        break;
+    case ShardEvent::Closed:
+        if (Session* session = m_sessions.byId(event.sessionId)) {
+            handleClosed(session, event.data["undelivered"].toArray());
+        }
+        break;
+    }
+}
 
-    QString username;
-    for (int i = 0; i < m_clients.size(); ++i) {
-        if (m_clients[i].socket == socket) {
-            username = m_clients[i].username;
-            m_clients.removeAt(i);
-            break;
+void ChatServer::handleFrame(Session* session, Protocol::Opcode opcode, const QJsonObject& obj) {
+    using Protocol::Opcode;
+
+    if (m_cluster && session->shard && routeFrame(session, opcode, obj)) return;
+
+    // Opcode-indexed jump table; unset slots are frames clients may not send
+    static const std::array<FrameHandler, static_cast<size_t>(Opcode::Count)> handlers = [] {
+        std::array<FrameHandler, static_cast<size_t>(Opcode::Count)> table{};
+        table[static_cast<size_t>(Opcode::Login)] = &ChatServer::handleLogin;
+        table[static_cast<size_t>(Opcode::Register)] = &ChatServer::handleRegister;
+        table[static_cast<size_t>(Opcode::Resume)] = &ChatServer::handleResume;
+        table[static_cast<size_t>(Opcode::Message)] = &ChatServer::handleMessage;
+        table[static_cast<size_t>(Opcode::OfflineAck)] = &ChatServer::handleOfflineAck;
+        table[static_cast<size_t>(Opcode::GetContacts)] = &ChatServer::handleGetContacts;
+        table[static_cast<size_t>(Opcode::AddContact)] = &ChatServer::handleAddContact;
+        table[static_cast<size_t>(Opcode::RemoveContact)] = &ChatServer::handleRemoveContact;
+        table[static_cast<size_t>(Opcode::HistoryFetch)] = &ChatServer::handleHistoryFetch;
+        table[static_cast<size_t>(Opcode::Status)] = &ChatServer::handleStatusChange;
+        table[static_cast<size_t>(Opcode::GroupCreate)] = &ChatServer::handleGroupFrame<Opcode::GroupCreate>;
+        table[static_cast<size_t>(Opcode::GroupInfo)] = &ChatServer::handleGroupFrame<Opcode::GroupInfo>;
+        table[static_cast<size_t>(Opcode::GroupInvite)] = &ChatServer::handleGroupFrame<Opcode::GroupInvite>;
+        table[static_cast<size_t>(Opcode::GroupLeave)] = &ChatServer::handleGroupFrame<Opcode::GroupLeave>;
+        table[static_cast<size_t>(Opcode::GroupMessage)] = &ChatServer::handleGroupFrame<Opcode::GroupMessage>;
+        table[static_cast<size_t>(Opcode::GroupTyping)] = &ChatServer::handleGroupFrame<Opcode::GroupTyping>;
+        table[static_cast<size_t>(Opcode::ConfCreate)] = &ChatServer::handleConfCreate;
+        table[static_cast<size_t>(Opcode::ConfJoin)] = &ChatServer::handleConfJoin;
+        table[static_cast<size_t>(Opcode::ConfLeave)] = &ChatServer::handleConfLeave;
+        return table;
+    }();
+
+    size_t index = static_cast<size_t>(opcode);
+    if (index >= handlers.size() || !handlers[index]) return;
+
+    if (!MetricsRecording::on()) {
+        (this->*handlers[index])(session, obj);
+        return;
+    }
+    quint64 startedAt = ServerMetrics::now();
+    (this->*handlers[index])(session, obj);
+    m_metrics.handlerLatency[index].record(ServerMetrics::now() - startedAt);
+}
+
+void ChatServer::handleClosed(Session* session, const QJsonArray& undelivered) {
+    if (m_relay && session->shard && !session->username.isEmpty()) {
+        const auto left = m_relay->leaveAll(session->id);
+        for (auto it = left.constBegin(); it != left.constEnd(); ++it) {
+            notifyConference(it.value(), {{"type", "conf_leave"},
+                                          {"from", session->username},
+                                          {"conferenceId", it.key()}});
+        }
+    }
+
+    if (!session->homeNode.isEmpty()) {
+        // The user lives elsewhere; let their home node sign them out
+        QJsonObject closed{{"kind", "closed"}, {"session", qint64(session->id)}};
+        if (!undelivered.isEmpty()) {
+            closed["undelivered"] = undelivered;
+        }
+        m_cluster->send(session->homeNode, closed);
+    } else {
+        if (!session->shard) {
+            m_proxies.remove(qMakePair(session->edgeNode, session->remoteId));
+        }
+        QString username = session->username;
+        if (!parkSession(session)) {
+            releaseUser(session);
         }
+        requeueUndelivered(username, undelivered);
     }
+    m_sessions.remove(session);
+}
+
+void ChatServer::releaseUser(Session* session) {
+    QString username = session->username;
+    m_sessions.unbindUser(session);
 
-    if (!username.isEmpty()) {
-        m_onlineStatus.remove(username);
-        broadcastPresence(username, "Offline");
+    // Only go offline if no newer session took over the name
+    if (!username.isEmpty() && !m_sessions.byUsername(username)) {
+        UserId id = m_users.intern(username);
+        setStatus(id, Presence::Offline);
+        broadcastPresence(id, Presence::Offline);
         qDebug() << username << "disconnected";
     }
+}
 
-    socket->deleteLater();
+void ChatServer::requeueUndelivered(const QString& username, const QJsonArray& frames) {
+    if (username.isEmpty()) return;
+
+    // Messages a dropped socket never read; stored offline unless the user
+    // already has a newer session
+    for (const QJsonValue& value : frames) {
+        const QJsonObject frame = value.toObject();
+        // A batch waiting for offline_ack is still queued
+        if (frame.contains("seq")) continue;
+        const QJsonArray messages = frame["type"].toString() == "offline_messages"
+            ? frame["messages"].toArray() : QJsonArray{frame};
+        for (const QJsonValue& message : messages) {
+            QJsonObject obj = message.toObject();
+            if (obj.contains("groupId")) {
+                obj["type"] = "group_message";
+                deliverGroupFrame({username}, obj, true);
+                continue;
+            }
+            deliverMessage(obj["from"].toString(), username, obj["text"].toString(),
+                           obj["timestamp"].toString());
+        }
+    }
 }
 
-void ChatServer::handleLogin(QWebSocket* socket, const QJsonObject& data) {
+// Password checks run on the hasher's pool and finish in a callback. The
+// session may be gone by then, so callbacks carry its id, not the pointer.
+void ChatServer::handleLogin(Session* session, const QJsonObject& data) {
+    if (session->credentialPending) return;
+
     QString username = data["username"].toString().toLower();
     QString password = data["password"].toString();
+    quint64 sessionId = session->id;
+    bool accepted = false;
 
-    // Auto-register if user doesn't exist
-    if (!m_users.contains(username)) {
-        ServerUser newUser;
-        newUser.username = username;
-        newUser.password = password;
-        newUser.contacts << "echo123";
-        m_users[username] = newUser;
+    if (password.isEmpty() && !m_options.allowEmptyPasswords) {
+        m_metrics.loginFailures.add();
+        sendJson(session, {{"type", "login_result"}, {"success", false},
+                           {"error", "Password required"}});
+        return;
+    }
 
-        // Add to echo123's contacts too
-        if (m_users.contains("echo123")) {
-            m_users["echo123"].contacts.append(username);
-        }
+    const ServerUser* user = m_users.user(username);
+    if (!user) {
+        // Auto-register once the password is hashed
+        accepted = m_hasher->hash(password, [this, sessionId, username, data](
+                                                const PasswordHasher::Result& result) {
+            Session* session = resumeCredentialCheck(sessionId);
+            if (!session) return;
+
+            if (m_users.contains(username)) {
+                // Someone registered the name meanwhile; check against theirs
+                handleLogin(session, data);
+                return;
+            }
+
+            createUser(username, result.credential);
+            addContactEdge(username, "echo123");
+
+            // Add to echo123's contacts too
+            requestContactEdge("echo123", username);
+            completeLogin(session, username, data);
+        });
+    } else {
+        QString stored = user->password;
+        accepted = m_hasher->verify(password, stored, [this, sessionId, username, stored, data](
+                                                         const PasswordHasher::Result& result) {
+            Session* session = resumeCredentialCheck(sessionId);
+            if (!session) return;
+
+            ServerUser* user = m_users.user(username);
+            if (!result.ok || !user) {
+                m_metrics.loginFailures.add();
+                sendJson(session, {{"type", "login_result"}, {"success", false},
+                                   {"error", "Invalid password"}});
+                return;
+            }
+
+            // Plaintext or weaker hash: store the upgraded one, unless the
+            // account changed while we were hashing
+            if (!result.credential.isEmpty() && user->password == stored) {
+                user->password = result.credential;
+                if (m_store) {
+                    m_store->logUser(username, result.credential);
+                    maybeSnapshot();
+                }
+            }
+            completeLogin(session, username, data);
+        });
     }
 
-    ServerUser& user = m_users[username];
-    if (user.password != password && !password.isEmpty()) {
-        sendJson(socket, {{"type", "login_result"}, {"success", false},
-                          {"error", "Invalid password"}});
+    if (!accepted) {
+        sendBusy(session, "login_result");
         return;
     }
+    session->credentialPending = true;
+}
 
-    // Associate socket with username
-    for (auto& client : m_clients) {
-        if (client.socket == socket) {
-            client.username = username;
-            break;
-        }
+Session* ChatServer::resumeCredentialCheck(quint64 sessionId) {
+    Session* session = m_sessions.byId(sessionId);
+    if (session) {
+        session->credentialPending = false;
     }
+    return session;
+}
+
+void ChatServer::sendBusy(Session* session, const char* resultType) {
+    sendJson(session, {{"type", resultType}, {"success", false},
+                       {"error", "Server busy, try again shortly"},
+                       {"retryAfter", kLoginRetryMs}});
+}
 
-    m_onlineStatus[username] = "Online";
+void ChatServer::completeLogin(Session* session, const QString& username, const QJsonObject& data) {
+    // Associate session with username; a full login supersedes a parked one
+    dropParked(username);
+    m_sessions.bindUser(session, username);
 
-    sendJson(socket, {{"type", "login_result"}, {"success", true},
-                      {"username", username}});
+    const UserId id = m_users.intern(username);
+    setStatus(id, Presence::Online);
 
-    // Send contact list
-    handleContactList(socket);
+    QJsonObject result{{"type", "login_result"}, {"success", true}, {"username", username}};
+    const QString token = issueResumeToken(session);
+    if (!token.isEmpty()) {
+        result["resumeToken"] = token;
+        result["resumeGraceMs"] = m_options.resumeGraceMs;
+    }
+    sendJson(session, result);
+
+    // Send the roster, or just what changed since the client's copy
+    session->rosterDeltas = data.contains("rosterVersion");
+    sendRoster(session, data["rosterVersion"]);
+
+    // Hand over anything that arrived while they were away
+    session->offlineAcks = data["offlineAck"].toBool();
+    deliverOfflineMessages(session);
 
     // Broadcast that this user is online
-    broadcastPresence(username, "Online");
+    broadcastPresence(id, Presence::Online);
 
     qDebug() << username << "logged in";
 }
 
-void ChatServer::handleRegister(QWebSocket* socket, const QJsonObject& data) {
+// A resume picks a parked login back up: no roster, no presence broadcast,
+// just whatever the user missed while the socket was gone
+void ChatServer::handleResume(Session* session, const QJsonObject& data) {
+    const QString token = data["token"].toString();
+    const QString username = data["username"].toString().toLower();
+
+    auto parked = m_parked.find(token);
+    const bool loggedIn = !session->username.isEmpty()
+                       && m_sessions.byUsername(session->username) == session;
+    if (parked == m_parked.end() || parked->username != username
+        || session->credentialPending || loggedIn) {
+        // Unknown, expired or mismatched; the client falls back to login
+        m_metrics.resumeFailures.add();
+        sendJson(session, {{"type", "resume_result"}, {"success", false}});
+        return;
+    }
+
+    const QHash<QString, QString> presence = parked->presence;
+    const qint64 parkedVersion = qint64(parked->rosterVersion);
+    m_parked.erase(parked);
+    m_parkedTokens.remove(username);
+
+    m_sessions.bindUser(session, username);
+    session->rosterDeltas = true;
+    sendJson(session, {{"type", "resume_result"}, {"success", true}, {"username", username},
+                       {"resumeToken", issueResumeToken(session)},
+                       {"resumeGraceMs", m_options.resumeGraceMs}});
+
+    // Roster edits made elsewhere meanwhile; nothing if the copy is current
+    const ServerUser* user = m_users.user(username);
+    const QJsonValue version = data.contains("rosterVersion")
+        ? data["rosterVersion"] : QJsonValue(parkedVersion);
+    if (user && version.toDouble(-1) != double(user->rosterVersion)) {
+        sendRoster(session, version);
+    }
+
+    if (!presence.isEmpty()) {
+        QJsonArray updates;
+        for (auto it = presence.constBegin(); it != presence.constEnd(); ++it) {
+            updates.append(QJsonObject{{"username", it.key()}, {"status", it.value()}});
+        }
+        sendJson(session, {{"type", "presence_batch"}, {"updates", updates}});
+        m_metrics.presenceFrames.add();
+    }
+
+    session->offlineAcks = data["offlineAck"].toBool();
+    deliverOfflineMessages(session);
+    m_metrics.sessionsResumed.add();
+    qDebug() << username << "resumed";
+}
+
+QString ChatServer::issueResumeToken(Session* session) {
+    if (m_options.resumeGraceMs <= 0) return QString();
+
+    quint64 bits[2];
+    QRandomGenerator::system()->fillRange(bits);
+    session->resumeToken = QString::fromLatin1(
+        QByteArray(reinterpret_cast<const char*>(bits), sizeof(bits)).toHex());
+    return session->resumeToken;
+}
+
+bool ChatServer::parkSession(Session* session) {
+    const QString username = session->username;
+    if (session->resumeToken.isEmpty() || username.isEmpty()
+        || m_sessions.byUsername(username) != session) {
+        return false;
+    }
+
+    // Still online as far as anyone else can tell
+    m_sessions.unbindUser(session);
+    dropParked(username);
+    const ServerUser* user = m_users.user(username);
+    const quint64 version = user ? user->rosterVersion : 0;
+    m_parked.insert(session->resumeToken, {username, version, {}});
+    m_parkedTokens.insert(username, session->resumeToken);
+    m_metrics.sessionsParked.add();
+
+    const QString token = session->resumeToken;
+    QTimer::singleShot(m_options.resumeGraceMs, this, [this, token]() { expireParked(token); });
+    return true;
+}
+
+void ChatServer::expireParked(const QString& token) {
+    auto parked = m_parked.find(token);
+    if (parked == m_parked.end()) return;
+
+    const QString username = parked->username;
+    m_parked.erase(parked);
+    m_parkedTokens.remove(username);
+    m_metrics.parkedExpired.add();
+
+    if (!m_sessions.byUsername(username)) {
+        UserId id = m_users.intern(username);
+        setStatus(id, Presence::Offline);
+        broadcastPresence(id, Presence::Offline);
+        qDebug() << username << "disconnected";
+    }
+}
+
+void ChatServer::dropParked(const QString& username) {
+    const QString token = m_parkedTokens.take(username);
+    if (!token.isEmpty()) {
+        m_parked.remove(token);
+    }
+}
+
+void ChatServer::handleRegister(Session* session, const QJsonObject& data) {
+    if (session->credentialPending) return;
+
     QString username = data["username"].toString().toLower();
     QString password = data["password"].toString();
 
+    if (password.isEmpty() && !m_options.allowEmptyPasswords) {
+        sendJson(session, {{"type", "register_result"}, {"success", false},
+                           {"error", "Password required"}});
+        return;
+    }
     if (m_users.contains(username)) {
-        sendJson(socket, {{"type", "register_result"}, {"success", false},
-                          {"error", "Username already exists"}});
+        sendJson(session, {{"type", "register_result"}, {"success", false},
+                           {"error", "Username already exists"}});
         return;
     }
 
-    ServerUser newUser;
-    newUser.username = username;
-    newUser.password = password;
-    newUser.contacts << "echo123";
-    m_users[username] = newUser;
+    quint64 sessionId = session->id;
+    bool accepted = m_hasher->hash(password, [this, sessionId, username](
+                                                const PasswordHasher::Result& result) {
+        Session* session = resumeCredentialCheck(sessionId);
 
-    sendJson(socket, {{"type", "register_result"}, {"success", true}});
-}
+        // The name may have been taken while hashing
+        bool created = !m_users.contains(username);
+        if (created) {
+            createUser(username, result.credential);
+            addContactEdge(username, "echo123");
+        }
+        if (!session) return;
 
-void ChatServer::handleMessage(QWebSocket* socket, const QJsonObject& data) {
-    QString from;
-    for (auto& client : m_clients) {
-        if (client.socket == socket) {
-            from = client.username;
-            break;
+        if (created) {
+            sendJson(session, {{"type", "register_result"}, {"success", true}});
+        } else {
+            sendJson(session, {{"type", "register_result"}, {"success", false},
+                               {"error", "Username already exists"}});
         }
+    });
+
+    if (!accepted) {
+        sendBusy(session, "register_result");
+        return;
     }
+    session->credentialPending = true;
+}
+
+// The relay path spells keys with QStringLiteral/QLatin1String: a plain
+// "literal" converts to a heap-allocated QString on every use.
+void ChatServer::handleMessage(Session* session, const QJsonObject& data) {
+    const QString& from = session->username;
     if (from.isEmpty()) return;
 
-    QString to = data["to"].toString();
-    QString text = data["text"].toString();
-
-    // Relay to recipient if online
-    QWebSocket* recipientSocket = findClientSocket(to);
-    if (recipientSocket) {
-        sendJson(recipientSocket, {
-            {"type", "message"},
-            {"from", from},
-            {"text", text},
-            {"timestamp", QDateTime::currentDateTime().toString(Qt::ISODate)}
-        });
+    const QString to = data.value(QLatin1String("to")).toString();
+    const QString text = data.value(QLatin1String("text")).toString();
+    const QString timestamp = currentTimestamp();
+    bool queued = false;
+
+    // The recipient's home node relays or queues it
+    QString home = homeOf(to);
+    if (home.isEmpty()) {
+        queued = relayMessage(from, to, text, timestamp);
+    } else {
+        m_cluster->send(home, {{"kind", "relay"}, {"from", from}, {"to", to},
+                               {"text", text}, {"timestamp", timestamp}});
     }
 
     // Echo service: auto-reply
-    if (to == "echo123") {
-        QJsonObject echo;
-        echo["type"] = "message";
-        echo["from"] = "echo123";
-        echo["text"] = QString("Echo: %1").arg(text);
-        echo["timestamp"] = QDateTime::currentDateTime().toString(Qt::ISODate);
-        sendJson(socket, echo);
+    if (to == QLatin1String("echo123")) {
+        sendJson(session, {
+            {QStringLiteral("type"), QStringLiteral("message")},
+            {QStringLiteral("from"), QStringLiteral("echo123")},
+            {QStringLiteral("text"), QStringLiteral("Echo: ") + text},
+            {QStringLiteral("timestamp"), timestamp}
+        });
+        recordHistory(QStringLiteral("echo123"), from, QStringLiteral("Echo: ") + text, timestamp);
     }
 
     // Acknowledge to sender
-    sendJson(socket, {
-        {"type", "message_ack"},
-        {"to", to},
-        {"text", text},
-        {"timestamp", QDateTime::currentDateTime().toString(Qt::ISODate)}
+    sendJson(session, {
+        {QStringLiteral("type"), QStringLiteral("message_ack")},
+        {QStringLiteral("to"), to},
+        {QStringLiteral("text"), text},
+        {QStringLiteral("timestamp"), timestamp},
+        {QStringLiteral("queued"), queued}
     });
 }
 
-void ChatServer::handleContactList(QWebSocket* socket) {
-    QString username;
-    for (auto& client : m_clients) {
-        if (client.socket == socket) {
-            username = client.username;
-            break;
+bool ChatServer::relayMessage(const QString& from, const QString& to,
+                              const QString& text, const QString& timestamp) {
+    // Runs on the recipient's home node, which knows whether the account exists
+    if (m_users.contains(to)) {
+        recordHistory(from, to, text, timestamp);
+    }
+    return deliverMessage(from, to, text, timestamp);
+}
+
+bool ChatServer::deliverMessage(const QString& from, const QString& to,
+                                const QString& text, const QString& timestamp) {
+    // Relay to recipient if online, otherwise store for their next login
+    Session* recipient = m_sessions.byUsername(to);
+    if (recipient) {
+        sendJson(recipient, {
+            {QStringLiteral("type"), QStringLiteral("message")},
+            {QStringLiteral("from"), from},
+            {QStringLiteral("text"), text},
+            {QStringLiteral("timestamp"), timestamp}
+        });
+        m_metrics.messagesRelayed.add();
+        return false;
+    }
+
+    if (to != QLatin1String("echo123") && m_users.contains(to)) {
+        bool queued = m_offline->enqueue(to, {from, text, timestamp});
+        if (queued) m_metrics.messagesQueued.add();
+        return queued;
+    }
+    return false;
+}
+
+template <Protocol::Opcode opcode>
+void ChatServer::handleGroupFrame(Session* session, const QJsonObject& data) {
+    routeGroupFrame(session, opcode, data);
+}
+
+void ChatServer::routeGroupFrame(Session* session, Protocol::Opcode opcode, const QJsonObject& data) {
+    const QString& from = session->username;
+    const QString groupId = data.value(QLatin1String("groupId")).toString();
+    if (from.isEmpty() || groupId.isEmpty()) return;
+
+    // The group's home node owns its membership and does the fan-out
+    QString home = homeOf(groupId);
+    if (!home.isEmpty()) {
+        m_cluster->send(home, {{"kind", "group"}, {"from", from},
+                               {"session", QString::number(session->id)},
+                               {"opcode", static_cast<int>(opcode)}, {"data", data}});
+        return;
+    }
+    applyGroupFrame(opcode, from, QString(), session->id, data);
+}
+
+// Runs on the group's home node. origin is the node holding the sender's
+// session (empty = this one), for frames that answer the sender only.
+void ChatServer::applyGroupFrame(Protocol::Opcode opcode, const QString& from, const QString& origin,
+                                 quint64 sessionId, const QJsonObject& data) {
+    using Protocol::Opcode;
+
+    const QString groupId = data.value(QLatin1String("groupId")).toString();
+    auto groupIt = m_groups.find(groupId);
+
+    if (opcode == Opcode::GroupCreate) {
+        // Ids are client-made UUIDs; an existing one means a resend
+        if (groupIt != m_groups.end()) return;
+
+        ServerGroup group;
+        group.id = groupId;
+        group.name = data["name"].toString();
+        group.creator = from;
+        group.members.insert(from);
+        QHash<QString, QStringList> remote;
+        QJsonArray rejected;
+        const QStringList local = vetGroupMembers(data["members"].toArray(), group.members,
+                                                  remote, rejected);
+        for (const QString& username : local) {
+            if (group.members.size() >= kMaxGroupMembers) break;
+            group.members.insert(username);
+        }
+        groupIt = m_groups.insert(groupId, group);
+
+        if (m_store) {
+            m_store->logGroup(groupId, group.name, from);
+            for (const QString& member : qAsConst(group.members)) {
+                m_store->logGroupMember(groupId, member);
+            }
+            maybeSnapshot();
+        }
+
+        QJsonObject info = groupInfo(*groupIt);
+        fanOutGroup(groupIt->members, info, {from}, false);
+        if (!rejected.isEmpty()) info["rejected"] = rejected;
+        replyTo(origin, sessionId, info);
+        requestGroupVouch(groupId, from, origin, sessionId, remote, false);
+        return;
+    }
+
+    // Everything else is for members only
+    if (groupIt == m_groups.end() || !groupIt->members.contains(from)) return;
+
+    switch (opcode) {
+    case Opcode::GroupInfo:
+        replyTo(origin, sessionId, groupInfo(*groupIt));
+        break;
+    case Opcode::GroupMessage: {
+        // Built once; shards encode it once per wire format for all members
+        const QJsonObject frame{
+            {QStringLiteral("type"), QStringLiteral("group_message")},
+            {QStringLiteral("groupId"), groupId},
+            {QStringLiteral("from"), from},
+            {QStringLiteral("text"), data.value(QLatin1String("text")).toString()},
+            {QStringLiteral("timestamp"), currentTimestamp()}
+        };
+        m_metrics.groupMessages.add();
+        fanOutGroup(groupIt->members, frame, {from}, true);
+        break;
+    }
+    case Opcode::GroupTyping:
+        fanOutGroup(groupIt->members, {{"type", "group_typing"}, {"groupId", groupId}, {"from", from}},
+                    {from}, false);
+        break;
+    case Opcode::GroupInvite: {
+        QHash<QString, QStringList> remote;
+        QJsonArray rejected;
+        addGroupMembers(*groupIt, from, vetGroupMembers(data["members"].toArray(), groupIt->members,
+                                                        remote, rejected));
+        if (!rejected.isEmpty()) {
+            QJsonObject info = groupInfo(*groupIt);
+            info["rejected"] = rejected;
+            replyTo(origin, sessionId, info);
+        }
+        requestGroupVouch(groupId, from, origin, sessionId, remote, false);
+        break;
+    }
+    case Opcode::GroupLeave:
+        groupIt->members.remove(from);
+        if (m_store) {
+            m_store->logGroupMemberRemoved(groupId, from);
+            maybeSnapshot();
+        }
+        if (groupIt->members.isEmpty()) {
+            m_groups.erase(groupIt);
+        } else {
+            fanOutGroup(groupIt->members, {{"type", "group_leave"}, {"groupId", groupId},
+                                           {"from", from}},
+                        {}, false);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Only accounts may join a group, or whoever registers a listed name
+// later would find themselves in it. Names homed here are checked now;
+// the rest are grouped by home node for requestGroupVouch().
+QStringList ChatServer::vetGroupMembers(const QJsonArray& names, const QSet<QString>& current,
+                                        QHash<QString, QStringList>& remote,
+                                        QJsonArray& rejected) const {
+    QStringList local;
+    for (const QJsonValue& value : names) {
+        QString username = value.toString().toLower();
+        if (username.isEmpty() || current.contains(username) || local.contains(username)) continue;
+
+        QString home = homeOf(username);
+        if (!home.isEmpty()) {
+            if (!remote[home].contains(username)) remote[home].append(username);
+        } else if (m_users.contains(username)) {
+            local.append(username);
+        } else {
+            rejected.append(username);
+        }
+    }
+    return local;
+}
+
+// Asks each home node which of its names are accounts; the answer comes
+// back as group_vouched. prune: the names are members already, from a
+// handoff, and only the rejected ones are dropped.
+void ChatServer::requestGroupVouch(const QString& groupId, const QString& from, const QString& origin,
+                                   quint64 sessionId, const QHash<QString, QStringList>& remote,
+                                   bool prune) {
+    for (auto it = remote.constBegin(); it != remote.constEnd(); ++it) {
+        m_cluster->send(it.key(), {{"kind", "group_vouch"}, {"groupId", groupId}, {"from", from},
+                                   {"origin", origin}, {"session", QString::number(sessionId)},
+                                   {"members", QJsonArray::fromStringList(it.value())},
+                                   {"prune", prune}});
+    }
+}
+
+void ChatServer::addGroupMembers(ServerGroup& group, const QString& from, const QStringList& names) {
+    QSet<QString> added;
+    QJsonArray addedList;
+    for (const QString& username : names) {
+        if (group.members.size() >= kMaxGroupMembers) break;
+        if (group.members.contains(username)) continue;
+        group.members.insert(username);
+        added.insert(username);
+        addedList.append(username);
+        if (m_store) m_store->logGroupMember(group.id, username);
+    }
+    if (added.isEmpty()) return;
+    if (m_store) maybeSnapshot();
+
+    // Newcomers get the whole group, everyone else just the names
+    fanOutGroup(added, groupInfo(group), {}, false);
+    QSet<QString> skip = added;
+    skip.insert(from);
+    fanOutGroup(group.members, {{"type", "group_invite"}, {"groupId", group.id},
+                                {"from", from}, {"members", addedList}},
+                skip, false);
+}
+
+void ChatServer::replyTo(const QString& origin, quint64 sessionId, const QJsonObject& obj) {
+    if (origin.isEmpty()) {
+        if (Session* session = m_sessions.byId(sessionId)) {
+            sendJson(session, obj);
+        }
+    } else {
+        m_cluster->send(origin, {{"kind", "group_reply"}, {"session", QString::number(sessionId)},
+                                 {"data", obj}});
+    }
+}
+
+QJsonObject ChatServer::groupInfo(const ServerGroup& group) const {
+    QJsonArray members;
+    for (const QString& member : group.members) {
+        members.append(member);
+    }
+    return {{"type", "group_info"}, {"groupId", group.id}, {"name", group.name},
+            {"creator", group.creator}, {"members", members}};
+}
+
+void ChatServer::fanOutGroup(const QSet<QString>& members, const QJsonObject& frame,
+                             const QSet<QString>& skip, bool queueOffline) {
+    // Members homed here are delivered directly; the rest go to their home
+    // node as one message per node carrying the frame and the names
+    QStringList local;
+    QHash<QString, QJsonArray> remote;
+    for (const QString& member : members) {
+        if (skip.contains(member)) continue;
+        QString home = homeOf(member);
+        if (home.isEmpty()) {
+            local.append(member);
+        } else {
+            remote[home].append(member);
+        }
+    }
+
+    deliverGroupFrame(local, frame, queueOffline);
+    for (auto it = remote.constBegin(); it != remote.constEnd(); ++it) {
+        m_cluster->send(it.key(), {{"kind", "group_deliver"}, {"members", it.value()},
+                                   {"data", frame}, {"queue", queueOffline}});
+    }
+}
+
+void ChatServer::deliverGroupFrame(const QStringList& members, const QJsonObject& frame,
+                                   bool queueOffline) {
+    // One broadcast command per shard instead of one send per member
+    QHash<ServerShard*, QVector<quint64>> byShard;
+    for (const QString& member : members) {
+        Session* session = m_sessions.byUsername(member);
+        if (session && session->shard) {
+            byShard[session->shard].append(session->id);
+        } else if (session) {
+            sendJson(session, frame); // proxy; the socket is on another node
+        } else if (queueOffline && m_users.contains(member)) {
+            bool queued = m_offline->enqueue(member, {
+                frame.value(QLatin1String("from")).toString(),
+                frame.value(QLatin1String("text")).toString(),
+                frame.value(QLatin1String("timestamp")).toString(),
+                frame.value(QLatin1String("groupId")).toString()
+            });
+            if (queued) m_metrics.messagesQueued.add();
+        }
+    }
+
+    for (auto it = byShard.begin(); it != byShard.end(); ++it) {
+        m_metrics.groupDeliveries.add(static_cast<quint64>(it.value().size()));
+        ShardCommand command;
+        command.kind = ShardCommand::Broadcast;
+        command.data = frame;
+        command.sessionIds = std::move(it.value());
+        it.key()->post(std::move(command));
+    }
+}
+
+void ChatServer::logGroupRemoval(const ServerGroup& group) {
+    if (!m_store) return;
+    // The last member out deletes the group on replay
+    for (const QString& member : group.members) {
+        m_store->logGroupMemberRemoved(group.id, member);
+    }
+    maybeSnapshot();
+}
+
+// Conference calls live on the node holding the participants' sockets,
+// since that is where their media arrives; see routeFrame()
+void ChatServer::handleConfCreate(Session* session, const QJsonObject& data) {
+    const QString conferenceId = data["conferenceId"].toString();
+    if (!joinConference(session, conferenceId)) return;
+
+    QJsonArray participants = data["participants"].toArray();
+    while (participants.size() > kMaxConferenceInvites) participants.removeLast();
+
+    QVector<quint64> invitees;
+    for (const QJsonValue& value : qAsConst(participants)) {
+        Session* invitee = m_sessions.byUsername(value.toString().toLower());
+        if (invitee && invitee != session && invitee->shard) {
+            invitees.append(invitee->id);
+        }
+    }
+    notifyConference(invitees, {{"type", "conf_create"},
+                                {"from", session->username},
+                                {"conferenceId", conferenceId},
+                                {"participants", participants}});
+}
+
+// No invite check: anyone logged in who knows the id can join, so the id
+// (a client-generated UUID) is the only thing keeping a call private
+void ChatServer::handleConfJoin(Session* session, const QJsonObject& data) {
+    joinConference(session, data["conferenceId"].toString());
+}
+
+void ChatServer::handleConfLeave(Session* session, const QJsonObject& data) {
+    if (!m_relay || session->username.isEmpty()) return;
+
+    const QString conferenceId = data["conferenceId"].toString();
+    notifyConference(m_relay->leave(conferenceId, session->id),
+                     {{"type", "conf_leave"},
+                      {"from", session->username},
+                      {"conferenceId", conferenceId}});
+}
+
+bool ChatServer::joinConference(Session* session, const QString& conferenceId) {
+    if (session->username.isEmpty() || !session->shard) return false;
+    // Media frames carry the id as kMediaIdSize UTF-8 bytes
+    if (conferenceId.isEmpty() || conferenceId.toUtf8().size() > Protocol::kMediaIdSize) return false;
+
+    QString error;
+    QStringList present;
+    if (!m_relay) {
+        error = "Conference calls are disabled on this server";
+    } else if (!m_relay->join(conferenceId, session->id, session->shard, session->username, &present)) {
+        error = "Conference is full";
+    }
+    if (!error.isEmpty()) {
+        sendJson(session, {{"type", "conf_leave"}, {"conferenceId", conferenceId}, {"error", error}});
+        return false;
+    }
+
+    // The joiner learns who is already there; they learn about the joiner
+    sendJson(session, {{"type", "conf_join"},
+                       {"conferenceId", conferenceId},
+                       {"participants", QJsonArray::fromStringList(present)}});
+
+    QVector<quint64> others = m_relay->members(conferenceId);
+    others.removeAll(session->id);
+    notifyConference(others, {{"type", "conf_join"},
+                              {"from", session->username},
+                              {"conferenceId", conferenceId}});
+    return true;
+}
+
+void ChatServer::notifyConference(const QVector<quint64>& sessionIds, const QJsonObject& frame) {
+    QHash<ServerShard*, QVector<quint64>> byShard;
+    for (quint64 sessionId : sessionIds) {
+        Session* member = m_sessions.byId(sessionId);
+        if (member && member->shard) byShard[member->shard].append(sessionId);
+    }
+    for (auto it = byShard.begin(); it != byShard.end(); ++it) {
+        ShardCommand command;
+        command.kind = ShardCommand::Broadcast;
+        command.data = frame;
+        command.sessionIds = std::move(it.value());
+        it.key()->post(std::move(command));
+    }
+}
+
+void ChatServer::deliverOfflineMessages(Session* session) {
+    if (m_offline->pendingFor(session->username) == 0) return;
+
+    // A client that confirms batches gets the messages tombstoned only
+    // once its offline_ack for them arrives; older clients as sent
+    const QList<OfflineMessage> messages = session->offlineAcks
+        ? m_offline->peek(session->username)
+        : m_offline->take(session->username);
+
+    // One frame per batch instead of one per message
+    const int batchSize = 1000;
+    for (int start = 0; start < messages.size(); start += batchSize) {
+        QJsonArray batch;
+        int end = qMin(start + batchSize, messages.size());
+        for (int i = start; i < end; ++i) {
+            const OfflineMessage& message = messages[i];
+            QJsonObject entry{
+                {"from", message.from},
+                {"text", message.text},
+                {"timestamp", message.timestamp}
+            };
+            if (!message.group.isEmpty()) {
+                entry["groupId"] = message.group;
+            }
+            batch.append(entry);
+        }
+        QJsonObject frame{{"type", "offline_messages"}, {"messages", batch}};
+        if (session->offlineAcks) {
+            frame["seq"] = qint64(messages[end - 1].seq);
         }
+        sendJson(session, frame);
     }
+
+    qDebug() << "Delivered" << messages.size() << "offline messages to" << session->username;
+}
+
+void ChatServer::handleOfflineAck(Session* session, const QJsonObject& data) {
+    const double seq = data["seq"].toDouble(-1);
+    if (session->username.isEmpty() || seq < 0) return;
+    m_offline->acknowledge(session->username, quint64(seq));
+}
+
+void ChatServer::handleContactList(Session* session) {
+    const QString& username = session->username;
     if (username.isEmpty()) return;
 
+    const ServerUser* user = m_users.user(username);
+    if (!user) return;
+
     QJsonArray contactArray;
-    for (auto& contactName : m_users[username].contacts) {
-        QJsonObject contactObj;
-        contactObj["username"] = contactName;
-        contactObj["displayName"] = contactName;
-        contactObj["status"] = m_onlineStatus.value(contactName, "Offline");
-        contactArray.append(contactObj);
+    for (UserId contact : user->contacts) {
+        contactArray.append(contactEntry(contact));
     }
 
-    sendJson(socket, {{"type", "contact_list"}, {"contacts", contactArray}});
+    sendJson(session, {{"type", "contact_list"}, {"contacts", contactArray},
+                       {"rosterVersion", qint64(user->rosterVersion)}});
 }
 
-void ChatServer::handleAddContact(QWebSocket* socket, const QJsonObject& data) {
-    QString username;
-    for (auto& client : m_clients) {
-        if (client.socket == socket) {
-            username = client.username;
-            break;
+void ChatServer::sendRoster(Session* session, const QJsonValue& clientVersion) {
+    const UserId owner = m_users.find(session->username);
+    const ServerUser* user = m_users.user(owner);
+    if (!user) return;
+
+    const double requested = clientVersion.toDouble(-1);
+    if (!session->rosterDeltas || requested < 0) {
+        handleContactList(session);
+        return;
+    }
+
+    // A diff needs every change after the client's version still in the log
+    const quint64 current = user->rosterVersion;
+    const quint64 have = static_cast<quint64>(requested);
+    const QVector<RosterChange> changes = m_rosterChanges.value(owner);
+    bool covered = have <= current
+        && (have == current || (!changes.isEmpty() && changes.first().version <= have + 1));
+    if (!covered) {
+        handleContactList(session);
+        return;
+    }
+
+    // Only the last change per contact matters
+    QHash<UserId, RosterChange::Kind> net;
+    for (const RosterChange& change : changes) {
+        if (change.version > have) net.insert(change.contact, change.kind);
+    }
+
+    QJsonArray added;
+    QJsonArray removed;
+    for (auto it = net.constBegin(); it != net.constEnd(); ++it) {
+        if (it.value() == RosterChange::Added) {
+            added.append(contactEntry(it.key()));
+        } else {
+            removed.append(m_users.name(it.key()));
+        }
+    }
+
+    const qint64 version = qint64(current);
+    if (!removed.isEmpty()) {
+        sendJson(session, {{"type", "contact_removed"}, {"contacts", removed},
+                           {"rosterVersion", version}});
+    }
+    if (!added.isEmpty()) {
+        sendJson(session, {{"type", "contact_added"}, {"contacts", added},
+                           {"rosterVersion", version}});
+    }
+
+    // Cached statuses are stale after a reconnect; list whoever isn't
+    // offline. Always sent, so it doubles as the end-of-sync marker.
+    QJsonArray statuses;
+    for (UserId contact : user->contacts) {
+        Presence status = statusOf(contact);
+        if (status != Presence::Offline) {
+            statuses.append(QJsonObject{{"username", m_users.name(contact)},
+                                        {"status", presenceName(status)}});
         }
     }
+    sendJson(session, {{"type", "contact_updated"}, {"contacts", statuses},
+                       {"rosterVersion", version}});
+}
+
+QJsonObject ChatServer::contactEntry(UserId contact) const {
+    const QString name = m_users.name(contact);
+    return {
+        {"username", name},
+        {"displayName", name},
+        {"status", presenceName(statusOf(contact))}
+    };
+}
+
+void ChatServer::handleGetContacts(Session* session, const QJsonObject& data) {
+    Q_UNUSED(data);
+    handleContactList(session);
+}
+
+void ChatServer::handleAddContact(Session* session, const QJsonObject& data) {
+    const QString username = session->username;
     if (username.isEmpty()) return;
 
     QString contactName = data["contact"].toString().toLower();
 
-    if (!m_users[username].contacts.contains(contactName)) {
-        m_users[username].contacts.append(contactName);
+    // Names are only interned once an account is known to exist, so
+    // made-up contacts can't grow the directory or the per-id arrays
+    const QString home = homeOf(contactName);
+    if (!home.isEmpty()) {
+        // The contact's home adds its side and, if the account exists,
+        // sends back the edge for this side
+        m_cluster->send(home, {{"kind", "edge"}, {"owner", contactName},
+                               {"contact", username}, {"confirm", true}});
+        sendJson(session, {{"type", "add_contact_result"}, {"success", true},
+                           {"contact", contactName}, {"pending", true}});
+        return;
     }
+    if (!m_users.contains(contactName)) {
+        sendJson(session, {{"type", "add_contact_result"}, {"success", false},
+                           {"contact", contactName}, {"error", "No such user"}});
+        return;
+    }
+
+    // Both sides get a contact_added delta (or a full list on old clients)
+    addContactEdge(username, contactName);
+    addContactEdge(contactName, username);
+
+    sendJson(session, {{"type", "add_contact_result"}, {"success", true},
+                       {"contact", contactName}});
+}
+
+void ChatServer::handleRemoveContact(Session* session, const QJsonObject& data) {
+    const QString username = session->username;
+    if (username.isEmpty()) return;
 
-    // Mutual add
-    if (m_users.contains(contactName)) {
-        if (!m_users[contactName].contacts.contains(username)) {
-            m_users[contactName].contacts.append(username);
+    // One-sided, like the client's "Remove from Contact List"
+    removeContactEdge(username, data["contact"].toString().toLower());
+}
+
+void ChatServer::handleHistoryFetch(Session* session, const QJsonObject& data) {
+    const QString& username = session->username;
+    if (username.isEmpty()) return;
+
+    const QString peer = data["conversation"].toString().toLower();
+    const qint64 before = data.contains("before") ? qint64(data["before"].toDouble()) : -1;
+    const int limit = qBound(1, data["limit"].toInt(kDefaultHistoryPage), kMaxHistoryPage);
+
+    // Conversations are placed on the ring by their own key
+    const QString key = HistoryStore::conversationKey(username, peer);
+    const QString node = homeOf(key);
+    if (node.isEmpty()) {
+        sendJson(session, historyReply(peer, key, before, limit));
+    } else {
+        // Proxy ids use the top bit, which a JSON double can't carry
+        m_cluster->send(node, {{"kind", "history_fetch"},
+                               {"session", QString::number(session->id)},
+                               {"conversation", key}, {"peer", peer},
+                               {"before", before}, {"limit", limit}});
+    }
+}
+
+QJsonObject ChatServer::historyReply(const QString& peer, const QString& conversation,
+                                     qint64 before, int limit) {
+    HistoryPage page = m_history->fetch(conversation, before, limit);
+    return {
+        {"type", "history"},
+        {"conversation", peer},
+        {"messages", page.messages},
+        {"cursor", page.first},
+        {"more", page.more()}
+    };
+}
+
+void ChatServer::recordHistory(const QString& from, const QString& to,
+                               const QString& text, const QString& timestamp) {
+    const QString key = HistoryStore::conversationKey(from, to);
+    const QString node = homeOf(key);
+    if (node.isEmpty()) {
+        m_history->append(key, from, text, timestamp);
+    } else {
+        m_cluster->send(node, {{"kind", "history_append"}, {"conversation", key},
+                               {"from", from}, {"text", text}, {"timestamp", timestamp}});
+    }
+}
+
+void ChatServer::handleStatusChange(Session* session, const QJsonObject& data) {
+    const QString& username = session->username;
+    if (username.isEmpty()) return;
+
+    UserId id = m_users.intern(username);
+    Presence status = presenceFromName(data["status"].toString());
+    setStatus(id, status);
+    broadcastPresence(id, status);
+}
+
+void ChatServer::sendJson(Session* session, const QJsonObject& obj) {
+    if (!session->shard) {
+        // Proxy: the socket lives on the edge node
+        m_cluster->send(session->edgeNode, {{"kind", "deliver"},
+                                            {"session", qint64(session->remoteId)},
+                                            {"data", obj}});
+        return;
+    }
+
+    ShardCommand command;
+    command.kind = ShardCommand::Send;
+    command.sessionId = session->id;
+    command.data = obj;
+    session->shard->post(std::move(command));
+}
+
+QString ChatServer::currentTimestamp() {
+    // Local-time ISO formatting goes through the time zone code; the
+    // format has one-second resolution, so redo it once a second at most
+    const qint64 second = QDateTime::currentMSecsSinceEpoch() / 1000;
+    if (second != m_timestampSecond) {
+        m_timestampSecond = second;
+        m_timestamp = QDateTime::fromSecsSinceEpoch(second).toString(Qt::ISODate);
+    }
+    return m_timestamp;
+}
+
+Presence ChatServer::statusOf(UserId id) const {
+    return id < static_cast<UserId>(m_status.size()) ? m_status.at(static_cast<int>(id))
+                                                     : Presence::Offline;
+}
+
+void ChatServer::setStatus(UserId id, Presence status) {
+    if (id >= static_cast<UserId>(m_status.size())) {
+        if (status == Presence::Offline) return;
+        m_status.resize(m_users.idCount());
+    }
+    m_status[static_cast<int>(id)] = status;
+}
+
+UserIdList& ChatServer::watchersOf(UserId id) {
+    if (id >= static_cast<UserId>(m_watchers.size())) {
+        m_watchers.resize(m_users.idCount());
+    }
+    return m_watchers[static_cast<int>(id)];
+}
+
+void ChatServer::broadcastPresence(UserId id, Presence status) {
+    // Later changes in the same window overwrite earlier ones
+    m_pendingPresence[id] = status;
+
+    if (m_options.presenceWindowMs <= 0) {
+        flushPresence();
+    } else if (!m_presenceTimer.isActive()) {
+        m_presenceTimer.start();
+    }
+}
+
+void ChatServer::createUser(const QString& username, const QString& credential) {
+    m_users.create(username).password = credential;
+
+    if (m_store) {
+        m_store->logUser(username, credential);
+        maybeSnapshot();
+    }
+}
+
+void ChatServer::flushPresence() {
+    QHash<UserId, Presence> pending;
+    pending.swap(m_pendingPresence);
+
+    // Group every change by the watcher that needs to hear about it;
+    // watchers homed on other nodes are batched per node
+    QHash<QString, QJsonArray> local;
+    QHash<QString, QHash<QString, QJsonArray>> remote;
+    for (auto change = pending.constBegin(); change != pending.constEnd(); ++change) {
+        if (change.key() >= static_cast<UserId>(m_watchers.size())) continue;
+        const UserIdList& watchers = m_watchers.at(static_cast<int>(change.key()));
+
+        QJsonObject update{{"username", m_users.name(change.key())},
+                           {"status", presenceName(change.value())}};
+        for (UserId watcherId : watchers) {
+            if (watcherId == change.key()) continue;
+
+            const QString watcher = m_users.name(watcherId);
+            QString home = homeOf(watcher);
+            if (!home.isEmpty()) {
+                remote[home][watcher].append(update);
+            } else if (m_sessions.byUsername(watcher) || m_parkedTokens.contains(watcher)) {
+                // Parked logins are unbound but hold updates for the resume
+                local[watcher].append(update);
+            }
         }
+    }
+
+    deliverPresence(local);
 
-        // Notify the other user
-        QWebSocket* otherSocket = findClientSocket(contactName);
-        if (otherSocket) {
-            handleContactList(otherSocket);
+    for (auto node = remote.constBegin(); node != remote.constEnd(); ++node) {
+        QJsonObject updates;
+        for (auto it = node->constBegin(); it != node->constEnd(); ++it) {
+            updates.insert(it.key(), it.value());
         }
+        m_cluster->send(node.key(), {{"kind", "presence"}, {"updates", updates}});
+    }
+}
+
+void ChatServer::deliverPresence(const QHash<QString, QJsonArray>& updates) {
+    for (auto it = updates.constBegin(); it != updates.constEnd(); ++it) {
+        Session* session = m_sessions.byUsername(it.key());
+        if (!session) {
+            // Held for a parked login and replayed if it resumes
+            auto token = m_parkedTokens.constFind(it.key());
+            if (token != m_parkedTokens.constEnd()) {
+                QHash<QString, QString>& presence = m_parked[*token].presence;
+                for (const QJsonValue& value : *it) {
+                    const QJsonObject update = value.toObject();
+                    presence.insert(update["username"].toString(), update["status"].toString());
+                }
+            }
+            continue;
+        }
+
+        if (it->size() == 1) {
+            // Single change: plain presence frame, understood by older clients
+            QJsonObject presenceMsg = it->first().toObject();
+            presenceMsg["type"] = "presence";
+            sendJson(session, presenceMsg);
+        } else {
+            sendJson(session, {{"type", "presence_batch"}, {"updates", *it}});
+        }
+        m_metrics.presenceFrames.add();
+    }
+}
+
+bool ChatServer::addContactEdge(const QString& owner, const QString& contact) {
+    const UserId ownerId = m_users.intern(owner);
+    const UserId contactId = m_users.intern(contact);
+    ServerUser* user = m_users.user(ownerId);
+    if (!user) return false;
+    UserIdList& watchers = watchersOf(contactId);
+
+    // Remote watchers share the index in a cluster, so a hit needs checking
+    if (watchers.contains(ownerId) && (!m_cluster || user->contacts.contains(contactId))) {
+        return false;
+    }
+
+    watchers.insert(ownerId);
+    user->contacts.insert(contactId);
+    recordRosterChange(ownerId, RosterChange::Added, contactId);
+
+    // Presence for a remote contact is sent by its home node
+    QString home = homeOf(contact);
+    if (!home.isEmpty()) {
+        m_cluster->send(home, {{"kind", "watch"},
+                               {"edges", QJsonArray{QJsonArray{contact, owner}}}});
+    }
+
+    if (m_store) {
+        m_store->logContact(owner, contact);
+        maybeSnapshot();
+    }
+    return true;
+}
+
+void ChatServer::requestContactEdge(const QString& owner, const QString& contact) {
+    QString home = homeOf(owner);
+    if (!home.isEmpty()) {
+        m_cluster->send(home, {{"kind", "edge"}, {"owner", owner}, {"contact", contact}});
+        return;
+    }
+
+    if (!m_users.contains(owner)) return;
+    addContactEdge(owner, contact);
+}
+
+bool ChatServer::removeContactEdge(const QString& owner, const QString& contact) {
+    const UserId ownerId = m_users.find(owner);
+    const UserId contactId = m_users.find(contact);
+    ServerUser* user = m_users.user(ownerId);
+    if (!user || !user->contacts.remove(contactId)) return false;
+
+    watchersOf(contactId).remove(ownerId);
+    recordRosterChange(ownerId, RosterChange::Removed, contactId);
+
+    QString home = homeOf(contact);
+    if (!home.isEmpty()) {
+        m_cluster->send(home, {{"kind", "unwatch"},
+                               {"edges", QJsonArray{QJsonArray{contact, owner}}}});
+    }
+
+    if (m_store) {
+        m_store->logContactRemoved(owner, contact);
+        maybeSnapshot();
     }
+    return true;
+}
 
-    handleContactList(socket);
+void ChatServer::recordRosterChange(UserId owner, RosterChange::Kind kind, UserId contact) {
+    ServerUser* user = m_users.user(owner);
+    if (!user) return;
+    const quint64 version = ++user->rosterVersion;
+
+    QVector<RosterChange>& changes = m_rosterChanges[owner];
+    changes.append({version, kind, contact});
+    if (changes.size() > kMaxRosterChanges) {
+        changes.remove(0, changes.size() - kMaxRosterChanges);
+    }
 
-    sendJson(socket, {{"type", "add_contact_result"}, {"success", true},
-                      {"contact", contactName}});
+    Session* session = m_sessions.byUsername(m_users.name(owner));
+    if (!session) return;
+
+    if (!session->rosterDeltas) {
+        handleContactList(session);
+    } else if (kind == RosterChange::Added) {
+        sendJson(session, {{"type", "contact_added"},
+                           {"contacts", QJsonArray{contactEntry(contact)}},
+                           {"rosterVersion", qint64(version)}});
+    } else {
+        sendJson(session, {{"type", "contact_removed"},
+                           {"contacts", QJsonArray{m_users.name(contact)}},
+                           {"rosterVersion", qint64(version)}});
+    }
 }
 
-void ChatServer::handleStatusChange(QWebSocket* socket, const QJsonObject& data) {
-    QString username;
-    for (auto& client : m_clients) {
-        if (client.socket == socket) {
-            username = client.username;
-            break;
+QByteArray ChatServer::renderMetrics() const {
+    MetricsWriter out;
+    m_metrics.render(out);
+
+    out.family("skype_connected_sockets", "gauge", "Open WebSocket connections per shard");
+    for (const ServerShard* shard : m_shards) {
+        out.sample("skype_connected_sockets", shard->sessionCount(),
+                   "shard=\"" + QByteArray::number(shard->index()) + "\"");
+    }
+    out.family("skype_socket_backlog_bytes", "gauge",
+               "Outbound bytes queued or not yet written, per shard");
+    for (const ServerShard* shard : m_shards) {
+        out.sample("skype_socket_backlog_bytes", shard->backlogBytes(),
+                   "shard=\"" + QByteArray::number(shard->index()) + "\"");
+    }
+    out.family("skype_socket_backlog_max_bytes", "gauge",
+               "Largest single-socket outbound backlog, sampled each second");
+    for (const ServerShard* shard : m_shards) {
+        out.sample("skype_socket_backlog_max_bytes", shard->maxBacklogBytes(),
+                   "shard=\"" + QByteArray::number(shard->index()) + "\"");
+    }
+
+    out.family("skype_slow_connections", "gauge",
+               "Connections over their outbound queue budget, sampled each second");
+    for (const ServerShard* shard : m_shards) {
+        out.sample("skype_slow_connections", shard->slowConnections(),
+                   "shard=\"" + QByteArray::number(shard->index()) + "\"");
+    }
+
+    out.family("skype_users_loaded", "gauge", "Accounts held in memory");
+    out.sample("skype_users_loaded", m_users.userCount());
+    out.family("skype_user_ids", "gauge",
+               "Usernames interned, accounts plus remote contacts and watchers");
+    out.sample("skype_user_ids", m_users.idCount());
+    out.family("skype_users_online", "gauge", "Logged-in users");
+    out.sample("skype_users_online", m_sessions.loggedInCount());
+    out.family("skype_presence_pending", "gauge", "Presence changes waiting for the next flush");
+    out.sample("skype_presence_pending", m_pendingPresence.size());
+    out.family("skype_sessions_parked", "gauge", "Dropped logins waiting to be resumed");
+    out.sample("skype_sessions_parked", m_parked.size());
+
+    if (m_cluster) {
+        out.family("skype_cluster_nodes", "gauge", "Live nodes on the hash ring, this one included");
+        out.sample("skype_cluster_nodes", m_cluster->aliveCount());
+        out.family("skype_proxy_sessions", "gauge", "Users homed here whose socket is on another node");
+        out.sample("skype_proxy_sessions", m_proxies.size());
+    }
+
+    return out.data();
+}
+
+void ChatServer::maybeSnapshot() {
+    if (m_store->snapshotDue()) {
+        m_store->snapshot();
+    }
+}
+
+QString ChatServer::homeOf(const QString& username) const {
+    if (!m_cluster) return QString();
+
+    QString owner = m_cluster->ownerOf(username);
+    return owner == m_cluster->id() ? QString() : owner;
+}
+
+bool ChatServer::routeFrame(Session* session, Protocol::Opcode opcode, const QJsonObject& obj) {
+    using Protocol::Opcode;
+
+    // Login, register and resume pick the home node; every later frame follows it
+    if (opcode == Opcode::Login || opcode == Opcode::Register || opcode == Opcode::Resume) {
+        QString username = obj["username"].toString().toLower();
+        QString home = homeOf(username);
+
+        if (home != session->homeNode) {
+            if (!session->homeNode.isEmpty()) {
+                m_cluster->send(session->homeNode,
+                                {{"kind", "closed"}, {"session", qint64(session->id)}});
+                session->username.clear();
+            } else {
+                releaseUser(session);
+            }
+            session->homeNode = home;
         }
+        // Trusted only once the home node's result comes back; see "deliver"
+        session->claimedUsername = home.isEmpty() ? QString() : username;
     }
-    if (username.isEmpty()) return;
 
-    QString status = data["status"].toString();
-    m_onlineStatus[username] = status;
-    broadcastPresence(username, status);
+    if (session->homeNode.isEmpty()) return false;
+
+    // Conferences are joined where the socket is, not on the home node
+    if (opcode == Opcode::ConfCreate || opcode == Opcode::ConfJoin || opcode == Opcode::ConfLeave) {
+        return false;
+    }
+
+    m_cluster->send(session->homeNode, {{"kind", "frame"},
+                                        {"session", qint64(session->id)},
+                                        {"opcode", static_cast<int>(opcode)},
+                                        {"data", obj}});
+    return true;
 }
 
-void ChatServer::sendJson(QWebSocket* socket, const QJsonObject& obj) {
-    socket->sendTextMessage(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+Session* ChatServer::proxySession(const QString& edge, quint64 remoteId) {
+    Session*& proxy = m_proxies[qMakePair(edge, remoteId)];
+    if (!proxy) {
+        proxy = m_sessions.add(kProxySessionBit | m_nextProxyId++, nullptr);
+        proxy->edgeNode = edge;
+        proxy->remoteId = remoteId;
+    }
+    return proxy;
 }
 
-void ChatServer::broadcastPresence(const QString& username, const QString& status) {
-    QJsonObject presenceMsg;
-    presenceMsg["type"] = "presence";
-    presenceMsg["username"] = username;
-    presenceMsg["status"] = status;
+void ChatServer::onClusterMessage(const QString& from, const QJsonObject& message) {
+    const QString kind = message["kind"].toString();
+    const quint64 sessionId = static_cast<quint64>(message["session"].toDouble());
 
-    for (auto& client : m_clients) {
-        if (client.username != username && !client.username.isEmpty()) {
-            // Only send to contacts of this user
-            if (m_users.contains(client.username) &&
-                m_users[client.username].contacts.contains(username)) {
-                sendJson(client.socket, presenceMsg);
+    if (kind == "frame") {
+        // A client connected to another node, homed here
+        int opcode = message["opcode"].toInt();
+        if (opcode <= 0 || opcode >= static_cast<int>(Protocol::Opcode::Count)) return;
+        handleFrame(proxySession(from, sessionId), static_cast<Protocol::Opcode>(opcode),
+                    message["data"].toObject());
+    } else if (kind == "closed") {
+        if (Session* proxy = m_proxies.value(qMakePair(from, sessionId))) {
+            handleClosed(proxy, message["undelivered"].toArray());
+        }
+    } else if (kind == "attach") {
+        // The user's home moved here while their socket stayed on the edge
+        Session* proxy = proxySession(from, sessionId);
+        QString username = message["username"].toString();
+        m_sessions.bindUser(proxy, username);
+        setStatus(m_users.intern(username), presenceFromName(message["status"].toString()));
+    } else if (kind == "deliver") {
+        Session* session = m_sessions.byId(sessionId);
+        if (session && session->shard) {
+            const QJsonObject data = message["data"].toObject();
+            const QString type = data["type"].toString();
+            if (from == session->homeNode && !session->claimedUsername.isEmpty()
+                && (type == QLatin1String("login_result") || type == QLatin1String("resume_result"))) {
+                if (data["success"].toBool()) {
+                    session->username = session->claimedUsername;
+                }
+                session->claimedUsername.clear();
             }
+            sendJson(session, data);
+        }
+    } else if (kind == "relay") {
+        relayMessage(message["from"].toString(), message["to"].toString(),
+                     message["text"].toString(), message["timestamp"].toString());
+    } else if (kind == "history_append") {
+        m_history->append(message["conversation"].toString(), message["from"].toString(),
+                          message["text"].toString(), message["timestamp"].toString());
+    } else if (kind == "history_fetch") {
+        m_cluster->send(from, {{"kind", "history"}, {"session", message["session"]},
+                               {"data", historyReply(message["peer"].toString(),
+                                                     message["conversation"].toString(),
+                                                     qint64(message["before"].toDouble()),
+                                                     message["limit"].toInt())}});
+    } else if (kind == "history") {
+        // Reply to a fetch forwarded above; the session may be local or a proxy
+        if (Session* session = m_sessions.byId(message["session"].toString().toULongLong())) {
+            sendJson(session, message["data"].toObject());
+        }
+    } else if (kind == "group") {
+        int opcode = message["opcode"].toInt();
+        if (opcode <= 0 || opcode >= static_cast<int>(Protocol::Opcode::Count)) return;
+        applyGroupFrame(static_cast<Protocol::Opcode>(opcode), message["from"].toString(), from,
+                        message["session"].toString().toULongLong(), message["data"].toObject());
+    } else if (kind == "group_reply") {
+        if (Session* session = m_sessions.byId(message["session"].toString().toULongLong())) {
+            sendJson(session, message["data"].toObject());
         }
+    } else if (kind == "group_deliver") {
+        QStringList members;
+        for (const QJsonValue& member : message["members"].toArray()) {
+            members.append(member.toString());
+        }
+        deliverGroupFrame(members, message["data"].toObject(), message["queue"].toBool());
+    } else if (kind == "group_handoff") {
+        // Merge like user handoff: a stale copy must never drop members
+        QString groupId = message["groupId"].toString();
+        ServerGroup& group = m_groups[groupId];
+        bool created = group.id.isEmpty();
+        if (created) {
+            group.id = groupId;
+            group.name = message["name"].toString();
+            group.creator = message["creator"].toString();
+            if (m_store) m_store->logGroup(groupId, group.name, group.creator);
+        }
+        // Remote names stay in while their home node is asked, so delivery
+        // doesn't stop for real members; the rest must be accounts here
+        QHash<QString, QStringList> remote;
+        for (const QJsonValue& member : message["members"].toArray()) {
+            QString username = member.toString();
+            if (group.members.contains(username)) continue;
+            QString home = homeOf(username);
+            if (home.isEmpty() && !m_users.contains(username)) continue;
+            if (!home.isEmpty()) remote[home].append(username);
+            group.members.insert(username);
+            if (m_store) m_store->logGroupMember(groupId, username);
+        }
+        if (m_store) maybeSnapshot();
+        if (group.members.isEmpty()) {
+            m_groups.remove(groupId);
+            return;
+        }
+        requestGroupVouch(groupId, group.creator, QString(), 0, remote, true);
+    } else if (kind == "group_vouch") {
+        // From a group's home: which of these names are accounts here
+        QJsonArray known;
+        QJsonArray unknown;
+        for (const QJsonValue& member : message["members"].toArray()) {
+            (m_users.contains(member.toString()) ? known : unknown).append(member);
+        }
+        QJsonObject reply = message;
+        reply["kind"] = "group_vouched";
+        reply["members"] = known;
+        reply["rejected"] = unknown;
+        m_cluster->send(from, reply);
+    } else if (kind == "group_vouched") {
+        auto groupIt = m_groups.find(message["groupId"].toString());
+        const QJsonArray rejected = message["rejected"].toArray();
+        if (groupIt != m_groups.end() && message["prune"].toBool()) {
+            for (const QJsonValue& member : rejected) {
+                if (groupIt->members.remove(member.toString()) && m_store) {
+                    m_store->logGroupMemberRemoved(groupIt->id, member.toString());
+                }
+            }
+            if (groupIt->members.isEmpty()) m_groups.erase(groupIt);
+            if (m_store) maybeSnapshot();
+        } else if (groupIt != m_groups.end() && groupIt->members.contains(message["from"].toString())) {
+            QStringList known;
+            for (const QJsonValue& member : message["members"].toArray()) {
+                known.append(member.toString());
+            }
+            addGroupMembers(*groupIt, message["from"].toString(), known);
+            if (!rejected.isEmpty()) {
+                QJsonObject info = groupInfo(*groupIt);
+                info["rejected"] = rejected;
+                replyTo(message["origin"].toString(), message["session"].toString().toULongLong(), info);
+            }
+        }
+    } else if (kind == "presence") {
+        QHash<QString, QJsonArray> updates;
+        const QJsonObject byWatcher = message["updates"].toObject();
+        for (auto it = byWatcher.constBegin(); it != byWatcher.constEnd(); ++it) {
+            const QJsonArray changes = it.value().toArray();
+            updates.insert(it.key(), changes);
+
+            // Remember remote statuses for contact lists rendered here
+            for (const QJsonValue& value : changes) {
+                QJsonObject change = value.toObject();
+                setStatus(m_users.intern(change["username"].toString()),
+                          presenceFromName(change["status"].toString()));
+            }
+        }
+        deliverPresence(updates);
+    } else if (kind == "watch") {
+        // [contact, watcher] pairs; answer with the current status of each
+        // online contact so the watcher's node can render it
+        QHash<QString, QJsonArray> current;
+        for (const QJsonValue& value : message["edges"].toArray()) {
+            const QJsonArray edge = value.toArray();
+            QString contact = edge.at(0).toString();
+            QString watcher = edge.at(1).toString();
+            UserId contactId = m_users.intern(contact);
+            watchersOf(contactId).insert(m_users.intern(watcher));
+
+            Presence status = statusOf(contactId);
+            if (status != Presence::Offline && homeOf(contact).isEmpty()) {
+                current[watcher].append(QJsonObject{{"username", contact},
+                                                    {"status", presenceName(status)}});
+            }
+        }
+        if (!current.isEmpty()) {
+            QJsonObject updates;
+            for (auto it = current.constBegin(); it != current.constEnd(); ++it) {
+                updates.insert(it.key(), it.value());
+            }
+            m_cluster->send(from, {{"kind", "presence"}, {"updates", updates}});
+        }
+    } else if (kind == "unwatch") {
+        for (const QJsonValue& value : message["edges"].toArray()) {
+            const QJsonArray edge = value.toArray();
+            UserId contact = m_users.find(edge.at(0).toString());
+            if (contact != kNoUser) {
+                watchersOf(contact).remove(m_users.find(edge.at(1).toString()));
+            }
+        }
+    } else if (kind == "edge") {
+        const QString owner = message["owner"].toString();
+        const QString contact = message["contact"].toString();
+        requestContactEdge(owner, contact);
+        // An add_contact on another node waits for this to intern the pair
+        if (message["confirm"].toBool() && m_users.contains(owner)) {
+            m_cluster->send(from, {{"kind", "edge"}, {"owner", contact}, {"contact", owner}});
+        }
+    } else if (kind == "handoff") {
+        // Merge rather than overwrite: a stale copy must never drop data
+        QString username = message["username"].toString();
+        if (!m_users.contains(username)) {
+            createUser(username, message["password"].toString());
+        }
+        for (const QJsonValue& contact : message["contacts"].toArray()) {
+            addContactEdge(username, contact.toString());
+        }
+        const UserId id = m_users.intern(username);
+        for (const QJsonValue& watcher : message["watchers"].toArray()) {
+            UserId watcherId = m_users.intern(watcher.toString());
+            watchersOf(id).insert(watcherId);
+        }
+
+        // Move past both copies' versions and forget the local change log,
+        // so any client version taken before the move gets a full list
+        ServerUser* user = m_users.user(id);
+        user->rosterVersion = qMax(user->rosterVersion,
+            static_cast<quint64>(message["rosterVersion"].toDouble())) + 1;
+        m_rosterChanges.remove(id);
+        if (m_store) {
+            m_store->logRosterVersion(username, user->rosterVersion);
+        }
+        QString status = message["status"].toString();
+        if (!status.isEmpty()) {
+            setStatus(id, presenceFromName(status));
+        }
+        for (const QJsonValue& value : message["offline"].toArray()) {
+            QJsonObject offline = value.toObject();
+            m_offline->enqueue(username, {offline["from"].toString(), offline["text"].toString(),
+                                          offline["timestamp"].toString(),
+                                          offline["group"].toString()});
+        }
+    }
+}
+
+void ChatServer::onMembershipChanged() {
+    // Accounts that now hash to another node move there
+    QStringList moving;
+    m_users.forEachUser([this, &moving](UserId id, const ServerUser&) {
+        QString username = m_users.name(id);
+        if (!homeOf(username).isEmpty()) moving.append(username);
+    });
+    for (const QString& username : qAsConst(moving)) {
+        handOff(username, homeOf(username));
+    }
+
+    // Same for groups
+    QStringList movingGroups;
+    for (auto it = m_groups.constBegin(); it != m_groups.constEnd(); ++it) {
+        if (!homeOf(it.key()).isEmpty()) movingGroups.append(it.key());
     }
+    for (const QString& groupId : qAsConst(movingGroups)) {
+        ServerGroup group = m_groups.take(groupId);
+        QJsonArray members;
+        for (const QString& member : qAsConst(group.members)) {
+            members.append(member);
+        }
+        m_cluster->send(homeOf(groupId), {{"kind", "group_handoff"}, {"groupId", group.id},
+                                          {"name", group.name}, {"creator", group.creator},
+                                          {"members", members}});
+        logGroupRemoval(group);
+    }
+
+    const QList<Session*> sessions = m_sessions.sessions();
+    for (Session* session : sessions) {
+        if (!session->shard) {
+            // Proxies whose edge died or whose user moved away are dropped;
+            // a live edge re-attaches the socket to the new home itself
+            if (!m_cluster->isAlive(session->edgeNode)) {
+                handleClosed(session);
+            } else if (!homeOf(session->username).isEmpty()) {
+                m_proxies.remove(qMakePair(session->edgeNode, session->remoteId));
+                m_sessions.remove(session);
+            }
+            continue;
+        }
+
+        if (session->username.isEmpty()) continue;
+        QString home = homeOf(session->username);
+        if (home == session->homeNode) continue;
+
+        const UserId id = m_users.intern(session->username);
+        Presence status = statusOf(id);
+        if (status == Presence::Offline) status = Presence::Online;
+        if (session->homeNode.isEmpty()) {
+            m_sessions.unbindUser(session);
+        }
+        session->homeNode = home;
+
+        if (home.isEmpty()) {
+            m_sessions.bindUser(session, session->username);
+            setStatus(id, status);
+            broadcastPresence(id, status);
+        } else {
+            m_cluster->send(home, {{"kind", "attach"}, {"session", qint64(session->id)},
+                                   {"username", session->username},
+                                   {"status", presenceName(status)}});
+        }
+    }
+
+    announceWatches();
+
+    qDebug() << "Cluster membership changed:" << m_cluster->aliveCount() << "node(s),"
+             << moving.size() << "account(s) handed off";
 }
 
-QWebSocket* ChatServer::findClientSocket(const QString& username) {
-    for (auto& client : m_clients) {
-        if (client.username == username) {
-            return client.socket;
+void ChatServer::handOff(const QString& username, const QString& node) {
+    const UserId id = m_users.find(username);
+    const ServerUser user = m_users.take(id);
+    m_rosterChanges.remove(id);
+    if (m_store) m_store->logUserRemoved(username);
+
+    QJsonArray contacts;
+    for (UserId contact : user.contacts) {
+        contacts.append(m_users.name(contact));
+    }
+
+    QJsonArray offline;
+    for (const OfflineMessage& message : m_offline->take(username)) {
+        offline.append(QJsonObject{{"from", message.from}, {"text", message.text},
+                                   {"timestamp", message.timestamp},
+                                   {"group", message.group}});
+    }
+
+    QJsonArray watchers;
+    UserIdList& watcherIds = watchersOf(id);
+    for (UserId watcher : watcherIds) {
+        watchers.append(m_users.name(watcher));
+    }
+    watcherIds.clear();
+
+    const Presence status = statusOf(id);
+
+    m_cluster->send(node, {
+        {"kind", "handoff"},
+        {"username", username},
+        {"password", user.password},
+        {"contacts", contacts},
+        {"rosterVersion", qint64(user.rosterVersion)},
+        {"watchers", watchers},
+        {"status", status != Presence::Offline ? QString(presenceName(status)) : QString()},
+        {"offline", offline}
+    });
+}
+
+void ChatServer::announceWatches() {
+    // Homes may have changed or restarted empty; tell each one who watches
+    // its users. Receivers insert idempotently.
+    QHash<QString, QJsonArray> edges;
+    m_users.forEachUser([this, &edges](UserId id, const ServerUser& user) {
+        for (UserId contactId : user.contacts) {
+            QString contact = m_users.name(contactId);
+            QString home = homeOf(contact);
+            if (!home.isEmpty()) {
+                edges[home].append(QJsonArray{contact, m_users.name(id)});
+            }
         }
+    });
+
+    for (auto it = edges.constBegin(); it != edges.constEnd(); ++it) {
+        m_cluster->send(it.key(), {{"kind", "watch"}, {"edges", it.value()}});
     }
-    return nullptr;
 }
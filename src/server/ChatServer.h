@@ -1,52 +1,211 @@
 #pragma once
 
 #include <QObject>
-#include <QWebSocketServer>
-#include <QWebSocket>
 #include <QJsonObject>
-#include <QMap>
-#include <QList>
+#include <QJsonArray>
+#include <QHash>
 #include <QSet>
+#include <QPair>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+#include <atomic>
+#include "server/SessionRegistry.h"
+#include "server/ServerShard.h"
+#include "server/UserDirectory.h"
+#include "server/MpscQueue.h"
+#include "server/Metrics.h"
+#include "utils/CryptoUtils.h"
 
-struct ServerUser {
-    QString username;
-    QString password;
-    QStringList contacts;
-};
+class QThread;
+class UserStore;
+class OfflineQueue;
+class HistoryStore;
+class PasswordHasher;
+class MediaRelay;
+class MetricsServer;
+class ClusterNode;
+
+struct ServerOptions {
+    quint16 port = 33033;
+    int threads = 1;
+    QString dataDirectory; // empty = keep accounts in memory only
+    int presenceWindowMs = 50; // 0 = send every change immediately
+    quint16 metricsPort = 33034; // loopback only, 0 = disabled
+    BackpressurePolicy backpressure;
+    CompressionPolicy compression; // deflate offered to clients that ask
+
+    // Password hashing runs on its own pool; logins beyond maxPendingLogins
+    // are told to retry instead of queueing
+    int hashThreads = 2;
+    int maxPendingLogins = 1024;
+    int hashIterations = CryptoUtils::kDefaultIterations;
+    // Migration only: accounts from old data with no password may log in
+    // and register with an empty one
+    bool allowEmptyPasswords = false;
+
+    // Conference media relay; audio is forwarded for this many of the
+    // loudest speakers per call, 0 = no relay
+    int conferenceSpeakers = 3;
+
+    // A dropped login stays parked this long so the client can resume it
+    // without a full login; 0 = sessions end with their socket
+    int resumeGraceMs = 30000;
 
-struct ConnectedClient {
-    QWebSocket* socket;
-    QString username;
+    // Clustering; clusterPort 0 = standalone
+    QString nodeId;
+    QString clusterHost = "127.0.0.1"; // address other nodes dial
+    QString clusterBind;               // listen address; empty = clusterHost
+    QByteArray clusterSecret;          // shared by every node; required to cluster
+    quint16 clusterPort = 0;
+    QStringList clusterSeeds;          // host:port of existing members
 };
 
 class ChatServer : public QObject {
     Q_OBJECT
 
 public:
-    explicit ChatServer(quint16 port, QObject* parent = nullptr);
+    explicit ChatServer(const ServerOptions& options, QObject* parent = nullptr);
     ~ChatServer();
 
     bool start();
 
-private slots:
-    void onNewConnection();
-    void onTextMessage(const QString& message);
-    void onDisconnected();
-
 private:
-    void handleLogin(QWebSocket* socket, const QJsonObject& data);
-    void handleRegister(QWebSocket* socket, const QJsonObject& data);
-    void handleMessage(QWebSocket* socket, const QJsonObject& data);
-    void handleContactList(QWebSocket* socket);
-    void handleAddContact(QWebSocket* socket, const QJsonObject& data);
-    void handleStatusChange(QWebSocket* socket, const QJsonObject& data);
-
-    void sendJson(QWebSocket* socket, const QJsonObject& obj);
-    void broadcastPresence(const QString& username, const QString& status);
-    QWebSocket* findClientSocket(const QString& username);
-
-    QWebSocketServer* m_server;
-    QList<ConnectedClient> m_clients;
-    QMap<QString, ServerUser> m_users;     // username -> user data
-    QMap<QString, QString> m_onlineStatus; // username -> status string
+    friend class RelayBench; // SkypeBench drives handleFrame directly
+    friend class OfflineBench;
+
+    void onIncomingConnection(qintptr descriptor);
+    void postEvent(ShardEvent event);
+    void drainEvents();
+    void handleEvent(const ShardEvent& event);
+    using FrameHandler = void (ChatServer::*)(Session*, const QJsonObject&);
+
+    void handleFrame(Session* session, Protocol::Opcode opcode, const QJsonObject& obj);
+    void handleClosed(Session* session, const QJsonArray& undelivered = QJsonArray());
+    void releaseUser(Session* session);
+    void requeueUndelivered(const QString& username, const QJsonArray& frames);
+
+    void handleLogin(Session* session, const QJsonObject& data);
+    void handleRegister(Session* session, const QJsonObject& data);
+    Session* resumeCredentialCheck(quint64 sessionId);
+    void completeLogin(Session* session, const QString& username, const QJsonObject& data);
+    void sendBusy(Session* session, const char* resultType);
+    void handleResume(Session* session, const QJsonObject& data);
+    QString issueResumeToken(Session* session);
+    bool parkSession(Session* session);
+    void expireParked(const QString& token);
+    void dropParked(const QString& username);
+    void handleMessage(Session* session, const QJsonObject& data);
+    void handleContactList(Session* session);
+    void handleGetContacts(Session* session, const QJsonObject& data);
+    void handleAddContact(Session* session, const QJsonObject& data);
+    void handleStatusChange(Session* session, const QJsonObject& data);
+    void handleRemoveContact(Session* session, const QJsonObject& data);
+    void handleHistoryFetch(Session* session, const QJsonObject& data);
+    QJsonObject historyReply(const QString& peer, const QString& conversation,
+                             qint64 before, int limit);
+    void recordHistory(const QString& from, const QString& to,
+                       const QString& text, const QString& timestamp);
+    template <Protocol::Opcode opcode>
+    void handleGroupFrame(Session* session, const QJsonObject& data);
+    void routeGroupFrame(Session* session, Protocol::Opcode opcode, const QJsonObject& data);
+    void applyGroupFrame(Protocol::Opcode opcode, const QString& from, const QString& origin,
+                         quint64 sessionId, const QJsonObject& data);
+    QStringList vetGroupMembers(const QJsonArray& names, const QSet<QString>& current,
+                                QHash<QString, QStringList>& remote, QJsonArray& rejected) const;
+    void requestGroupVouch(const QString& groupId, const QString& from, const QString& origin,
+                           quint64 sessionId, const QHash<QString, QStringList>& remote, bool prune);
+    void addGroupMembers(ServerGroup& group, const QString& from, const QStringList& names);
+    void replyTo(const QString& origin, quint64 sessionId, const QJsonObject& obj);
+    QJsonObject groupInfo(const ServerGroup& group) const;
+    void fanOutGroup(const QSet<QString>& members, const QJsonObject& frame,
+                     const QSet<QString>& skip, bool queueOffline);
+    void deliverGroupFrame(const QStringList& members, const QJsonObject& frame, bool queueOffline);
+    void logGroupRemoval(const ServerGroup& group);
+    void handleConfCreate(Session* session, const QJsonObject& data);
+    void handleConfJoin(Session* session, const QJsonObject& data);
+    void handleConfLeave(Session* session, const QJsonObject& data);
+    bool joinConference(Session* session, const QString& conferenceId);
+    void notifyConference(const QVector<quint64>& sessionIds, const QJsonObject& frame);
+    void sendRoster(Session* session, const QJsonValue& clientVersion);
+    void deliverOfflineMessages(Session* session);
+    void handleOfflineAck(Session* session, const QJsonObject& data);
+    bool relayMessage(const QString& from, const QString& to,
+                      const QString& text, const QString& timestamp);
+    bool deliverMessage(const QString& from, const QString& to,
+                        const QString& text, const QString& timestamp);
+
+    void sendJson(Session* session, const QJsonObject& obj);
+    QString currentTimestamp();
+    Presence statusOf(UserId id) const;
+    void setStatus(UserId id, Presence status);
+    UserIdList& watchersOf(UserId id);
+    void broadcastPresence(UserId id, Presence status);
+    void flushPresence();
+    void deliverPresence(const QHash<QString, QJsonArray>& updates);
+    void createUser(const QString& username, const QString& credential);
+    bool addContactEdge(const QString& owner, const QString& contact);
+    void requestContactEdge(const QString& owner, const QString& contact);
+    bool removeContactEdge(const QString& owner, const QString& contact);
+    void recordRosterChange(UserId owner, RosterChange::Kind kind, UserId contact);
+    QJsonObject contactEntry(UserId contact) const;
+    void seedDefaultAccounts();
+    void maybeSnapshot();
+    QByteArray renderMetrics() const;
+
+    // Cluster routing; homeOf() is empty for users homed on this node
+    QString homeOf(const QString& username) const;
+    bool routeFrame(Session* session, Protocol::Opcode opcode, const QJsonObject& obj);
+    Session* proxySession(const QString& edge, quint64 remoteId);
+    void onClusterMessage(const QString& from, const QJsonObject& message);
+    void onMembershipChanged();
+    void handOff(const QString& username, const QString& node);
+    void announceWatches();
+
+    ServerOptions m_options;
+    ConnectionAcceptor* m_acceptor;
+    QVector<ServerShard*> m_shards;
+    QVector<QThread*> m_shardThreads;
+
+    // Shard -> core handoff (only used when shards run on worker threads)
+    MpscQueue<ShardEvent> m_events;
+    std::atomic<bool> m_drainScheduled{false};
+
+    ServerMetrics m_metrics;
+    MetricsServer* m_metricsServer = nullptr;
+
+    ClusterNode* m_cluster = nullptr;
+    QHash<QPair<QString, quint64>, Session*> m_proxies; // (edge node, remote id) -> proxy
+    quint64 m_nextProxyId = 1;
+
+    UserStore* m_store = nullptr;
+    OfflineQueue* m_offline = nullptr;
+    HistoryStore* m_history = nullptr;
+    PasswordHasher* m_hasher = nullptr;
+    MediaRelay* m_relay = nullptr;
+    SessionRegistry m_sessions;
+    UserDirectory m_users;                // interned names and local accounts
+    QVector<Presence> m_status;           // by UserId; short = Offline
+    QVector<UserIdList> m_watchers;       // by UserId: users listing them as a contact
+    QHash<UserId, QVector<RosterChange>> m_rosterChanges; // recent changes per owner
+    QHash<QString, ServerGroup> m_groups;   // group id -> group homed on this node
+
+    // Logins whose socket dropped, kept for resumeGraceMs. The user stays
+    // online to everyone else; messages go to the offline queue and the
+    // latest presence of each contact is held for the resume.
+    struct ParkedSession {
+        QString username;
+        quint64 rosterVersion = 0; // what the dropped socket had seen
+        QHash<QString, QString> presence;
+    };
+    QHash<QString, ParkedSession> m_parked; // resume token -> parked login
+    QHash<QString, QString> m_parkedTokens; // username -> resume token
+
+    // ISO timestamp for the current second; see currentTimestamp()
+    QString m_timestamp;
+    qint64 m_timestampSecond = -1;
+
+    // Presence changes collapsed per user until the window closes
+    QHash<UserId, Presence> m_pendingPresence;
+    QTimer m_presenceTimer;
 };
@@ -0,0 +1,327 @@
+#include "server/ClusterNode.h"
+
+#include <QCborMap>
+#include <QCborValue>
+#include <QJsonArray>
+#include <QMessageAuthenticationCode>
+#include <QRandomGenerator>
+#include <QUrl>
+#include <QDebug>
+
+namespace {
+const int kTickMs = 1000;
+const qint64 kMemberTimeoutMs = 5000;
+const int kMaxPendingFrames = 65536;
+const int kNonceSize = 16;
+
+QByteArray encode(const QJsonObject& message) {
+    return QCborValue(QCborMap::fromJsonObject(message)).toCbor();
+}
+
+// Compares without an early exit, so timing doesn't leak a MAC prefix
+bool sameBytes(const QByteArray& a, const QByteArray& b) {
+    if (a.size() != b.size()) return false;
+    char diff = 0;
+    for (int i = 0; i < a.size(); ++i) diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+QByteArray makeNonce() {
+    QByteArray nonce(kNonceSize, Qt::Uninitialized);
+    QRandomGenerator::system()->fillRange(reinterpret_cast<quint32*>(nonce.data()), kNonceSize / 4);
+    return nonce;
+}
+}
+
+ClusterNode::ClusterNode(const QString& id, const QString& address, const QStringList& seeds,
+                         const QByteArray& secret, QObject* parent)
+    : QObject(parent)
+    , m_id(id)
+    , m_address(address)
+    , m_seeds(seeds)
+    , m_secret(secret)
+    , m_server("SkypeClassicCluster", QWebSocketServer::NonSecureMode)
+{
+    m_clock.start();
+    connect(&m_server, &QWebSocketServer::newConnection, this, &ClusterNode::onInboundConnection);
+    connect(&m_ticker, &QTimer::timeout, this, &ClusterNode::onTick);
+}
+
+ClusterNode::~ClusterNode() {
+    for (const Link& link : qAsConst(m_links)) {
+        link.socket->disconnect(this);
+        delete link.socket;
+    }
+}
+
+bool ClusterNode::start(const QHostAddress& bindAddress, quint16 port) {
+    if (!m_server.listen(bindAddress, port)) {
+        qWarning() << "Failed to start cluster listener:" << m_server.errorString();
+        return false;
+    }
+
+    rebuildRing();
+    for (const QString& seed : qAsConst(m_seeds)) {
+        if (seed != m_address) dial(seed);
+    }
+    m_ticker.start(kTickMs);
+
+    qDebug() << "Cluster node" << m_id << "listening on" << m_address;
+    return true;
+}
+
+void ClusterNode::leave() {
+    for (auto it = m_links.begin(); it != m_links.end(); ++it) {
+        if (it->socket->state() == QAbstractSocket::ConnectedState) {
+            it->socket->sendBinaryMessage(encode({{"kind", "leave"}}));
+            it->socket->flush();
+        }
+    }
+}
+
+bool ClusterNode::isAlive(const QString& node) const {
+    if (node == m_id) return true;
+    auto it = m_members.constFind(node);
+    return it != m_members.constEnd() && it->alive;
+}
+
+void ClusterNode::send(const QString& node, const QJsonObject& message) {
+    auto it = m_members.constFind(node);
+    if (it == m_members.constEnd() || !it->alive) return;
+    sendTo(it->address, message);
+}
+
+void ClusterNode::sendTo(const QString& address, const QJsonObject& message) {
+    dial(address);
+    Link& link = m_links[address];
+
+    if (link.joined && link.socket->state() == QAbstractSocket::ConnectedState) {
+        link.socket->sendBinaryMessage(encode(message));
+    } else if (link.pending.size() < kMaxPendingFrames) {
+        link.pending.append(encode(message));
+    } else {
+        qWarning() << "Cluster link to" << address << "backlogged, dropping frame";
+    }
+}
+
+void ClusterNode::dial(const QString& address) {
+    Link& link = m_links[address];
+    if (!link.socket) {
+        link.socket = new QWebSocket("SkypeClassicCluster");
+        m_linkAddress.insert(link.socket, address);
+        connect(link.socket, &QWebSocket::connected, this, &ClusterNode::onLinkConnected);
+        connect(link.socket, &QWebSocket::binaryMessageReceived, this, &ClusterNode::onLinkMessage);
+    }
+    if (link.socket->state() == QAbstractSocket::UnconnectedState) {
+        link.joined = false;
+        link.nonce.clear();
+        link.socket->open(QUrl("ws://" + address));
+    }
+}
+
+void ClusterNode::onLinkConnected() {
+    // Nothing goes out until the listener's challenge is answered
+}
+
+void ClusterNode::onLinkMessage(const QByteArray& frame) {
+    auto* socket = qobject_cast<QWebSocket*>(sender());
+    QString address = m_linkAddress.value(socket);
+    if (address.isEmpty()) return;
+
+    Link& link = m_links[address];
+    if (link.joined) return;
+
+    QJsonObject message = QCborValue::fromCbor(frame).toMap().toJsonObject();
+    QString kind = message["kind"].toString();
+
+    if (kind == "challenge" && link.nonce.isEmpty()) {
+        // "join" is always the first frame on a link; it names the sender
+        QByteArray nonce = QByteArray::fromBase64(message["nonce"].toString().toLatin1());
+        link.nonce = makeNonce();
+        socket->sendBinaryMessage(encode({{"kind", "join"}, {"node", m_id}, {"address", m_address},
+                                          {"mac", QString::fromLatin1(
+                                              linkMac("join", nonce, m_id, m_address).toBase64())},
+                                          {"nonce", QString::fromLatin1(link.nonce.toBase64())}}));
+        return;
+    }
+    if (kind != "welcome" || link.nonce.isEmpty()) return;
+
+    // The listener has to know the secret too before anything goes out
+    QString node = message["node"].toString();
+    QByteArray mac = QByteArray::fromBase64(message["mac"].toString().toLatin1());
+    if (!sameBytes(mac, linkMac("welcome", link.nonce, node, QString()))) {
+        qWarning() << "Cluster node at" << address << "failed authentication";
+        link.nonce.clear();
+        socket->close(QWebSocketProtocol::CloseCodePolicyViolated, "Bad welcome");
+        return;
+    }
+    link.nonce.clear();
+    link.joined = true;
+
+    for (const QByteArray& pending : qAsConst(link.pending)) {
+        socket->sendBinaryMessage(pending);
+    }
+    link.pending.clear();
+}
+
+QByteArray ClusterNode::linkMac(const char* role, const QByteArray& nonce, const QString& node,
+                                const QString& address) const {
+    QMessageAuthenticationCode mac(QCryptographicHash::Sha256, m_secret);
+    mac.addData(role, static_cast<int>(qstrlen(role)));
+    mac.addData("\n", 1);
+    mac.addData(nonce);
+    mac.addData(node.toUtf8());
+    mac.addData("\n", 1);
+    mac.addData(address.toUtf8());
+    return mac.result();
+}
+
+void ClusterNode::onInboundConnection() {
+    while (QWebSocket* socket = m_server.nextPendingConnection()) {
+        connect(socket, &QWebSocket::binaryMessageReceived, this, &ClusterNode::onInboundMessage);
+        connect(socket, &QWebSocket::disconnected, this, &ClusterNode::onInboundClosed);
+        m_inbound.insert(socket, QString());
+
+        QByteArray nonce = makeNonce();
+        m_challenges.insert(socket, nonce);
+        socket->sendBinaryMessage(encode({{"kind", "challenge"},
+                                          {"nonce", QString::fromLatin1(nonce.toBase64())}}));
+    }
+}
+
+void ClusterNode::onInboundClosed() {
+    auto* socket = qobject_cast<QWebSocket*>(sender());
+    m_inbound.remove(socket);
+    m_challenges.remove(socket);
+    socket->deleteLater();
+}
+
+void ClusterNode::onInboundMessage(const QByteArray& frame) {
+    auto* socket = qobject_cast<QWebSocket*>(sender());
+    auto inbound = m_inbound.find(socket);
+    if (inbound == m_inbound.end()) return;
+
+    QJsonObject message = QCborValue::fromCbor(frame).toMap().toJsonObject();
+    QString kind = message["kind"].toString();
+
+    if (kind == "join") {
+        QString node = message["node"].toString();
+        QString address = message["address"].toString();
+        if (node.isEmpty() || node == m_id || !inbound.value().isEmpty()) return;
+
+        // One attempt per socket; a wrong MAC ends the connection
+        QByteArray nonce = m_challenges.take(socket);
+        QByteArray mac = QByteArray::fromBase64(message["mac"].toString().toLatin1());
+        QByteArray theirNonce = QByteArray::fromBase64(message["nonce"].toString().toLatin1());
+        if (nonce.isEmpty() || theirNonce.size() != kNonceSize
+            || !sameBytes(mac, linkMac("join", nonce, node, address))) {
+            qWarning() << "Cluster join from" << socket->peerAddress().toString()
+                       << "failed authentication";
+            socket->close(QWebSocketProtocol::CloseCodePolicyViolated, "Bad join");
+            return;
+        }
+
+        // Prove the secret back before the dialer sends anything
+        socket->sendBinaryMessage(encode({{"kind", "welcome"}, {"node", m_id},
+                                          {"mac", QString::fromLatin1(
+                                              linkMac("welcome", theirNonce, m_id, QString()).toBase64())}}));
+
+        inbound.value() = node;
+        addMember(node, address);
+        markAlive(node);
+
+        // Answer with the table so the newcomer can dial everyone else
+        QJsonArray members{QJsonObject{{"node", m_id}, {"address", m_address}}};
+        for (const ClusterMember& member : qAsConst(m_members)) {
+            if (member.alive) {
+                members.append(QJsonObject{{"node", member.id}, {"address", member.address}});
+            }
+        }
+        sendTo(address, {{"kind", "members"}, {"members", members}});
+        return;
+    }
+
+    const QString from = inbound.value();
+    if (from.isEmpty()) return; // nothing is accepted before "join"
+
+    if (kind == "leave") {
+        m_members.remove(from);
+        qDebug() << "Cluster member" << from << "left";
+        rebuildRing();
+        emit membershipChanged();
+        return;
+    }
+
+    markAlive(from);
+
+    if (kind == "members") {
+        for (const QJsonValue& value : message["members"].toArray()) {
+            QJsonObject member = value.toObject();
+            addMember(member["node"].toString(), member["address"].toString());
+        }
+    } else if (kind != "ping") {
+        emit messageReceived(from, message);
+    }
+}
+
+void ClusterNode::addMember(const QString& id, const QString& address) {
+    if (id.isEmpty() || id == m_id || address.isEmpty()) return;
+
+    auto it = m_members.find(id);
+    if (it != m_members.end() && it->address == address) return;
+
+    ClusterMember member;
+    member.id = id;
+    member.address = address;
+    member.lastSeen = m_clock.elapsed();
+    m_members.insert(id, member);
+    dial(address);
+}
+
+void ClusterNode::markAlive(const QString& id) {
+    auto it = m_members.find(id);
+    if (it == m_members.end()) return;
+
+    it->lastSeen = m_clock.elapsed();
+    if (!it->alive) {
+        it->alive = true;
+        qDebug() << "Cluster member" << id << "is up";
+        rebuildRing();
+        emit membershipChanged();
+    }
+}
+
+void ClusterNode::onTick() {
+    qint64 now = m_clock.elapsed();
+    bool changed = false;
+
+    for (auto it = m_members.begin(); it != m_members.end(); ++it) {
+        if (it->alive && now - it->lastSeen > kMemberTimeoutMs) {
+            it->alive = false;
+            changed = true;
+            qWarning() << "Cluster member" << it->id << "timed out";
+        }
+        // Keep dialing dead members too, so a restarted node is found again
+        dial(it->address);
+        QWebSocket* socket = m_links[it->address].socket;
+        if (socket->state() == QAbstractSocket::ConnectedState) {
+            socket->sendBinaryMessage(encode({{"kind", "ping"}}));
+        }
+    }
+    for (const QString& seed : qAsConst(m_seeds)) {
+        if (seed != m_address) dial(seed);
+    }
+
+    if (changed) {
+        rebuildRing();
+        emit membershipChanged();
+    }
+}
+
+void ClusterNode::rebuildRing() {
+    QStringList nodes{m_id};
+    for (const ClusterMember& member : qAsConst(m_members)) {
+        if (member.alive) nodes.append(member.id);
+    }
+    m_ring.setNodes(nodes);
+}
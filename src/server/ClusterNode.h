@@ -0,0 +1,99 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QJsonObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QWebSocketServer>
+#include <QWebSocket>
+#include "server/ClusterRing.h"
+
+struct ClusterMember {
+    QString id;
+    QString address;     // host:port of the member's cluster listener
+    bool alive = false;
+    qint64 lastSeen = 0; // ms on the node's monotonic clock
+};
+
+// Membership table and inter-node links for a SkypeServer cluster.
+//
+// Every node listens on a cluster port and dials every member it learns
+// about. Each direction of a pair has its own socket, so a node only sends
+// on links it opened. A new node dials the seeds and announces itself with
+// "join". The reply carries the member table, which it dials in turn.
+// Members ping once a second. A member drops out of the hash ring after
+// five silent seconds, or at once when it says "leave".
+//
+// Links are authenticated both ways with a shared secret. The listener
+// opens every inbound socket with a random "challenge"; the dialer answers
+// with "join", carrying an HMAC-SHA256 of that nonce, its id and its
+// address, plus a nonce of its own. The listener proves the secret back
+// with "welcome", an HMAC of the dialer's nonce and its id. Until then
+// the listener reads nothing else and the dialer sends nothing else. The
+// MACs are labelled by role, so one side's proof can't be replayed as
+// the other's.
+//
+// Links are not encrypted: forwarded messages, presence and group state
+// cross them in the clear. Run cluster ports on a trusted network only.
+class ClusterNode : public QObject {
+    Q_OBJECT
+
+public:
+    ClusterNode(const QString& id, const QString& address, const QStringList& seeds,
+                const QByteArray& secret, QObject* parent = nullptr);
+    ~ClusterNode();
+
+    bool start(const QHostAddress& bindAddress, quint16 port);
+    void leave();
+
+    const QString& id() const { return m_id; }
+    QString ownerOf(const QString& username) const { return m_ring.ownerOf(username); }
+    bool isAlive(const QString& node) const;
+    int aliveCount() const { return m_ring.nodes().size(); }
+
+    // Queued while the link is connecting; dropped if the member is gone
+    void send(const QString& node, const QJsonObject& message);
+
+signals:
+    void messageReceived(const QString& from, const QJsonObject& message);
+    void membershipChanged();
+
+private slots:
+    void onInboundConnection();
+    void onInboundMessage(const QByteArray& frame);
+    void onInboundClosed();
+    void onLinkConnected();
+    void onLinkMessage(const QByteArray& frame);
+    void onTick();
+
+private:
+    struct Link {
+        QWebSocket* socket = nullptr;
+        bool joined = false;       // both sides proved the secret; frames can flow
+        QByteArray nonce;          // ours, until the listener's welcome
+        QList<QByteArray> pending; // frames waiting for the connection
+    };
+
+    void dial(const QString& address);
+    void sendTo(const QString& address, const QJsonObject& message);
+    void addMember(const QString& id, const QString& address);
+    void markAlive(const QString& id);
+    void rebuildRing();
+    QByteArray linkMac(const char* role, const QByteArray& nonce, const QString& node,
+                       const QString& address) const;
+
+    QString m_id;
+    QString m_address;
+    QStringList m_seeds;
+    QByteArray m_secret;
+    QWebSocketServer m_server;
+    QHash<QString, ClusterMember> m_members;  // id -> member, self excluded
+    QHash<QString, Link> m_links;             // address -> outbound link
+    QHash<QWebSocket*, QString> m_linkAddress;
+    QHash<QWebSocket*, QString> m_inbound;    // inbound socket -> member id once joined
+    QHash<QWebSocket*, QByteArray> m_challenges; // inbound socket -> nonce until it joins
+    ClusterRing m_ring;
+    QTimer m_ticker;
+    QElapsedTimer m_clock;
+};
@@ -0,0 +1,44 @@
+#include "server/ClusterRing.h"
+
+#include <algorithm>
+
+void ClusterRing::setNodes(QStringList nodes) {
+    // Sorted so every node builds the identical ring from the same set
+    nodes.sort();
+    nodes.removeDuplicates();
+    m_nodes = nodes;
+
+    m_points.clear();
+    m_points.reserve(m_nodes.size() * kVirtualNodes);
+    for (int i = 0; i < m_nodes.size(); ++i) {
+        for (int v = 0; v < kVirtualNodes; ++v) {
+            m_points.append({hash(m_nodes[i].toUtf8() + '#' + QByteArray::number(v)), i});
+        }
+    }
+    std::sort(m_points.begin(), m_points.end());
+}
+
+QString ClusterRing::ownerOf(const QString& key) const {
+    if (m_points.isEmpty()) return QString();
+
+    quint64 h = hash(key.toUtf8());
+    auto it = std::lower_bound(m_points.constBegin(), m_points.constEnd(), h,
+        [](const QPair<quint64, int>& point, quint64 value) { return point.first < value; });
+    if (it == m_points.constEnd()) it = m_points.constBegin();
+    return m_nodes[it->second];
+}
+
+quint64 ClusterRing::hash(const QByteArray& key) {
+    // FNV-1a, then a splitmix64 finalizer so similar keys spread out
+    quint64 h = 14695981039346656037ULL;
+    for (char c : key) {
+        h ^= static_cast<quint8>(c);
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <QPair>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// Consistent-hash ring mapping usernames to node ids. Each node is placed
+// at many virtual points so load stays even and a membership change only
+// moves the keys adjacent to the points that came or went.
+class ClusterRing {
+public:
+    void setNodes(QStringList nodes);
+    const QStringList& nodes() const { return m_nodes; }
+
+    // Empty when the ring has no nodes
+    QString ownerOf(const QString& key) const;
+
+    // Stable across processes and platforms, unlike qHash
+    static quint64 hash(const QByteArray& key);
+
+private:
+    static const int kVirtualNodes = 128;
+
+    QStringList m_nodes;
+    QVector<QPair<quint64, int>> m_points; // hash -> index into m_nodes, sorted
+};
@@ -0,0 +1,446 @@
+#include "server/HistoryStore.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonObject>
+#include <QtEndian>
+#include <QDebug>
+#include <algorithm>
+
+namespace {
+
+const int kRecordHeaderSize = 6;      // quint32 length + quint16 checksum
+const int kIndexEntrySize = 12;       // quint32 segment + qint64 offset
+const int kIndexStride = 64;          // messages per index entry
+const qint64 kSegmentBytes = 4 * 1024 * 1024;
+const int kMaxOpenConversations = 64; // each holds a log, an index and mapped segments
+const int kMaxConversations = 4096;   // index and segment sizes kept after the files close
+const int kMaxMemoryMessages = 500;   // per conversation without a directory
+const int kFlushWindowMs = 10;
+
+QString segmentPath(const QString& directory, int index) {
+    return QDir(directory).filePath(QString("history-%1.seg").arg(index, 8, 10, QChar('0')));
+}
+
+QByteArray encodeMessage(const QString& from, const QString& text, const QString& timestamp) {
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_9);
+    out << from << text << timestamp;
+    return payload;
+}
+
+QJsonObject decodeMessage(qint64 seq, const QByteArray& payload) {
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_5_9);
+    QString from;
+    QString text;
+    QString timestamp;
+    in >> from >> text >> timestamp;
+    return {{"seq", seq}, {"from", from}, {"text", text}, {"timestamp", timestamp}};
+}
+
+}
+
+HistoryStore::Conversation::~Conversation() {
+    // Log before index, so an index entry never outlives its record
+    log.close();
+    indexFile.close();
+    for (Segment* segment : qAsConst(segments)) {
+        if (segment->map) segment->file.unmap(segment->map);
+    }
+    qDeleteAll(segments);
+}
+
+HistoryStore::HistoryStore(const QString& directory, QObject* parent)
+    : QObject(parent)
+    , m_directory(directory)
+{
+    m_flushTimer.setSingleShot(true);
+    m_flushTimer.setInterval(kFlushWindowMs);
+    connect(&m_flushTimer, &QTimer::timeout, this, &HistoryStore::flush);
+}
+
+HistoryStore::~HistoryStore() {
+    flush();
+    qDeleteAll(m_conversations);
+}
+
+bool HistoryStore::open() {
+    if (m_directory.isEmpty()) return true;
+
+    if (!QDir().mkpath(m_directory)) {
+        qWarning() << "Cannot create history directory" << m_directory;
+        m_directory.clear();
+        return false;
+    }
+    return true;
+}
+
+QString HistoryStore::conversationKey(const QString& a, const QString& b) {
+    return a < b ? a + QChar(0) + b : b + QChar(0) + a;
+}
+
+void HistoryStore::append(const QString& key, const QString& from,
+                          const QString& text, const QString& timestamp) {
+    Conversation* conversation = this->conversation(key, true);
+    if (!conversation) return;
+
+    QByteArray payload = encodeMessage(from, text, timestamp);
+    if (m_directory.isEmpty()) {
+        conversation->memory.append(payload);
+        conversation->count++;
+        // Oldest messages go a block at a time, so the front removal is amortized
+        if (conversation->memory.size() >= kMaxMemoryMessages + kIndexStride) {
+            conversation->memory.remove(0, kIndexStride);
+            conversation->memoryFirst += kIndexStride;
+        }
+        return;
+    }
+
+    int active = conversation->segments.size() - 1;
+    if (conversation->segments[active]->size >= kSegmentBytes) {
+        if (!openSegment(conversation, active + 1)) return;
+        active++;
+    }
+    Segment* segment = conversation->segments[active];
+
+    if (conversation->count % kIndexStride == 0) {
+        Position position{active, segment->size};
+        conversation->index.append(position);
+        writeIndex(conversation, position);
+    }
+
+    char header[kRecordHeaderSize];
+    qToBigEndian<quint32>(static_cast<quint32>(payload.size()), header);
+    qToBigEndian<quint16>(qChecksum(payload.constData(), static_cast<uint>(payload.size())), header + 4);
+    conversation->log.write(header, kRecordHeaderSize);
+    conversation->log.write(payload);
+
+    segment->size += kRecordHeaderSize + payload.size();
+    conversation->count++;
+
+    m_dirty.insert(conversation);
+    if (!m_flushTimer.isActive()) {
+        m_flushTimer.start();
+    }
+}
+
+HistoryPage HistoryStore::fetch(const QString& key, qint64 before, int limit) {
+    HistoryPage page;
+    Conversation* conversation = this->conversation(key, false);
+    if (!conversation) return page;
+
+    const qint64 end = before < 0 ? conversation->count : qMin(before, conversation->count);
+    const qint64 start = qMax<qint64>(0, end - qMax(0, limit));
+    page.first = start;
+    page.total = conversation->count;
+
+    if (m_directory.isEmpty()) {
+        page.oldest = qMin(end, conversation->memoryFirst);
+        page.first = qMax(start, page.oldest);
+        for (qint64 seq = page.first; seq < end; ++seq) {
+            page.messages.append(decodeMessage(
+                seq, conversation->memory[static_cast<int>(seq - conversation->memoryFirst)]));
+        }
+        return page;
+    }
+    if (start == end) return page;
+
+    // Jump to the closest indexed message, then skip forward to start
+    Position position = conversation->index.value(static_cast<int>(start / kIndexStride));
+    QByteArray payload;
+    for (qint64 seq = start - start % kIndexStride; seq < end; ++seq) {
+        if (!readRecord(conversation, position, &payload)) {
+            qWarning() << "History log ended early in" << conversation->path;
+            break;
+        }
+        if (seq >= start) {
+            page.messages.append(decodeMessage(seq, payload));
+        }
+    }
+    return page;
+}
+
+HistoryStore::Conversation* HistoryStore::conversation(const QString& key, bool create) {
+    Conversation* conversation = m_conversations.value(key);
+    if (!conversation) {
+        if (m_directory.isEmpty() && !create) return nullptr;
+
+        conversation = new Conversation;
+        if (!m_directory.isEmpty()) {
+            QByteArray name = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
+            conversation->path = QDir(m_directory).filePath(QString::fromLatin1(name));
+            if (!load(conversation, create)) {
+                delete conversation;
+                return nullptr;
+            }
+            conversation->filesOpen = true;
+            m_withFiles.insert(conversation);
+        }
+        m_conversations.insert(key, conversation);
+    } else if (!m_directory.isEmpty() && !conversation->filesOpen) {
+        if (!reopen(conversation)) return nullptr;
+    }
+    conversation->lastUsed = ++m_useCounter;
+    evict();
+    return conversation;
+}
+
+bool HistoryStore::load(Conversation* conversation, bool create) {
+    QDir dir(conversation->path);
+    if (!dir.exists()) {
+        if (!create) return false;
+        if (!QDir().mkpath(conversation->path)) {
+            qWarning() << "Cannot create history directory" << conversation->path;
+            return false;
+        }
+    }
+
+    QList<int> numbers;
+    const QStringList files = dir.entryList({"history-*.seg"}, QDir::Files);
+    for (const QString& name : files) {
+        bool ok = false;
+        int number = name.mid(8, name.size() - 12).toInt(&ok);
+        if (ok) numbers.append(number);
+    }
+    std::sort(numbers.begin(), numbers.end());
+
+    // Segments are numbered from 0; anything past a gap is unreachable
+    for (int i = 0; i < numbers.size() && numbers[i] == i; ++i) {
+        auto* segment = new Segment;
+        segment->file.setFileName(segmentPath(conversation->path, i));
+        segment->size = segment->file.size();
+        conversation->segments.append(segment);
+    }
+
+    conversation->indexFile.setFileName(dir.filePath("index"));
+    if (!conversation->indexFile.open(QIODevice::ReadWrite)) {
+        qWarning() << "Failed to open history index" << conversation->indexFile.fileName()
+                   << conversation->indexFile.errorString();
+        return false;
+    }
+    const QByteArray raw = conversation->indexFile.readAll();
+    if (raw.size() % kIndexEntrySize != 0) {
+        // Torn last entry; later appends must stay aligned
+        conversation->indexFile.resize(raw.size() - raw.size() % kIndexEntrySize);
+        conversation->indexFile.seek(conversation->indexFile.size());
+    }
+    for (int offset = 0; offset + kIndexEntrySize <= raw.size(); offset += kIndexEntrySize) {
+        Position position;
+        position.segment = static_cast<int>(qFromBigEndian<quint32>(raw.constData() + offset));
+        position.offset = qFromBigEndian<qint64>(raw.constData() + offset + 4);
+        conversation->index.append(position);
+    }
+
+    recover(conversation);
+
+    // Never append after a torn tail
+    int last = conversation->segments.size() - 1;
+    bool torn = last >= 0
+        && QFileInfo(conversation->segments[last]->file).size() > conversation->segments[last]->size;
+    return openSegment(conversation, last < 0 || torn ? last + 1 : last);
+}
+
+void HistoryStore::recover(Conversation* conversation) {
+    // Index entries are written first; drop any whose record didn't make it
+    const int indexed = conversation->index.size();
+    while (!conversation->index.isEmpty() && !validRecord(conversation, conversation->index.last())) {
+        conversation->index.removeLast();
+    }
+    bool rewrite = conversation->index.size() != indexed;
+
+    Position position = conversation->index.isEmpty() ? Position() : conversation->index.last();
+    conversation->count = conversation->index.isEmpty()
+        ? 0 : qint64(conversation->index.size() - 1) * kIndexStride;
+
+    // Walk the tail past the last index entry
+    while (validRecord(conversation, position)) {
+        if (conversation->count == qint64(conversation->index.size()) * kIndexStride) {
+            conversation->index.append(position);
+            rewrite = true;
+        }
+        readRecord(conversation, position, nullptr);
+        conversation->count++;
+    }
+
+    // Everything after the first bad record is cut off
+    if (position.segment < conversation->segments.size()) {
+        Segment* torn = conversation->segments[position.segment];
+        if (torn->size > position.offset) {
+            qWarning() << "Truncated history log" << torn->file.fileName() << "at" << position.offset;
+        }
+        torn->size = position.offset;
+        while (conversation->segments.size() > position.segment + 1) {
+            Segment* segment = conversation->segments.takeLast();
+            if (segment->map) segment->file.unmap(segment->map);
+            QFile::remove(segment->file.fileName());
+            delete segment;
+        }
+    }
+
+    if (rewrite) {
+        conversation->indexFile.resize(0);
+        conversation->indexFile.seek(0);
+        for (const Position& entry : qAsConst(conversation->index)) {
+            writeIndex(conversation, entry);
+        }
+        conversation->indexFile.flush();
+    }
+}
+
+bool HistoryStore::reopen(Conversation* conversation) {
+    // Index and segment sizes are still current; only the handles went
+    conversation->indexFile.setFileName(QDir(conversation->path).filePath("index"));
+    if (!conversation->indexFile.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "Failed to open history index" << conversation->indexFile.fileName()
+                   << conversation->indexFile.errorString();
+        return false;
+    }
+    if (!openSegment(conversation, conversation->segments.size() - 1)) {
+        conversation->indexFile.close();
+        return false;
+    }
+    conversation->filesOpen = true;
+    m_withFiles.insert(conversation);
+    return true;
+}
+
+void HistoryStore::closeFiles(Conversation* conversation) {
+    // Log before index, so an index entry never outlives its record
+    conversation->log.close();
+    conversation->indexFile.close();
+    for (Segment* segment : qAsConst(conversation->segments)) {
+        if (segment->map) segment->file.unmap(segment->map);
+        segment->map = nullptr;
+        segment->mapped = 0;
+        segment->file.close();
+    }
+    conversation->filesOpen = false;
+    m_withFiles.remove(conversation);
+    m_dirty.remove(conversation);
+}
+
+bool HistoryStore::openSegment(Conversation* conversation, int index) {
+    if (index == conversation->segments.size()) {
+        auto* segment = new Segment;
+        segment->file.setFileName(segmentPath(conversation->path, index));
+        conversation->segments.append(segment);
+    }
+
+    conversation->log.close();
+    conversation->log.setFileName(segmentPath(conversation->path, index));
+    if (!conversation->log.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "Failed to open history segment" << conversation->log.fileName()
+                   << conversation->log.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool HistoryStore::validRecord(Conversation* conversation, const Position& start) {
+    Position position = start;
+    QByteArray payload;
+    if (!readRecord(conversation, position, &payload)) return false;
+
+    const char* header = payload.constData() - kRecordHeaderSize;
+    return qFromBigEndian<quint16>(header + 4)
+        == qChecksum(payload.constData(), static_cast<uint>(payload.size()));
+}
+
+const char* HistoryStore::segmentData(Conversation* conversation, int index) {
+    Segment* segment = conversation->segments[index];
+    if (segment->map && segment->mapped >= segment->size) {
+        return reinterpret_cast<const char*>(segment->map);
+    }
+
+    // The tail segment is written through a buffer; push it out first
+    if (index == conversation->segments.size() - 1) {
+        conversation->log.flush();
+    }
+    if (segment->map) {
+        segment->file.unmap(segment->map);
+        segment->map = nullptr;
+        segment->mapped = 0;
+    }
+    if (!segment->file.isOpen() && !segment->file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed to open history segment" << segment->file.fileName();
+        return nullptr;
+    }
+
+    segment->map = segment->file.map(0, segment->size);
+    if (!segment->map) {
+        qWarning() << "Failed to map history segment" << segment->file.fileName()
+                   << segment->file.errorString();
+        return nullptr;
+    }
+    segment->mapped = segment->size;
+    return reinterpret_cast<const char*>(segment->map);
+}
+
+bool HistoryStore::readRecord(Conversation* conversation, Position& position, QByteArray* payload) {
+    // A position at the end of a segment continues at the start of the next
+    while (position.segment < conversation->segments.size()
+           && position.offset >= conversation->segments[position.segment]->size) {
+        position.segment++;
+        position.offset = 0;
+    }
+    if (position.segment < 0 || position.segment >= conversation->segments.size()) return false;
+
+    const Segment* segment = conversation->segments[position.segment];
+    if (position.offset < 0 || position.offset + kRecordHeaderSize > segment->size) return false;
+
+    const char* data = segmentData(conversation, position.segment);
+    if (!data) return false;
+
+    const char* header = data + position.offset;
+    quint32 length = qFromBigEndian<quint32>(header);
+    if (length > segment->size - position.offset - kRecordHeaderSize) return false;
+
+    // Points into the map; valid until the segment is remapped
+    if (payload) {
+        *payload = QByteArray::fromRawData(header + kRecordHeaderSize, static_cast<int>(length));
+    }
+    position.offset += kRecordHeaderSize + length;
+    return true;
+}
+
+void HistoryStore::writeIndex(Conversation* conversation, const Position& position) {
+    char entry[kIndexEntrySize];
+    qToBigEndian<quint32>(static_cast<quint32>(position.segment), entry);
+    qToBigEndian<qint64>(position.offset, entry + 4);
+    conversation->indexFile.write(entry, kIndexEntrySize);
+}
+
+void HistoryStore::evict() {
+    // Least recently used first. The scan over every conversation only
+    // runs when one is loaded from disk or created, which costs far more.
+    while (m_withFiles.size() > kMaxOpenConversations) {
+        Conversation* oldest = *m_withFiles.begin();
+        for (Conversation* conversation : qAsConst(m_withFiles)) {
+            if (conversation->lastUsed < oldest->lastUsed) oldest = conversation;
+        }
+        closeFiles(oldest);
+    }
+
+    while (m_conversations.size() > kMaxConversations) {
+        auto oldest = m_conversations.begin();
+        for (auto it = m_conversations.begin(); it != m_conversations.end(); ++it) {
+            if (it.value()->lastUsed < oldest.value()->lastUsed) oldest = it;
+        }
+        if (oldest.value()->filesOpen) closeFiles(oldest.value());
+        delete oldest.value();
+        m_conversations.erase(oldest);
+    }
+}
+
+void HistoryStore::flush() {
+    m_flushTimer.stop();
+    for (Conversation* conversation : qAsConst(m_dirty)) {
+        conversation->log.flush();
+        conversation->indexFile.flush();
+    }
+    m_dirty.clear();
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <QObject>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QSet>
+#include <QTimer>
+#include <QVector>
+
+// One page of a conversation, oldest message first
+struct HistoryPage {
+    QJsonArray messages; // {seq, from, text, timestamp}
+    qint64 first = 0;    // seq of the first message; "before" for the previous page
+    qint64 oldest = 0;   // seq of the oldest message still kept
+    qint64 total = 0;
+
+    // Older messages left to page through
+    bool more() const { return first > oldest; }
+};
+
+// Time-ordered chat history with one append-only log per conversation.
+// A conversation's directory holds numbered segment files plus a sparse
+// index with the position of every 64th message, so fetching any page is
+// an index lookup and at most 63 skipped record headers, however long the
+// conversation is. Segments are read through memory maps and only the
+// most recently used conversations keep their files open; a larger set
+// keeps its index and segment sizes in memory, so reopening one is two
+// file opens rather than a directory listing, an index read and recovery.
+// Without a directory history is kept in memory only, and only for the
+// latest messages of the most recently used conversations.
+class HistoryStore : public QObject {
+    Q_OBJECT
+
+public:
+    explicit HistoryStore(const QString& directory, QObject* parent = nullptr);
+    ~HistoryStore();
+
+    bool open();
+
+    // Same key whichever side of the conversation asks
+    static QString conversationKey(const QString& a, const QString& b);
+
+    void append(const QString& conversation, const QString& from,
+                const QString& text, const QString& timestamp);
+
+    // Up to limit messages before seq "before" (< 0 = the latest ones)
+    HistoryPage fetch(const QString& conversation, qint64 before, int limit);
+
+private:
+    struct Position {
+        int segment = 0;
+        qint64 offset = 0;
+    };
+
+    struct Segment {
+        QFile file;       // read side, mapped
+        uchar* map = nullptr;
+        qint64 mapped = 0;
+        qint64 size = 0;  // bytes of valid records
+    };
+
+    struct Conversation {
+        QString path;
+        qint64 count = 0;
+        QVector<Position> index;   // position of message i * kIndexStride
+        QVector<Segment*> segments;
+        QFile log;                 // append side of the last segment
+        QFile indexFile;
+        quint64 lastUsed = 0;
+        bool filesOpen = false;     // log, index and segment handles held
+        QVector<QByteArray> memory; // payloads when there is no directory
+        qint64 memoryFirst = 0;     // seq of memory[0]; older ones were dropped
+
+        ~Conversation();
+    };
+
+    Conversation* conversation(const QString& key, bool create);
+    bool load(Conversation* conversation, bool create);
+    bool reopen(Conversation* conversation);
+    void closeFiles(Conversation* conversation);
+    void recover(Conversation* conversation);
+    bool openSegment(Conversation* conversation, int index);
+    bool validRecord(Conversation* conversation, const Position& position);
+    const char* segmentData(Conversation* conversation, int segment);
+    bool readRecord(Conversation* conversation, Position& position, QByteArray* payload);
+    void writeIndex(Conversation* conversation, const Position& position);
+    void evict();
+    void flush();
+
+    QString m_directory;
+    QHash<QString, Conversation*> m_conversations;
+    QSet<Conversation*> m_withFiles; // the ones with filesOpen
+    QSet<Conversation*> m_dirty;
+    quint64 m_useCounter = 0;
+    QTimer m_flushTimer;
+};
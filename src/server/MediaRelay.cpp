@@ -0,0 +1,127 @@
+#include "server/MediaRelay.h"
+#include "server/Metrics.h"
+#include "server/ServerShard.h"
+#include "network/Protocol.h"
+
+#include <QMutexLocker>
+
+namespace {
+const int kMaxRoomSize = 64;
+const quint64 kSpeakerTimeoutNs = 1000000000ull; // no audio this long = not speaking
+}
+
+MediaRelay::MediaRelay(int topSpeakers, ServerMetrics* metrics)
+    : m_topSpeakers(topSpeakers)
+    , m_metrics(metrics)
+{
+}
+
+bool MediaRelay::join(const QString& conferenceId, quint64 sessionId, ServerShard* shard,
+                      const QString& username, QStringList* present) {
+    QMutexLocker lock(&m_mutex);
+
+    Room& room = m_rooms[conferenceId];
+    if (!room.contains(sessionId) && room.size() >= kMaxRoomSize) return false;
+
+    for (auto it = room.constBegin(); it != room.constEnd(); ++it) {
+        if (it.key() != sessionId) present->append(it->username);
+    }
+
+    Participant& participant = room[sessionId];
+    participant.shard = shard;
+    participant.username = username;
+    m_roomsBySession[sessionId].insert(conferenceId);
+    return true;
+}
+
+QVector<quint64> MediaRelay::leave(const QString& conferenceId, quint64 sessionId) {
+    QMutexLocker lock(&m_mutex);
+
+    auto roomIt = m_rooms.find(conferenceId);
+    if (roomIt == m_rooms.end() || !roomIt->remove(sessionId)) return QVector<quint64>();
+
+    auto sessionIt = m_roomsBySession.find(sessionId);
+    if (sessionIt != m_roomsBySession.end()) {
+        sessionIt->remove(conferenceId);
+        if (sessionIt->isEmpty()) m_roomsBySession.erase(sessionIt);
+    }
+
+    QVector<quint64> remaining = roomIt->keys().toVector();
+    if (remaining.isEmpty()) m_rooms.erase(roomIt);
+    return remaining;
+}
+
+QHash<QString, QVector<quint64>> MediaRelay::leaveAll(quint64 sessionId) {
+    QSet<QString> rooms;
+    {
+        QMutexLocker lock(&m_mutex);
+        rooms = m_roomsBySession.value(sessionId);
+    }
+
+    QHash<QString, QVector<quint64>> left;
+    for (const QString& conferenceId : qAsConst(rooms)) {
+        left.insert(conferenceId, leave(conferenceId, sessionId));
+    }
+    return left;
+}
+
+QVector<quint64> MediaRelay::members(const QString& conferenceId) const {
+    QMutexLocker lock(&m_mutex);
+    return m_rooms.value(conferenceId).keys().toVector();
+}
+
+bool MediaRelay::isTopSpeaker(const Room& room, quint64 sessionId, int loudness, quint64 now) const {
+    // Ranked by smoothed loudness, ties to the lower session id so the
+    // choice is stable between frames
+    int louder = 0;
+    for (auto it = room.constBegin(); it != room.constEnd(); ++it) {
+        if (it.key() == sessionId || now - it->heardAt > kSpeakerTimeoutNs) continue;
+        if (it->loudness > loudness || (it->loudness == loudness && it.key() < sessionId)) {
+            if (++louder >= m_topSpeakers) return false;
+        }
+    }
+    return true;
+}
+
+void MediaRelay::forward(quint64 sessionId, const QByteArray& frame) {
+    Protocol::MediaFrame header;
+    if (!Protocol::decodeMedia(frame, header)) return;
+    m_metrics->mediaFramesReceived.add();
+
+    QString sender;
+    QHash<ServerShard*, QVector<quint64>> targets;
+    {
+        QMutexLocker lock(&m_mutex);
+
+        auto roomIt = m_rooms.find(header.conferenceId);
+        if (roomIt == m_rooms.end()) return;
+        auto self = roomIt->find(sessionId);
+        if (self == roomIt->end()) return;
+
+        if (!header.video) {
+            const quint64 now = ServerMetrics::now();
+            self->loudness = (3 * self->loudness + Protocol::kMediaSilent - header.level) / 4;
+            self->heardAt = now;
+
+            if (!isTopSpeaker(*roomIt, sessionId, self->loudness, now)) {
+                m_metrics->mediaAudioSuppressed.add();
+                return;
+            }
+        }
+
+        sender = self->username;
+        for (auto it = roomIt->constBegin(); it != roomIt->constEnd(); ++it) {
+            if (it.key() != sessionId) targets[it->shard].append(it.key());
+        }
+    }
+    if (targets.isEmpty()) return;
+
+    ShardCommand command;
+    command.kind = ShardCommand::Media;
+    command.media = Protocol::forwardMedia(frame, header, sender);
+    command.droppable = header.video;
+    for (auto it = targets.begin(); it != targets.end(); ++it) {
+        command.sessionIds = std::move(it.value());
+        it.key()->post(command);
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+class ServerShard;
+struct ServerMetrics;
+
+// Selective forwarding for conference calls. Every participant uploads a
+// single audio and video stream to the server, which forwards each frame
+// to the rest of the room instead of clients sending one copy per peer.
+// Audio is only forwarded for the topSpeakers loudest participants, going
+// by the level clients put in each frame, and receivers' shards skip video
+// for sockets that are congested. The forwarded frame is built once per
+// upload and shared by every receiver.
+//
+// Membership changes come from the core thread; forward() runs on the
+// uploader's shard. Both sides take the one mutex.
+class MediaRelay {
+public:
+    MediaRelay(int topSpeakers, ServerMetrics* metrics);
+
+    // Adds the session to the room, created on first join, and fills in
+    // the usernames already there. False if the room is full.
+    bool join(const QString& conferenceId, quint64 sessionId, ServerShard* shard,
+              const QString& username, QStringList* present);
+    // Returns the sessions still in the room
+    QVector<quint64> leave(const QString& conferenceId, quint64 sessionId);
+    // Every room the session was in -> the sessions still in it
+    QHash<QString, QVector<quint64>> leaveAll(quint64 sessionId);
+
+    QVector<quint64> members(const QString& conferenceId) const;
+
+    void forward(quint64 sessionId, const QByteArray& frame);
+
+private:
+    struct Participant {
+        ServerShard* shard = nullptr;
+        QString username;
+        int loudness = 0;     // smoothed 127 - level, higher is louder
+        quint64 heardAt = 0;  // ns of the last audio frame
+    };
+    using Room = QHash<quint64, Participant>;
+
+    bool isTopSpeaker(const Room& room, quint64 sessionId, int loudness, quint64 now) const;
+
+    const int m_topSpeakers;
+    ServerMetrics* m_metrics;
+
+    mutable QMutex m_mutex;
+    QHash<QString, Room> m_rooms;
+    QHash<quint64, QSet<QString>> m_roomsBySession;
+};
@@ -0,0 +1,211 @@
+#include "server/Metrics.h"
+#include "server/AllocationCounter.h"
+
+#include <QtAlgorithms>
+#include <chrono>
+
+namespace {
+// Exported bucket bounds: 2^10 ns (~1 us) to 2^34 ns (~17 s) in steps of 4x
+const int kFirstExportedExponent = 10;
+const int kLastExportedExponent = 34;
+const int kExportedExponentStep = 2;
+
+QByteArray typeLabel(int opcode) {
+    QByteArray type = Protocol::typeForOpcode(static_cast<Protocol::Opcode>(opcode)).toUtf8();
+    return "type=\"" + (type.isEmpty() ? QByteArray("unknown") : type) + "\"";
+}
+}
+
+int LatencyHistogram::bucketFor(quint64 ns) {
+    const quint64 subBuckets = 1u << kSubBucketBits;
+    if (ns < subBuckets) return static_cast<int>(ns);
+
+    int exponent = 63 - static_cast<int>(qCountLeadingZeroBits(ns));
+    int sub = static_cast<int>((ns >> (exponent - kSubBucketBits)) & (subBuckets - 1));
+    return ((exponent - kSubBucketBits + 1) << kSubBucketBits) + sub;
+}
+
+void LatencyHistogram::record(quint64 ns) {
+    if (!MetricsRecording::on()) return;
+    m_buckets[bucketFor(ns)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sumNs.fetch_add(ns, std::memory_order_relaxed);
+}
+
+quint64 LatencyHistogram::countBelowPowerOfTwo(int exponent) const {
+    // 2^exponent is the lower bound of the first sub-bucket of its range
+    int end = qMin(kBucketCount, (exponent - kSubBucketBits + 1) << kSubBucketBits);
+    quint64 total = 0;
+    for (int i = 0; i < end; ++i) {
+        total += m_buckets[i].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void MetricsWriter::family(const char* name, const char* type, const char* help) {
+    m_out += "# HELP ";
+    m_out += name;
+    m_out += ' ';
+    m_out += help;
+    m_out += "\n# TYPE ";
+    m_out += name;
+    m_out += ' ';
+    m_out += type;
+    m_out += '\n';
+}
+
+void MetricsWriter::sample(const char* name, double value, const QByteArray& labels) {
+    m_out += name;
+    if (!labels.isEmpty()) {
+        m_out += '{';
+        m_out += labels;
+        m_out += '}';
+    }
+    m_out += ' ';
+    m_out += QByteArray::number(value, 'g', 12);
+    m_out += '\n';
+}
+
+void MetricsWriter::histogram(const char* name, const LatencyHistogram& histogram,
+                              const QByteArray& labels) {
+    const QByteArray bucket = QByteArray(name) + "_bucket";
+    const QByteArray prefix = labels.isEmpty() ? QByteArray() : labels + ',';
+
+    // Read the total first so concurrent records can't make +Inf < a bucket
+    quint64 count = histogram.count();
+    for (int exponent = kFirstExportedExponent; exponent <= kLastExportedExponent;
+         exponent += kExportedExponentStep) {
+        double bound = double(1ULL << exponent) / 1e9;
+        quint64 below = qMin(count, histogram.countBelowPowerOfTwo(exponent));
+        sample(bucket.constData(), double(below),
+               prefix + "le=\"" + QByteArray::number(bound, 'g', 6) + "\"");
+    }
+    sample(bucket.constData(), double(count), prefix + "le=\"+Inf\"");
+    sample((QByteArray(name) + "_sum").constData(), histogram.sumNs() / 1e9, labels);
+    sample((QByteArray(name) + "_count").constData(), double(count), labels);
+}
+
+void ServerMetrics::render(MetricsWriter& out) const {
+    out.family("skype_frames_received_total", "counter", "Frames received by message type");
+    for (int i = 0; i < kOpcodes; ++i) {
+        if (framesReceived[i].value() > 0) {
+            out.sample("skype_frames_received_total", double(framesReceived[i].value()), typeLabel(i));
+        }
+    }
+
+    out.family("skype_frame_parse_seconds", "histogram", "Time to decode an inbound frame");
+    for (int i = 0; i < kOpcodes; ++i) {
+        if (parseLatency[i].count() > 0) {
+            out.histogram("skype_frame_parse_seconds", parseLatency[i], typeLabel(i));
+        }
+    }
+
+    out.family("skype_handler_seconds", "histogram", "Time spent in the core handler");
+    for (int i = 0; i < kOpcodes; ++i) {
+        if (handlerLatency[i].count() > 0) {
+            out.histogram("skype_handler_seconds", handlerLatency[i], typeLabel(i));
+        }
+    }
+
+    // Compression ratio and cost per frame type: bytes_out / bytes_in and
+    // compress_seconds against the frames that took the deflate path
+    out.family("skype_compressed_frames_total", "counter", "Frames sent deflated, by message type");
+    for (int i = 0; i < kOpcodes; ++i) {
+        if (compressedFrames[i].value() > 0) {
+            out.sample("skype_compressed_frames_total", double(compressedFrames[i].value()),
+                       typeLabel(i));
+        }
+    }
+    out.family("skype_compression_input_bytes_total", "counter",
+               "Size of deflated frames before compression, by message type");
+    for (int i = 0; i < kOpcodes; ++i) {
+        if (compressedFrames[i].value() > 0) {
+            out.sample("skype_compression_input_bytes_total", double(compressedBytesIn[i].value()),
+                       typeLabel(i));
+        }
+    }
+    out.family("skype_compression_output_bytes_total", "counter",
+               "Size of deflated frames on the wire, by message type");
+    for (int i = 0; i < kOpcodes; ++i) {
+        if (compressedFrames[i].value() > 0) {
+            out.sample("skype_compression_output_bytes_total", double(compressedBytesOut[i].value()),
+                       typeLabel(i));
+        }
+    }
+    out.family("skype_compress_seconds", "histogram", "Time to deflate one outbound frame");
+    for (int i = 0; i < kOpcodes; ++i) {
+        if (compressLatency[i].count() > 0) {
+            out.histogram("skype_compress_seconds", compressLatency[i], typeLabel(i));
+        }
+    }
+
+    out.family("skype_core_queue_delay_seconds", "histogram",
+               "Time a frame waits between its shard and the core");
+    out.histogram("skype_core_queue_delay_seconds", coreQueueDelay);
+
+    out.family("skype_core_queue_depth", "gauge", "Events waiting for the core thread");
+    out.sample("skype_core_queue_depth", double(coreQueueDepth.load(std::memory_order_relaxed)));
+
+    out.family("skype_password_queue_delay_seconds", "histogram",
+               "Time a login or registration waits for a hashing thread");
+    out.histogram("skype_password_queue_delay_seconds", passwordQueueDelay);
+    out.family("skype_password_hash_seconds", "histogram",
+               "Time spent hashing or verifying one password");
+    out.histogram("skype_password_hash_seconds", passwordHashLatency);
+
+    struct { const char* name; const char* help; const Counter& counter; } counters[] = {
+        {"skype_connections_accepted_total", "WebSocket connections accepted", connectionsAccepted},
+        {"skype_frames_sent_total", "Frames written to sockets", framesSent},
+        {"skype_received_bytes_total", "Payload bytes received", bytesReceived},
+        {"skype_sent_bytes_total", "Payload bytes queued for sending", bytesSent},
+        {"skype_oversized_frames_total", "Inbound frames dropped for size", oversizedFrames},
+        {"skype_messages_relayed_total", "Chat messages relayed to an online user", messagesRelayed},
+        {"skype_messages_queued_total", "Chat messages stored for an offline user", messagesQueued},
+        {"skype_login_failures_total", "Rejected login attempts", loginFailures},
+        {"skype_presence_frames_total", "Presence and presence_batch frames sent", presenceFrames},
+        {"skype_frames_deferred_total", "Frames queued behind a congested socket", framesDeferred},
+        {"skype_presence_coalesced_total", "Presence updates held back for a congested socket",
+         presenceCoalesced},
+        {"skype_slow_consumer_disconnects_total", "Connections dropped for not reading",
+         slowConsumerDisconnects},
+        {"skype_password_jobs_rejected_total", "Logins and registrations refused as busy",
+         passwordJobsRejected},
+        {"skype_group_messages_total", "Group messages accepted for fan-out", groupMessages},
+        {"skype_group_deliveries_total", "Group frames handed to online members' shards",
+         groupDeliveries},
+        {"skype_media_frames_received_total", "Conference audio and video frames uploaded",
+         mediaFramesReceived},
+        {"skype_media_frames_forwarded_total", "Conference frames written to receivers",
+         mediaFramesForwarded},
+        {"skype_media_frames_dropped_total", "Conference frames skipped for congested receivers",
+         mediaFramesDropped},
+        {"skype_media_audio_suppressed_total", "Audio frames not forwarded: sender outside the top speakers",
+         mediaAudioSuppressed},
+        {"skype_sessions_parked_total", "Logins kept for resumption after their socket dropped",
+         sessionsParked},
+        {"skype_sessions_resumed_total", "Parked logins picked up again with a resume token",
+         sessionsResumed},
+        {"skype_resume_failures_total", "Resume attempts with an unknown or expired token",
+         resumeFailures},
+        {"skype_parked_expired_total", "Parked logins that ran out their grace period",
+         parkedExpired},
+        {"skype_compressed_frames_received_total", "Inbound frames that arrived deflated",
+         compressedFramesReceived},
+    };
+    for (const auto& entry : counters) {
+        out.family(entry.name, "counter", entry.help);
+        out.sample(entry.name, double(entry.counter.value()));
+    }
+
+    if (AllocationCounter::counting()) {
+        out.family("skype_heap_allocations_total", "counter",
+                   "malloc/calloc/realloc calls in the whole process");
+        out.sample("skype_heap_allocations_total", double(AllocationCounter::count()));
+    }
+}
+
+quint64 ServerMetrics::now() {
+    using namespace std::chrono;
+    return static_cast<quint64>(
+        duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+}
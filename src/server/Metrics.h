@@ -0,0 +1,116 @@
+#pragma once
+
+#include <QByteArray>
+#include <QtGlobal>
+#include <array>
+#include <atomic>
+#include "network/Protocol.h"
+
+// Process-wide switch for Counter and LatencyHistogram updates. Always on
+// in the server; SkypeBench turns it off to price the instrumentation.
+namespace MetricsRecording {
+
+inline std::atomic<bool> enabled{true};
+inline bool on() { return enabled.load(std::memory_order_relaxed); }
+
+}
+
+// Monotonic counter; relaxed increments are enough for a scrape
+class Counter {
+public:
+    void add(quint64 n = 1) {
+        if (MetricsRecording::on()) m_value.fetch_add(n, std::memory_order_relaxed);
+    }
+    quint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<quint64> m_value{0};
+};
+
+// Log-linear histogram in the style of HdrHistogram: every power of two is
+// split into eight linear sub-buckets, so a recorded value is never more
+// than 12.5% away from its bucket bound. Recording is a count-leading-zeros
+// and three relaxed atomic adds, cheap enough to leave on permanently.
+class LatencyHistogram {
+public:
+    static const int kSubBucketBits = 3;
+    static const int kBucketCount = (64 - kSubBucketBits + 1) << kSubBucketBits;
+
+    void record(quint64 ns);
+
+    quint64 count() const { return m_count.load(std::memory_order_relaxed); }
+    quint64 sumNs() const { return m_sumNs.load(std::memory_order_relaxed); }
+
+    // Samples below 2^exponent ns; exponent must be >= kSubBucketBits
+    quint64 countBelowPowerOfTwo(int exponent) const;
+
+private:
+    static int bucketFor(quint64 ns);
+
+    std::array<std::atomic<quint64>, kBucketCount> m_buckets{};
+    std::atomic<quint64> m_count{0};
+    std::atomic<quint64> m_sumNs{0};
+};
+
+// Accumulates Prometheus text exposition format (version 0.0.4)
+class MetricsWriter {
+public:
+    void family(const char* name, const char* type, const char* help);
+    void sample(const char* name, double value, const QByteArray& labels = QByteArray());
+    void histogram(const char* name, const LatencyHistogram& histogram,
+                   const QByteArray& labels = QByteArray());
+
+    const QByteArray& data() const { return m_out; }
+
+private:
+    QByteArray m_out;
+};
+
+// Process-wide instrumentation shared by the core and the shards. Every
+// field is updated with relaxed atomics, so any thread can record and the
+// metrics endpoint can read at any time without locks.
+struct ServerMetrics {
+    static const int kOpcodes = static_cast<int>(Protocol::Opcode::Count);
+
+    std::array<Counter, kOpcodes> framesReceived;
+    std::array<LatencyHistogram, kOpcodes> parseLatency;   // shard: decode
+    std::array<LatencyHistogram, kOpcodes> handlerLatency; // core: handler
+    std::array<Counter, kOpcodes> compressedFrames;        // shard: sent deflated
+    std::array<Counter, kOpcodes> compressedBytesIn;       // their size before deflate
+    std::array<Counter, kOpcodes> compressedBytesOut;      // and after
+    std::array<LatencyHistogram, kOpcodes> compressLatency;
+    LatencyHistogram coreQueueDelay;                       // shard -> core handoff
+    std::atomic<qint64> coreQueueDepth{0};
+    LatencyHistogram passwordQueueDelay;                   // login -> hasher thread
+    LatencyHistogram passwordHashLatency;                  // hasher: hash or verify
+
+    Counter connectionsAccepted;
+    Counter framesSent;
+    Counter bytesReceived;
+    Counter bytesSent;
+    Counter oversizedFrames;
+    Counter messagesRelayed;
+    Counter messagesQueued;
+    Counter loginFailures;
+    Counter presenceFrames;
+    Counter framesDeferred;
+    Counter presenceCoalesced;
+    Counter slowConsumerDisconnects;
+    Counter passwordJobsRejected;
+    Counter groupMessages;
+    Counter groupDeliveries;
+    Counter mediaFramesReceived;
+    Counter mediaFramesForwarded;
+    Counter mediaFramesDropped;
+    Counter mediaAudioSuppressed;
+    Counter sessionsParked;
+    Counter sessionsResumed;
+    Counter resumeFailures;
+    Counter parkedExpired;
+    Counter compressedFramesReceived;
+
+    void render(MetricsWriter& out) const;
+
+    // Monotonic nanoseconds for latency measurements
+    static quint64 now();
+};
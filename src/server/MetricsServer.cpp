@@ -0,0 +1,79 @@
+#include "server/MetricsServer.h"
+
+#include <QTcpSocket>
+#include <QDebug>
+
+namespace {
+const int kMaxRequestSize = 8192;
+}
+
+MetricsServer::MetricsServer(Renderer renderer, QObject* parent)
+    : QObject(parent)
+    , m_renderer(std::move(renderer))
+{
+    connect(&m_server, &QTcpServer::newConnection, this, &MetricsServer::onNewConnection);
+}
+
+bool MetricsServer::listen(const QHostAddress& address, quint16 port) {
+    if (!m_server.listen(address, port)) {
+        qWarning() << "Failed to start metrics endpoint:" << m_server.errorString();
+        return false;
+    }
+    qDebug() << "Metrics endpoint on" << address.toString() << "port" << port;
+    return true;
+}
+
+void MetricsServer::onNewConnection() {
+    while (QTcpSocket* socket = m_server.nextPendingConnection()) {
+        connect(socket, &QTcpSocket::readyRead, this, &MetricsServer::onReadyRead);
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+            m_requests.remove(socket);
+            socket->deleteLater();
+        });
+        m_requests.insert(socket, QByteArray());
+    }
+}
+
+void MetricsServer::onReadyRead() {
+    auto* socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket || !m_requests.contains(socket)) return;
+
+    QByteArray& request = m_requests[socket];
+    request += socket->readAll();
+
+    int headerEnd = request.indexOf("\r\n\r\n");
+    if (headerEnd < 0) {
+        if (request.size() > kMaxRequestSize) {
+            respond(socket, "413 Payload Too Large", "text/plain", "request too large\n");
+        }
+        return;
+    }
+
+    // Request line: METHOD SP PATH SP VERSION
+    const QList<QByteArray> requestLine = request.left(request.indexOf("\r\n")).split(' ');
+    QByteArray method = requestLine.value(0);
+    QByteArray path = requestLine.value(1);
+    path = path.left(path.indexOf('?') < 0 ? path.size() : path.indexOf('?'));
+
+    if (method != "GET") {
+        respond(socket, "405 Method Not Allowed", "text/plain", "method not allowed\n");
+    } else if (path != "/metrics") {
+        respond(socket, "404 Not Found", "text/plain", "not found\n");
+    } else {
+        respond(socket, "200 OK", "text/plain; version=0.0.4; charset=utf-8", m_renderer());
+    }
+}
+
+void MetricsServer::respond(QTcpSocket* socket, const QByteArray& status,
+                            const QByteArray& contentType, const QByteArray& body) {
+    m_requests.remove(socket);
+    socket->disconnect(this);
+
+    QByteArray response = "HTTP/1.0 " + status + "\r\n"
+                          "Content-Type: " + contentType + "\r\n"
+                          "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                          "Connection: close\r\n\r\n" + body;
+    connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    socket->write(response);
+    socket->disconnectFromHost();
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <QObject>
+#include <QTcpServer>
+#include <QHash>
+#include <functional>
+
+class QTcpSocket;
+
+// Minimal HTTP/1.0 responder for Prometheus scrapes. Serves GET /metrics
+// from a render callback and answers everything else with 404. Meant to
+// listen on loopback only.
+class MetricsServer : public QObject {
+    Q_OBJECT
+
+public:
+    using Renderer = std::function<QByteArray()>;
+
+    explicit MetricsServer(Renderer renderer, QObject* parent = nullptr);
+
+    bool listen(const QHostAddress& address, quint16 port);
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+
+private:
+    void respond(QTcpSocket* socket, const QByteArray& status,
+                 const QByteArray& contentType, const QByteArray& body);
+
+    Renderer m_renderer;
+    QTcpServer m_server;
+    QHash<QTcpSocket*, QByteArray> m_requests; // partial request headers
+};
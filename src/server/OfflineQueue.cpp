@@ -0,0 +1,428 @@
+#include "server/OfflineQueue.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QtEndian>
+#include <QDebug>
+#include <algorithm>
+
+namespace {
+
+const int kRecordHeaderSize = 6;                   // quint32 length + quint16 checksum
+const qint64 kSegmentBytes = 16 * 1024 * 1024;
+const int kFlushWindowMs = 10;
+const int kMaintenanceIntervalMs = 30 * 1000;
+
+enum RecordType : quint8 {
+    RecordMessage = 1,
+    RecordDelivered = 2 // everything up to seq for the recipient was delivered
+};
+
+QString segmentPath(const QString& directory, int index) {
+    return QDir(directory).filePath(QString("offline-%1.seg").arg(index, 8, 10, QChar('0')));
+}
+
+QByteArray encodeMessage(quint64 seq, qint64 storedAt, const QString& recipient,
+                         const OfflineMessage& message) {
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_9);
+    out << static_cast<quint8>(RecordMessage) << seq << storedAt << recipient
+        << message.from << message.text << message.timestamp;
+    if (!message.group.isEmpty()) {
+        out << message.group; // optional trailer; older records end here
+    }
+    return payload;
+}
+
+QByteArray encodeDelivered(quint64 seq, const QString& recipient) {
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_9);
+    out << static_cast<quint8>(RecordDelivered) << seq << recipient;
+    return payload;
+}
+
+OfflineMessage decodeMessage(const QByteArray& payload) {
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_5_9);
+    quint8 type = 0;
+    quint64 seq = 0;
+    qint64 storedAt = 0;
+    QString recipient;
+    OfflineMessage message;
+    in >> type >> seq >> storedAt >> recipient >> message.from >> message.text >> message.timestamp;
+    if (!in.atEnd()) {
+        in >> message.group;
+    }
+    return message;
+}
+
+}
+
+OfflineQueue::OfflineQueue(const QString& directory, QObject* parent)
+    : QObject(parent)
+    , m_directory(directory)
+{
+    m_flushTimer.setSingleShot(true);
+    m_flushTimer.setInterval(kFlushWindowMs);
+    connect(&m_flushTimer, &QTimer::timeout, this, &OfflineQueue::flush);
+
+    m_maintenanceTimer.setInterval(kMaintenanceIntervalMs);
+    connect(&m_maintenanceTimer, &QTimer::timeout, this, &OfflineQueue::maintain);
+}
+
+OfflineQueue::~OfflineQueue() {
+    flush();
+}
+
+bool OfflineQueue::open() {
+    m_maintenanceTimer.start();
+    if (m_directory.isEmpty()) return true;
+
+    if (!QDir().mkpath(m_directory)) {
+        qWarning() << "Cannot create offline queue directory" << m_directory;
+        m_directory.clear();
+        return false;
+    }
+
+    QList<int> indexes;
+    const QStringList files = QDir(m_directory).entryList({"offline-*.seg"}, QDir::Files);
+    for (const QString& name : files) {
+        bool ok = false;
+        int index = name.mid(8, name.size() - 12).toInt(&ok);
+        if (ok) indexes.append(index);
+    }
+    std::sort(indexes.begin(), indexes.end());
+
+    QHash<QString, quint64> delivered;
+    for (int index : qAsConst(indexes)) {
+        scanSegment(index, delivered);
+    }
+
+    // Drop delivered, expired and duplicate (relocated) records; order by seq
+    qint64 cutoff = QDateTime::currentMSecsSinceEpoch() - m_retentionMs;
+    int pending = 0;
+    for (auto it = m_queues.begin(); it != m_queues.end();) {
+        QVector<Entry>& entries = it.value();
+        std::stable_sort(entries.begin(), entries.end(),
+                         [](const Entry& a, const Entry& b) { return a.seq < b.seq; });
+
+        quint64 deliveredSeq = delivered.value(it.key(), 0);
+        QVector<Entry> kept;
+        kept.reserve(entries.size());
+        for (int i = 0; i < entries.size(); ++i) {
+            const Entry& entry = entries[i];
+            bool superseded = i + 1 < entries.size() && entries[i + 1].seq == entry.seq;
+            if (superseded || entry.seq <= deliveredSeq || entry.storedAt < cutoff) {
+                m_cachedBytes -= entry.payload.size();
+                continue;
+            }
+            Segment& segment = m_segments[entry.segment];
+            segment.liveCount++;
+            segment.liveBytes += entry.length;
+            kept.append(entry);
+        }
+
+        if (kept.isEmpty()) {
+            it = m_queues.erase(it);
+        } else {
+            pending += kept.size();
+            it.value() = kept;
+            ++it;
+        }
+    }
+
+    // Never append after a possibly torn tail
+    int next = indexes.isEmpty() ? 0 : indexes.last() + 1;
+    if (!openSegment(next)) return false;
+
+    if (pending > 0) {
+        qDebug() << "Recovered" << pending << "offline messages for" << m_queues.size() << "users";
+    }
+    return true;
+}
+
+bool OfflineQueue::enqueue(const QString& recipient, const OfflineMessage& message) {
+    Entry entry;
+    entry.seq = m_nextSeq++;
+    entry.storedAt = QDateTime::currentMSecsSinceEpoch();
+    QByteArray payload = encodeMessage(entry.seq, entry.storedAt, recipient, message);
+    entry.length = static_cast<quint32>(payload.size());
+
+    bool fitsInMemory = m_cachedBytes + payload.size() <= m_memoryBudget;
+    if (m_directory.isEmpty()) {
+        if (!fitsInMemory) {
+            qWarning() << "Offline queue full, dropping message for" << recipient;
+            return false;
+        }
+    } else {
+        writeRecord(payload, &entry);
+        if (entry.segment < 0 && !fitsInMemory) {
+            qWarning() << "Offline queue unavailable, dropping message for" << recipient;
+            return false;
+        }
+        if (entry.segment >= 0) {
+            Segment& segment = m_segments[entry.segment];
+            segment.liveCount++;
+            segment.liveBytes += entry.length;
+        }
+    }
+
+    // Spill: past the budget only the index entry stays in memory
+    if (fitsInMemory) {
+        entry.payload = payload;
+        m_cachedBytes += payload.size();
+    }
+
+    m_queues[recipient].append(entry);
+    return true;
+}
+
+QList<OfflineMessage> OfflineQueue::take(const QString& recipient) {
+    QList<OfflineMessage> messages;
+    auto it = m_queues.find(recipient);
+    if (it == m_queues.end()) return messages;
+
+    QVector<Entry> entries = it.value();
+    m_queues.erase(it);
+
+    messages.reserve(entries.size());
+    for (const Entry& entry : qAsConst(entries)) {
+        messages.append(decodeMessage(readPayload(entry)));
+        release(entry);
+    }
+
+    if (!m_directory.isEmpty()) {
+        Entry tombstone;
+        writeRecord(encodeDelivered(entries.last().seq, recipient), &tombstone);
+    }
+    return messages;
+}
+
+QList<OfflineMessage> OfflineQueue::peek(const QString& recipient) {
+    QList<OfflineMessage> messages;
+    auto it = m_queues.constFind(recipient);
+    if (it == m_queues.constEnd()) return messages;
+
+    messages.reserve(it->size());
+    for (const Entry& entry : *it) {
+        OfflineMessage message = decodeMessage(readPayload(entry));
+        message.seq = entry.seq;
+        messages.append(message);
+    }
+    return messages;
+}
+
+void OfflineQueue::acknowledge(const QString& recipient, quint64 seq) {
+    auto it = m_queues.find(recipient);
+    if (it == m_queues.end()) return;
+
+    QVector<Entry>& entries = it.value();
+    int acked = 0;
+    while (acked < entries.size() && entries[acked].seq <= seq) {
+        release(entries[acked]);
+        ++acked;
+    }
+    if (acked == 0) return;
+
+    if (!m_directory.isEmpty()) {
+        Entry tombstone;
+        writeRecord(encodeDelivered(entries[acked - 1].seq, recipient), &tombstone);
+    }
+    if (acked == entries.size()) {
+        m_queues.erase(it);
+    } else {
+        entries.remove(0, acked);
+    }
+}
+
+int OfflineQueue::pendingFor(const QString& recipient) const {
+    auto it = m_queues.constFind(recipient);
+    return it == m_queues.constEnd() ? 0 : it->size();
+}
+
+bool OfflineQueue::openSegment(int index) {
+    m_active.close();
+    m_active.setFileName(segmentPath(m_directory, index));
+    if (!m_active.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "Failed to open offline segment" << m_active.fileName() << m_active.errorString();
+        m_directory.clear();
+        return false;
+    }
+    m_activeSegment = index;
+    m_segments[index].size = m_active.size();
+    return true;
+}
+
+void OfflineQueue::scanSegment(int index, QHash<QString, quint64>& delivered) {
+    QFile file(segmentPath(m_directory, index));
+    if (!file.open(QIODevice::ReadOnly)) return;
+
+    qint64 size = file.size();
+    uchar* mapped = file.map(0, size);
+    QByteArray raw = mapped
+        ? QByteArray::fromRawData(reinterpret_cast<const char*>(mapped), static_cast<int>(size))
+        : file.readAll();
+    const char* data = raw.constData();
+
+    m_segments[index].size = size;
+
+    qint64 offset = 0;
+    while (offset + kRecordHeaderSize <= size) {
+        quint32 length = qFromBigEndian<quint32>(data + offset);
+        quint16 checksum = qFromBigEndian<quint16>(data + offset + 4);
+        const char* payloadData = data + offset + kRecordHeaderSize;
+
+        if (length > size - offset - kRecordHeaderSize) break;
+        if (qChecksum(payloadData, length) != checksum) break;
+
+        QByteArray payload(payloadData, static_cast<int>(length));
+        QDataStream in(payload);
+        in.setVersion(QDataStream::Qt_5_9);
+        quint8 type = 0;
+        quint64 seq = 0;
+        in >> type >> seq;
+        m_nextSeq = qMax(m_nextSeq, seq + 1);
+
+        if (type == RecordMessage) {
+            Entry entry;
+            entry.seq = seq;
+            entry.segment = index;
+            entry.offset = offset + kRecordHeaderSize;
+            entry.length = length;
+            QString recipient;
+            in >> entry.storedAt >> recipient;
+            if (m_cachedBytes + payload.size() <= m_memoryBudget) {
+                entry.payload = payload;
+                m_cachedBytes += payload.size();
+            }
+            m_queues[recipient].append(entry);
+        } else if (type == RecordDelivered) {
+            QString recipient;
+            in >> recipient;
+            quint64& last = delivered[recipient];
+            last = qMax(last, seq);
+        }
+
+        offset += kRecordHeaderSize + length;
+    }
+
+    if (mapped) file.unmap(mapped);
+}
+
+void OfflineQueue::writeRecord(const QByteArray& payload, Entry* entry) {
+    Segment* segment = &m_segments[m_activeSegment];
+    if (segment->size >= kSegmentBytes) {
+        flush();
+        if (!openSegment(m_activeSegment + 1)) return;
+        segment = &m_segments[m_activeSegment];
+    }
+
+    char header[kRecordHeaderSize];
+    qToBigEndian<quint32>(static_cast<quint32>(payload.size()), header);
+    qToBigEndian<quint16>(qChecksum(payload.constData(), static_cast<uint>(payload.size())), header + 4);
+    m_active.write(header, kRecordHeaderSize);
+    m_active.write(payload);
+
+    entry->segment = m_activeSegment;
+    entry->offset = segment->size + kRecordHeaderSize;
+    entry->length = static_cast<quint32>(payload.size());
+    segment->size += kRecordHeaderSize + payload.size();
+
+    scheduleFlush();
+}
+
+QByteArray OfflineQueue::readPayload(const Entry& entry) {
+    if (!entry.payload.isEmpty() || entry.segment < 0) return entry.payload;
+
+    if (entry.segment == m_activeSegment) {
+        m_active.flush();
+    }
+
+    QFile file(segmentPath(m_directory, entry.segment));
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(entry.offset)) {
+        qWarning() << "Lost offline message in segment" << entry.segment;
+        return QByteArray();
+    }
+    return file.read(entry.length);
+}
+
+void OfflineQueue::release(const Entry& entry) {
+    m_cachedBytes -= entry.payload.size();
+    if (entry.segment < 0) return;
+
+    auto it = m_segments.find(entry.segment);
+    if (it != m_segments.end()) {
+        it->liveCount--;
+        it->liveBytes -= entry.length;
+    }
+}
+
+void OfflineQueue::scheduleFlush() {
+    if (!m_flushTimer.isActive()) {
+        m_flushTimer.start();
+    }
+}
+
+void OfflineQueue::flush() {
+    m_flushTimer.stop();
+    if (m_active.isOpen()) {
+        m_active.flush();
+    }
+}
+
+void OfflineQueue::maintain() {
+    // Retention: queues are seq-ordered, so expired entries are at the front
+    qint64 cutoff = QDateTime::currentMSecsSinceEpoch() - m_retentionMs;
+    for (auto it = m_queues.begin(); it != m_queues.end();) {
+        QVector<Entry>& entries = it.value();
+        int expired = 0;
+        while (expired < entries.size() && entries[expired].storedAt < cutoff) {
+            release(entries[expired]);
+            ++expired;
+        }
+        entries.remove(0, expired);
+
+        if (entries.isEmpty()) {
+            it = m_queues.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    if (m_directory.isEmpty()) return;
+
+    // Segments are only ever removed oldest-first: a younger segment may
+    // hold the delivery tombstones that keep older records from replaying.
+    while (!m_segments.isEmpty() && m_segments.firstKey() != m_activeSegment) {
+        int oldest = m_segments.firstKey();
+        const Segment& segment = m_segments.first();
+        if (segment.liveCount > 0) {
+            if (segment.liveBytes * 2 >= segment.size) break;
+            // Sparse: move the survivors forward, then drop the file
+            relocateSegment(oldest);
+        }
+        QFile::remove(segmentPath(m_directory, oldest));
+        m_segments.remove(oldest);
+    }
+}
+
+void OfflineQueue::relocateSegment(int index) {
+    for (auto it = m_queues.begin(); it != m_queues.end(); ++it) {
+        for (Entry& entry : it.value()) {
+            if (entry.segment != index) continue;
+
+            QByteArray payload = readPayload(entry);
+            release(entry);
+            writeRecord(payload, &entry);
+
+            Segment& target = m_segments[entry.segment];
+            target.liveCount++;
+            target.liveBytes += entry.length;
+            m_cachedBytes += entry.payload.size();
+        }
+    }
+    flush();
+}
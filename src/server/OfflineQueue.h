@@ -0,0 +1,87 @@
+#pragma once
+
+#include <QObject>
+#include <QFile>
+#include <QHash>
+#include <QMap>
+#include <QVector>
+#include <QTimer>
+
+struct OfflineMessage {
+    QString from;
+    QString text;
+    QString timestamp;
+    QString group; // group chat id, empty for a direct message
+    quint64 seq = 0; // queue position, set by peek()
+};
+
+// Per-recipient store-and-forward queue for messages sent to offline users.
+// Messages are appended to segment files and indexed in memory; payloads
+// stay cached until the memory budget is hit, after which only the index
+// entry is kept and the payload is read back from disk on delivery.
+// Fully drained segments are deleted oldest-first, sparse ones are
+// compacted by relocating their live records, and expired messages are
+// dropped by the retention policy. Without a directory the queue is
+// memory-only and refuses new messages once over budget.
+class OfflineQueue : public QObject {
+    Q_OBJECT
+
+public:
+    explicit OfflineQueue(const QString& directory, QObject* parent = nullptr);
+    ~OfflineQueue();
+
+    bool open();
+
+    bool enqueue(const QString& recipient, const OfflineMessage& message);
+    // Removes and returns everything queued for recipient
+    QList<OfflineMessage> take(const QString& recipient);
+    // Everything queued for recipient, left in place until acknowledge()
+    // covers it, so a delivery the client never confirms is sent again
+    QList<OfflineMessage> peek(const QString& recipient);
+    // Drops recipient's messages up to and including seq
+    void acknowledge(const QString& recipient, quint64 seq);
+    int pendingFor(const QString& recipient) const;
+
+    void setMemoryBudget(qint64 bytes) { m_memoryBudget = bytes; }
+    void setRetention(qint64 ms) { m_retentionMs = ms; }
+
+private:
+    struct Entry {
+        quint64 seq = 0;
+        qint64 storedAt = 0;
+        int segment = -1;     // -1 = memory only
+        qint64 offset = 0;    // payload offset within the segment
+        quint32 length = 0;
+        QByteArray payload;   // empty once spilled
+    };
+
+    struct Segment {
+        qint64 size = 0;
+        qint64 liveBytes = 0;
+        int liveCount = 0;
+    };
+
+    bool openSegment(int index);
+    void scanSegment(int index, QHash<QString, quint64>& delivered);
+    void writeRecord(const QByteArray& payload, Entry* entry);
+    QByteArray readPayload(const Entry& entry);
+    void release(const Entry& entry);
+    void scheduleFlush();
+    void flush();
+    void maintain();
+    void relocateSegment(int index);
+
+    QString m_directory;
+    QFile m_active;
+    int m_activeSegment = -1;
+    QMap<int, Segment> m_segments;            // ordered oldest first
+    QHash<QString, QVector<Entry>> m_queues;  // recipient -> entries by seq
+
+    quint64 m_nextSeq = 1;
+    qint64 m_cachedBytes = 0;
+    qint64 m_memoryBudget = 64 * 1024 * 1024;
+    qint64 m_retentionMs = 30LL * 24 * 60 * 60 * 1000;
+
+    QTimer m_flushTimer;
+    QTimer m_maintenanceTimer;
+};
@@ -0,0 +1,87 @@
+#include "server/PasswordHasher.h"
+#include "server/Metrics.h"
+#include "utils/CryptoUtils.h"
+
+#include <QRunnable>
+
+namespace {
+
+class HashJob : public QRunnable {
+public:
+    explicit HashJob(std::function<void()> body) : m_body(std::move(body)) {}
+    void run() override { m_body(); }
+
+private:
+    std::function<void()> m_body;
+};
+
+}
+
+PasswordHasher::PasswordHasher(int threads, int maxPending, int iterations,
+                               ServerMetrics* metrics, QObject* parent)
+    : QObject(parent)
+    , m_metrics(metrics)
+    , m_maxPending(qMax(1, maxPending))
+    , m_iterations(qMax(1, iterations))
+{
+    m_pool.setMaxThreadCount(qMax(1, threads));
+    m_pool.setExpiryTimeout(-1); // keep the workers warm between storms
+}
+
+PasswordHasher::~PasswordHasher() {
+    // Results still in flight are dropped along with this object
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+bool PasswordHasher::verify(const QString& password, const QString& stored, Callback done) {
+    int iterations = m_iterations;
+    return submit([password, stored, iterations]() {
+        Result result;
+        if (CryptoUtils::isHashed(stored)) {
+            result.ok = CryptoUtils::verifyPassword(password, stored);
+            if (result.ok && CryptoUtils::iterationsOf(stored) < iterations) {
+                result.credential = CryptoUtils::hashAndStore(password, iterations);
+            }
+        } else {
+            // Accounts from before hashing; upgraded on their first login
+            result.ok = CryptoUtils::constantTimeEquals(password, stored);
+            if (result.ok) {
+                result.credential = CryptoUtils::hashAndStore(password, iterations);
+            }
+        }
+        return result;
+    }, std::move(done));
+}
+
+bool PasswordHasher::hash(const QString& password, Callback done) {
+    int iterations = m_iterations;
+    return submit([password, iterations]() {
+        Result result;
+        result.ok = true;
+        result.credential = CryptoUtils::hashAndStore(password, iterations);
+        return result;
+    }, std::move(done));
+}
+
+bool PasswordHasher::submit(std::function<Result()> work, Callback done) {
+    if (m_pending >= m_maxPending) {
+        m_metrics->passwordJobsRejected.add();
+        return false;
+    }
+    ++m_pending;
+
+    quint64 queuedAt = ServerMetrics::now();
+    m_pool.start(new HashJob([this, work = std::move(work), done = std::move(done), queuedAt]() {
+        quint64 startedAt = ServerMetrics::now();
+        m_metrics->passwordQueueDelay.record(startedAt - queuedAt);
+        Result result = work();
+        m_metrics->passwordHashLatency.record(ServerMetrics::now() - startedAt);
+
+        QMetaObject::invokeMethod(this, [this, done, result]() {
+            --m_pending;
+            done(result);
+        }, Qt::QueuedConnection);
+    }));
+    return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+#include <functional>
+
+struct ServerMetrics;
+
+// Runs password hashing and verification off the core thread. Jobs go to
+// a dedicated, fixed-size thread pool and each result comes back as a
+// queued call on the hasher's own thread, so callbacks may touch server
+// state directly. At most maxPending jobs are queued or running at once;
+// submissions beyond that are refused, which keeps a login storm from
+// growing an unbounded backlog of work the clients will have given up on.
+class PasswordHasher : public QObject {
+    Q_OBJECT
+
+public:
+    struct Result {
+        bool ok = false;
+        QString credential; // new value to store, empty if the old one is fine
+    };
+    using Callback = std::function<void(const Result&)>;
+
+    PasswordHasher(int threads, int maxPending, int iterations, ServerMetrics* metrics,
+                   QObject* parent = nullptr);
+    ~PasswordHasher();
+
+    // Checks password against a stored credential. Legacy plaintext and
+    // under-iterated hashes that match get a fresh credential to store.
+    bool verify(const QString& password, const QString& stored, Callback done);
+    // Hashes a password for a new account
+    bool hash(const QString& password, Callback done);
+
+    int pending() const { return m_pending; }
+    int iterations() const { return m_iterations; }
+
+private:
+    bool submit(std::function<Result()> work, Callback done);
+
+    QThreadPool m_pool;
+    ServerMetrics* m_metrics;
+    int m_maxPending;
+    int m_iterations;
+    int m_pending = 0; // only touched on the hasher's thread
+};
@@ -0,0 +1,519 @@
+#include "server/ServerShard.h"
+#include "server/Metrics.h"
+#include "server/MediaRelay.h"
+
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QTcpSocket>
+#include <QThread>
+#include <QDebug>
+
+namespace {
+std::atomic<quint64> g_nextSessionId{1};
+const int kMaxFrameSize = 65536;
+const int kBacklogSampleMs = 1000;
+const int kHardLimitFactor = 4; // queue multiple that disconnects without grace
+}
+
+ServerShard::ServerShard(int index, EventSink sink, ServerMetrics* metrics,
+                         const BackpressurePolicy& policy, QObject* parent)
+    : QObject(parent)
+    , m_index(index)
+    , m_sink(std::move(sink))
+    , m_metrics(metrics)
+    , m_policy(policy)
+    , m_upgrader(new QWebSocketServer("SkypeClassicServer",
+          QWebSocketServer::NonSecureMode, this))
+    , m_backlogTimer(new QTimer(this))
+{
+    connect(m_upgrader, &QWebSocketServer::newConnection,
+            this, &ServerShard::onUpgraded);
+    connect(m_backlogTimer, &QTimer::timeout, this, &ServerShard::sampleBacklog);
+}
+
+ServerShard::~ServerShard() {
+    for (ShardConnection* connection : qAsConst(m_connections)) {
+        connection->socket->disconnect(this);
+        connection->socket->close();
+    }
+    qDeleteAll(m_connections);
+}
+
+void ServerShard::adoptDescriptor(qintptr descriptor) {
+    QMetaObject::invokeMethod(this, [this, descriptor]() {
+        auto* tcp = new QTcpSocket;
+        if (!tcp->setSocketDescriptor(descriptor)) {
+            qWarning() << "Shard" << m_index << "failed to adopt socket:" << tcp->errorString();
+            delete tcp;
+            return;
+        }
+        // The upgrader takes ownership and emits newConnection after the handshake
+        m_upgrader->handleConnection(tcp);
+    }, Qt::QueuedConnection);
+}
+
+void ServerShard::post(ShardCommand command) {
+    if (QThread::currentThread() == thread()) {
+        execute(command);
+        return;
+    }
+
+    m_commands.push(std::move(command));
+    if (!m_drainScheduled.exchange(true, std::memory_order_acq_rel)) {
+        QMetaObject::invokeMethod(this, &ServerShard::drainCommands, Qt::QueuedConnection);
+    }
+}
+
+void ServerShard::drainCommands() {
+    m_drainScheduled.exchange(false, std::memory_order_acq_rel);
+
+    ShardCommand command;
+    while (m_commands.pop(command)) {
+        execute(command);
+    }
+}
+
+void ServerShard::execute(const ShardCommand& command) {
+    if (command.kind == ShardCommand::Broadcast) {
+        broadcast(command);
+        return;
+    }
+    if (command.kind == ShardCommand::Media) {
+        forwardMedia(command);
+        return;
+    }
+
+    ShardConnection* connection = m_connections.value(command.sessionId);
+    if (!connection) return;
+
+    switch (command.kind) {
+    case ShardCommand::Send:
+        send(connection, command.data);
+        break;
+    case ShardCommand::Close:
+        connection->socket->close();
+        break;
+    case ShardCommand::Broadcast:
+    case ShardCommand::Media:
+        break;
+    }
+}
+
+void ServerShard::send(ShardConnection* connection, const QJsonObject& data,
+                       const QByteArray& encoded) {
+    if (connection->dropping) return;
+
+    // Once anything is held back, later frames wait behind it
+    if (connection->outbox.isEmpty() && connection->presence.isEmpty()
+        && connection->pendingBytes < m_policy.socketBytes) {
+        write(connection, encoded.isNull() ? encode(connection, data) : encoded);
+    } else {
+        enqueue(connection, data, encoded);
+    }
+}
+
+void ServerShard::broadcast(const ShardCommand& command) {
+    // Each format is serialized on first use; every socket after that
+    // shares the same implicitly shared bytes
+    QByteArray text;
+    QByteArray binary;
+    for (quint64 sessionId : command.sessionIds) {
+        ShardConnection* connection = m_connections.value(sessionId);
+        if (!connection) continue;
+
+        QByteArray& frame = connection->binary ? binary : text;
+        if (frame.isNull()) {
+            frame = encode(connection, command.data);
+        }
+        send(connection, command.data, frame);
+    }
+}
+
+void ServerShard::forwardMedia(const ShardCommand& command) {
+    // Late media is worthless, so it never waits in the outbox: a congested
+    // receiver skips video outright and audio once it nears the hard limit
+    for (quint64 sessionId : command.sessionIds) {
+        ShardConnection* connection = m_connections.value(sessionId);
+        if (!connection || connection->dropping) continue;
+
+        const bool congested = !connection->outbox.isEmpty()
+                            || connection->pendingBytes >= m_policy.socketBytes;
+        if (congested && (command.droppable
+                          || connection->pendingBytes >= kHardLimitFactor * m_policy.socketBytes)) {
+            m_metrics->mediaFramesDropped.add();
+            continue;
+        }
+        write(connection, command.media, true);
+        m_metrics->mediaFramesForwarded.add();
+    }
+}
+
+QByteArray ServerShard::encode(const ShardConnection* connection, const QJsonObject& data) const {
+    if (connection->binary) {
+        return Protocol::encodeBinary(data);
+    }
+    return QJsonDocument(data).toJson(QJsonDocument::Compact);
+}
+
+void ServerShard::write(ShardConnection* connection, const QByteArray& frame) {
+    write(connection, frame, connection->binary);
+}
+
+void ServerShard::write(ShardConnection* connection, const QByteArray& frame, bool binary) {
+    // Deflated here and nowhere earlier: the stream carries state from one
+    // frame to the next, so frames must be compressed in the order they
+    // are written. Queued and broadcast bytes stay uncompressed and shared.
+    if (binary && connection->compressor && frame.size() >= m_compression.threshold
+        && static_cast<quint8>(frame[0]) == Protocol::kBinaryVersion) {
+        writeBytes(connection, compress(connection, frame), true);
+        return;
+    }
+    writeBytes(connection, frame, binary);
+}
+
+void ServerShard::writeBytes(ShardConnection* connection, const QByteArray& frame, bool binary) {
+    connection->pendingBytes += frame.size();
+    m_backlogBytes.fetch_add(frame.size(), std::memory_order_relaxed);
+    m_metrics->framesSent.add();
+    m_metrics->bytesSent.add(static_cast<quint64>(frame.size()));
+
+    if (binary) {
+        connection->socket->sendBinaryMessage(frame);
+    } else {
+        connection->socket->sendTextMessage(QString::fromUtf8(frame));
+    }
+}
+
+QByteArray ServerShard::compress(ShardConnection* connection, const QByteArray& frame) {
+    const quint64 startedAt = ServerMetrics::now();
+    QByteArray compressed = Protocol::compressBinary(frame, *connection->compressor);
+
+    int index = static_cast<quint8>(frame[1]);
+    if (index >= ServerMetrics::kOpcodes) index = 0;
+    m_metrics->compressLatency[index].record(ServerMetrics::now() - startedAt);
+    m_metrics->compressedFrames[index].add();
+    m_metrics->compressedBytesIn[index].add(static_cast<quint64>(frame.size()));
+    m_metrics->compressedBytesOut[index].add(static_cast<quint64>(compressed.size()));
+    return compressed;
+}
+
+void ServerShard::enqueue(ShardConnection* connection, const QJsonObject& data,
+                          const QByteArray& encoded) {
+    // Presence is only worth its latest value, so it never fills the queue
+    const QString type = data["type"].toString();
+    if (type == QLatin1String("presence")) {
+        coalescePresence(connection, data);
+        return;
+    }
+    if (type == QLatin1String("presence_batch")) {
+        for (const QJsonValue& update : data["updates"].toArray()) {
+            coalescePresence(connection, update.toObject());
+        }
+        return;
+    }
+
+    OutboundFrame frame{encoded.isNull() ? encode(connection, data) : encoded, data};
+    connection->queuedBytes += frame.bytes.size();
+    m_backlogBytes.fetch_add(frame.bytes.size(), std::memory_order_relaxed);
+    connection->outbox.enqueue(std::move(frame));
+    m_metrics->framesDeferred.add();
+
+    checkBudget(connection);
+}
+
+void ServerShard::coalescePresence(ShardConnection* connection, const QJsonObject& update) {
+    connection->presence.insert(update["username"].toString(), update["status"].toString());
+    m_metrics->presenceCoalesced.add();
+}
+
+void ServerShard::drainOutbox(ShardConnection* connection) {
+    if (connection->dropping) return;
+
+    while (!connection->outbox.isEmpty() && connection->pendingBytes < m_policy.socketBytes) {
+        OutboundFrame frame = connection->outbox.dequeue();
+        connection->queuedBytes -= frame.bytes.size();
+        m_backlogBytes.fetch_sub(frame.bytes.size(), std::memory_order_relaxed);
+        write(connection, frame.bytes);
+    }
+
+    // Held-back presence goes last, as one frame with the latest statuses
+    if (connection->outbox.isEmpty() && !connection->presence.isEmpty()
+        && connection->pendingBytes < m_policy.socketBytes) {
+        QJsonArray updates;
+        for (auto it = connection->presence.constBegin(); it != connection->presence.constEnd(); ++it) {
+            updates.append(QJsonObject{{"username", it.key()}, {"status", it.value()}});
+        }
+        connection->presence.clear();
+
+        QJsonObject frame;
+        if (updates.size() == 1) {
+            frame = updates.first().toObject();
+            frame["type"] = "presence";
+        } else {
+            frame = {{"type", "presence_batch"}, {"updates", updates}};
+        }
+        write(connection, encode(connection, frame));
+    }
+
+    checkBudget(connection);
+}
+
+void ServerShard::checkBudget(ShardConnection* connection) {
+    const bool overBudget = connection->queuedBytes > m_policy.queueBytes
+                         || connection->outbox.size() > m_policy.queueFrames;
+    if (!overBudget) {
+        connection->slowSince = 0;
+        return;
+    }
+
+    // Chat messages are kept through the grace period, but not without bound
+    if (connection->queuedBytes > kHardLimitFactor * m_policy.queueBytes
+        || connection->outbox.size() > kHardLimitFactor * m_policy.queueFrames) {
+        dropSlow(connection, "queue limit");
+        return;
+    }
+
+    if (connection->slowSince == 0) {
+        connection->slowSince = ServerMetrics::now();
+    }
+}
+
+void ServerShard::dropSlow(ShardConnection* connection, const char* reason) {
+    if (connection->dropping) return;
+    connection->dropping = true;
+    m_metrics->slowConsumerDisconnects.add();
+
+    qWarning() << "Disconnecting slow consumer on shard" << m_index << "(" << reason << "):"
+               << connection->queuedBytes << "bytes in" << connection->outbox.size()
+               << "queued frames";
+
+    // abort() emits disconnected synchronously, which frees the connection;
+    // defer it so callers can keep iterating
+    QWebSocket* socket = connection->socket;
+    QMetaObject::invokeMethod(socket, [socket]() { socket->abort(); }, Qt::QueuedConnection);
+}
+
+void ServerShard::onBytesWritten(qint64 bytes) {
+    ShardConnection* connection = m_bySocket.value(qobject_cast<QWebSocket*>(sender()));
+    if (!connection) return;
+
+    // Written bytes include frame headers, so clamp rather than go negative
+    qint64 drained = qMin(bytes, connection->pendingBytes);
+    connection->pendingBytes -= drained;
+    m_backlogBytes.fetch_sub(drained, std::memory_order_relaxed);
+
+    drainOutbox(connection);
+}
+
+void ServerShard::sampleBacklog() {
+    const quint64 now = ServerMetrics::now();
+    const quint64 grace = static_cast<quint64>(m_policy.graceMs) * 1000000;
+
+    qint64 maxBacklog = 0;
+    int slow = 0;
+    for (ShardConnection* connection : qAsConst(m_connections)) {
+        maxBacklog = qMax(maxBacklog, connection->pendingBytes + connection->queuedBytes);
+        if (connection->slowSince == 0) continue;
+
+        ++slow;
+        if (now - connection->slowSince >= grace) {
+            dropSlow(connection, "grace period expired");
+        }
+    }
+    m_maxBacklogBytes.store(maxBacklog, std::memory_order_relaxed);
+    m_slowConnections.store(slow, std::memory_order_relaxed);
+}
+
+void ServerShard::onUpgraded() {
+    // Started here so the timer lives on the shard's own thread
+    if (!m_backlogTimer->isActive()) {
+        m_backlogTimer->start(kBacklogSampleMs);
+    }
+
+    while (m_upgrader->hasPendingConnections()) {
+        QWebSocket* socket = m_upgrader->nextPendingConnection();
+
+        auto* connection = new ShardConnection;
+        connection->id = g_nextSessionId.fetch_add(1, std::memory_order_relaxed);
+        connection->socket = socket;
+
+        connect(socket, &QWebSocket::textMessageReceived, this, &ServerShard::onTextMessage);
+        connect(socket, &QWebSocket::binaryMessageReceived, this, &ServerShard::onBinaryMessage);
+        connect(socket, &QWebSocket::bytesWritten, this, &ServerShard::onBytesWritten);
+        connect(socket, &QWebSocket::disconnected, this, &ServerShard::onDisconnected);
+
+        m_connections.insert(connection->id, connection);
+        m_bySocket.insert(socket, connection);
+        m_sessionCount.fetch_add(1, std::memory_order_relaxed);
+        m_metrics->connectionsAccepted.add();
+
+        qDebug() << "New connection from" << socket->peerAddress().toString()
+                 << "on shard" << m_index;
+
+        ShardEvent event;
+        event.kind = ShardEvent::Opened;
+        event.shard = m_index;
+        event.sessionId = connection->id;
+        m_sink(std::move(event));
+    }
+}
+
+void ServerShard::onTextMessage(const QString& message) {
+    ShardConnection* connection = m_bySocket.value(qobject_cast<QWebSocket*>(sender()));
+    if (!connection) return;
+
+    if (message.size() > kMaxFrameSize) {
+        qWarning() << "Dropping oversized message:" << message.size() << "bytes";
+        m_metrics->oversizedFrames.add();
+        return;
+    }
+
+    quint64 startedAt = ServerMetrics::now();
+    QJsonDocument doc = QJsonDocument::fromJson(message.toUtf8());
+    if (!doc.isObject()) return;
+
+    QJsonObject obj = doc.object();
+    Protocol::Opcode opcode = Protocol::opcodeForType(obj.value(QLatin1String("type")).toString());
+    recordFrame(opcode, message.size(), startedAt);
+    dispatch(connection, opcode, obj);
+}
+
+void ServerShard::onBinaryMessage(const QByteArray& message) {
+    ShardConnection* connection = m_bySocket.value(qobject_cast<QWebSocket*>(sender()));
+    if (!connection) return;
+
+    if (message.size() > kMaxFrameSize) {
+        qWarning() << "Dropping oversized message:" << message.size() << "bytes";
+        m_metrics->oversizedFrames.add();
+        return;
+    }
+
+    if (Protocol::isMediaFrame(message)) {
+        if (m_relay) m_relay->forward(connection->id, message);
+        return;
+    }
+
+    quint64 startedAt = ServerMetrics::now();
+    QByteArray inflated;
+    if (Protocol::isCompressedFrame(message)) {
+        // The stream can't be resynchronised after a bad frame
+        if (!connection->compressor
+            || !Protocol::decompressBinary(message, *connection->compressor, inflated, kMaxFrameSize)) {
+            qWarning() << "Closing connection after a bad compressed frame";
+            connection->socket->close(QWebSocketProtocol::CloseCodeProtocolError,
+                                      "Bad compressed frame");
+            return;
+        }
+        m_metrics->compressedFramesReceived.add();
+    }
+
+    Protocol::Opcode opcode;
+    QJsonObject obj;
+    if (!Protocol::decodeBinary(inflated.isNull() ? message : inflated, opcode, obj)) return;
+
+    recordFrame(opcode, message.size(), startedAt);
+    dispatch(connection, opcode, obj);
+}
+
+void ServerShard::recordFrame(Protocol::Opcode opcode, int size, quint64 startedAt) {
+    int index = static_cast<int>(opcode);
+    m_metrics->parseLatency[index].record(ServerMetrics::now() - startedAt);
+    m_metrics->framesReceived[index].add();
+    m_metrics->bytesReceived.add(static_cast<quint64>(size));
+}
+
+void ServerShard::dispatch(ShardConnection* connection, Protocol::Opcode opcode, const QJsonObject& obj) {
+    switch (opcode) {
+    case Protocol::Opcode::Unknown:
+        return;
+    case Protocol::Opcode::Hello:
+        // Framing is a per-connection concern; the core never sees it
+        negotiate(connection, obj);
+        return;
+    default:
+        break;
+    }
+
+    ShardEvent event;
+    event.kind = ShardEvent::Frame;
+    event.shard = m_index;
+    event.sessionId = connection->id;
+    event.opcode = opcode;
+    event.data = obj;
+    m_sink(std::move(event));
+}
+
+void ServerShard::negotiate(ShardConnection* connection, const QJsonObject& hello) {
+    QString chosen = "json";
+    for (const QJsonValue& value : hello["protocols"].toArray()) {
+        if (value.toString() == QLatin1String(Protocol::kBinaryProtocol)) {
+            chosen = QString::fromLatin1(Protocol::kBinaryProtocol);
+            break;
+        }
+    }
+
+    // Compression rides on binary framing, and a new hello starts both
+    // streams over
+    const bool binary = chosen != "json";
+    const bool compress = binary && m_compression.threshold > 0
+        && hello["compression"].toArray().contains(QLatin1String(Protocol::kCompression));
+
+    // The reply is always JSON; binary starts with the next frame
+    QJsonObject reply{{"type", "hello"}, {"protocol", chosen}};
+    if (compress) {
+        // The client applies the same policy to what it sends
+        reply["compression"] = QLatin1String(Protocol::kCompression);
+        reply["compressionThreshold"] = m_compression.threshold;
+        reply["compressionLevel"] = m_compression.level;
+    }
+    connection->socket->sendTextMessage(QJsonDocument(reply).toJson(QJsonDocument::Compact));
+    connection->binary = binary;
+    delete connection->compressor;
+    connection->compressor = compress ? new FrameCompressor(m_compression.level) : nullptr;
+}
+
+void ServerShard::onDisconnected() {
+    auto* socket = qobject_cast<QWebSocket*>(sender());
+    if (!socket) return;
+
+    ShardConnection* connection = m_bySocket.take(socket);
+    if (connection) {
+        m_connections.remove(connection->id);
+        m_sessionCount.fetch_sub(1, std::memory_order_relaxed);
+        m_backlogBytes.fetch_sub(connection->pendingBytes + connection->queuedBytes,
+                                 std::memory_order_relaxed);
+
+        // Queued chat messages go back to the core to be stored for later;
+        // whatever the socket already had is lost with it
+        QJsonArray undelivered;
+        for (const OutboundFrame& frame : qAsConst(connection->outbox)) {
+            const QString type = frame.data["type"].toString();
+            if (type == QLatin1String("message") || type == QLatin1String("offline_messages")
+                || type == QLatin1String("group_message")) {
+                undelivered.append(frame.data);
+            }
+        }
+
+        ShardEvent event;
+        event.kind = ShardEvent::Closed;
+        event.shard = m_index;
+        event.sessionId = connection->id;
+        if (!undelivered.isEmpty()) {
+            event.data = {{"undelivered", undelivered}};
+        }
+        m_sink(std::move(event));
+        delete connection;
+    }
+
+    socket->deleteLater();
+}
+
+ConnectionAcceptor::ConnectionAcceptor(Handler handler, QObject* parent)
+    : QTcpServer(parent)
+    , m_handler(std::move(handler))
+{
+}
+
+void ConnectionAcceptor::incomingConnection(qintptr socketDescriptor) {
+    m_handler(socketDescriptor);
+}
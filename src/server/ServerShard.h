@@ -0,0 +1,178 @@
+#pragma once
+
+#include <QObject>
+#include <QTcpServer>
+#include <QWebSocketServer>
+#include <QWebSocket>
+#include <QJsonObject>
+#include <QHash>
+#include <QQueue>
+#include <QVector>
+#include <QTimer>
+#include <atomic>
+#include <functional>
+#include "server/MpscQueue.h"
+#include "network/Protocol.h"
+#include "network/FrameCompressor.h"
+
+struct ServerMetrics;
+class MediaRelay;
+
+// Shard -> core notification
+struct ShardEvent {
+    enum Kind { Opened, Frame, Closed };
+
+    Kind kind = Frame;
+    int shard = 0;
+    quint64 sessionId = 0;
+    Protocol::Opcode opcode = Protocol::Opcode::Unknown;
+    QJsonObject data; // Closed: "undelivered" chat messages still queued
+    quint64 queuedAt = 0; // set when the event crosses threads
+};
+
+// Core -> shard instruction. Payloads are never mutated after posting,
+// so the implicitly shared QJsonObject can cross threads safely.
+// Broadcast sends one frame to every session in sessionIds and encodes it
+// at most once per wire format, however many sockets it goes to. Media
+// writes an already built conference frame to the same kind of list.
+struct ShardCommand {
+    enum Kind { Send, Close, Broadcast, Media };
+
+    Kind kind = Send;
+    quint64 sessionId = 0;
+    QJsonObject data;
+    QVector<quint64> sessionIds; // Broadcast and Media
+    QByteArray media;            // Media: shared by every receiver
+    bool droppable = false;      // Media: skip for congested receivers (video)
+};
+
+// Outbound limits applied to every connection of a shard
+struct BackpressurePolicy {
+    qint64 socketBytes = 64 * 1024;   // unwritten bytes before frames queue up
+    qint64 queueBytes = 1024 * 1024;  // queued bytes before the client is "slow"
+    int queueFrames = 1024;
+    int graceMs = 10000;              // slow this long = disconnected
+};
+
+// Frame waiting behind a congested socket
+struct OutboundFrame {
+    QByteArray bytes;
+    QJsonObject data; // kept so undelivered chat messages can be requeued
+};
+
+// Per-socket state owned by a shard
+struct ShardConnection {
+    quint64 id = 0;
+    QWebSocket* socket = nullptr;
+    bool binary = false; // negotiated CBOR framing
+    FrameCompressor* compressor = nullptr; // negotiated deflate, owned; null = off
+    qint64 pendingBytes = 0; // handed to the socket but not yet written
+
+    // Frames held back while the socket is above its write budget.
+    // Presence isn't queued: the latest status per contact is kept and
+    // sent as one presence_batch once the queue has drained.
+    QQueue<OutboundFrame> outbox;
+    qint64 queuedBytes = 0;
+    QHash<QString, QString> presence;
+    quint64 slowSince = 0;  // ns; 0 = queue within budget
+    bool dropping = false;  // disconnect scheduled, ignore further sends
+
+    ~ShardConnection() { delete compressor; }
+};
+
+// Owns a slice of the connected sockets and runs their I/O (handshake,
+// frame decoding, JSON/CBOR parse and serialize, writes) on its own event
+// loop. Parsed frames are handed to the core through a lock-free queue.
+class ServerShard : public QObject {
+    Q_OBJECT
+
+public:
+    using EventSink = std::function<void(ShardEvent)>;
+
+    ServerShard(int index, EventSink sink, ServerMetrics* metrics,
+                const BackpressurePolicy& policy, QObject* parent = nullptr);
+    ~ServerShard();
+
+    int index() const { return m_index; }
+    int sessionCount() const { return m_sessionCount.load(std::memory_order_relaxed); }
+    qint64 backlogBytes() const { return m_backlogBytes.load(std::memory_order_relaxed); }
+    qint64 maxBacklogBytes() const { return m_maxBacklogBytes.load(std::memory_order_relaxed); }
+    int slowConnections() const { return m_slowConnections.load(std::memory_order_relaxed); }
+
+    // Conference media is handed straight to the relay on this thread;
+    // set before the first connection
+    void setMediaRelay(MediaRelay* relay) { m_relay = relay; }
+    // Offered to clients that ask in their hello; set before the first
+    // connection. A zero threshold turns compression off.
+    void setCompression(const CompressionPolicy& policy) { m_compression = policy; }
+
+    // Thread-safe entry points
+    void adoptDescriptor(qintptr descriptor);
+    void post(ShardCommand command);
+
+private slots:
+    void onUpgraded();
+    void onTextMessage(const QString& message);
+    void onBinaryMessage(const QByteArray& message);
+    void onBytesWritten(qint64 bytes);
+    void onDisconnected();
+
+private:
+    void drainCommands();
+    void execute(const ShardCommand& command);
+    void dispatch(ShardConnection* connection, Protocol::Opcode opcode, const QJsonObject& obj);
+    void negotiate(ShardConnection* connection, const QJsonObject& hello);
+    void send(ShardConnection* connection, const QJsonObject& data,
+              const QByteArray& encoded = QByteArray());
+    void broadcast(const ShardCommand& command);
+    void forwardMedia(const ShardCommand& command);
+    QByteArray encode(const ShardConnection* connection, const QJsonObject& data) const;
+    void write(ShardConnection* connection, const QByteArray& frame);
+    void write(ShardConnection* connection, const QByteArray& frame, bool binary);
+    void writeBytes(ShardConnection* connection, const QByteArray& frame, bool binary);
+    QByteArray compress(ShardConnection* connection, const QByteArray& frame);
+    void enqueue(ShardConnection* connection, const QJsonObject& data,
+                 const QByteArray& encoded = QByteArray());
+    void coalescePresence(ShardConnection* connection, const QJsonObject& update);
+    void drainOutbox(ShardConnection* connection);
+    void checkBudget(ShardConnection* connection);
+    void dropSlow(ShardConnection* connection, const char* reason);
+    void recordFrame(Protocol::Opcode opcode, int size, quint64 startedAt);
+    void sampleBacklog();
+
+    int m_index;
+    EventSink m_sink;
+    ServerMetrics* m_metrics;
+    BackpressurePolicy m_policy;
+    MediaRelay* m_relay = nullptr;
+    CompressionPolicy m_compression;
+    QWebSocketServer* m_upgrader;
+    QHash<quint64, ShardConnection*> m_connections;
+    QHash<QWebSocket*, ShardConnection*> m_bySocket;
+    std::atomic<int> m_sessionCount{0};
+
+    // Outbound backlog (socket buffers plus queues); the per-socket maximum
+    // and the slow-consumer count are sampled once a second
+    std::atomic<qint64> m_backlogBytes{0};
+    std::atomic<qint64> m_maxBacklogBytes{0};
+    std::atomic<int> m_slowConnections{0};
+    QTimer* m_backlogTimer;
+
+    MpscQueue<ShardCommand> m_commands;
+    std::atomic<bool> m_drainScheduled{false};
+};
+
+// Listens on the core thread and hands raw descriptors out so that each
+// socket is created on the thread of the shard that will own it.
+class ConnectionAcceptor : public QTcpServer {
+public:
+    using Handler = std::function<void(qintptr)>;
+
+    explicit ConnectionAcceptor(Handler handler, QObject* parent = nullptr);
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+    Handler m_handler;
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <QLatin1String>
+#include <QSet>
+#include <QString>
+#include <QVector>
+#include <algorithm>
+
+// Dense per-process id for a username, handed out by UserDirectory. Ids
+// are never written to disk or sent to other nodes; both use names.
+using UserId = quint32;
+const UserId kNoUser = 0xffffffffu;
+
+// Set of user ids as a sorted vector: four bytes an entry and a binary
+// search to test. Ids grow in registration order, so adding a newly
+// registered user (echo123's roster, a new account's watchers) appends.
+class UserIdList {
+public:
+    using const_iterator = QVector<UserId>::const_iterator;
+
+    bool contains(UserId id) const {
+        return std::binary_search(m_ids.constBegin(), m_ids.constEnd(), id);
+    }
+
+    bool insert(UserId id) {
+        if (m_ids.isEmpty() || m_ids.last() < id) {
+            m_ids.append(id);
+            return true;
+        }
+        auto it = std::lower_bound(m_ids.begin(), m_ids.end(), id);
+        if (*it == id) return false;
+        m_ids.insert(it, id);
+        return true;
+    }
+
+    bool remove(UserId id) {
+        auto it = std::lower_bound(m_ids.begin(), m_ids.end(), id);
+        if (it == m_ids.end() || *it != id) return false;
+        m_ids.erase(it);
+        return true;
+    }
+
+    int size() const { return m_ids.size(); }
+    bool isEmpty() const { return m_ids.isEmpty(); }
+    void clear() { m_ids.clear(); }
+    const_iterator begin() const { return m_ids.constBegin(); }
+    const_iterator end() const { return m_ids.constEnd(); }
+
+private:
+    QVector<UserId> m_ids;
+};
+
+// Server-side presence. The wire still carries the client's strings;
+// anything unrecognised from a logged-in user counts as Online.
+enum class Presence : quint8 {
+    Offline,
+    Online,
+    Away,
+    NotAvailable,
+    DoNotDisturb,
+    Invisible
+};
+
+inline QLatin1String presenceName(Presence presence) {
+    switch (presence) {
+        case Presence::Online:       return QLatin1String("Online");
+        case Presence::Away:         return QLatin1String("Away");
+        case Presence::NotAvailable: return QLatin1String("Not Available");
+        case Presence::DoNotDisturb: return QLatin1String("Do Not Disturb");
+        case Presence::Invisible:    return QLatin1String("Invisible");
+        case Presence::Offline:      break;
+    }
+    return QLatin1String("Offline");
+}
+
+inline Presence presenceFromName(const QString& name) {
+    if (name == QLatin1String("Offline")) return Presence::Offline;
+    if (name == QLatin1String("Away")) return Presence::Away;
+    if (name == QLatin1String("Not Available")) return Presence::NotAvailable;
+    if (name == QLatin1String("Do Not Disturb")) return Presence::DoNotDisturb;
+    if (name == QLatin1String("Invisible")) return Presence::Invisible;
+    return Presence::Online;
+}
+
+// An account homed on this node; its name lives in the UserDirectory
+struct ServerUser {
+    QString password; // CryptoUtils::hashAndStore() value; plaintext in old data
+    UserIdList contacts;
+    quint64 rosterVersion = 0; // bumped on every contact add or removal
+    bool registered = false;   // false for ids interned only as someone's contact
+};
+
+// Server-hosted group chat; lives on the node its id hashes to
+struct ServerGroup {
+    QString id;
+    QString name;
+    QString creator;
+    QSet<QString> members; // hashed so fan-out and checks stay flat for big groups
+};
+
+// One roster mutation, kept so a reconnecting client can catch up by diff
+struct RosterChange {
+    enum Kind { Added, Removed };
+
+    quint64 version = 0; // roster version after this change
+    Kind kind = Added;
+    UserId contact = kNoUser;
+};
@@ -0,0 +1,46 @@
+#include "server/SessionRegistry.h"
+
+SessionRegistry::~SessionRegistry() {
+    qDeleteAll(m_byId);
+}
+
+Session* SessionRegistry::add(quint64 id, ServerShard* shard) {
+    auto* session = new Session;
+    session->id = id;
+    session->shard = shard;
+    m_byId.insert(id, session);
+    return session;
+}
+
+void SessionRegistry::remove(Session* session) {
+    if (!session) return;
+
+    m_byId.remove(session->id);
+
+    // A newer login for the same name may already own the username slot
+    auto it = m_byUsername.find(session->username);
+    if (it != m_byUsername.end() && it.value() == session) {
+        m_byUsername.erase(it);
+    }
+
+    delete session;
+}
+
+void SessionRegistry::unbindUser(Session* session) {
+    auto it = m_byUsername.find(session->username);
+    if (it != m_byUsername.end() && it.value() == session) {
+        m_byUsername.erase(it);
+    }
+}
+
+void SessionRegistry::bindUser(Session* session, const QString& username) {
+    if (!session->username.isEmpty() && session->username != username) {
+        auto it = m_byUsername.find(session->username);
+        if (it != m_byUsername.end() && it.value() == session) {
+            m_byUsername.erase(it);
+        }
+    }
+
+    session->username = username;
+    m_byUsername.insert(username, session);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <QHash>
+#include <QList>
+#include <QString>
+
+class ServerShard;
+
+struct Session {
+    quint64 id = 0;               // stable handle, never reused
+    ServerShard* shard = nullptr; // shard owning the socket
+    QString username;             // empty until login
+    bool rosterDeltas = false;    // client sent a roster version at login
+    bool offlineAcks = false;     // client confirms offline batches with offline_ack
+    bool credentialPending = false; // login/register waiting on the hasher
+    QString resumeToken;          // issued at login; parks the session on close
+
+    // Clustering: a local socket whose user is homed on another node
+    // forwards its frames to homeNode. On the home node it is represented
+    // by a proxy session (no shard) that writes back through edgeNode.
+    QString homeNode;
+    QString edgeNode;
+    quint64 remoteId = 0;         // the session's id on edgeNode
+    // Name from a login or resume forwarded to homeNode; it only becomes
+    // username once the home's result says the credential checked out
+    QString claimedUsername;
+};
+
+// Owns all live sessions and indexes them by id and username so every
+// lookup on the relay path is a single hash probe.
+class SessionRegistry {
+public:
+    SessionRegistry() = default;
+    ~SessionRegistry();
+
+    Session* add(quint64 id, ServerShard* shard);
+    void remove(Session* session);
+    void bindUser(Session* session, const QString& username);
+    // Drops the username index entry but keeps session->username
+    void unbindUser(Session* session);
+
+    Session* byId(quint64 id) const { return m_byId.value(id); }
+    Session* byUsername(const QString& username) const { return m_byUsername.value(username); }
+
+    QList<Session*> sessions() const { return m_byId.values(); }
+    int size() const { return m_byId.size(); }
+    int loggedInCount() const { return m_byUsername.size(); }
+
+private:
+    Q_DISABLE_COPY(SessionRegistry)
+
+    QHash<quint64, Session*> m_byId;
+    QHash<QString, Session*> m_byUsername;
+};
@@ -0,0 +1,49 @@
+#include "server/UserDirectory.h"
+
+UserId UserDirectory::intern(const QString& username) {
+    auto it = m_ids.constFind(username);
+    if (it != m_ids.constEnd()) return *it;
+
+    UserId id = static_cast<UserId>(m_names.size());
+    m_ids.insert(username, id);
+    m_names.append(username);
+    m_users.append(ServerUser());
+    return id;
+}
+
+ServerUser* UserDirectory::user(UserId id) {
+    if (id >= static_cast<UserId>(m_users.size())) return nullptr;
+    ServerUser& user = m_users[static_cast<int>(id)];
+    return user.registered ? &user : nullptr;
+}
+
+const ServerUser* UserDirectory::user(UserId id) const {
+    if (id >= static_cast<UserId>(m_users.size())) return nullptr;
+    const ServerUser& user = m_users.at(static_cast<int>(id));
+    return user.registered ? &user : nullptr;
+}
+
+ServerUser& UserDirectory::create(const QString& username) {
+    ServerUser& user = m_users[static_cast<int>(intern(username))];
+    if (!user.registered) {
+        user.registered = true;
+        ++m_userCount;
+    }
+    return user;
+}
+
+ServerUser UserDirectory::take(UserId id) {
+    ServerUser* existing = user(id);
+    if (!existing) return ServerUser();
+
+    ServerUser taken = std::move(*existing);
+    *existing = ServerUser();
+    --m_userCount;
+    return taken;
+}
+
+void UserDirectory::reserve(int count) {
+    m_ids.reserve(count);
+    m_names.reserve(count);
+    m_users.reserve(count);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+#include "server/ServerUser.h"
+
+// Interns usernames to dense UserIds and holds the accounts homed on this
+// node in an array indexed by them. The name is stored once, shared by
+// the lookup hash and the id -> name table; everything else on the server
+// keys users by id. Ids are handed out in first-seen order and never
+// reused, so they only mean something inside this process. Because they
+// are never freed, callers intern only names known to be accounts, here
+// or on their home node, never a name straight from a client.
+class UserDirectory {
+public:
+    // Id for a name, assigning the next one on first sight
+    UserId intern(const QString& username);
+    // kNoUser for a name never seen
+    UserId find(const QString& username) const { return m_ids.value(username, kNoUser); }
+    QString name(UserId id) const { return m_names.at(static_cast<int>(id)); }
+    int idCount() const { return m_names.size(); }
+
+    // Accounts; null for unknown names, contacts-only ids and handed-off users
+    ServerUser* user(UserId id);
+    const ServerUser* user(UserId id) const;
+    ServerUser* user(const QString& username) { return user(find(username)); }
+    const ServerUser* user(const QString& username) const { return user(find(username)); }
+    bool contains(const QString& username) const { return user(username) != nullptr; }
+
+    // Registers the account, or returns the existing one
+    ServerUser& create(const QString& username);
+    // Removes the account; the id stays interned
+    ServerUser take(UserId id);
+
+    int userCount() const { return m_userCount; }
+    void reserve(int count);
+
+    // fn(UserId, const ServerUser&) for every account, in id order
+    template <typename Fn>
+    void forEachUser(Fn fn) const {
+        for (int i = 0; i < m_users.size(); ++i) {
+            if (m_users.at(i).registered) fn(static_cast<UserId>(i), m_users.at(i));
+        }
+    }
+
+private:
+    QHash<QString, UserId> m_ids;
+    QVector<QString> m_names;
+    QVector<ServerUser> m_users; // parallel to m_names
+    int m_userCount = 0;
+};
@@ -0,0 +1,420 @@
+#include "server/UserStore.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QThread>
+#include <QtEndian>
+#include <QDebug>
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+namespace {
+
+const quint32 kSnapshotMagic = 0x534B5553; // "SKUS"
+const quint32 kSnapshotVersion = 3;        // 2 adds the roster version, 3 groups
+const int kRecordHeaderSize = 6;           // quint32 length + quint16 checksum
+const int kCommitWindowMs = 5;
+
+enum RecordType : quint8 {
+    RecordUser = 1,
+    RecordContact = 2,
+    RecordContactRemoved = 3,
+    RecordRosterVersion = 4,
+    RecordGroup = 5,             // id, name, creator
+    RecordGroupMember = 6,
+    RecordGroupMemberRemoved = 7, // the last one out deletes the group
+    RecordUserRemoved = 8         // handed off to another node
+};
+
+QString snapshotPath(const QString& directory) {
+    return QDir(directory).filePath("users.snap");
+}
+
+QString logPath(const QString& directory, quint64 generation) {
+    return QDir(directory).filePath(QString("wal-%1.log").arg(generation, 10, 10, QChar('0')));
+}
+
+// Generation numbers of the log files present in the directory, ascending
+QList<quint64> logGenerations(const QString& directory) {
+    QList<quint64> generations;
+    const QStringList files = QDir(directory).entryList({"wal-*.log"}, QDir::Files);
+    for (const QString& name : files) {
+        bool ok = false;
+        quint64 generation = name.mid(4, name.size() - 8).toULongLong(&ok);
+        if (ok) generations.append(generation);
+    }
+    std::sort(generations.begin(), generations.end());
+    return generations;
+}
+
+// Maps the snapshot and decodes every record into users and groups;
+// generation is the first log it doesn't cover
+bool readSnapshot(const QString& directory, UserDirectory& users,
+                  QHash<QString, ServerGroup>& groups, quint64& generation) {
+    QFile file(snapshotPath(directory));
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    uchar* mapped = file.map(0, file.size());
+    QByteArray raw = mapped
+        ? QByteArray::fromRawData(reinterpret_cast<const char*>(mapped), static_cast<int>(file.size()))
+        : file.readAll();
+
+    QDataStream in(raw);
+    in.setVersion(QDataStream::Qt_5_9);
+
+    quint32 magic = 0, version = 0, count = 0;
+    quint64 covered = 0;
+    in >> magic >> version >> covered >> count;
+    if (magic != kSnapshotMagic || version < 1 || version > kSnapshotVersion) {
+        qWarning() << "Ignoring unrecognized user snapshot" << file.fileName();
+        return false;
+    }
+
+    users.reserve(static_cast<int>(count));
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString username, password;
+        QStringList contacts;
+        quint64 rosterVersion = 0;
+        in >> username >> password >> contacts;
+        if (version >= 2) {
+            in >> rosterVersion;
+        } else {
+            // Version 1 logs only ever added contacts, one change each
+            rosterVersion = static_cast<quint64>(contacts.size());
+        }
+
+        // Intern contacts first: that can grow the table under a reference
+        UserIdList contactIds;
+        for (const QString& contact : qAsConst(contacts)) {
+            contactIds.insert(users.intern(contact));
+        }
+        ServerUser& user = users.create(username);
+        user.password = password;
+        user.contacts = contactIds;
+        user.rosterVersion = rosterVersion;
+    }
+
+    quint32 groupCount = 0;
+    if (version >= 3) {
+        in >> groupCount;
+        groups.reserve(static_cast<int>(groupCount));
+    }
+    for (quint32 i = 0; i < groupCount && in.status() == QDataStream::Ok; ++i) {
+        ServerGroup group;
+        in >> group.id >> group.name >> group.creator >> group.members;
+        groups.insert(group.id, group);
+    }
+
+    if (mapped) file.unmap(mapped);
+    generation = covered;
+    return in.status() == QDataStream::Ok;
+}
+
+// Applies the intact records of one log; returns how many
+quint64 replayLog(const QString& path, UserDirectory& users, QHash<QString, ServerGroup>& groups) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return 0;
+
+    qint64 size = file.size();
+    uchar* mapped = file.map(0, size);
+    QByteArray raw = mapped
+        ? QByteArray::fromRawData(reinterpret_cast<const char*>(mapped), static_cast<int>(size))
+        : file.readAll();
+    const char* data = raw.constData();
+
+    quint64 records = 0;
+    qint64 offset = 0;
+    while (offset + kRecordHeaderSize <= size) {
+        quint32 length = qFromBigEndian<quint32>(data + offset);
+        quint16 checksum = qFromBigEndian<quint16>(data + offset + 4);
+        const char* payload = data + offset + kRecordHeaderSize;
+
+        // Torn or corrupt tail from a crash mid-commit: stop here
+        if (length > size - offset - kRecordHeaderSize) break;
+        if (qChecksum(payload, length) != checksum) break;
+
+        QByteArray record = QByteArray::fromRawData(payload, static_cast<int>(length));
+        QDataStream in(record);
+        in.setVersion(QDataStream::Qt_5_9);
+        quint8 type = 0;
+        QString a, b, c;
+        in >> type >> a >> b;
+        if (!in.atEnd()) in >> c;
+
+        if (type == RecordUser) {
+            users.create(a).password = b;
+        } else if (type == RecordUserRemoved) {
+            if (users.user(a)) users.take(users.find(a));
+        } else if (type == RecordContact) {
+            UserId contact = users.intern(b);
+            if (ServerUser* user = users.user(a)) {
+                user->contacts.insert(contact);
+                ++user->rosterVersion;
+            }
+        } else if (type == RecordContactRemoved) {
+            if (ServerUser* user = users.user(a)) {
+                user->contacts.remove(users.find(b));
+                ++user->rosterVersion;
+            }
+        } else if (type == RecordRosterVersion) {
+            if (ServerUser* user = users.user(a)) {
+                user->rosterVersion = b.toULongLong();
+            }
+        } else if (type == RecordGroup) {
+            ServerGroup& group = groups[a];
+            group.id = a;
+            group.name = b;
+            group.creator = c;
+        } else if (type == RecordGroupMember) {
+            auto it = groups.find(a);
+            if (it != groups.end()) {
+                it->members.insert(b);
+            }
+        } else if (type == RecordGroupMemberRemoved) {
+            auto it = groups.find(a);
+            if (it != groups.end()) {
+                it->members.remove(b);
+                if (it->members.isEmpty()) groups.erase(it);
+            }
+        }
+
+        offset += kRecordHeaderSize + length;
+        ++records;
+    }
+
+    if (mapped) file.unmap(mapped);
+    return records;
+}
+
+}
+
+// File side of the store; only ever used from the writer thread.
+struct UserStoreWriter {
+    QString directory;
+    QFile log;
+
+    void openLog(quint64 generation) {
+        log.close();
+        log.setFileName(logPath(directory, generation));
+        if (!log.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            qWarning() << "Failed to open user log" << log.fileName() << log.errorString();
+        }
+    }
+
+    void append(const QByteArray& batch) {
+        if (!log.isOpen()) return;
+        log.write(batch);
+        log.flush();
+#ifdef Q_OS_UNIX
+        ::fsync(log.handle());
+#endif
+    }
+
+    // Rebuilds the state from the files alone, the previous snapshot plus
+    // every log before generation, and writes it as the new snapshot; the
+    // event loop neither copies nor waits for any of it
+    void compact(quint64 generation) {
+        UserDirectory users;
+        QHash<QString, ServerGroup> groups;
+        quint64 base = 0;
+        readSnapshot(directory, users, groups, base);
+        for (quint64 old : logGenerations(directory)) {
+            if (old >= base && old < generation) {
+                replayLog(logPath(directory, old), users, groups);
+            }
+        }
+        writeSnapshot(users, groups, generation);
+    }
+
+    void writeSnapshot(const UserDirectory& users,
+                       const QHash<QString, ServerGroup>& groups, quint64 generation) {
+        QSaveFile file(snapshotPath(directory));
+        if (!file.open(QIODevice::WriteOnly)) {
+            qWarning() << "Failed to write user snapshot" << file.errorString();
+            return;
+        }
+
+        QDataStream out(&file);
+        out.setVersion(QDataStream::Qt_5_9);
+        out << kSnapshotMagic << kSnapshotVersion << generation
+            << static_cast<quint32>(users.userCount());
+        // Names on disk: ids are reassigned every run
+        users.forEachUser([&](UserId id, const ServerUser& user) {
+            QStringList contacts;
+            contacts.reserve(user.contacts.size());
+            for (UserId contact : user.contacts) {
+                contacts.append(users.name(contact));
+            }
+            out << users.name(id) << user.password << contacts << user.rosterVersion;
+        });
+        out << static_cast<quint32>(groups.size());
+        for (auto it = groups.constBegin(); it != groups.constEnd(); ++it) {
+            out << it->id << it->name << it->creator << it->members;
+        }
+
+        if (!file.commit()) {
+            qWarning() << "Failed to commit user snapshot" << file.errorString();
+            return;
+        }
+
+        // Everything before this generation is now covered by the snapshot
+        for (quint64 old : logGenerations(directory)) {
+            if (old < generation) QFile::remove(logPath(directory, old));
+        }
+    }
+};
+
+UserStore::UserStore(const QString& directory, QObject* parent)
+    : QObject(parent)
+    , m_directory(directory)
+{
+    m_commitTimer.setSingleShot(true);
+    m_commitTimer.setInterval(kCommitWindowMs);
+    connect(&m_commitTimer, &QTimer::timeout, this, &UserStore::flush);
+}
+
+UserStore::~UserStore() {
+    flush();
+
+    if (m_writerThread) {
+        // Blocking call runs after every queued batch, so nothing is lost
+        UserStoreWriter* writer = m_writer;
+        QMetaObject::invokeMethod(m_writerContext, [writer]() {
+            writer->log.close();
+        }, Qt::BlockingQueuedConnection);
+
+        m_writerThread->quit();
+        m_writerThread->wait();
+        delete m_writerThread;
+        delete m_writerContext;
+    }
+    delete m_writer;
+}
+
+bool UserStore::open(UserDirectory& users, QHash<QString, ServerGroup>& groups) {
+    if (!QDir().mkpath(m_directory)) {
+        qWarning() << "Cannot create data directory" << m_directory;
+        return false;
+    }
+
+    readSnapshot(m_directory, users, groups, m_generation);
+
+    // Replay the logs written after the snapshot was taken
+    quint64 lastGeneration = m_generation;
+    for (quint64 generation : logGenerations(m_directory)) {
+        if (generation < m_generation) {
+            QFile::remove(logPath(m_directory, generation));
+            continue;
+        }
+        m_mutationsSinceSnapshot += replayLog(logPath(m_directory, generation), users, groups);
+        lastGeneration = generation;
+    }
+
+    // Always append to a fresh log so a torn tail is never extended
+    m_generation = lastGeneration + 1;
+
+    m_writer = new UserStoreWriter;
+    m_writer->directory = m_directory;
+    m_writerThread = new QThread;
+    m_writerThread->setObjectName("user-store");
+    m_writerContext = new QObject;
+    m_writerContext->moveToThread(m_writerThread);
+    m_writerThread->start();
+
+    UserStoreWriter* writer = m_writer;
+    quint64 generation = m_generation;
+    QMetaObject::invokeMethod(m_writerContext, [writer, generation]() {
+        writer->openLog(generation);
+    }, Qt::QueuedConnection);
+
+    qDebug() << "Loaded" << users.userCount() << "users and" << groups.size() << "groups from"
+             << m_directory;
+    return true;
+}
+
+void UserStore::logUser(const QString& username, const QString& password) {
+    append(RecordUser, username, password);
+}
+
+void UserStore::logUserRemoved(const QString& username) {
+    append(RecordUserRemoved, username, QString());
+}
+
+void UserStore::logContact(const QString& owner, const QString& contact) {
+    append(RecordContact, owner, contact);
+}
+
+void UserStore::logContactRemoved(const QString& owner, const QString& contact) {
+    append(RecordContactRemoved, owner, contact);
+}
+
+void UserStore::logRosterVersion(const QString& owner, quint64 version) {
+    append(RecordRosterVersion, owner, QString::number(version));
+}
+
+void UserStore::logGroup(const QString& groupId, const QString& name, const QString& creator) {
+    append(RecordGroup, groupId, name, creator);
+}
+
+void UserStore::logGroupMember(const QString& groupId, const QString& member) {
+    append(RecordGroupMember, groupId, member);
+}
+
+void UserStore::logGroupMemberRemoved(const QString& groupId, const QString& member) {
+    append(RecordGroupMemberRemoved, groupId, member);
+}
+
+void UserStore::append(quint8 type, const QString& a, const QString& b, const QString& c) {
+    QByteArray payload;
+    {
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_9);
+        out << type << a << b;
+        if (!c.isNull()) out << c;
+    }
+
+    char header[kRecordHeaderSize];
+    qToBigEndian<quint32>(static_cast<quint32>(payload.size()), header);
+    qToBigEndian<quint16>(qChecksum(payload.constData(), static_cast<uint>(payload.size())), header + 4);
+
+    m_pending.append(header, kRecordHeaderSize);
+    m_pending.append(payload);
+    ++m_mutationsSinceSnapshot;
+
+    if (!m_commitTimer.isActive()) {
+        m_commitTimer.start();
+    }
+}
+
+void UserStore::flush() {
+    m_commitTimer.stop();
+    if (m_pending.isEmpty() || !m_writer) return;
+
+    QByteArray batch;
+    batch.swap(m_pending);
+
+    UserStoreWriter* writer = m_writer;
+    QMetaObject::invokeMethod(m_writerContext, [writer, batch]() {
+        writer->append(batch);
+    }, Qt::QueuedConnection);
+}
+
+void UserStore::snapshot() {
+    if (!m_writer) return;
+
+    // Records up to here go to the current log; the snapshot covers them
+    flush();
+    quint64 generation = ++m_generation;
+    m_mutationsSinceSnapshot = 0;
+
+    UserStoreWriter* writer = m_writer;
+    QMetaObject::invokeMethod(m_writerContext, [writer, generation]() {
+        writer->openLog(generation);
+        writer->compact(generation);
+    }, Qt::QueuedConnection);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QByteArray>
+#include <QTimer>
+#include "server/UserDirectory.h"
+
+class QThread;
+struct UserStoreWriter;
+
+// Durable account/contact storage: a write-ahead log of mutations plus
+// periodic binary snapshots. Mutations are buffered on the caller's
+// thread and group-committed by a writer thread, so logging never does
+// file I/O on the event loop. The writer also builds each snapshot from
+// the previous one and the logs after it, so the in-memory state is
+// never copied for it.
+class UserStore : public QObject {
+    Q_OBJECT
+
+public:
+    explicit UserStore(const QString& directory, QObject* parent = nullptr);
+    ~UserStore();
+
+    // Loads the latest snapshot and replays the logs after it. The files are
+    // mapped rather than read, but every record is still decoded into
+    // users and groups, so startup is linear in the number of accounts.
+    bool open(UserDirectory& users, QHash<QString, ServerGroup>& groups);
+
+    void logUser(const QString& username, const QString& password);
+    void logUserRemoved(const QString& username);
+    void logContact(const QString& owner, const QString& contact);
+    void logContactRemoved(const QString& owner, const QString& contact);
+    void logRosterVersion(const QString& owner, quint64 version);
+    void logGroup(const QString& groupId, const QString& name, const QString& creator);
+    void logGroupMember(const QString& groupId, const QString& member);
+    void logGroupMemberRemoved(const QString& groupId, const QString& member);
+
+    bool snapshotDue() const { return m_mutationsSinceSnapshot >= m_snapshotInterval; }
+    // Starts a new log and has the writer compact the older ones into a
+    // snapshot
+    void snapshot();
+    // Hands the buffered records to the writer now instead of after the
+    // commit window
+    void flush();
+
+private:
+    void append(quint8 type, const QString& a, const QString& b, const QString& c = QString());
+
+    QString m_directory;
+    QThread* m_writerThread = nullptr;
+    QObject* m_writerContext = nullptr;  // lives on m_writerThread
+    UserStoreWriter* m_writer = nullptr; // only touched on m_writerThread
+
+    QByteArray m_pending;
+    QTimer m_commitTimer;
+    quint64 m_generation = 0;
+    quint64 m_mutationsSinceSnapshot = 0;
+    quint64 m_snapshotInterval = 100000;
+};
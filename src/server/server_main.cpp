@@ -1,5 +1,6 @@
 #include <QCoreApplication>
 #include <QCommandLineParser>
+#include <QThread>
 #include "server/ChatServer.h"
 
 int main(int argc, char* argv[]) {
@@ -12,17 +13,113 @@ int main(int argc, char* argv[]) {
     parser.addVersionOption();
     QCommandLineOption portOption("port", "Server port (default: 33033)", "port", "33033");
     parser.addOption(portOption);
+    QCommandLineOption threadsOption("threads",
+        "Socket I/O worker threads (default: 1, 0 = one per CPU core)", "count", "1");
+    parser.addOption(threadsOption);
+    QCommandLineOption dataDirOption("data-dir",
+        "Directory for the account log and snapshots (default: data, empty = in-memory)",
+        "path", "data");
+    parser.addOption(dataDirOption);
+    QCommandLineOption presenceWindowOption("presence-window",
+        "Milliseconds to coalesce presence changes (default: 50, 0 = off)", "ms", "50");
+    parser.addOption(presenceWindowOption);
+    QCommandLineOption metricsPortOption("metrics-port",
+        "Loopback port for the Prometheus /metrics endpoint (default: 33034, 0 = off)",
+        "port", "33034");
+    parser.addOption(metricsPortOption);
+    QCommandLineOption sendQueueOption("send-queue",
+        "Outbound KiB queued per connection before it counts as slow (default: 1024)",
+        "KiB", "1024");
+    parser.addOption(sendQueueOption);
+    QCommandLineOption slowGraceOption("slow-grace",
+        "Milliseconds a slow connection may stay over its queue budget (default: 10000)",
+        "ms", "10000");
+    parser.addOption(slowGraceOption);
+    QCommandLineOption hashThreadsOption("hash-threads",
+        "Threads hashing passwords for logins and registrations (default: 2)", "count", "2");
+    parser.addOption(hashThreadsOption);
+    QCommandLineOption loginQueueOption("login-queue",
+        "Password checks queued before logins are refused as busy (default: 1024)",
+        "count", "1024");
+    parser.addOption(loginQueueOption);
+    QCommandLineOption hashIterationsOption("hash-iterations",
+        QString("SHA-256 rounds for newly hashed passwords (default: %1)")
+            .arg(CryptoUtils::kDefaultIterations),
+        "count", QString::number(CryptoUtils::kDefaultIterations));
+    parser.addOption(hashIterationsOption);
+    QCommandLineOption emptyPasswordsOption("allow-empty-passwords",
+        "Migration only: let accounts without a password log in and register with an empty one");
+    parser.addOption(emptyPasswordsOption);
+    QCommandLineOption speakersOption("conference-speakers",
+        "Loudest speakers whose audio is relayed in a conference call (default: 3, 0 = no relay)",
+        "count", "3");
+    parser.addOption(speakersOption);
+    QCommandLineOption resumeGraceOption("resume-grace",
+        "Milliseconds a dropped login can be resumed without signing in again (default: 30000, 0 = off)",
+        "ms", "30000");
+    parser.addOption(resumeGraceOption);
+    QCommandLineOption compressThresholdOption("compress-threshold",
+        "Smallest outbound frame in bytes worth deflating for clients that accept it "
+        "(default: 512, 0 = never compress)", "bytes", "512");
+    parser.addOption(compressThresholdOption);
+    QCommandLineOption compressLevelOption("compress-level",
+        "zlib level for outbound frames, 1 (cheapest) to 9 (smallest) (default: 1)",
+        "level", "1");
+    parser.addOption(compressLevelOption);
+    QCommandLineOption clusterPortOption("cluster-port",
+        "Port for links to other cluster nodes (default: 0 = standalone). Links are "
+        "authenticated but not encrypted; keep them on a trusted network", "port", "0");
+    parser.addOption(clusterPortOption);
+    QCommandLineOption clusterHostOption("cluster-host",
+        "Address other nodes use to reach this one (default: 127.0.0.1)", "host", "127.0.0.1");
+    parser.addOption(clusterHostOption);
+    QCommandLineOption clusterBindOption("cluster-bind",
+        "Address the cluster listener binds to (default: the cluster host)", "address");
+    parser.addOption(clusterBindOption);
+    QCommandLineOption clusterSecretOption("cluster-secret",
+        "Shared secret that authenticates cluster links (default: $SKYPE_CLUSTER_SECRET)",
+        "secret");
+    parser.addOption(clusterSecretOption);
+    QCommandLineOption nodeIdOption("node-id",
+        "Cluster node name (default: cluster host:port)", "name");
+    parser.addOption(nodeIdOption);
+    QCommandLineOption seedsOption("seeds",
+        "Comma-separated host:port cluster addresses of existing nodes", "list");
+    parser.addOption(seedsOption);
     parser.process(app);
 
-    quint16 port = parser.value(portOption).toUShort();
+    ServerOptions options;
+    options.port = parser.value(portOption).toUShort();
+    options.threads = parser.value(threadsOption).toInt();
+    if (options.threads <= 0) options.threads = QThread::idealThreadCount();
+    options.dataDirectory = parser.value(dataDirOption);
+    options.presenceWindowMs = parser.value(presenceWindowOption).toInt();
+    options.metricsPort = parser.value(metricsPortOption).toUShort();
+    options.backpressure.queueBytes = qMax(1LL, parser.value(sendQueueOption).toLongLong()) * 1024;
+    options.backpressure.graceMs = qMax(0, parser.value(slowGraceOption).toInt());
+    options.hashThreads = qMax(1, parser.value(hashThreadsOption).toInt());
+    options.maxPendingLogins = qMax(1, parser.value(loginQueueOption).toInt());
+    options.hashIterations = qMax(1, parser.value(hashIterationsOption).toInt());
+    options.allowEmptyPasswords = parser.isSet(emptyPasswordsOption);
+    options.conferenceSpeakers = qMax(0, parser.value(speakersOption).toInt());
+    options.resumeGraceMs = qMax(0, parser.value(resumeGraceOption).toInt());
+    options.compression.threshold = qMax(0, parser.value(compressThresholdOption).toInt());
+    options.compression.level = qBound(1, parser.value(compressLevelOption).toInt(), 9);
+    options.clusterPort = parser.value(clusterPortOption).toUShort();
+    options.clusterHost = parser.value(clusterHostOption);
+    options.clusterBind = parser.value(clusterBindOption);
+    options.clusterSecret = parser.isSet(clusterSecretOption)
+        ? parser.value(clusterSecretOption).toUtf8() : qgetenv("SKYPE_CLUSTER_SECRET");
+    options.nodeId = parser.value(nodeIdOption);
+    options.clusterSeeds = parser.value(seedsOption).split(',', QString::SkipEmptyParts);
 
-    ChatServer server(port);
+    ChatServer server(options);
     if (!server.start()) {
         qCritical() << "Failed to start server";
         return 1;
     }
 
-    qDebug() << "SkypeClassic Server running on port" << port;
+    qDebug() << "SkypeClassic Server running on port" << options.port;
     qDebug() << "Default accounts: alice/alice, bob/bob, charlie/charlie";
     qDebug() << "Or sign in with any name to auto-register.";
 
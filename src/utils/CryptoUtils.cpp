@@ -2,9 +2,15 @@
 
 #include <QCryptographicHash>
 #include <QRandomGenerator>
+#include <QStringList>
 
 namespace CryptoUtils {
 
+namespace {
+// "sha256$<iterations>$<salt>$<hash>"; older builds stored "<salt>:<hash>"
+const QLatin1String kHashPrefix("sha256$");
+}
+
 QString generateSalt() {
     QByteArray salt;
     salt.resize(16);
@@ -14,24 +20,62 @@ QString generateSalt() {
     return salt.toHex();
 }
 
-QString hashPassword(const QString& password, const QString& salt) {
-    QByteArray data = (salt + password).toUtf8();
-    QByteArray hash = QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+QString hashPassword(const QString& password, const QString& salt, int iterations) {
+    QByteArray saltBytes = salt.toUtf8();
+    QByteArray hash = QCryptographicHash::hash(saltBytes + password.toUtf8(),
+                                               QCryptographicHash::Sha256);
+
+    // Each further round re-hashes the previous digest with the salt
+    QCryptographicHash round(QCryptographicHash::Sha256);
+    for (int i = 1; i < iterations; ++i) {
+        round.reset();
+        round.addData(hash);
+        round.addData(saltBytes);
+        hash = round.result();
+    }
     return hash.toHex();
 }
 
-QString hashAndStore(const QString& password) {
+QString hashAndStore(const QString& password, int iterations) {
+    iterations = qMax(1, iterations);
     QString salt = generateSalt();
-    QString hash = hashPassword(password, salt);
-    return salt + ":" + hash;
+    QString hash = hashPassword(password, salt, iterations);
+    return kHashPrefix + QString::number(iterations) + '$' + salt + '$' + hash;
 }
 
 bool verifyPassword(const QString& password, const QString& storedHash) {
+    if (isHashed(storedHash)) {
+        const QStringList parts = storedHash.mid(kHashPrefix.size()).split('$');
+        if (parts.size() != 3) return false;
+        int iterations = parts[0].toInt();
+        if (iterations < 1) return false;
+        return constantTimeEquals(hashPassword(password, parts[1], iterations), parts[2]);
+    }
+
     int sep = storedHash.indexOf(':');
     if (sep < 0) return false;
     QString salt = storedHash.left(sep);
     QString hash = storedHash.mid(sep + 1);
-    return hashPassword(password, salt) == hash;
+    return constantTimeEquals(hashPassword(password, salt), hash);
+}
+
+bool isHashed(const QString& stored) {
+    return stored.startsWith(kHashPrefix);
+}
+
+int iterationsOf(const QString& storedHash) {
+    if (!isHashed(storedHash)) return 1;
+    int end = storedHash.indexOf('$', kHashPrefix.size());
+    return storedHash.midRef(kHashPrefix.size(), end - kHashPrefix.size()).toInt();
+}
+
+bool constantTimeEquals(const QString& a, const QString& b) {
+    ushort diff = a.size() == b.size() ? 0 : 1;
+    int size = qMin(a.size(), b.size());
+    for (int i = 0; i < size; ++i) {
+        diff |= a[i].unicode() ^ b[i].unicode();
+    }
+    return diff == 0;
 }
 
 }
@@ -3,8 +3,20 @@
 #include <QString>
 
 namespace CryptoUtils {
+    // Rounds of SHA-256 for new hashes; stored alongside each hash, so
+    // raising it only affects passwords hashed afterwards
+    const int kDefaultIterations = 10000;
+
     QString generateSalt();
-    QString hashPassword(const QString& password, const QString& salt);
-    QString hashAndStore(const QString& password);
+    QString hashPassword(const QString& password, const QString& salt, int iterations = 1);
+    QString hashAndStore(const QString& password, int iterations = kDefaultIterations);
     bool verifyPassword(const QString& password, const QString& storedHash);
+
+    // True for values made by hashAndStore(); anything else is a legacy
+    // plaintext password
+    bool isHashed(const QString& stored);
+    int iterationsOf(const QString& storedHash);
+
+    // Comparison time doesn't depend on where the strings differ
+    bool constantTimeEquals(const QString& a, const QString& b);
 }
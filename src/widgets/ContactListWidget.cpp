@@ -20,15 +20,61 @@ ContactListWidget::ContactListWidget(QWidget* parent)
     m_contentLayout = new QVBoxLayout(m_scrollContent);
     m_contentLayout->setContentsMargins(0, 0, 0, 0);
     m_contentLayout->setSpacing(0);
-    m_contentLayout->addStretch();
+    rebuildList(QList<Contact>());
 
     m_scrollArea->setWidget(m_scrollContent);
     outerLayout->addWidget(m_scrollArea);
 }
 
 void ContactListWidget::setContacts(const QList<Contact>& contacts) {
-    m_contacts = contacts;
-    rebuildList();
+    rebuildList(contacts);
+}
+
+QList<Contact> ContactListWidget::contacts() const {
+    QList<Contact> contacts;
+    for (int i = 0; i < m_contentLayout->count(); ++i) {
+        if (auto* item = qobject_cast<ContactItem*>(m_contentLayout->itemAt(i)->widget())) {
+            contacts.append(item->contact());
+        }
+    }
+    return contacts;
+}
+
+void ContactListWidget::addContact(const Contact& contact) {
+    if (m_items.contains(contact.id)) {
+        updateContact(contact);
+        return;
+    }
+    placeItem(createItem(contact));
+    updateHeaders();
+}
+
+void ContactListWidget::updateContact(const Contact& contact) {
+    ContactItem* item = m_items.value(contact.id);
+    if (!item) {
+        addContact(contact);
+        return;
+    }
+
+    bool wasOnline = item->contact().isOnline();
+    item->setContact(contact);
+    if (wasOnline == contact.isOnline()) return;
+
+    // Moves to the end of the other section
+    m_contentLayout->removeWidget(item);
+    if (wasOnline) --m_onlineCount;
+    placeItem(item);
+    updateHeaders();
+}
+
+void ContactListWidget::removeContact(int contactId) {
+    ContactItem* item = m_items.take(contactId);
+    if (!item) return;
+
+    if (item->contact().isOnline()) --m_onlineCount;
+    m_contentLayout->removeWidget(item);
+    item->deleteLater();
+    updateHeaders();
 }
 
 QLabel* ContactListWidget::createGroupHeader(const QString& text) {
@@ -48,7 +94,37 @@ QLabel* ContactListWidget::createGroupHeader(const QString& text) {
     return label;
 }
 
-void ContactListWidget::rebuildList() {
+ContactItem* ContactListWidget::createItem(const Contact& contact) {
+    auto* item = new ContactItem(contact, m_scrollContent);
+    connect(item, &ContactItem::doubleClicked, this, &ContactListWidget::contactDoubleClicked);
+    connect(item, &ContactItem::callRequested, this, &ContactListWidget::callRequested);
+    connect(item, &ContactItem::sendFileRequested, this, &ContactListWidget::sendFileRequested);
+    connect(item, &ContactItem::viewProfileRequested, this, &ContactListWidget::viewProfileRequested);
+    connect(item, &ContactItem::renameRequested, this, &ContactListWidget::renameRequested);
+    connect(item, &ContactItem::blockRequested, this, &ContactListWidget::blockRequested);
+    connect(item, &ContactItem::removeRequested, this, &ContactListWidget::removeRequested);
+    connect(item, &ContactItem::sendContactRequested, this, &ContactListWidget::sendContactRequested);
+    m_items.insert(contact.id, item);
+    return item;
+}
+
+void ContactListWidget::placeItem(ContactItem* item) {
+    // At the end of its section: just above the offline header, or the stretch
+    if (item->contact().isOnline()) {
+        m_contentLayout->insertWidget(1 + m_onlineCount, item);
+        ++m_onlineCount;
+    } else {
+        m_contentLayout->insertWidget(m_contentLayout->count() - 1, item);
+    }
+}
+
+void ContactListWidget::updateHeaders() {
+    m_onlineHeader->setText(QString("Online (%1/%2)").arg(m_onlineCount).arg(m_items.size()));
+    m_offlineHeader->setText(QString("Offline (%1/%2)")
+                                 .arg(m_items.size() - m_onlineCount).arg(m_items.size()));
+}
+
+void ContactListWidget::rebuildList(const QList<Contact>& contacts) {
     // Clear existing items
     QLayoutItem* item;
     while ((item = m_contentLayout->takeAt(0)) != nullptr) {
@@ -57,50 +133,18 @@ void ContactListWidget::rebuildList() {
         }
         delete item;
     }
+    m_items.clear();
+    m_onlineCount = 0;
 
-    // Separate online and offline contacts
-    QList<Contact> online, offline;
-    for (auto& c : m_contacts) {
-        if (c.isOnline()) {
-            online.append(c);
-        } else {
-            offline.append(c);
-        }
-    }
-
-    // Online section
-    m_contentLayout->addWidget(createGroupHeader(
-        QString("Online (%1/%2)").arg(online.size()).arg(m_contacts.size())));
-
-    for (auto& c : online) {
-        auto* item = new ContactItem(c, m_scrollContent);
-        connect(item, &ContactItem::doubleClicked, this, &ContactListWidget::contactDoubleClicked);
-        connect(item, &ContactItem::callRequested, this, &ContactListWidget::callRequested);
-        connect(item, &ContactItem::sendFileRequested, this, &ContactListWidget::sendFileRequested);
-        connect(item, &ContactItem::viewProfileRequested, this, &ContactListWidget::viewProfileRequested);
-        connect(item, &ContactItem::renameRequested, this, &ContactListWidget::renameRequested);
-        connect(item, &ContactItem::blockRequested, this, &ContactListWidget::blockRequested);
-        connect(item, &ContactItem::removeRequested, this, &ContactListWidget::removeRequested);
-        connect(item, &ContactItem::sendContactRequested, this, &ContactListWidget::sendContactRequested);
-        m_contentLayout->addWidget(item);
-    }
+    m_onlineHeader = createGroupHeader(QString());
+    m_offlineHeader = createGroupHeader(QString());
+    m_contentLayout->addWidget(m_onlineHeader);
+    m_contentLayout->addWidget(m_offlineHeader);
+    m_contentLayout->addStretch();
 
-    // Offline section
-    m_contentLayout->addWidget(createGroupHeader(
-        QString("Offline (%1/%2)").arg(offline.size()).arg(m_contacts.size())));
-
-    for (auto& c : offline) {
-        auto* item = new ContactItem(c, m_scrollContent);
-        connect(item, &ContactItem::doubleClicked, this, &ContactListWidget::contactDoubleClicked);
-        connect(item, &ContactItem::callRequested, this, &ContactListWidget::callRequested);
-        connect(item, &ContactItem::sendFileRequested, this, &ContactListWidget::sendFileRequested);
-        connect(item, &ContactItem::viewProfileRequested, this, &ContactListWidget::viewProfileRequested);
-        connect(item, &ContactItem::renameRequested, this, &ContactListWidget::renameRequested);
-        connect(item, &ContactItem::blockRequested, this, &ContactListWidget::blockRequested);
-        connect(item, &ContactItem::removeRequested, this, &ContactListWidget::removeRequested);
-        connect(item, &ContactItem::sendContactRequested, this, &ContactListWidget::sendContactRequested);
-        m_contentLayout->addWidget(item);
+    // Online first, then offline, each in roster order
+    for (const Contact& c : contacts) {
+        placeItem(createItem(c));
     }
-
-    m_contentLayout->addStretch();
+    updateHeaders();
 }
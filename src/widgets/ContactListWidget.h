@@ -4,6 +4,8 @@
 #include <QVBoxLayout>
 #include <QScrollArea>
 #include <QList>
+#include <QHash>
+#include <QLabel>
 #include "models/Contact.h"
 #include "widgets/ContactItem.h"
 
@@ -14,6 +16,12 @@ public:
     explicit ContactListWidget(QWidget* parent = nullptr);
 
     void setContacts(const QList<Contact>& contacts);
+    QList<Contact> contacts() const;
+
+    // One row at a time, for roster deltas and presence changes
+    void addContact(const Contact& contact);
+    void updateContact(const Contact& contact);
+    void removeContact(int contactId);
 
 signals:
     void contactDoubleClicked(int contactId);
@@ -26,11 +34,18 @@ signals:
     void sendContactRequested(int contactId);
 
 private:
-    void rebuildList();
+    void rebuildList(const QList<Contact>& contacts);
     QLabel* createGroupHeader(const QString& text);
+    ContactItem* createItem(const Contact& contact);
+    void placeItem(ContactItem* item);
+    void updateHeaders();
 
     QScrollArea* m_scrollArea;
     QWidget* m_scrollContent;
+    // Online header, online rows, offline header, offline rows, stretch
     QVBoxLayout* m_contentLayout;
-    QList<Contact> m_contacts;
+    QLabel* m_onlineHeader = nullptr;
+    QLabel* m_offlineHeader = nullptr;
+    QHash<int, ContactItem*> m_items; // by contact id
+    int m_onlineCount = 0;
 };
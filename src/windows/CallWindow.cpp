@@ -343,9 +343,9 @@ void CallWindow::onRingTimeout() {
     }
 }
 
-void CallWindow::playRemoteAudio(const QByteArray& data) {
+void CallWindow::playRemoteAudio(const QByteArray& data, int lostBefore) {
     if (m_state == Connected && !m_onHold) {
-        m_audio->playAudioData(data);
+        m_audio->playAudioData(data, lostBefore);
     }
 }
 
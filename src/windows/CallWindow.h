@@ -39,7 +39,7 @@ public slots:
     void onPeerAccepted();
     void onPeerRejected(const QString& reason);
     void onPeerHungUp();
-    void playRemoteAudio(const QByteArray& data);
+    void playRemoteAudio(const QByteArray& data, int lostBefore = 0);
     void displayRemoteVideo(const QByteArray& jpegData);
 
 private slots:
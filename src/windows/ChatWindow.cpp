@@ -193,27 +193,16 @@ void ChatWindow::onAttachClicked() {
     QString filePath = QFileDialog::getOpenFileName(this, "Attach File");
     if (filePath.isEmpty()) return;
 
-    QFile file(filePath);
     QFileInfo fi(filePath);
-
-    // 5MB limit for inline attachments
-    if (fi.size() > 5 * 1024 * 1024) {
-        appendMessage("System", "File too large (max 5 MB).", false);
-        return;
-    }
-
-    if (!file.open(QIODevice::ReadOnly)) {
+    if (!fi.isReadable()) {
         appendMessage("System", "Could not read file.", false);
         return;
     }
 
-    QByteArray data = file.readAll();
-    QString fileName = fi.fileName();
-
-    // Show in our own chat
-    appendMessage("Me", QString("[File: %1 (%2 KB)]").arg(fileName).arg(fi.size() / 1024), true);
+    // Show in our own chat; the file streams from disk as it goes
+    appendMessage("Me", QString("[File: %1 (%2 KB)]").arg(fi.fileName()).arg(fi.size() / 1024), true);
 
-    emit fileAttached(m_contact.id, fileName, data);
+    emit fileAttached(m_contact.id, filePath);
     SoundPlayer::instance().play("IM_SENT.WAV");
 }
 
@@ -281,27 +270,61 @@ void ChatWindow::appendMessage(const QString& sender, const QString& text, bool
     msg.timestamp = QDateTime::currentDateTime();
     msg.isOutgoing = isOutgoing;
     m_messages.append(msg);
+    renderMessage(msg);
+}
 
+void ChatWindow::renderMessage(const Message& msg) {
     QSettings settings("SkypeClassic", "SkypeClassic");
     bool showTimestamps = settings.value("general/showTimestamps", true).toBool();
 
-    QString displayText = text.toHtmlEscaped();
+    QString displayText = msg.text.toHtmlEscaped();
     QString timeStr = msg.timestamp.toString("h:mm AP");
-    QString color = isOutgoing ? "#00008B" : "#000000";
+    QString color = msg.isOutgoing ? "#00008B" : "#000000";
 
     if (showTimestamps) {
         m_chatHistory->append(
             QString("<span style='color: %1; font-weight: bold;'>[%2] %3:</span> %4")
-                .arg(color, timeStr, sender.toHtmlEscaped(), displayText)
+                .arg(color, timeStr, msg.sender.toHtmlEscaped(), displayText)
         );
     } else {
         m_chatHistory->append(
             QString("<span style='color: %1; font-weight: bold;'>%2:</span> %3")
-                .arg(color, sender.toHtmlEscaped(), displayText)
+                .arg(color, msg.sender.toHtmlEscaped(), displayText)
         );
     }
 }
 
+void ChatWindow::showServerHistory(const QList<Message>& history) {
+    if (history.isEmpty()) return;
+
+    // Keep whatever was sent or received since the window opened, minus
+    // anything the server already stored by the time it answered
+    QList<Message> live = m_messages.mid(m_historyCount);
+    for (int overlap = qMin(live.size(), history.size()); overlap > 0; --overlap) {
+        bool same = true;
+        for (int i = 0; i < overlap && same; ++i) {
+            const Message& stored = history[history.size() - overlap + i];
+            same = stored.text == live[i].text && stored.isOutgoing == live[i].isOutgoing;
+        }
+        if (same) {
+            live = live.mid(overlap);
+            break;
+        }
+    }
+    m_messages = history;
+    m_historyCount = history.size();
+
+    m_chatHistory->clear();
+    for (const Message& msg : history) {
+        renderMessage(msg);
+    }
+    m_chatHistory->append("<hr><span style='color: #808080; font-size: 10px;'>--- Previous messages ---</span><hr>");
+    for (const Message& msg : qAsConst(live)) {
+        m_messages.append(msg);
+        renderMessage(msg);
+    }
+}
+
 void ChatWindow::resizeEvent(QResizeEvent* event) {
     QWidget::resizeEvent(event);
 
@@ -345,25 +368,9 @@ void ChatWindow::loadHistory() {
         msg.isOutgoing = isOutgoing;
         msg.text = text;
         m_messages.append(msg);
-
-        QSettings settings("SkypeClassic", "SkypeClassic");
-        bool showTimestamps = settings.value("general/showTimestamps", true).toBool();
-
-        QString displayText = text.toHtmlEscaped();
-
-        QString timeStr = ts.toString("h:mm AP");
-        QString color = isOutgoing ? "#00008B" : "#000000";
-
-        if (showTimestamps) {
-            m_chatHistory->append(
-                QString("<span style='color: %1; font-weight: bold;'>[%2] %3:</span> %4")
-                    .arg(color, timeStr, sender.toHtmlEscaped(), displayText));
-        } else {
-            m_chatHistory->append(
-                QString("<span style='color: %1; font-weight: bold;'>%2:</span> %3")
-                    .arg(color, sender.toHtmlEscaped(), displayText));
-        }
+        renderMessage(msg);
     }
+    m_historyCount = m_messages.size();
 
     if (!m_messages.isEmpty()) {
         m_chatHistory->append("<hr><span style='color: #808080; font-size: 10px;'>--- Previous messages ---</span><hr>");
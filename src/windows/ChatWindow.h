@@ -19,10 +19,13 @@ public:
 
     int contactId() const { return m_contact.id; }
 
+    // Replaces the history loaded from disk with the server's copy
+    void showServerHistory(const QList<Message>& history);
+
 signals:
     void messageSent(int contactId, const QString& text);
     void typingStarted(int contactId);
-    void fileAttached(int contactId, const QString& fileName, const QByteArray& fileData);
+    void fileAttached(int contactId, const QString& filePath);
 
 public slots:
     void receiveMessage(const QString& sender, const QString& text);
@@ -44,6 +47,7 @@ protected:
 private:
     void setupUi();
     void appendMessage(const QString& sender, const QString& text, bool isOutgoing);
+    void renderMessage(const Message& msg);
     void loadHistory();
     void saveHistory();
 
@@ -56,4 +60,5 @@ private:
     QTimer* m_typingTimer;
     QTimer* m_ownTypingTimer;
     QList<Message> m_messages;
+    int m_historyCount = 0; // leading entries of m_messages that came from history
 };
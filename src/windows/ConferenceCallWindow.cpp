@@ -30,7 +30,7 @@ ConferenceCallWindow::ConferenceCallWindow(const QString& conferenceId,
     // Forward captured audio
     connect(m_audio, &AudioStreamManager::audioCaptured, [this](const QByteArray& data) {
         if (!m_muted) {
-            emit audioToSend(m_conferenceId, data);
+            emit audioToSend(m_conferenceId, data, m_audio->captureLevel());
         }
     });
 
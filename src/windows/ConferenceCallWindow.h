@@ -26,7 +26,7 @@ public:
 
 signals:
     void leaveRequested(const QString& conferenceId);
-    void audioToSend(const QString& conferenceId, const QByteArray& data);
+    void audioToSend(const QString& conferenceId, const QByteArray& data, int level);
     void videoToSend(const QString& conferenceId, const QByteArray& jpegData);
 
 public slots:
@@ -19,7 +19,6 @@ FileTransferDialog::FileTransferDialog(const QString& contactName,
     , m_filePath(filePath)
     , m_fileSize(fileSize)
     , m_direction(direction)
-    , m_progressTimer(new QTimer(this))
 {
     // If we have a file path, get real file info
     if (!m_filePath.isEmpty() && m_fileSize == 0) {
@@ -35,8 +34,6 @@ FileTransferDialog::FileTransferDialog(const QString& contactName,
     resize(320, 200);
     setMinimumSize(280, 170);
 
-    connect(m_progressTimer, &QTimer::timeout, this, &FileTransferDialog::updateProgress);
-
     if (direction == Receiving) {
         SoundPlayer::instance().play("INCOMING_FILE.WAV");
     }
@@ -113,7 +110,6 @@ void FileTransferDialog::setupUi() {
 
     if (m_direction == Sending) {
         m_progressBar->setVisible(true);
-        m_progressTimer->start(100);
     }
 }
 
@@ -128,7 +124,8 @@ void FileTransferDialog::onAcceptClicked() {
     m_cancelBtn->setVisible(true);
     m_progressBar->setVisible(true);
     m_statusLabel->setText(QString("Receiving file from %1:").arg(m_contactName));
-    m_progressTimer->start(100);
+    m_accepted = true;
+    emit transferAccepted(savePath);
 }
 
 void FileTransferDialog::onDeclineClicked() {
@@ -136,37 +133,77 @@ void FileTransferDialog::onDeclineClicked() {
     m_acceptBtn->setVisible(false);
     m_declineBtn->setVisible(false);
     m_closeBtn->setVisible(true);
+    m_done = true;
     SoundPlayer::instance().play("FT_FAILED.WAV");
+    emit transferDeclined();
 }
 
 void FileTransferDialog::onCancelClicked() {
-    m_progressTimer->stop();
     m_statusLabel->setText("File transfer cancelled.");
     m_cancelBtn->setVisible(false);
     m_closeBtn->setVisible(true);
+    m_done = true;
     SoundPlayer::instance().play("FT_FAILED.WAV");
+    emit transferCancelled();
+}
+
+void FileTransferDialog::reject() {
+    // With WA_DeleteOnClose nothing would be left to release the offer or
+    // the half-done transfer on either side
+    if (!m_done) {
+        m_done = true;
+        if (m_direction == Receiving && !m_accepted) {
+            emit transferDeclined();
+        } else {
+            emit transferCancelled();
+        }
+    }
+    QDialog::reject();
 }
 
-void FileTransferDialog::updateProgress() {
-    m_progress += 2;
-    m_progressBar->setValue(m_progress);
+void FileTransferDialog::setProgress(qint64 transferred, qint64 total) {
+    if (m_done) return;
 
-    if (m_fileSize > 0) {
-        qint64 transferred = (m_fileSize * m_progress) / 100;
-        m_sizeLabel->setText(QString("%1 / %2")
-            .arg(formatSize(transferred), formatSize(m_fileSize)));
+    if (!m_elapsed.isValid()) {
+        m_elapsed.start();
+        m_startBytes = transferred;
     }
+    m_fileSize = total;
+    m_progressBar->setValue(total > 0 ? static_cast<int>(transferred * 100 / total) : 100);
+
+    QString text = QString("%1 / %2").arg(formatSize(transferred), formatSize(total));
+    qint64 ms = m_elapsed.elapsed();
+    if (ms >= 500) {
+        qint64 rate = (transferred - m_startBytes) * 1000 / ms;
+        text += QString(" at %1/s").arg(formatSize(rate));
+    }
+    m_sizeLabel->setText(text);
+}
 
-    if (m_progress >= 100) {
-        m_progressTimer->stop();
-        m_statusLabel->setText("File transfer complete!");
-        m_cancelBtn->setVisible(false);
-        m_closeBtn->setVisible(true);
-        if (m_fileSize > 0) {
-            m_sizeLabel->setText(QString("%1 transferred").arg(formatSize(m_fileSize)));
-        }
-        SoundPlayer::instance().play("FT_COMPLETE.WAV");
+void FileTransferDialog::setFinished() {
+    if (m_done) return;
+    m_done = true;
+
+    m_progressBar->setValue(100);
+    m_statusLabel->setText("File transfer complete!");
+    m_cancelBtn->setVisible(false);
+    m_closeBtn->setVisible(true);
+    if (m_fileSize > 0) {
+        m_sizeLabel->setText(QString("%1 transferred").arg(formatSize(m_fileSize)));
     }
+    SoundPlayer::instance().play("FT_COMPLETE.WAV");
+}
+
+void FileTransferDialog::setFailed(const QString& reason) {
+    if (m_done) return;
+    m_done = true;
+
+    m_statusLabel->setText(QString("File transfer failed: %1").arg(reason));
+    m_acceptBtn->setVisible(false);
+    m_declineBtn->setVisible(false);
+    m_cancelBtn->setVisible(false);
+    m_closeBtn->setVisible(true);
+    SoundPlayer::instance().play("FT_FAILED.WAV");
 }
 
 QString FileTransferDialog::formatSize(qint64 bytes) const {
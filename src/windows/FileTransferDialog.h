@@ -1,10 +1,10 @@
 #pragma once
 
 #include <QDialog>
+#include <QElapsedTimer>
 #include <QLabel>
 #include <QProgressBar>
 #include <QPushButton>
-#include <QTimer>
 
 class FileTransferDialog : public QDialog {
     Q_OBJECT
@@ -19,11 +19,22 @@ public:
                                  const QString& filePath = QString(),
                                  qint64 fileSize = 0);
 
+public slots:
+    void setProgress(qint64 transferred, qint64 total);
+    void setFinished();
+    void setFailed(const QString& reason);
+    // Close button, Esc or the window's X: ends a transfer still pending
+    void reject() override;
+
+signals:
+    void transferAccepted(const QString& savePath);
+    void transferDeclined();
+    void transferCancelled();
+
 private slots:
     void onAcceptClicked();
     void onDeclineClicked();
     void onCancelClicked();
-    void updateProgress();
 
 private:
     void setupUi();
@@ -44,6 +55,8 @@ private:
     QPushButton* m_cancelBtn;
     QPushButton* m_closeBtn;
 
-    QTimer* m_progressTimer;
-    int m_progress = 0;
+    QElapsedTimer m_elapsed; // since the first byte moved, for the rate
+    qint64 m_startBytes = 0; // already there when it started (a resumed .part)
+    bool m_accepted = false; // receiving: a save path was chosen
+    bool m_done = false;
 };
@@ -2,7 +2,6 @@
 #include "windows/AddContactDialog.h"
 #include "windows/SearchDialog.h"
 #include "windows/OptionsDialog.h"
-#include "windows/FileTransferDialog.h"
 #include "utils/SoundPlayer.h"
 #include "utils/CryptoUtils.h"
 
@@ -133,7 +132,7 @@ void MainWindow::setupMenuBar() {
         }
     });
     contactsMenu->addAction("&Search for Skype Users...", [this]() {
-        SearchDialog dlg(m_contacts, this);
+        SearchDialog dlg(m_contactList->contacts(), this);
         connect(&dlg, &SearchDialog::contactAdded, [this](const QString& name) {
             emit contactAdded(name);
         });
@@ -186,15 +185,12 @@ void MainWindow::setupMenuBar() {
     });
     toolsMenu->addSeparator();
     toolsMenu->addAction("&Send File...", [this]() {
-        QString file = QFileDialog::getOpenFileName(this, "Send File");
-        if (!file.isEmpty()) {
-            auto* ftDlg = new FileTransferDialog("Contact", QString(),
-                FileTransferDialog::Sending, this, file);
-            ftDlg->show();
-        }
+        int id = pickContact("Send File To");
+        if (id >= 0) emit sendFileToContact(id);
     });
     toolsMenu->addAction("&Export Contacts...", [this]() {
-        if (m_contacts.isEmpty()) {
+        const QList<Contact> contacts = m_contactList->contacts();
+        if (contacts.isEmpty()) {
             QMessageBox::information(this, "Export Contacts", "No contacts to export.");
             return;
         }
@@ -207,11 +203,11 @@ void MainWindow::setupMenuBar() {
             return;
         }
         QTextStream out(&f);
-        for (const auto& c : m_contacts) {
+        for (const auto& c : contacts) {
             out << c.skypeName << "\n";
         }
         QMessageBox::information(this, "Export Contacts",
-            QString("Exported %1 contact(s).").arg(m_contacts.size()));
+            QString("Exported %1 contact(s).").arg(contacts.size()));
     });
 
     // Call
@@ -311,7 +307,7 @@ void MainWindow::setupToolBar() {
         }
     });
     toolbar->addAction("Search", [this]() {
-        SearchDialog dlg(m_contacts, this);
+        SearchDialog dlg(m_contactList->contacts(), this);
         connect(&dlg, &SearchDialog::contactAdded, [this](const QString& name) {
             emit contactAdded(name);
         });
@@ -392,11 +388,23 @@ void MainWindow::setupStatusBar() {
 }
 
 void MainWindow::setContacts(const QList<Contact>& contacts) {
-    m_contacts = contacts;
     m_contactList->setContacts(contacts);
 }
 
+void MainWindow::addContactRow(const Contact& contact) {
+    m_contactList->addContact(contact);
+}
+
+void MainWindow::updateContactRow(const Contact& contact) {
+    m_contactList->updateContact(contact);
+}
+
+void MainWindow::removeContactRow(int contactId) {
+    m_contactList->removeContact(contactId);
+}
+
 int MainWindow::pickContact(const QString& title) {
+    const QList<Contact> contacts = m_contactList->contacts();
     QDialog dlg(this);
     dlg.setWindowTitle(title);
     dlg.resize(220, 300);
@@ -408,14 +416,14 @@ int MainWindow::pickContact(const QString& title) {
     layout->addWidget(label);
 
     auto* list = new QListWidget(&dlg);
-    for (const auto& c : m_contacts) {
+    for (const auto& c : contacts) {
         if (c.isOnline()) {
             auto* item = new QListWidgetItem(c.displayName, list);
             item->setData(Qt::UserRole, c.id);
         }
     }
     // Add offline contacts below
-    for (const auto& c : m_contacts) {
+    for (const auto& c : contacts) {
         if (!c.isOnline()) {
             auto* item = new QListWidgetItem(c.displayName + "  (Offline)", list);
             item->setData(Qt::UserRole, c.id);
@@ -449,6 +457,7 @@ int MainWindow::pickContact(const QString& title) {
 }
 
 QList<int> MainWindow::pickMultipleContacts(const QString& title) {
+    const QList<Contact> contacts = m_contactList->contacts();
     QDialog dlg(this);
     dlg.setWindowTitle(title);
     dlg.resize(240, 340);
@@ -460,7 +469,7 @@ QList<int> MainWindow::pickMultipleContacts(const QString& title) {
 
     auto* list = new QListWidget(&dlg);
     list->setSelectionMode(QAbstractItemView::MultiSelection);
-    for (const auto& c : m_contacts) {
+    for (const auto& c : contacts) {
         auto* item = new QListWidgetItem(c.displayName, list);
         item->setData(Qt::UserRole, c.id);
         if (!c.isOnline()) {
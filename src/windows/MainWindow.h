@@ -16,6 +16,10 @@ public:
     explicit MainWindow(const QString& username, QWidget* parent = nullptr);
 
     void setContacts(const QList<Contact>& contacts);
+    // Roster deltas and presence: one row changes, not the whole list
+    void addContactRow(const Contact& contact);
+    void updateContactRow(const Contact& contact);
+    void removeContactRow(int contactId);
 
 signals:
     void profileUpdated(const QString& displayName, const QString& moodText);
@@ -50,7 +54,6 @@ private:
     void showAccountDialog();
 
     QString m_username;
-    QList<Contact> m_contacts;
     QTabWidget* m_tabs;
     ContactListWidget* m_contactList;
     DialPad* m_dialPad;